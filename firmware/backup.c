@@ -0,0 +1,153 @@
+// Backup paths of the routes, see include/backup.h
+#include "stdint.h"
+#include "timer.h"
+#include "hal.h"
+#include "nexthop.h"
+#include "backup.h"
+
+#define BACKUP_BUCKET(mem_id) ((mem_id) & (NUM_BACKUP_BUCKET - 1))
+
+struct backup_rte backup_rte[NUM_BACKUP_RTE] __attribute__((section(".data")));
+int backup_buckets[NUM_BACKUP_BUCKET] __attribute__((section(".data")));
+int spare_backup_index = 1; // entries from here were never used
+int free_backup_index = 0;  // freed entries, chained by next
+
+static void backup_unlink(int *link)
+{
+    int index = *link;
+    *link = backup_rte[index].next;
+    nexthop_unhold(backup_rte[index].neighbor);
+    backup_rte[index].next = free_backup_index;
+    free_backup_index = index;
+}
+
+// Find the best backup of a route, dropping the ones that timed out or whose neighbor is down
+static int *backup_find_best(int mem_id)
+{
+    int *link = backup_buckets + BACKUP_BUCKET(mem_id);
+    int *best = 0;
+    while (*link)
+    {
+        struct backup_rte *backup = backup_rte + *link;
+        if (backup->mem_id != mem_id)
+        {
+            link = &backup->next;
+        }
+        else if (check_timeout(TIMEOUT_TIME_LIMIT, backup->lower_timer) || !nexthop_alive(backup->neighbor))
+        {
+            backup_unlink(link);
+        }
+        else
+        {
+            if (!best || backup->metric < backup_rte[*best].metric)
+            {
+                best = link;
+            }
+            link = &backup->next;
+        }
+    }
+    return best;
+}
+
+void backup_update(int mem_id, int neighbor, uint8_t metric)
+{
+    if (neighbor < 0)
+    {
+        return;
+    }
+    int *link = backup_buckets + BACKUP_BUCKET(mem_id);
+    int *worst = 0;
+    int num = 0;
+    while (*link)
+    {
+        struct backup_rte *backup = backup_rte + *link;
+        if (backup->mem_id == mem_id)
+        {
+            if (backup->neighbor == neighbor)
+            {
+                if (metric >= 16)
+                {
+                    backup_unlink(link);
+                    return;
+                }
+                backup->metric = metric;
+                backup->lower_timer = HAL_READ32(MTIME_LADDR);
+                return;
+            }
+            num++;
+            if (!worst || backup->metric >= backup_rte[*worst].metric)
+            {
+                worst = link;
+            }
+        }
+        link = &backup->next;
+    }
+    if (metric >= 16)
+    {
+        return;
+    }
+    if (num >= BACKUP_PER_ROUTE)
+    {
+        if (backup_rte[*worst].metric <= metric)
+        {
+            return;
+        }
+        backup_unlink(worst);
+    }
+    int index = free_backup_index;
+    if (index)
+    {
+        free_backup_index = backup_rte[index].next;
+    }
+    else if (spare_backup_index < NUM_BACKUP_RTE)
+    {
+        index = spare_backup_index++;
+    }
+    else
+    {
+        return;
+    }
+    backup_rte[index].mem_id = mem_id;
+    backup_rte[index].neighbor = neighbor;
+    backup_rte[index].metric = metric;
+    backup_rte[index].lower_timer = HAL_READ32(MTIME_LADDR);
+    backup_rte[index].next = backup_buckets[BACKUP_BUCKET(mem_id)];
+    backup_buckets[BACKUP_BUCKET(mem_id)] = index;
+    nexthop_hold(neighbor);
+}
+
+int backup_best(int mem_id)
+{
+    int *best = backup_find_best(mem_id);
+    return best ? backup_rte[*best].metric : 16;
+}
+
+int backup_pop(int mem_id, int *neighbor, uint8_t *metric, uint8_t *lower_timer)
+{
+    int *best = backup_find_best(mem_id);
+    if (!best)
+    {
+        return 0;
+    }
+    *neighbor = backup_rte[*best].neighbor;
+    *metric = backup_rte[*best].metric;
+    *lower_timer = backup_rte[*best].lower_timer;
+    backup_unlink(best);
+    return 1;
+}
+
+void backup_clear(int mem_id)
+{
+    int *link = backup_buckets + BACKUP_BUCKET(mem_id);
+    while (*link)
+    {
+        if (backup_rte[*link].mem_id == mem_id)
+        {
+            backup_unlink(link);
+        }
+        else
+        {
+            link = &backup_rte[*link].next;
+        }
+    }
+}
@@ -0,0 +1,540 @@
+// Management console on the UART, see include/console.h
+#include "stdint.h"
+#include "stdarg.h"
+#include "stdio.h"
+#include "uart.h"
+#include "packet.h"
+#include "memory.h"
+#include "protocol.h"
+#include "nexthop.h"
+#include "fib.h"
+#include "trie.h"
+#include "trace.h"
+#include "profile.h"
+#include "stats.h"
+#include "console.h"
+
+// The flags of memory_rte, see protocol.c
+#define CONSOLE_VALID(rte) (((rte)->nexthop_port & 0x80) != 0)
+#define CONSOLE_DIRECT(rte) (((rte)->nexthop_port & 0x40) != 0)
+#define CONSOLE_PORT(rte) ((rte)->nexthop_port & 0x03)
+
+extern struct memory_rte memory_rte[NUM_MEMORY_RTE];
+extern struct nexthop nexthops[NUM_NEXTHOP];
+extern uint32_t nexthop_slot_refs[NEXTHOP_TABLE_INDEX_NUM];
+extern int route_num;
+
+struct console_command
+{
+    const char *name;
+    const char *help;
+    int (*step)(); // outputs the next line, returns 1 when the command is done
+};
+
+char console_line[CONSOLE_LINE_LEN]; // the command line being typed
+int console_line_len = 0;
+char console_last = 0; // the last character typed
+uint8_t console_out[CONSOLE_OUT_LEN];
+uint32_t console_out_head = 0; // next byte to write
+uint32_t console_out_tail = 0; // next byte to send
+const struct console_command *console_running = NULL; // NULL at the prompt
+int console_cursor = 0; // next item of the command
+int console_count = 0;  // items shown by the command
+int console_lines = 0;  // lines since the last key
+int console_more = 0;   // waiting for a key
+struct ip6_addr console_prefix; // the filter of routes
+uint8_t console_prefix_len = 0;
+
+static uint32_t console_room()
+{
+    return CONSOLE_OUT_LEN - 1 - ((console_out_head - console_out_tail) & (CONSOLE_OUT_LEN - 1));
+}
+
+static void console_put(uint8_t byte)
+{
+    console_out[console_out_head] = byte;
+    console_out_head = (console_out_head + 1) & (CONSOLE_OUT_LEN - 1);
+}
+
+// Format into the output buffer, at most CONSOLE_ROOM bytes
+static void console_printf(const char *format, ...)
+{
+    char text[CONSOLE_ROOM];
+    va_list va;
+    va_start(va, format);
+    int length = vsnprintf(text, sizeof(text), format, va);
+    va_end(va);
+    if (length > (int)sizeof(text) - 1)
+    {
+        length = sizeof(text) - 1;
+    }
+    for (int i = 0; i < length; i++)
+    {
+        if (text[i] == '\n')
+        {
+            console_lines++;
+        }
+        console_put(text[i]);
+    }
+}
+
+// Send the output, between the frames of the trace and the lines of the profile
+static void console_flush()
+{
+    if (trace_sending() || profile_sending())
+    {
+        return;
+    }
+    while (console_out_tail != console_out_head && _trychar(console_out[console_out_tail]))
+    {
+        console_out_tail = (console_out_tail + 1) & (CONSOLE_OUT_LEN - 1);
+    }
+}
+
+int console_sending()
+{
+    return console_out_tail != console_out_head;
+}
+
+// Format an address, with its longest run of zero groups as ::
+static void console_format_ip6(char *text, const struct ip6_addr *addr)
+{
+    int best = -1;
+    int best_len = 1;
+    for (int i = 0; i < 8;)
+    {
+        int j = i;
+        while (j < 8 && addr->s6_addr16[j] == 0)
+        {
+            j++;
+        }
+        if (j - i > best_len)
+        {
+            best = i;
+            best_len = j - i;
+        }
+        i = j > i ? j : i + 1;
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        if (i == best)
+        {
+            text += sprintf(text, "::");
+            i += best_len - 1;
+            continue;
+        }
+        text += sprintf(text, (i == 0 || i == best + best_len) ? "%x" : ":%x", ntohs(addr->s6_addr16[i]));
+    }
+    *text = '\0';
+}
+
+static int console_hex(char ch)
+{
+    if (ch >= '0' && ch <= '9')
+    {
+        return ch - '0';
+    }
+    if (ch >= 'a' && ch <= 'f')
+    {
+        return ch - 'a' + 10;
+    }
+    if (ch >= 'A' && ch <= 'F')
+    {
+        return ch - 'A' + 10;
+    }
+    return -1;
+}
+
+// Parse "address/length", with at most one ::
+static int console_parse_prefix(const char *text, struct ip6_addr *prefix, uint8_t *prefix_len)
+{
+    uint16_t groups[8];
+    int num = 0;
+    int gap = -1; // groups before the ::
+    if (text[0] == ':' && text[1] == ':')
+    {
+        gap = 0;
+        text += 2;
+    }
+    while (*text != '/')
+    {
+        uint32_t value = 0;
+        int digits = 0;
+        for (; console_hex(*text) >= 0; text++, digits++)
+        {
+            value = (value << 4) | console_hex(*text);
+        }
+        if (digits == 0 || digits > 4 || num == 8)
+        {
+            return -1;
+        }
+        groups[num++] = value;
+        if (*text == ':' && text[1] == ':' && gap < 0)
+        {
+            gap = num;
+            text += 2;
+        }
+        else if (*text == ':' && console_hex(text[1]) >= 0)
+        {
+            text++;
+        }
+        else if (*text != '/')
+        {
+            return -1;
+        }
+    }
+    if (gap < 0 ? num != 8 : num > 7)
+    {
+        return -1;
+    }
+    uint32_t length = 0;
+    int digits = 0;
+    for (text++; *text >= '0' && *text <= '9'; text++, digits++)
+    {
+        length = length * 10 + *text - '0';
+    }
+    if (*text != '\0' || digits == 0 || digits > 3 || length > 128)
+    {
+        return -1;
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        prefix->s6_addr16[i] = 0;
+    }
+    for (int i = 0; i < num; i++)
+    {
+        int at = (gap < 0 || i < gap) ? i : 8 - num + i;
+        prefix->s6_addr16[at] = htons(groups[i]);
+    }
+    *prefix_len = length;
+    return 0;
+}
+
+// Whether a route is inside the filter
+static int console_match(const struct memory_rte *rte)
+{
+    if (rte->prefix_len < console_prefix_len)
+    {
+        return 0;
+    }
+    for (int i = 0; i < console_prefix_len; i += 8)
+    {
+        uint8_t mask = console_prefix_len - i >= 8 ? 0xff : (uint8_t)(0xff00 >> (console_prefix_len - i));
+        if ((rte->ip6_addr.s6_addr8[i >> 3] ^ console_prefix.s6_addr8[i >> 3]) & mask)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int console_routes()
+{
+    for (int scanned = 0; scanned < CONSOLE_SCAN; scanned++)
+    {
+        if (console_cursor >= NUM_MEMORY_RTE)
+        {
+            console_printf("%d routes shown, %d in the table\r\n", console_count, route_num);
+            return 1;
+        }
+        int mem_id = console_cursor++;
+        struct memory_rte *rte = memory_rte + mem_id;
+        if (!CONSOLE_VALID(rte) || !console_match(rte))
+        {
+            continue;
+        }
+        char prefix[40];
+        console_format_ip6(prefix, &rte->ip6_addr);
+        console_count++;
+        if (CONSOLE_DIRECT(rte))
+        {
+            console_printf("%s/%u metric %u port %u direct\r\n", prefix, rte->prefix_len, rte->metric, CONSOLE_PORT(rte));
+            return 0;
+        }
+        int neighbors[NEXTHOP_GROUP_SIZE];
+        uint32_t slot = fib_slot(mem_id);
+        int num = slot < NEXTHOP_SLOT_END ? nexthop_members(slot, neighbors) : 0;
+        if (num == 0)
+        {
+            console_printf("%s/%u metric %u port %u not installed\r\n", prefix, rte->prefix_len, rte->metric, CONSOLE_PORT(rte));
+            return 0;
+        }
+        char via[40];
+        console_format_ip6(via, &nexthops[neighbors[0]].ip6_addr);
+        console_printf("%s/%u metric %u port %u slot %u via %s", prefix, rte->prefix_len, rte->metric, CONSOLE_PORT(rte), slot, via);
+        console_printf(num > 1 ? " +%d\r\n" : "\r\n", num - 1);
+        return 0;
+    }
+    return 0;
+}
+
+static int console_neighbors()
+{
+    while (console_cursor < NUM_NEXTHOP && !nexthops[console_cursor].valid)
+    {
+        console_cursor++;
+    }
+    if (console_cursor == NUM_NEXTHOP)
+    {
+        console_printf("%d neighbors\r\n", console_count);
+        return 1;
+    }
+    int neighbor = console_cursor++;
+    struct nexthop *nexthop = nexthops + neighbor;
+    char addr[40];
+    console_format_ip6(addr, &nexthop->ip6_addr);
+    console_printf("n%d %s port %u slot %u %s routes %d holds %u responses %u flushes %u rejected %u\r\n",
+                   neighbor, addr, nexthop->port, nexthop->slot, nexthop->alive ? "up" : "down",
+                   nexthop_routes(neighbor), nexthop->holds, nexthop->responses, nexthop->flushes, nexthop->rejected);
+    console_count++;
+    return 0;
+}
+
+static int console_nexthops()
+{
+    int neighbors[NEXTHOP_GROUP_SIZE];
+    int num = 0;
+    while (console_cursor < NEXTHOP_SLOT_END && (num = nexthop_members(console_cursor, neighbors)) == 0)
+    {
+        console_cursor++;
+    }
+    if (console_cursor == NEXTHOP_SLOT_END)
+    {
+        console_printf("%d of %d slots in use\r\n", console_count, NEXTHOP_SLOT_END - NEXTHOP_SLOT_BASE);
+        return 1;
+    }
+    int slot = console_cursor++;
+    console_count++;
+    console_printf("slot %d refs %u", slot, nexthop_slot_refs[slot]);
+    if (nexthop_slot_neighbor(slot) < 0)
+    {
+        console_printf(" group");
+        for (int i = 0; i < num; i++)
+        {
+            console_printf(" n%d", neighbors[i]);
+        }
+        console_printf("\r\n");
+        return 0;
+    }
+    char addr[40];
+    console_format_ip6(addr, &nexthops[neighbors[0]].ip6_addr);
+    console_printf(" n%d %s port %u\r\n", neighbors[0], addr, nexthops[neighbors[0]].port);
+    return 0;
+}
+
+// VC stages, then BT levels
+static int console_trie()
+{
+    if (console_cursor == TRIE_STATS_BRAMS)
+    {
+        return 1;
+    }
+    int bram = (console_cursor++ + 16) & (TRIE_STATS_BRAMS - 1);
+    uint32_t capacity;
+    uint32_t nodes = TrieBramNodes(bram, &capacity);
+    if (bram >= 16)
+    {
+        console_printf("VC stage %d: %u/%u nodes\r\n", bram - 16, nodes, capacity);
+    }
+    else if (nodes != 0)
+    {
+        console_printf("BT level %d: %u/%u nodes up to the top\r\n", bram, nodes, capacity);
+    }
+    return 0;
+}
+
+static int console_stats()
+{
+    const char *name;
+    const uint32_t *values;
+    int count = stats_counter(console_cursor++, &name, &values);
+    if (count == 0)
+    {
+        return 1;
+    }
+    console_printf("%s", name);
+    for (int i = 0; i < count; i++)
+    {
+        console_printf(" %u", values[i]);
+    }
+    console_printf("\r\n");
+    return 0;
+}
+
+static int console_dump()
+{
+    uint8_t frame[STATS_FRAME_LEN];
+    if (console_room() < STATS_FRAME_LEN)
+    {
+        return 0;
+    }
+    stats_frame(frame);
+    for (uint32_t i = 0; i < STATS_FRAME_LEN; i++)
+    {
+        console_put(frame[i]);
+    }
+    return 1;
+}
+
+static int console_clear()
+{
+    stats_clear();
+    console_printf("counters cleared\r\n");
+    return 1;
+}
+
+static int console_help();
+
+static const struct console_command console_commands[] = {
+    {"routes", "[prefix/len]  the routes, or the ones inside a prefix", console_routes},
+    {"neighbors", "the neighbors", console_neighbors},
+    {"nexthops", "the slots of the next hop table", console_nexthops},
+    {"trie", "the nodes used in each BRAM of the tries", console_trie},
+    {"stats", "the counters", console_stats},
+    {"dump", "the counters as a binary frame", console_dump},
+    {"clear", "clear the counters", console_clear},
+    {"help", "this list", console_help},
+};
+
+#define CONSOLE_NUM_COMMANDS ((int)(sizeof(console_commands) / sizeof(console_commands[0])))
+
+static int console_help()
+{
+    if (console_cursor == CONSOLE_NUM_COMMANDS)
+    {
+        return 1;
+    }
+    const struct console_command *command = console_commands + console_cursor++;
+    console_printf("%s %s\r\n", command->name, command->help);
+    return 0;
+}
+
+// Whether a command line starts with a word, returns what follows it
+static const char *console_word(const char *line, const char *word)
+{
+    while (*word != '\0')
+    {
+        if (*line++ != *word++)
+        {
+            return NULL;
+        }
+    }
+    if (*line != '\0' && *line != ' ')
+    {
+        return NULL;
+    }
+    while (*line == ' ')
+    {
+        line++;
+    }
+    return line;
+}
+
+static void console_prompt()
+{
+    console_running = NULL;
+    console_more = 0;
+    console_printf("> ");
+}
+
+// Start the command of the line typed
+static void console_start()
+{
+    console_line[console_line_len] = '\0';
+    console_line_len = 0;
+    const char *line = console_line;
+    while (*line == ' ')
+    {
+        line++;
+    }
+    if (*line == '\0')
+    {
+        console_prompt();
+        return;
+    }
+    for (int i = 0; i < CONSOLE_NUM_COMMANDS; i++)
+    {
+        const char *args = console_word(line, console_commands[i].name);
+        if (args == NULL)
+        {
+            continue;
+        }
+        console_prefix_len = 0;
+        if (console_commands[i].step == console_routes && *args != '\0' &&
+            console_parse_prefix(args, &console_prefix, &console_prefix_len) < 0)
+        {
+            console_printf("bad prefix, e.g. 2a0e:aa06::/32\r\n");
+            console_prompt();
+            return;
+        }
+        console_running = console_commands + i;
+        console_cursor = 0;
+        console_count = 0;
+        console_lines = 0;
+        return;
+    }
+    console_printf("unknown command, see help\r\n");
+    console_prompt();
+}
+
+// Collect the command line, with echo
+static void console_input(char ch)
+{
+    char last = console_last;
+    console_last = ch;
+    if (ch == '\r' || (ch == '\n' && last != '\r'))
+    {
+        console_printf("\r\n");
+        console_start();
+    }
+    else if ((ch == '\b' || ch == 0x7f) && console_line_len > 0)
+    {
+        console_line_len--;
+        console_printf("\b \b");
+    }
+    else if (ch >= ' ' && ch < 0x7f && console_line_len < CONSOLE_LINE_LEN - 1)
+    {
+        console_line[console_line_len++] = ch;
+        console_put(ch);
+    }
+}
+
+void console_poll()
+{
+    console_flush();
+    int ch = _trygetchar();
+    if (console_running == NULL)
+    {
+        if (ch >= 0)
+        {
+            console_input(ch);
+        }
+    }
+    else if (ch == 'q')
+    {
+        console_printf(console_more ? "\r          \r" : "\r\n");
+        console_prompt();
+    }
+    else if (console_more)
+    {
+        if (ch >= 0)
+        {
+            console_printf("\r          \r");
+            console_more = 0;
+            console_lines = 0;
+        }
+    }
+    else if (console_room() >= CONSOLE_ROOM)
+    {
+        if (console_running->step())
+        {
+            console_prompt();
+        }
+        else if (console_lines >= CONSOLE_PAGE)
+        {
+            console_printf("-- more --");
+            console_more = 1;
+        }
+    }
+    console_flush();
+}
@@ -0,0 +1,119 @@
+// Route flap dampening, see include/damping.h
+#include "stdint.h"
+#include "timer.h"
+#include "hal.h"
+#include "damping.h"
+
+#define DAMPING_BUCKET(mem_id) ((mem_id) & (NUM_DAMPING_BUCKET - 1))
+
+struct damping_rte damping_rte[NUM_DAMPING_RTE] __attribute__((section(".data")));
+int damping_buckets[NUM_DAMPING_BUCKET] __attribute__((section(".data")));
+int spare_damping_index = 1; // entries from here were never used
+int free_damping_index = 0;  // freed entries, chained by next
+
+static void damping_unlink(int *link)
+{
+    int index = *link;
+    *link = damping_rte[index].next;
+    damping_rte[index].next = free_damping_index;
+    free_damping_index = index;
+}
+
+// Halve the penalty once per half-life elapsed, the rest of the time counts for the next one
+static void damping_decay(struct damping_rte *damping)
+{
+    uint32_t now = HAL_READ32(MTIME_LADDR);
+    uint32_t half_lives = (now - damping->updated) / DAMPING_HALF_LIFE;
+    if (half_lives == 0)
+    {
+        return;
+    }
+    damping->penalty = (half_lives >= 16) ? 0 : damping->penalty >> half_lives;
+    damping->updated += half_lives * DAMPING_HALF_LIFE;
+    if (damping->penalty < DAMPING_REUSE)
+    {
+        damping->suppressed = 0;
+    }
+}
+
+// Find the entry of a route with its penalty decayed, dropping it once the penalty is negligible
+static int *damping_find(int mem_id)
+{
+    int *link = damping_buckets + DAMPING_BUCKET(mem_id);
+    while (*link)
+    {
+        struct damping_rte *damping = damping_rte + *link;
+        if (damping->mem_id == mem_id)
+        {
+            damping_decay(damping);
+            if (damping->penalty < (DAMPING_REUSE >> 1))
+            {
+                damping_unlink(link);
+                return 0;
+            }
+            return link;
+        }
+        link = &damping->next;
+    }
+    return 0;
+}
+
+int damping_flap(int mem_id, uint16_t penalty)
+{
+    int *link = damping_find(mem_id);
+    int index;
+    if (link)
+    {
+        index = *link;
+    }
+    else
+    {
+        index = free_damping_index;
+        if (index)
+        {
+            free_damping_index = damping_rte[index].next;
+        }
+        else if (spare_damping_index < NUM_DAMPING_RTE)
+        {
+            index = spare_damping_index++;
+        }
+        else
+        {
+            // No room to track it, the route is not dampened
+            return 0;
+        }
+        damping_rte[index].mem_id = mem_id;
+        damping_rte[index].updated = HAL_READ32(MTIME_LADDR);
+        damping_rte[index].penalty = 0;
+        damping_rte[index].suppressed = 0;
+        damping_rte[index].next = damping_buckets[DAMPING_BUCKET(mem_id)];
+        damping_buckets[DAMPING_BUCKET(mem_id)] = index;
+    }
+    struct damping_rte *damping = damping_rte + index;
+    damping->penalty = (damping->penalty + penalty > DAMPING_CEILING) ? DAMPING_CEILING : damping->penalty + penalty;
+    if (damping->penalty >= DAMPING_SUPPRESS)
+    {
+        damping->suppressed = 1;
+    }
+    return damping->suppressed;
+}
+
+int damping_suppressed(int mem_id)
+{
+    int *link = damping_find(mem_id);
+    return link ? damping_rte[*link].suppressed : 0;
+}
+
+void damping_clear(int mem_id)
+{
+    int *link = damping_buckets + DAMPING_BUCKET(mem_id);
+    while (*link)
+    {
+        if (damping_rte[*link].mem_id == mem_id)
+        {
+            damping_unlink(link);
+            return;
+        }
+        link = &damping_rte[*link].next;
+    }
+}
@@ -0,0 +1,504 @@
+// Forwarding table compression, see include/fib.h
+#include "stdint.h"
+#include "memory.h"
+#include "nexthop.h"
+#include "fib.h"
+#include "trace.h"
+
+#define FIB_BUCKET(key) ((key) & (NUM_FIB_BUCKET - 1))
+#define FIB_PARKED -1 // anchor of a withdrawn route, it is in no bucket of anchors
+#define FIB_CHUNK_NUM ((NUM_MEMORY_RTE + FIB_CHUNK - 1) / FIB_CHUNK)
+#define FIB_CHUNK_WORDS ((FIB_CHUNK_NUM + 31) / 32)
+
+extern int rte_map[NUM_TRIE_NODE];
+extern struct memory_rte memory_rte[NUM_MEMORY_RTE];
+
+extern int TrieInsert(void *prefix, unsigned int length, uint32_t next_hop);
+extern int TrieDelete(void *prefix, unsigned int length);
+extern int TrieLookup(void *prefix, unsigned int length);
+extern int TrieLongestMatch(void *prefix, unsigned int length, unsigned int *match_length);
+extern void TrieModify(void *prefix, unsigned int length, uint32_t next_hop);
+extern uint32_t TrieGetNextHop(int index);
+
+struct fib_hidden fib_hidden[NUM_FIB_HIDDEN] __attribute__((section(".data")));
+uint8_t fib_slots[NUM_MEMORY_RTE] __attribute__((section(".data"))); // slot of each route, 0 if it is not in the table
+uint32_t fib_slot_chunks[NEXTHOP_SLOT_END][FIB_CHUNK_WORDS]; // bit c: chunk c may hold routes of the slot
+uint16_t fib_prefix_buckets[NUM_FIB_BUCKET] __attribute__((section(".data")));
+uint16_t fib_anchor_buckets[NUM_FIB_BUCKET] __attribute__((section(".data")));
+int spare_fib_index = 1;      // entries from here were never used
+int free_fib_index = 0;       // freed entries, chained by next
+uint32_t fib_hidden_num = 0;  // routes out of the tries
+uint32_t fib_parked_num = 0;  // withdrawn routes, see fib_withdraw()
+uint32_t fib_stranded_num = 0; // hidden routes without anchor, their addresses may be forwarded wrong
+uint32_t fib_removed = 0;     // routes taken out of the tries, room for the stranded ones
+uint32_t fib_retried = 0;     // fib_removed when the stranded routes were last retried
+
+// A route that is about to leave the tries, or to enter them with a slot
+struct fib_change
+{
+    int removed;
+    int added;
+    uint32_t added_slot;
+};
+
+static int fib_install(int mem_id, uint32_t slot, int anchor, struct fib_change *change);
+
+static int fib_hash(struct ip6_addr *prefix, uint8_t prefix_len)
+{
+    uint32_t hash = prefix->s6_addr32[0] ^ prefix->s6_addr32[1] ^ prefix->s6_addr32[2] ^ prefix->s6_addr32[3] ^ prefix_len;
+    hash ^= hash >> 16;
+    hash ^= hash >> 8;
+    return FIB_BUCKET(hash);
+}
+
+static void fib_mask(struct ip6_addr *masked, struct ip6_addr *prefix, int prefix_len)
+{
+    for (int i = 0; i < 16; i++)
+    {
+        int bits = prefix_len - (i << 3);
+        masked->s6_addr8[i] = bits >= 8 ? prefix->s6_addr8[i] : bits <= 0 ? 0 : prefix->s6_addr8[i] & (0xff00 >> bits);
+    }
+}
+
+// Whether a route is shorter than another one and covers it
+static int fib_covers(struct memory_rte *outer, struct memory_rte *inner)
+{
+    if (outer->prefix_len >= inner->prefix_len)
+    {
+        return 0;
+    }
+    struct ip6_addr a, b;
+    fib_mask(&a, &outer->ip6_addr, outer->prefix_len);
+    fib_mask(&b, &inner->ip6_addr, outer->prefix_len);
+    return a.s6_addr32[0] == b.s6_addr32[0] && a.s6_addr32[1] == b.s6_addr32[1] &&
+           a.s6_addr32[2] == b.s6_addr32[2] && a.s6_addr32[3] == b.s6_addr32[3];
+}
+
+// The link to the hidden route of a prefix, pointing to 0 if there is none
+static uint16_t *fib_find(struct ip6_addr *prefix, uint8_t prefix_len)
+{
+    uint16_t *link = fib_prefix_buckets + fib_hash(prefix, prefix_len);
+    while (*link)
+    {
+        struct memory_rte *rte = memory_rte + fib_hidden[*link].mem_id;
+        if (rte->prefix_len == prefix_len &&
+            rte->ip6_addr.s6_addr32[0] == prefix->s6_addr32[0] && rte->ip6_addr.s6_addr32[1] == prefix->s6_addr32[1] &&
+            rte->ip6_addr.s6_addr32[2] == prefix->s6_addr32[2] && rte->ip6_addr.s6_addr32[3] == prefix->s6_addr32[3])
+        {
+            break;
+        }
+        link = &fib_hidden[*link].next;
+    }
+    return link;
+}
+
+/*
+ * The route a route would be hidden behind: the longest route in the tries
+ * above it, taking the change into account. 0 if there is none.
+ * The tries are walked once, again past the route being removed if it is found.
+ */
+static int fib_anchor(struct memory_rte *rte, uint32_t *slot, struct fib_change *change)
+{
+    int anchor = 0;
+    unsigned int length;
+    int trie_index = TrieLongestMatch(&rte->ip6_addr, rte->prefix_len, &length);
+    while (trie_index >= 0 && rte_map[trie_index] == change->removed)
+    {
+        trie_index = TrieLongestMatch(&rte->ip6_addr, length, &length);
+    }
+    if (trie_index >= 0)
+    {
+        anchor = rte_map[trie_index];
+        *slot = TrieGetNextHop(trie_index);
+    }
+    if (change->added && fib_covers(memory_rte + change->added, rte) &&
+        (!anchor || memory_rte[anchor].prefix_len <= memory_rte[change->added].prefix_len))
+    {
+        anchor = change->added;
+        *slot = change->added_slot;
+    }
+    return anchor;
+}
+
+static void fib_link_anchor(int index, int anchor)
+{
+    fib_hidden[index].anchor = anchor;
+    if (anchor == FIB_PARKED)
+    {
+        return;
+    }
+    if (!anchor)
+    {
+        fib_stranded_num++;
+    }
+    fib_hidden[index].next_anchor = fib_anchor_buckets[FIB_BUCKET(anchor)];
+    fib_anchor_buckets[FIB_BUCKET(anchor)] = index;
+}
+
+static void fib_unlink_anchor(int index)
+{
+    if (fib_hidden[index].anchor == FIB_PARKED)
+    {
+        return;
+    }
+    if (!fib_hidden[index].anchor)
+    {
+        fib_stranded_num--;
+    }
+    uint16_t *link = fib_anchor_buckets + FIB_BUCKET(fib_hidden[index].anchor);
+    while (*link != index)
+    {
+        link = &fib_hidden[*link].next_anchor;
+    }
+    *link = fib_hidden[index].next_anchor;
+}
+
+static int fib_hide(int mem_id, int anchor)
+{
+    int index = free_fib_index;
+    if (index)
+    {
+        free_fib_index = fib_hidden[index].next;
+    }
+    else if (spare_fib_index < NUM_FIB_HIDDEN)
+    {
+        index = spare_fib_index++;
+    }
+    else
+    {
+        return -1;
+    }
+    struct memory_rte *rte = memory_rte + mem_id;
+    uint16_t *bucket = fib_prefix_buckets + fib_hash(&rte->ip6_addr, rte->prefix_len);
+    fib_hidden[index].mem_id = mem_id;
+    fib_hidden[index].next = *bucket;
+    *bucket = index;
+    fib_link_anchor(index, anchor);
+    if (anchor == FIB_PARKED)
+    {
+        fib_parked_num++;
+    }
+    else
+    {
+        fib_hidden_num++;
+    }
+    return 0;
+}
+
+// Free a hidden route, already out of the bucket of its anchor
+static void fib_free(int index)
+{
+    struct memory_rte *rte = memory_rte + fib_hidden[index].mem_id;
+    uint16_t *link = fib_find(&rte->ip6_addr, rte->prefix_len);
+    *link = fib_hidden[index].next;
+    fib_hidden[index].next = free_fib_index;
+    free_fib_index = index;
+    if (fib_hidden[index].anchor == FIB_PARKED)
+    {
+        fib_parked_num--;
+    }
+    else
+    {
+        fib_hidden_num--;
+    }
+}
+
+/*
+ * Take the routes hidden behind a route out of its bucket, all of them or
+ * the ones another route covers.
+ * @return The list of routes, chained by next_anchor.
+ */
+static int fib_take(int anchor, struct memory_rte *cover)
+{
+    uint16_t *link = fib_anchor_buckets + FIB_BUCKET(anchor);
+    int taken = 0;
+    while (*link)
+    {
+        int index = *link;
+        struct fib_hidden *hidden = fib_hidden + index;
+        if (hidden->anchor != anchor || (cover && !fib_covers(cover, memory_rte + hidden->mem_id)))
+        {
+            link = &hidden->next_anchor;
+            continue;
+        }
+        *link = hidden->next_anchor;
+        if (!anchor)
+        {
+            fib_stranded_num--;
+        }
+        hidden->next_anchor = taken;
+        taken = index;
+    }
+    return taken;
+}
+
+/*
+ * Hide again the routes of a list, behind the route they are now covered by,
+ * or put them into the tries if it does not have their slot.
+ * A route that does not fit into the tries stays hidden without anchor.
+ */
+static void fib_requeue(int taken, struct fib_change *change)
+{
+    while (taken)
+    {
+        int index = taken;
+        taken = fib_hidden[index].next_anchor;
+        int mem_id = fib_hidden[index].mem_id;
+        uint32_t slot = fib_slots[mem_id];
+        uint32_t anchor_slot;
+        int anchor = fib_anchor(memory_rte + mem_id, &anchor_slot, change);
+        if (!anchor || anchor_slot != slot)
+        {
+            if (fib_install(mem_id, slot, anchor, change) == 0)
+            {
+                fib_free(index);
+                continue;
+            }
+            anchor = 0;
+        }
+        fib_link_anchor(index, anchor);
+    }
+}
+
+/*
+ * Put a route into the tries, the routes it covers that were hidden behind
+ * its anchor are moved behind it first: they keep being forwarded through
+ * the anchor, with the same slot, until it is in.
+ */
+static int fib_install(int mem_id, uint32_t slot, int anchor, struct fib_change *change)
+{
+    struct memory_rte *rte = memory_rte + mem_id;
+    if (anchor)
+    {
+        struct fib_change inner = {change->removed, mem_id, slot};
+        fib_requeue(fib_take(anchor, rte), &inner);
+    }
+    int trie_index = TrieInsert(&rte->ip6_addr, rte->prefix_len, slot);
+    TRACE_EVENT(TRACE_ROUTE_INSERT, rte->ip6_addr.s6_addr32[0], rte->ip6_addr.s6_addr32[1],
+                rte->prefix_len | (slot << 8) | ((uint32_t)(trie_index < 0) << 31));
+    if (trie_index < 0)
+    {
+        fib_requeue(fib_take(mem_id, 0), change);
+        return -1;
+    }
+    rte_map[trie_index] = mem_id;
+    return 0;
+}
+
+// Take a route out of the tries, once the routes hidden behind it have another anchor
+static void fib_uninstall(int mem_id)
+{
+    struct memory_rte *rte = memory_rte + mem_id;
+    struct fib_change change = {mem_id, 0, 0};
+    fib_requeue(fib_take(mem_id, 0), &change);
+    int trie_index = TrieDelete(&rte->ip6_addr, rte->prefix_len);
+    TRACE_EVENT(TRACE_ROUTE_DELETE, rte->ip6_addr.s6_addr32[0], rte->ip6_addr.s6_addr32[1],
+                rte->prefix_len | ((uint32_t)(trie_index < 0) << 31));
+    if (trie_index >= 0)
+    {
+        rte_map[trie_index] = 0;
+        fib_removed++;
+    }
+}
+
+int fib_lookup(struct ip6_addr *prefix, uint8_t prefix_len, uint32_t *slot)
+{
+    int trie_index = TrieLookup(prefix, prefix_len);
+    if (trie_index >= 0)
+    {
+        if (slot)
+        {
+            *slot = TrieGetNextHop(trie_index);
+        }
+        return rte_map[trie_index];
+    }
+    uint16_t *link = fib_find(prefix, prefix_len);
+    if (!*link)
+    {
+        return 0;
+    }
+    if (slot)
+    {
+        *slot = fib_slot(fib_hidden[*link].mem_id);
+    }
+    return fib_hidden[*link].mem_id;
+}
+
+// Set the slot of a route, and mark its chunk for the slot
+static void fib_set_slot(int mem_id, uint32_t slot)
+{
+    fib_slots[mem_id] = slot;
+    int chunk = mem_id / FIB_CHUNK;
+    fib_slot_chunks[slot][chunk >> 5] |= 1u << (chunk & 31);
+}
+
+uint32_t fib_slot(int mem_id)
+{
+    return fib_slots[mem_id] ? fib_slots[mem_id] : NEXTHOP_SLOT_END;
+}
+
+int fib_insert(int mem_id, uint32_t slot)
+{
+    struct memory_rte *rte = memory_rte + mem_id;
+    uint16_t *link = fib_find(&rte->ip6_addr, rte->prefix_len);
+    if (*link && fib_hidden[*link].anchor == FIB_PARKED)
+    {
+        fib_free(*link);
+    }
+    struct fib_change change = {0, 0, 0};
+    uint32_t anchor_slot;
+    int anchor = fib_anchor(memory_rte + mem_id, &anchor_slot, &change);
+    fib_set_slot(mem_id, slot);
+    if (anchor && anchor_slot == slot && fib_hide(mem_id, anchor) == 0)
+    {
+        return 0;
+    }
+    if (fib_install(mem_id, slot, anchor, &change) < 0)
+    {
+        fib_slots[mem_id] = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void fib_modify(int mem_id, uint32_t slot)
+{
+    struct memory_rte *rte = memory_rte + mem_id;
+    uint16_t *link = fib_find(&rte->ip6_addr, rte->prefix_len);
+    if (*link)
+    {
+        // Nothing is hidden behind a hidden route, it is placed again
+        int index = *link;
+        fib_unlink_anchor(index);
+        fib_free(index);
+        if (fib_insert(mem_id, slot) < 0)
+        {
+            fib_set_slot(mem_id, slot);
+            fib_hide(mem_id, 0);
+        }
+        return;
+    }
+    if (TrieLookup(&rte->ip6_addr, rte->prefix_len) < 0)
+    {
+        return;
+    }
+    fib_set_slot(mem_id, slot);
+    struct fib_change change = {0, mem_id, slot};
+    uint32_t anchor_slot;
+    int anchor = fib_anchor(rte, &anchor_slot, &change);
+    if (anchor && anchor_slot == slot && fib_hide(mem_id, anchor) == 0)
+    {
+        // The route above forwards the same way now
+        fib_uninstall(mem_id);
+        return;
+    }
+    // The routes hidden behind it with the old slot go into the tries first
+    fib_requeue(fib_take(mem_id, 0), &change);
+    TrieModify(&rte->ip6_addr, rte->prefix_len, slot);
+}
+
+void fib_delete(int mem_id)
+{
+    struct memory_rte *rte = memory_rte + mem_id;
+    uint16_t *link = fib_find(&rte->ip6_addr, rte->prefix_len);
+    if (*link)
+    {
+        int index = *link;
+        fib_unlink_anchor(index);
+        fib_free(index);
+    }
+    else if (fib_slots[mem_id])
+    {
+        fib_uninstall(mem_id);
+    }
+    fib_slots[mem_id] = 0;
+}
+
+int fib_withdraw(int mem_id)
+{
+    if (!fib_slots[mem_id])
+    {
+        return 0;
+    }
+    struct memory_rte *rte = memory_rte + mem_id;
+    uint16_t *link = fib_find(&rte->ip6_addr, rte->prefix_len);
+    if (*link)
+    {
+        // A hidden route keeps its entry of the pool
+        fib_unlink_anchor(*link);
+        fib_hidden[*link].anchor = FIB_PARKED;
+        fib_hidden_num--;
+        fib_parked_num++;
+    }
+    else
+    {
+        if (!free_fib_index && spare_fib_index == NUM_FIB_HIDDEN)
+        {
+            return -1;
+        }
+        fib_uninstall(mem_id);
+        fib_hide(mem_id, FIB_PARKED);
+    }
+    fib_slots[mem_id] = 0;
+    return 0;
+}
+
+int fib_retry()
+{
+    if (fib_stranded_num == 0 || fib_removed == fib_retried)
+    {
+        return 0;
+    }
+    fib_retried = fib_removed;
+    struct fib_change change = {0, 0, 0};
+    uint32_t stranded = fib_stranded_num;
+    fib_requeue(fib_take(0, 0), &change);
+    return stranded - fib_stranded_num;
+}
+
+int fib_next_chunk(uint32_t slots, int chunk)
+{
+    for (int word = chunk >> 5; word < FIB_CHUNK_WORDS; word++)
+    {
+        uint32_t bits = 0;
+        for (int slot = 1; slot < NEXTHOP_SLOT_END; slot++)
+        {
+            if (slots & (1u << slot))
+            {
+                bits |= fib_slot_chunks[slot][word];
+            }
+        }
+        if (word == chunk >> 5)
+        {
+            bits &= ~0u << (chunk & 31);
+        }
+        if (bits)
+        {
+            int found = word << 5;
+            while (!(bits & 1))
+            {
+                bits >>= 1;
+                found++;
+            }
+            return found;
+        }
+    }
+    return -1;
+}
+
+void fib_chunk_sync(int chunk)
+{
+    uint32_t slots = 0;
+    int end = (chunk + 1) * FIB_CHUNK;
+    for (int mem_id = chunk * FIB_CHUNK; mem_id < end && mem_id < NUM_MEMORY_RTE; mem_id++)
+    {
+        slots |= 1u << fib_slots[mem_id];
+    }
+    for (int slot = 1; slot < NEXTHOP_SLOT_END; slot++)
+    {
+        if (!(slots & (1u << slot)))
+        {
+            fib_slot_chunks[slot][chunk >> 5] &= ~(1u << (chunk & 31));
+        }
+    }
+}
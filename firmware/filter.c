@@ -0,0 +1,346 @@
+// Ingress prefix-list, see include/filter.h
+#include "stdint.h"
+#include "ip6.h"
+#include "filter.h"
+#include "stats.h"
+
+#define FILTER_WORDS 5    // words of a bitmap of the lengths 0 to 128
+#define FILTER_LEVELS 34  // node depths 0, 4, ..., 128, and one for scratch
+#define FILTER_NONE 0xffff
+
+struct filter_rule filter_rules[NUM_FILTER_RULE] __attribute__((section(".data")));
+struct filter_node filter_nodes[NUM_FILTER_NODE] __attribute__((section(".data")));
+uint16_t filter_results[NUM_FILTER_RULE] __attribute__((section(".data"))); // a decision per rule prefix
+uint32_t filter_decisions[NUM_FILTER_DECISION][FILTER_WORDS] __attribute__((section(".data")));
+// While compiling: the rules sorted by prefix, and the first rule matching each length above every node of the path
+uint16_t filter_order[NUM_FILTER_RULE] __attribute__((section(".data")));
+uint16_t filter_first[FILTER_LEVELS][129] __attribute__((section(".data")));
+int filter_rule_num = 0;
+int filter_node_num = 0;
+int filter_result_num = 0;
+int filter_decision_num = 0;
+int filter_compiled = 0; // 0: the list is empty, every route is permitted; -1: no list could be compiled, every route is denied
+int filter_kept = 0;     // rules of the last list compiled
+uint32_t filter_denied = 0; // routes denied
+
+// The first k bits of an address from a depth, a multiple of 4
+static inline uint32_t filter_bits(struct ip6_addr *addr, int depth, int k)
+{
+    if (k == 0)
+    {
+        return 0;
+    }
+    return ((addr->s6_addr8[depth >> 3] >> ((depth & 4) ? 0 : 4)) & 0xf) >> (4 - k);
+}
+
+static inline uint32_t filter_popcount(uint32_t x)
+{
+    x = x - ((x >> 1) & 0x5555);
+    x = (x & 0x3333) + ((x >> 2) & 0x3333);
+    x = (x + (x >> 4)) & 0x0f0f;
+    return (x + (x >> 8)) & 0x1f;
+}
+
+int filter_add(struct ip6_addr *prefix, uint8_t prefix_len, uint8_t ge, uint8_t le, uint8_t permit)
+{
+    if (filter_rule_num == NUM_FILTER_RULE || prefix_len > 128 || ge > 128 || le > 128)
+    {
+        return -1;
+    }
+    uint8_t low = ge ? ge : prefix_len;
+    uint8_t high = le ? le : (ge ? 128 : prefix_len);
+    if (low < prefix_len || high < low)
+    {
+        return -1;
+    }
+    struct filter_rule *rule = filter_rules + filter_rule_num++;
+    for (int i = 0; i < 16; i++)
+    {
+        int bits = prefix_len - (i << 3);
+        rule->prefix.s6_addr8[i] = bits >= 8 ? prefix->s6_addr8[i] : bits <= 0 ? 0 : prefix->s6_addr8[i] & (0xff00 >> bits);
+    }
+    rule->prefix_len = prefix_len;
+    rule->ge = low;
+    rule->le = high;
+    rule->permit = permit;
+    return 0;
+}
+
+static int filter_before(int a, int b)
+{
+    for (int i = 0; i < 16; i++)
+    {
+        if (filter_rules[a].prefix.s6_addr8[i] != filter_rules[b].prefix.s6_addr8[i])
+        {
+            return filter_rules[a].prefix.s6_addr8[i] < filter_rules[b].prefix.s6_addr8[i];
+        }
+    }
+    return 0;
+}
+
+// Sort the rules by prefix, so the rules below a prefix are next to each other
+static void filter_sort()
+{
+    for (int i = 0; i < filter_rule_num; i++)
+    {
+        filter_order[i] = i;
+    }
+    for (int gap = filter_rule_num >> 1; gap > 0; gap >>= 1)
+    {
+        for (int i = gap; i < filter_rule_num; i++)
+        {
+            uint16_t r = filter_order[i];
+            int j = i;
+            while (j >= gap && filter_before(r, filter_order[j - gap]))
+            {
+                filter_order[j] = filter_order[j - gap];
+                j -= gap;
+            }
+            filter_order[j] = r;
+        }
+    }
+}
+
+// Apply the rules of filter_order[lo..hi) with a prefix of k bits b below depth
+static void filter_apply(uint16_t *first, int lo, int hi, int depth, int k, uint32_t b)
+{
+    for (int i = lo; i < hi; i++)
+    {
+        int r = filter_order[i];
+        if (filter_rules[r].prefix_len != depth + k || filter_bits(&(filter_rules[r].prefix), depth, k) != b)
+        {
+            continue;
+        }
+        for (int length = filter_rules[r].ge; length <= filter_rules[r].le; length++)
+        {
+            if (r < first[length])
+            {
+                first[length] = r;
+            }
+        }
+    }
+}
+
+// The decision of the lengths permitted by the first rules, added if it is new
+static int filter_decision(uint16_t *first)
+{
+    uint32_t bitmap[FILTER_WORDS];
+    for (int w = 0; w < FILTER_WORDS; w++)
+    {
+        bitmap[w] = 0;
+    }
+    for (int length = 0; length <= 128; length++)
+    {
+        if (first[length] != FILTER_NONE && filter_rules[first[length]].permit)
+        {
+            bitmap[length >> 5] |= 1u << (length & 31);
+        }
+    }
+    for (int d = 0; d < filter_decision_num; d++)
+    {
+        int w = 0;
+        while (w < FILTER_WORDS && filter_decisions[d][w] == bitmap[w])
+        {
+            w++;
+        }
+        if (w == FILTER_WORDS)
+        {
+            return d;
+        }
+    }
+    if (filter_decision_num == NUM_FILTER_DECISION)
+    {
+        return -1;
+    }
+    for (int w = 0; w < FILTER_WORDS; w++)
+    {
+        filter_decisions[filter_decision_num][w] = bitmap[w];
+    }
+    return filter_decision_num++;
+}
+
+/*
+ * Build a node from the rules of filter_order[lo..hi), which share the first
+ * depth bits of the node, the shorter ones belong to the nodes above.
+ * filter_first[depth / 4] holds the rules of the nodes above.
+ */
+static int filter_build(int node, int depth, int lo, int hi)
+{
+    uint16_t *above = filter_first[depth >> 2];
+    uint16_t *first = filter_first[(depth >> 2) + 1];
+    uint32_t internal = 0, external = 0;
+    int last_k = (depth == 128) ? 0 : 3;
+    for (int i = lo; i < hi; i++)
+    {
+        struct filter_rule *rule = filter_rules + filter_order[i];
+        int k = rule->prefix_len - depth;
+        if (k < 0)
+        {
+            continue;
+        }
+        if (k <= last_k)
+        {
+            internal |= 1u << ((1 << k) - 1 + filter_bits(&(rule->prefix), depth, k));
+        }
+        else
+        {
+            external |= 1u << filter_bits(&(rule->prefix), depth, 4);
+        }
+    }
+    filter_nodes[node].internal = internal;
+    filter_nodes[node].external = external;
+    filter_nodes[node].result_base = filter_result_num;
+    filter_nodes[node].child_base = filter_node_num;
+    if (filter_node_num + filter_popcount(external) > NUM_FILTER_NODE)
+    {
+        return -1;
+    }
+    filter_node_num += filter_popcount(external);
+    // A decision per rule prefix, from the rules above and the ones inside the node above it
+    for (int k = 0; k <= last_k; k++)
+    {
+        for (uint32_t b = 0; b < (1u << k); b++)
+        {
+            if (!(internal & (1u << ((1 << k) - 1 + b))))
+            {
+                continue;
+            }
+            for (int length = 0; length <= 128; length++)
+            {
+                first[length] = above[length];
+            }
+            for (int j = 0; j <= k; j++)
+            {
+                filter_apply(first, lo, hi, depth, j, b >> (k - j));
+            }
+            int decision = filter_decision(first);
+            if (decision < 0)
+            {
+                return -1;
+            }
+            filter_results[filter_result_num++] = decision;
+        }
+    }
+    // The children, with the rules inside the node above each of them
+    int child = filter_nodes[node].child_base;
+    for (uint32_t v = 0; v < 16; v++)
+    {
+        if (!(external & (1u << v)))
+        {
+            continue;
+        }
+        int child_lo = -1, child_hi = -1;
+        for (int i = lo; i < hi; i++)
+        {
+            struct filter_rule *rule = filter_rules + filter_order[i];
+            if (rule->prefix_len >= depth + 4 && filter_bits(&(rule->prefix), depth, 4) == v)
+            {
+                if (child_lo < 0)
+                {
+                    child_lo = i;
+                }
+                child_hi = i + 1;
+            }
+        }
+        for (int length = 0; length <= 128; length++)
+        {
+            first[length] = above[length];
+        }
+        for (int k = 0; k < 4; k++)
+        {
+            if (internal & (1u << ((1 << k) - 1 + (v >> (4 - k)))))
+            {
+                filter_apply(first, lo, hi, depth, k, v >> (4 - k));
+            }
+        }
+        if (filter_build(child++, depth + 4, child_lo, child_hi) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Compile the first filter_rule_num rules
+static int filter_compile_rules()
+{
+    filter_compiled = 0;
+    if (filter_rule_num == 0)
+    {
+        return 0;
+    }
+    filter_sort();
+    for (int length = 0; length <= 128; length++)
+    {
+        filter_first[0][length] = FILTER_NONE;
+    }
+    filter_node_num = 1;
+    filter_result_num = 0;
+    filter_decision_num = 0;
+    if (filter_build(0, 0, 0, filter_rule_num) < 0)
+    {
+        return -1;
+    }
+    filter_compiled = 1;
+    return 0;
+}
+
+int filter_compile()
+{
+    if (filter_compile_rules() == 0)
+    {
+        filter_kept = filter_rule_num;
+        return 0;
+    }
+    // The rules added since the last list compiled are dropped, that list is compiled again
+    STATS_INC(filter_overflows);
+    int added = filter_rule_num;
+    filter_rule_num = filter_kept;
+    filter_compile_rules();
+    if (filter_kept == 0 && added > 0)
+    {
+        filter_compiled = -1;
+    }
+    return -1;
+}
+
+int filter_permit(struct ip6_addr *prefix, uint8_t prefix_len)
+{
+    if (filter_compiled == 0)
+    {
+        return 1;
+    }
+    if (filter_compiled < 0)
+    {
+        filter_denied++;
+        return 0;
+    }
+    struct filter_node *node = filter_nodes;
+    int result = -1;
+    for (int depth = 0;; depth += 4)
+    {
+        uint32_t v = (depth < 128) ? filter_bits(prefix, depth, 4) : 0;
+        // The longest rule prefix inside the node, not longer than the route
+        int k = prefix_len - depth;
+        for (k = (k > 3) ? 3 : k; k >= 0; k--)
+        {
+            uint32_t pos = (1u << k) - 1 + (v >> (4 - k));
+            if (node->internal & (1u << pos))
+            {
+                result = node->result_base + filter_popcount(node->internal & ((1u << pos) - 1));
+                break;
+            }
+        }
+        if (prefix_len < depth + 4 || !(node->external & (1u << v)))
+        {
+            break;
+        }
+        node = filter_nodes + node->child_base + filter_popcount(node->external & ((1u << v) - 1));
+    }
+    if (result >= 0 && ((filter_decisions[filter_results[result]][prefix_len >> 5] >> (prefix_len & 31)) & 1))
+    {
+        return 1;
+    }
+    filter_denied++;
+    return 0;
+}
@@ -0,0 +1,192 @@
+// Hardware of the router on the build host, see include/hal.h
+#ifndef RV32
+#include "stdint.h"
+#include "hal.h"
+#include "dma.h"
+#include "uart.h"
+
+// From the C library of the host
+void *mmap(void *addr, unsigned long length, int prot, int flags, int fd, long offset);
+long write(int fd, const void *buf, unsigned long count);
+#define PROT_READ_WRITE 0x3
+#define MAP_ANONYMOUS_NORESERVE 0x4022  // MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE
+#define MAP_FIXED_NOREPLACE 0x100000
+
+struct hal_region
+{
+    uint32_t base;
+    uint32_t size;
+    uint8_t *data;
+};
+
+static uint8_t hal_dma_regs[0x100];
+static uint8_t hal_clint[0x10000];
+static uint8_t hal_uart[0x8];
+static uint8_t hal_config[0x3000];
+static uint8_t hal_nexthop_table[0x3000];
+static uint8_t hal_sram[0x30000]; // DMA_BLOCK_WADDR, DMA_BLOCK_RADDR and DMA_OUT_LENGTH
+
+static struct hal_region hal_regions[] = {
+    {0x01000000, sizeof(hal_dma_regs), hal_dma_regs},
+    {0x02000000, sizeof(hal_clint), hal_clint},
+    {UART_BASE, sizeof(hal_uart), hal_uart},
+    {HAL_BRAM_BASE, HAL_BRAM_SIZE, (uint8_t *)HAL_BRAM_BASE},
+    {0x40000000, sizeof(hal_config), hal_config},
+    {0x41000000, sizeof(hal_nexthop_table), hal_nexthop_table},
+    {DMA_BLOCK_WADDR, sizeof(hal_sram), hal_sram},
+};
+
+static int hal_bram_mapped = 0;
+
+// The packet waiting for the DMA
+static uint8_t hal_rx_data[HAL_RX_SIZE];
+static uint32_t hal_rx_length = 0;
+static uint32_t hal_rx_port = 0;
+
+void (*hal_host_tx)(uint32_t port, const uint8_t *data, uint32_t length) = 0;
+void (*hal_host_poll)() = 0;
+void (*hal_host_uart)(uint8_t data) = 0;
+
+// The linker script of the router clears .bss from start(), there is nothing to clear here
+uint32_t _bss_begin[1];
+extern uint32_t _bss_end[1] __attribute__((alias("_bss_begin")));
+
+// The host memory behind an address, an access outside the hardware is a bug of the firmware
+static uint8_t *hal_host_addr(uint32_t addr, uint32_t size)
+{
+    for (uint32_t i = 0; i < sizeof(hal_regions) / sizeof(hal_regions[0]); i++)
+    {
+        if (addr - hal_regions[i].base < hal_regions[i].size && addr + size - hal_regions[i].base <= hal_regions[i].size)
+        {
+            if (hal_regions[i].base == HAL_BRAM_BASE && !hal_bram_mapped)
+            {
+                break;
+            }
+            return hal_regions[i].data + (addr - hal_regions[i].base);
+        }
+    }
+    __builtin_trap();
+}
+
+// The DMA runs a transfer as soon as it is granted
+static void hal_dma_transfer()
+{
+    uint32_t *regs = (uint32_t *)hal_dma_regs;
+    uint32_t addr = regs[(DMA_CPU_ADDR & 0xff) >> 2];
+    uint32_t length = regs[(DMA_CPU_DATA_WIDTH & 0xff) >> 2];
+    if (regs[(DMA_CPU_WE & 0xff) >> 2] == 0)
+    {
+        if (hal_host_tx)
+        {
+            hal_host_tx(regs[(DMA_OUT_PORT_ID & 0xff) >> 2] & 0xff, hal_host_addr(addr, length), length);
+        }
+    }
+    else if (regs[(DMA_IN_VALID & 0xff) >> 2])
+    {
+        uint8_t *data = hal_host_addr(addr, hal_rx_length);
+        for (uint32_t i = 0; i < hal_rx_length; i++)
+        {
+            data[i] = hal_rx_data[i];
+        }
+        regs[(DMA_DATA_WIDTH & 0xff) >> 2] = hal_rx_length;
+        regs[(DMA_IN_PORT_ID & 0xff) >> 2] = hal_rx_port;
+        regs[(DMA_IN_VALID & 0xff) >> 2] = 0;
+    }
+    regs[(DMA_ACK & 0xff) >> 2] = 1;
+}
+
+uint32_t hal_read32(uint32_t addr)
+{
+    if (addr == DMA_IN_VALID && hal_host_poll)
+    {
+        hal_host_poll();
+    }
+    return *(volatile uint32_t *)hal_host_addr(addr, 4);
+}
+
+void hal_write32(uint32_t addr, uint32_t data)
+{
+    *(volatile uint32_t *)hal_host_addr(addr, 4) = data;
+    if (addr == DMA_CPU_STB)
+    {
+        if (data)
+        {
+            hal_dma_transfer();
+        }
+        else
+        {
+            hal_write32(DMA_ACK, 0);
+        }
+    }
+}
+
+uint8_t hal_read8(uint32_t addr)
+{
+    return *(volatile uint8_t *)hal_host_addr(addr, 1);
+}
+
+void hal_write8(uint32_t addr, uint8_t data)
+{
+    *(volatile uint8_t *)hal_host_addr(addr, 1) = data;
+    if (addr == UART_THR && !(hal_read8(UART_LCR) & COM_LCR_DLAB))
+    {
+        if (hal_host_uart)
+        {
+            hal_host_uart(data);
+        }
+        else
+        {
+            write(2, &data, 1);
+        }
+    }
+}
+
+void *hal_ptr(uint32_t addr)
+{
+    return hal_host_addr(addr, 1);
+}
+
+int hal_host_init()
+{
+    if (!hal_bram_mapped)
+    {
+        void *bram = mmap((void *)HAL_BRAM_BASE, HAL_BRAM_SIZE, PROT_READ_WRITE,
+                          MAP_ANONYMOUS_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+        if (bram != (void *)HAL_BRAM_BASE)
+        {
+            return -1;
+        }
+        hal_bram_mapped = 1;
+    }
+    for (uint32_t i = 0; i < sizeof(hal_regions) / sizeof(hal_regions[0]); i++)
+    {
+        if (hal_regions[i].base != HAL_BRAM_BASE)
+        {
+            for (uint32_t j = 0; j < hal_regions[i].size; j++)
+            {
+                hal_regions[i].data[j] = 0;
+            }
+        }
+    }
+    hal_write8(UART_LSR, COM_LSR_THRE | COM_LSR_TEMT);
+    hal_rx_length = 0;
+    return 0;
+}
+
+int hal_host_rx(uint32_t port, const uint8_t *data, uint32_t length)
+{
+    uint32_t *regs = (uint32_t *)hal_dma_regs;
+    if (regs[(DMA_IN_VALID & 0xff) >> 2] || length > HAL_RX_SIZE)
+    {
+        return -1;
+    }
+    for (uint32_t i = 0; i < length; i++)
+    {
+        hal_rx_data[i] = data[i];
+    }
+    hal_rx_length = length;
+    hal_rx_port = port;
+    hal_write32(DMA_IN_VALID, 1);
+    return 0;
+}
+#endif
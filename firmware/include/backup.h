@@ -0,0 +1,52 @@
+#ifndef _BACKUP_H_
+#define _BACKUP_H_
+
+#include "stdint.h"
+
+/*
+ * Backup paths of the routes: the next best paths advertised by other
+ * neighbors, each with its own timer. They are not in the tries, the best one
+ * replaces the active path as soon as it fails.
+ * The backups are kept in a pool chained by buckets of memory_rte indices, so
+ * only the routes with backups use memory.
+ */
+#define NUM_BACKUP_RTE 8192
+#define NUM_BACKUP_BUCKET 2048 // power of 2
+#define BACKUP_PER_ROUTE 2     // backups kept per route, the worst is dropped
+
+struct backup_rte
+{
+    int mem_id;  // index of the route in memory_rte
+    int next;    // next backup in the bucket, 0 at the end
+    uint8_t neighbor;
+    uint8_t metric;
+    uint8_t lower_timer;
+    uint8_t reserved;
+};
+
+/**
+ * @brief Add, refresh, or remove the backup path of a route through a neighbor.
+ * @param mem_id The index of the route in memory_rte.
+ * @param neighbor The neighbor id, see nexthop_get().
+ * @param metric The metric of the path, 16 removes it.
+ */
+void backup_update(int mem_id, int neighbor, uint8_t metric);
+
+/**
+ * @brief The metric of the best backup path of a route.
+ * @return The metric, 16 if the route has no backup.
+ */
+int backup_best(int mem_id);
+
+/**
+ * @brief Take the best backup path of a route out of the backups.
+ * @return 1 if the route has a backup, 0 otherwise.
+ */
+int backup_pop(int mem_id, int *neighbor, uint8_t *metric, uint8_t *lower_timer);
+
+/**
+ * @brief Remove all backup paths of a route.
+ */
+void backup_clear(int mem_id);
+
+#endif // _BACKUP_H_
@@ -0,0 +1,40 @@
+#ifndef _CONSOLE_H_
+#define _CONSOLE_H_
+
+#include "stdint.h"
+
+/*
+ * Management console on the UART. console_poll() runs in idle time and never
+ * waits: a command line is collected one character at a time, and a command
+ * formats at most a line into the output buffer per call, while there is
+ * room, and looks at no more than CONSOLE_SCAN routes. The output buffer is
+ * sent whenever the UART can take a byte. The long listings stop after
+ * CONSOLE_PAGE lines until a key is pressed, 'q' ends them.
+ *
+ *   routes [prefix/len]  the routes, or the ones inside a prefix
+ *   neighbors            the neighbors known to the firmware
+ *   nexthops             the slots of the next hop table
+ *   trie                 the nodes used in each BRAM of the tries
+ *   stats                the counters of include/stats.h
+ *   dump                 the counters as a binary frame, see stats.py
+ *   clear                clear the counters
+ */
+#define CONSOLE_LINE_LEN 64  // longest command line
+#define CONSOLE_OUT_LEN 1024 // output buffer, a power of 2
+#define CONSOLE_ROOM 192     // free space needed to format a line
+#define CONSOLE_PAGE 20      // lines of a listing between two keys
+#define CONSOLE_SCAN 256     // routes looked at per call
+
+/**
+ * @brief Read the command line, run the command and send its output, as far as
+ *  it goes without waiting.
+ * @note Call from the idle loop.
+ */
+void console_poll();
+
+/**
+ * @brief Whether output is waiting to be sent, the UART must not be given other bytes meanwhile.
+ */
+int console_sending();
+
+#endif // _CONSOLE_H_
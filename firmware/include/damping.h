@@ -0,0 +1,54 @@
+#ifndef _DAMPING_H_
+#define _DAMPING_H_
+
+#include "stdint.h"
+
+/*
+ * Route flap dampening: every time a route is withdrawn it gets a penalty,
+ * which halves every DAMPING_HALF_LIFE. Once the penalty of a route reaches
+ * DAMPING_SUPPRESS, the route is suppressed until it decays below
+ * DAMPING_REUSE: it is not put back nor moved to a better path, so a flapping
+ * neighbor does not rewrite the tries and trigger updates over and over.
+ * Bad news (withdrawals, worse metrics) is always taken.
+ * The penalties are kept in a pool chained by buckets of memory_rte indices,
+ * so only the routes that flapped recently use memory.
+ */
+#define NUM_DAMPING_RTE 4096
+#define NUM_DAMPING_BUCKET 1024 // power of 2
+
+#define DAMPING_PENALTY 1000   // added every time a route is withdrawn
+#define DAMPING_SUPPRESS 2000
+#define DAMPING_REUSE 750
+#define DAMPING_CEILING 12000  // DAMPING_REUSE << 4, a route is suppressed 4 half-lives at most
+#define DAMPING_HALF_LIFE 15
+
+struct damping_rte
+{
+    int mem_id;       // index of the route in memory_rte
+    int next;         // next entry in the bucket, 0 at the end
+    uint32_t updated; // mtime of the last decay
+    uint16_t penalty;
+    uint8_t suppressed;
+    uint8_t reserved;
+};
+
+/**
+ * @brief Add a penalty to a route.
+ * @param mem_id The index of the route in memory_rte.
+ * @param penalty The penalty, see DAMPING_PENALTY.
+ * @return 1 if the route is suppressed, 0 otherwise.
+ */
+int damping_flap(int mem_id, uint16_t penalty);
+
+/**
+ * @brief Whether a route is suppressed.
+ * @note Decays its penalty first, it may be reused from now on.
+ */
+int damping_suppressed(int mem_id);
+
+/**
+ * @brief Forget the penalty of a route, when it is deleted.
+ */
+void damping_clear(int mem_id);
+
+#endif // _DAMPING_H_
@@ -18,6 +18,10 @@
 #define DMA_OUT_LENGTH 0x807E0000
 
 #include "stdint.h"
+#include "hal.h"
+#include "profile.h"
+#include "trace.h"
+#include "stats.h"
 
 /**
  * @brief Grant the DMA access to the memory
@@ -26,10 +30,11 @@
 inline void _grant_dma_access(uint32_t address, uint32_t size, uint32_t write_enable)
 {
     // write_enable: 1 for in, 0 for out
-    *((volatile uint32_t *)DMA_CPU_ADDR) = address;
-    *((volatile uint32_t *)DMA_CPU_DATA_WIDTH) = size;
-    *((volatile uint32_t *)DMA_CPU_WE) = write_enable;
-    *((volatile uint32_t *)DMA_CPU_STB) = 1;
+    HAL_WRITE32(DMA_CPU_ADDR, address);
+    HAL_WRITE32(DMA_CPU_DATA_WIDTH, size);
+    HAL_WRITE32(DMA_CPU_WE, write_enable);
+    HAL_WRITE32(DMA_CPU_STB, 1);
+    TRACE_EVENT(TRACE_DMA_START, address, size, write_enable);
 }
 
 /**
@@ -40,9 +45,14 @@ inline void _grant_dma_access(uint32_t address, uint32_t size, uint32_t write_en
  */
 inline void _wait_for_dma()
 {
-    while (*((volatile uint32_t *)DMA_ACK) == 0)
+    PROFILE_BEGIN(mark);
+    STATS_INC(dma_waits);
+    while (HAL_READ32(DMA_ACK) == 0)
     {
+        STATS_INC(dma_wait_polls);
     }
+    PROFILE_END(mark, PROFILE_DMA_WAIT);
+    TRACE_EVENT(TRACE_DMA_ACK, 1, 0, 0);
 }
 
 /**
@@ -51,9 +61,9 @@ inline void _wait_for_dma()
  */
 inline int _check_dma_busy()
 {
-    if (*((volatile uint32_t *)DMA_CPU_STB) == 1)
+    if (HAL_READ32(DMA_CPU_STB) == 1)
     {
-        return *((volatile uint32_t *)DMA_CPU_WE) + 1;
+        return HAL_READ32(DMA_CPU_WE) + 1;
     }
     return 0;
 }
@@ -63,10 +73,11 @@ inline int _check_dma_busy()
  */
 inline int _check_dma_ack()
 {
-    int res = *((volatile uint32_t *)DMA_ACK);
+    int res = HAL_READ32(DMA_ACK);
     if (res == 1)
     {
-        *((volatile uint32_t *)DMA_CPU_STB) = 0;
+        HAL_WRITE32(DMA_CPU_STB, 0);
+        TRACE_EVENT(TRACE_DMA_ACK, 0, 0, 0);
     }
     return res;
 }
@@ -77,7 +88,7 @@ inline int _check_dma_ack()
  */
 inline int _get_dma_data_width()
 {
-    return *((volatile uint32_t *)DMA_DATA_WIDTH);
+    return HAL_READ32(DMA_DATA_WIDTH);
 }
 
 #endif // _DMA_H_
\ No newline at end of file
@@ -0,0 +1,99 @@
+#ifndef _FIB_H_
+#define _FIB_H_
+
+#include "stdint.h"
+#include "ip6.h"
+
+/*
+ * The routes of memory_rte are not all put into the tries: a route is hidden
+ * when the longest route above it in the tries has the same slot, since the
+ * addresses it covers are forwarded the same way without it. Hidden routes
+ * are kept in a pool chained by buckets of their prefix, and by buckets
+ * of the route they are hidden behind (their anchor), so that they are put
+ * back into the tries as soon as their anchor goes away or changes slot.
+ * Routes are put into the tries before the ones they are hidden behind are
+ * removed, so forwarding never misses them. A route that must be put back
+ * while the tries are full stays hidden without anchor, see fib_retry().
+ * A withdrawn route is kept in the same pool without slot, so its prefix is
+ * still found while it is advertised as unreachable, see fib_withdraw().
+ * Only nested routes are hidden: merging siblings would need a copy of the
+ * whole table, which does not fit into the SRAM with memory_rte.
+ * The routes of a slot are found through a bitmap per slot of the chunks of
+ * FIB_CHUNK routes that may hold some, rather than lists of routes, which
+ * would not fit either. A chunk is marked when a route in it gets the slot,
+ * and unmarked by fib_chunk_sync() once none has it any more.
+ */
+#define NUM_FIB_HIDDEN 8192    // hidden routes, the others are put into the tries
+#define NUM_FIB_BUCKET 2048    // power of 2
+#define FIB_CHUNK 256          // routes of memory_rte behind a bit of the index of slots, see fib_next_chunk()
+
+struct fib_hidden
+{
+    int mem_id;           // index of the route in memory_rte
+    int anchor;           // the route it is hidden behind, 0 if it could not be put back, -1 if withdrawn
+    uint16_t next;        // next in the bucket of its prefix, 0 at the end
+    uint16_t next_anchor; // next in the bucket of its anchor, 0 at the end
+};
+
+/**
+ * @brief Find a route.
+ * @param slot Set to the slot of the route if it is found, 31 if it is withdrawn, may be NULL.
+ * @return The index of the route in memory_rte, 0 if there is none.
+ */
+int fib_lookup(struct ip6_addr *prefix, uint8_t prefix_len, uint32_t *slot);
+
+/**
+ * @brief The slot of a route, 31 if it is not in the table.
+ * @note The slot of each route is kept apart, the route is not looked up.
+ */
+uint32_t fib_slot(int mem_id);
+
+/**
+ * @brief Add a route, its prefix must be set in memory_rte already.
+ * @param slot The slot, the reference taken for it goes to the route.
+ * @return 0 on success, -1 if the tries are full.
+ */
+int fib_insert(int mem_id, uint32_t slot);
+
+/**
+ * @brief Point a route to another slot.
+ * @note The reference to the old slot is left to the caller, see fib_slot().
+ */
+void fib_modify(int mem_id, uint32_t slot);
+
+/**
+ * @brief Remove a route.
+ * @note The reference to its slot is left to the caller, see fib_slot().
+ */
+void fib_delete(int mem_id);
+
+/**
+ * @brief Stop forwarding through a route, but keep it to be found by its prefix.
+ * @note The reference to its slot is left to the caller, see fib_slot(). It
+ *  gets a slot again with fib_insert(), and is removed with fib_delete().
+ * @return 0 on success, -1 if the pool is full, the route is left as it is.
+ */
+int fib_withdraw(int mem_id);
+
+/**
+ * @brief The next chunk that may hold routes of some slots.
+ * @param slots Bit s: look for the routes of slot s.
+ * @param chunk The first chunk to look at.
+ * @return The chunk, its routes are from FIB_CHUNK * chunk on, -1 if there is none.
+ */
+int fib_next_chunk(uint32_t slots, int chunk);
+
+/**
+ * @brief Unmark a chunk for the slots none of its routes has any more.
+ */
+void fib_chunk_sync(int chunk);
+
+/**
+ * @brief Place again the hidden routes that did not fit into the tries.
+ * @note Does nothing unless routes left the tries since the last call, so it
+ *  is cheap enough to be called whenever the main loop is idle.
+ * @return The number of routes placed.
+ */
+int fib_retry();
+
+#endif // _FIB_H_
@@ -0,0 +1,67 @@
+#ifndef _FILTER_H_
+#define _FILTER_H_
+
+#include "stdint.h"
+#include "ip6.h"
+
+/*
+ * Ingress prefix-list: the routes of the responses are checked against a list
+ * of permit/deny rules, the first rule that matches a route decides, and the
+ * routes no rule matches are denied. A rule matches the routes below its
+ * prefix whose length is in [ge, le].
+ * The list is compiled into a tree bitmap of 4-bit strides: a node has a bitmap
+ * of the rule prefixes inside its 4 bits and a bitmap of its children, which
+ * are stored next to each other. Every rule prefix gets the bitmap of the
+ * lengths permitted below it, from its rules and the ones above it, so a route
+ * is decided by the longest rule prefix above it. Checking a route walks down
+ * at most one node per 4 bits of its length, whatever the number of rules.
+ */
+#define NUM_FILTER_RULE 1024
+#define NUM_FILTER_NODE 4096
+#define NUM_FILTER_DECISION 256 // distinct bitmaps of permitted lengths
+
+struct filter_rule
+{
+    struct ip6_addr prefix;
+    uint8_t prefix_len;
+    uint8_t ge;
+    uint8_t le;
+    uint8_t permit;
+};
+
+struct filter_node
+{
+    uint16_t internal;    // bit (1 << k) - 1 + b: a rule prefix of k more bits b
+    uint16_t external;    // bit v: a child for the next 4 bits v
+    uint16_t child_base;  // the first child in filter_nodes
+    uint16_t result_base; // the decision of the first rule prefix in filter_results
+};
+
+/**
+ * @brief Append a rule to the prefix-list.
+ * @param prefix The prefix, the bits past prefix_len are ignored.
+ * @param prefix_len The length of the prefix.
+ * @param ge The shortest length matched, 0 for prefix_len.
+ * @param le The longest length matched, 0 for prefix_len, or 128 if ge is set.
+ * @param permit 1 to permit the routes matched, 0 to deny them.
+ * @note The rule takes effect with the next filter_compile().
+ * @return 0 on success, -1 if the list is full or the lengths are wrong.
+ */
+int filter_add(struct ip6_addr *prefix, uint8_t prefix_len, uint8_t ge, uint8_t le, uint8_t permit);
+
+/**
+ * @brief Compile the prefix-list.
+ * @note If the tree is too large, the rules added since the last list compiled
+ *  are dropped and that list stays in effect. Without such a list, every route
+ *  is denied until a list is compiled. Counted in filter_overflows, see stats.h.
+ * @return 0 on success, -1 if the tree is too large.
+ */
+int filter_compile();
+
+/**
+ * @brief Whether a route passes the prefix-list.
+ * @return 1 if it is permitted, or if the list is empty, 0 otherwise.
+ */
+int filter_permit(struct ip6_addr *prefix, uint8_t prefix_len);
+
+#endif // _FILTER_H_
@@ -0,0 +1,130 @@
+#ifndef _HAL_H_
+#define _HAL_H_
+
+#include "stdint.h"
+
+/*
+ * Hardware access of the firmware: the registers, the DMA blocks in the SRAM,
+ * the trie BRAM and the byte swaps. Built for the router (RV32), they are
+ * accessed in place. Built for the host, the registers and the DMA blocks are
+ * arrays of hal_host.c and the trie BRAM is mapped at its address by
+ * hal_host_init(), so that the control plane runs natively.
+ */
+#ifdef RV32
+#define HAL_READ32(addr)        (*(volatile uint32_t *)(addr))
+#define HAL_WRITE32(addr, data) (*(volatile uint32_t *)(addr) = (data))
+#define HAL_READ8(addr)         (*(volatile uint8_t *)(addr))
+#define HAL_WRITE8(addr, data)  (*(volatile uint8_t *)(addr) = (data))
+#define HAL_PTR(addr)           ((void *)(addr))
+#else
+#ifdef __cplusplus
+extern "C" {
+#endif
+uint32_t hal_read32(uint32_t addr);
+void hal_write32(uint32_t addr, uint32_t data);
+uint8_t hal_read8(uint32_t addr);
+void hal_write8(uint32_t addr, uint8_t data);
+void *hal_ptr(uint32_t addr);
+
+/**
+ * @brief Map the trie BRAM and reset the registers, before anything else runs.
+ * @return 0 on success, -1 if the BRAM window cannot be mapped.
+ */
+int hal_host_init();
+
+#define HAL_BRAM_BASE 0x20000000 // the trie BRAM window mapped by hal_host_init()
+#define HAL_BRAM_SIZE 0x10000000
+
+/**
+ * @brief Called with every packet the DMA sends, if set.
+ * @param port The port of the packet.
+ * @param data The packet, from the padding of its Ethernet header.
+ * @param length The length of the packet.
+ */
+extern void (*hal_host_tx)(uint32_t port, const uint8_t *data, uint32_t length);
+
+/**
+ * @brief Called whenever the firmware reads DMA_IN_VALID, once per turn of the
+ *  main loop while the DMA is idle, if set. It may hand the next packet to the
+ *  DMA, or move mtime.
+ */
+extern void (*hal_host_poll)();
+
+/**
+ * @brief Called with every byte the firmware sends to the UART, if set.
+ *  Else the bytes go to stderr, so that they do not mix with the output of the tools.
+ */
+extern void (*hal_host_uart)(uint8_t data);
+
+#define HAL_RX_SIZE 2048 // the largest packet hal_host_rx() takes
+
+/**
+ * @brief Hand a packet to the DMA, as if it was received.
+ * @note The packet is written to DMA_BLOCK_WADDR once the firmware grants the DMA access.
+ * @return 0 on success, -1 if the previous packet was not taken yet.
+ */
+int hal_host_rx(uint32_t port, const uint8_t *data, uint32_t length);
+#ifdef __cplusplus
+}
+#endif
+#define HAL_READ32(addr)        hal_read32((uint32_t)(uintptr_t)(addr))
+#define HAL_WRITE32(addr, data) hal_write32((uint32_t)(uintptr_t)(addr), (data))
+#define HAL_READ8(addr)         hal_read8((uint32_t)(uintptr_t)(addr))
+#define HAL_WRITE8(addr, data)  hal_write8((uint32_t)(uintptr_t)(addr), (data))
+#define HAL_PTR(addr)           hal_ptr((uint32_t)(uintptr_t)(addr))
+#endif
+
+#ifdef RV32
+#define __REVS(x)                              \
+    asm volatile("mv a0, %0" ::"r"(x) : "a0"); \
+    asm volatile(".word 0x68855513" ::: "a0") // grevi a0, a0, 01000
+#define __REVL(x)                              \
+    asm volatile("mv a0, %0" ::"r"(x) : "a0"); \
+    asm volatile(".word 0x69855513" ::: "a0") // grevi a0, a0, 11000
+#define __BREV8(x)                             \
+    asm volatile("mv a0, %0" ::"r"(x) : "a0"); \
+    asm volatile(".word 0x68755513" ::: "a0") // brev8 a0, a0
+#endif
+
+// Without RV32, plain C versions are used instead of the B extension
+inline uint32_t brev8(uint32_t x)
+{
+#ifdef RV32
+    __BREV8(x);
+    uint32_t ret;
+    asm volatile("mv %0, a0" : "=r"(ret) : :);
+    return ret;
+#else
+    x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+    x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+    x = ((x >> 4) & 0x0f0f0f0f) | ((x & 0x0f0f0f0f) << 4);
+    return x;
+#endif
+}
+
+inline uint32_t htonl(uint32_t hostlong)
+{
+#ifdef RV32
+    __REVL(hostlong);
+    uint32_t ret;
+    asm volatile("mv %0, a0" : "=r"(ret) : :);
+    return ret;
+#else
+    return __builtin_bswap32(hostlong);
+#endif
+}
+
+inline uint16_t htons(uint16_t hostshort)
+{
+#ifdef RV32
+    uint32_t extended = (uint32_t)hostshort;
+    uint32_t ret;
+    __REVS(extended);
+    asm volatile("mv %0, a0" : "=r"(ret) : :);
+    return (uint16_t)ret;
+#else
+    return __builtin_bswap16(hostshort);
+#endif
+}
+
+#endif // _HAL_H_
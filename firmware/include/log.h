@@ -0,0 +1,52 @@
+#ifndef _LOG_H_
+#define _LOG_H_
+
+#include "trace.h"
+
+/*
+ * Deferred logging: LOG() records the id of a message and its 2 arguments as
+ * a TRACE_LOG event, without formatting anything or waiting for the UART, and
+ * trace_poll() sends it from the idle loop. trace.py formats the messages
+ * with the table below. The messages below LOG_LEVEL (make LOG_LEVEL=...)
+ * are compiled out. Without TRACE, every message is.
+ */
+#define LOG_DEBUG 0
+#define LOG_INFO 1
+#define LOG_WARN 2
+#define LOG_ERROR 3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_INFO
+#endif
+
+// X(id, level, format), the format takes at most 2 of %u, %d and %x
+#define LOG_MESSAGES(X)                                                                  \
+    X(LOG_VC_STAGE_FULL, LOG_WARN, "VC trie stage %u is full")                           \
+    X(LOG_VC_EXCESSIVE, LOG_DEBUG, "a /%u prefix did not fit into the VC trie, spilled") \
+    X(LOG_TRIE_MODIFY, LOG_DEBUG, "TrieModify of entry %d, next hop %u")
+
+enum LogId
+{
+#define LOG_ID(id, level, format) id,
+    LOG_MESSAGES(LOG_ID)
+#undef LOG_ID
+    LOG_ID_NUM
+};
+
+enum LogIdLevel
+{
+#define LOG_ID_LEVEL(id, level, format) id##_LEVEL = level,
+    LOG_MESSAGES(LOG_ID_LEVEL)
+#undef LOG_ID_LEVEL
+};
+
+#define LOG(id, a0, a1)                               \
+    do                                                \
+    {                                                 \
+        if (id##_LEVEL >= LOG_LEVEL)                  \
+        {                                             \
+            TRACE_EVENT(TRACE_LOG, (id), (a0), (a1)); \
+        }                                             \
+    } while (0)
+
+#endif // _LOG_H_
@@ -4,27 +4,41 @@
 #include <stdint.h>
 #include <packet.h>
 #include <ip6.h>
+#include <hal.h>
 
 #define IP_CONFIG_BASE_ADDR 0x40000000
 #define MAC_CONFIG_BASE_ADDR 0x40001000
+#define LINK_STATUS_ADDR 0x40002000 // bit i: port i is up (RO)
 #define NEXTHOP_TABLE_BASE_ADDR 0x41000000
 #define NEXTHOP_TABLE_PORT_ID_BASE_ADDR 0x41001000
-
+#define NEXTHOP_TABLE_GROUP_BASE_ADDR 0x41002000
+
+/*
+ * RAM budget: the image must end below the DMA buffers at 0x807C0000, 7936 KB
+ * above the RAM base, which linker.ld checks:
+ *  - memory_rte, rte_map and the slot of each route (fib.c): 6042 KB;
+ *  - the pools of backup paths, hidden routes, damping penalties, filters and
+ *    trie spills, sized in their headers: 512 KB at most together;
+ *  - the code, the packet buffers and the other tables: about 256 KB.
+ * The rest is headroom. Every byte kept per route costs 225 KB, so state of
+ * a few routes goes into a pool rather than an array indexed by route.
+ */
 #define NUM_MEMORY_RTE 230000
-#define NUM_TRIE_NODE 330001
+#define NUM_TRIE_NODE 339265 // VC entries, then 16 BT levels of 2048 entries, then the default route
 #define NEXTHOP_TABLE_INDEX_NUM 32
 
 #define IP_CONFIG_ADDR(i)               (IP_CONFIG_BASE_ADDR + ((i) << 8))
 #define MAC_CONFIG_ADDR(i)              (MAC_CONFIG_BASE_ADDR + ((i) << 8))
 #define NEXTHOP_TABLE_ADDR(i)           (NEXTHOP_TABLE_BASE_ADDR + ((i) << 4))
 #define NEXTHOP_TABLE_PORT_ID_ADDR(i)   (NEXTHOP_TABLE_PORT_ID_BASE_ADDR + ((i) << 4))
+#define NEXTHOP_TABLE_GROUP_ADDR(i)     (NEXTHOP_TABLE_GROUP_BASE_ADDR + ((i) << 4))
 
 struct memory_rte
 {
     struct ip6_addr ip6_addr;
     uint8_t prefix_len;
     uint8_t metric; // == 16 ? timer = GC timer : Timeout timer
-    uint8_t nexthop_port; // Upper 1 bit: valid; Second 1 bit: is_direct_route; Lower 2 bits: port number
+    uint8_t nexthop_port; // Upper 1 bit: valid; Second 1 bit: is_direct_route; Third 1 bit: changed, see mark_changed(); Lower 2 bits: port number
     uint8_t lower_timer;
 };
 
@@ -38,7 +52,7 @@ inline void write_ip_addr(struct ip6_addr *ip_addr, uint32_t base_addr)
 {
     for (int i = 0; i < 4; i++)
     {
-        *((volatile uint32_t *)(base_addr + (i << 2))) = ip_addr->s6_addr32[i];
+        HAL_WRITE32(base_addr + (i << 2), ip_addr->s6_addr32[i]);
     }
 }
 
@@ -53,7 +67,7 @@ inline struct ip6_addr read_ip_addr(uint32_t base_addr)
     struct ip6_addr ip_addr;
     for (int i = 0; i < 4; i++)
     {
-        ip_addr.s6_addr32[i] = *((volatile uint32_t *)(base_addr + (i << 2)));
+        ip_addr.s6_addr32[i] = HAL_READ32(base_addr + (i << 2));
     }
     return ip_addr;
 }
@@ -66,8 +80,8 @@ inline struct ip6_addr read_ip_addr(uint32_t base_addr)
  */
 inline void write_mac_addr(struct ether_addr *mac_addr, uint32_t base_addr)
 {
-    *((volatile uint32_t *)(base_addr)) = mac_addr->ether_addr16[0] | (mac_addr->ether_addr16[1] << 16);
-    *((volatile uint32_t *)(base_addr + 4)) = mac_addr->ether_addr16[2];
+    HAL_WRITE32(base_addr, mac_addr->ether_addr16[0] | (mac_addr->ether_addr16[1] << 16));
+    HAL_WRITE32(base_addr + 4, mac_addr->ether_addr16[2]);
 }
 
 /**
@@ -79,9 +93,9 @@ inline void write_mac_addr(struct ether_addr *mac_addr, uint32_t base_addr)
 inline struct ether_addr read_mac_addr(uint32_t base_addr)
 {
     struct ether_addr mac_addr;
-    mac_addr.ether_addr16[0] = *((volatile uint32_t *)(base_addr));
-    mac_addr.ether_addr16[1] = *((volatile uint32_t *)(base_addr)) >> 16;
-    mac_addr.ether_addr16[2] = *((volatile uint32_t *)(base_addr + 4));
+    mac_addr.ether_addr16[0] = HAL_READ32(base_addr);
+    mac_addr.ether_addr16[1] = HAL_READ32(base_addr) >> 16;
+    mac_addr.ether_addr16[2] = HAL_READ32(base_addr + 4);
     return mac_addr;
 }
 
@@ -95,7 +109,7 @@ inline struct ether_addr read_mac_addr(uint32_t base_addr)
 inline void write_nexthop_table_ip6_addr(struct ip6_addr *ip_addr, uint32_t base_addr){
     for (int i = 0; i < 4; i++)
     {
-        *((volatile uint32_t *)(base_addr + (i << 2))) = ip_addr->s6_addr32[i];
+        HAL_WRITE32(base_addr + (i << 2), ip_addr->s6_addr32[i]);
     }
 }
 
@@ -110,7 +124,7 @@ inline struct ip6_addr read_nexthop_table_ip6_addr(uint32_t base_addr){
     struct ip6_addr ip_addr;
     for (int i = 0; i < 4; i++)
     {
-        ip_addr.s6_addr32[i] = *((volatile uint32_t *)(base_addr + (i << 2)));
+        ip_addr.s6_addr32[i] = HAL_READ32(base_addr + (i << 2));
     }
     return ip_addr;
 }
@@ -122,7 +136,7 @@ inline struct ip6_addr read_nexthop_table_ip6_addr(uint32_t base_addr){
  *
  */
 inline void write_nexthop_table_port_id(uint32_t port_id, uint32_t base_addr){
-    *((volatile uint32_t *)(base_addr)) = port_id;
+    HAL_WRITE32(base_addr, port_id);
 }
 
 /**
@@ -132,7 +146,17 @@ inline void write_nexthop_table_port_id(uint32_t port_id, uint32_t base_addr){
  *
  */
 inline uint32_t read_nexthop_table_port_id(uint32_t base_addr){
-    return *((volatile uint32_t *)(base_addr));
+    return HAL_READ32(base_addr);
+}
+
+/**
+ * @brief Write an ECMP group to the next hop table
+ * @param group Member i in bits [5i+4:5i], the number of members in bits [22:20], 0 if not a group
+ * @param base_addr Base address of the memory
+ *
+ */
+inline void write_nexthop_table_group(uint32_t group, uint32_t base_addr){
+    HAL_WRITE32(base_addr, group);
 }
 
 #endif // _MEMORY_H_
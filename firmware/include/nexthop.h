@@ -0,0 +1,163 @@
+#ifndef _NEXTHOP_H_
+#define _NEXTHOP_H_
+
+#include "stdint.h"
+#include "ip6.h"
+
+/*
+ * Next hops are resolved in two steps:
+ *  - the tries hold a slot of the hardware next hop table (5 bits, the width of
+ *    the trie entries), which the pipeline resolves to (ip6, port);
+ *  - the firmware keeps a larger table of neighbors, and binds a neighbor to a
+ *    slot only while some route uses it.
+ * The firmware thus knows up to NUM_NEXTHOP neighbors, but the data plane
+ * forwards to at most 25 next hops or groups at once (slots 6 ~ 30). A wider
+ * index is not done: it changes the VC entries (38 bits) and the BT nodes (36
+ * bits, a full BRAM word), the BRAM width of every level, the adapter of the
+ * hardware table and the trie writers. While every slot is in use, a new route
+ * through a neighbor without slot is refused (nexthop_full), and learned again
+ * from its next response.
+ * Slots are reference counted by the routes in the tries, so a slot is never
+ * reused while a prefix still points to it. Rewriting a slot moves every prefix
+ * that uses it to another neighbor at once.
+ *
+ * A slot can also hold an ECMP group: the pipeline picks one of the member
+ * slots by the flow hash of the packet. A group holds a reference to the slot
+ * of each member, and is shared by the routes with the same members.
+ */
+#define NUM_NEXTHOP 256         // neighbors known to the firmware
+#define NEXTHOP_SLOT_BASE 6     // slots below are reserved
+#define NEXTHOP_SLOT_END 31     // a trie entry with next hop 31 is invalid
+#define NEXTHOP_GROUP_SIZE 4    // members of an ECMP group
+
+struct nexthop
+{
+    struct ip6_addr ip6_addr;
+    uint8_t port;
+    uint8_t valid;
+    uint8_t slot; // 0: not in the hardware table
+    uint8_t heard; // lower bits of mtime, when the neighbor last sent a response
+    uint8_t alive; // 0: never heard, timed out, or its port is down
+    uint8_t warned; // it has more routes than the warning threshold of its port, see config_max_prefix()
+    uint8_t held_down; // 1: torn down by the prefix limit of its port, see nexthop_hold_down()
+    uint8_t held; // lower bits of mtime, when it was held down
+    uint16_t holds; // backup paths through the neighbor, see backup.h
+    uint32_t responses; // responses received
+    uint32_t flushes; // times its routes were withdrawn at once
+    uint32_t rejected; // new routes refused by the prefix limits
+};
+
+/**
+ * @brief Forget all neighbors and free all slots.
+ */
+void nexthop_init();
+
+/**
+ * @brief Find a neighbor, or add it.
+ * @note A neighbor without slot nor hold may be evicted to make room.
+ * @return The neighbor id, -1 if the table is full of neighbors in use.
+ */
+int nexthop_get(struct ip6_addr *ip6_addr, uint8_t port);
+
+/**
+ * @brief Keep a neighbor in the table while a backup path goes through it.
+ */
+void nexthop_hold(int neighbor);
+
+/**
+ * @brief Drop a hold taken by nexthop_hold().
+ */
+void nexthop_unhold(int neighbor);
+
+/**
+ * @brief Take a reference to the slot of a neighbor, binding one if needed.
+ * @note Call once for every route that is inserted into the tries with the slot.
+ * @return The slot, -1 if every slot is in use.
+ */
+int nexthop_acquire(int neighbor);
+
+/**
+ * @brief Take a reference to the slot of an ECMP group, binding one if needed.
+ * @param neighbors The members, a single member is the slot of the neighbor.
+ * @param num The number of members, at most NEXTHOP_GROUP_SIZE.
+ * @return The slot, -1 if every slot is in use.
+ */
+int nexthop_acquire_group(int *neighbors, int num);
+
+/**
+ * @brief Drop a reference to a slot, the slot is freed with its last route.
+ */
+void nexthop_release(int slot);
+
+/**
+ * @brief Move every route using a slot to another neighbor, by rewriting the slot.
+ * @note The slot must not be a group, the neighbor must not have a slot of its own.
+ * @return 0 on success, -1 otherwise.
+ */
+int nexthop_move(int slot, int neighbor);
+
+/**
+ * @brief The neighbor bound to a slot, -1 if the slot is free or a group.
+ */
+int nexthop_slot_neighbor(int slot);
+
+/**
+ * @brief The neighbors a slot forwards to.
+ * @param neighbors Filled with up to NEXTHOP_GROUP_SIZE neighbor ids.
+ * @return The number of neighbors, 0 if the slot is free.
+ */
+int nexthop_members(int slot, int *neighbors);
+
+/**
+ * @brief Take a reference to the slot forwarding to the members of a slot and one more neighbor.
+ * @return The slot, -1 if the neighbor is a member already, the group is full, or every slot is in use.
+ */
+int nexthop_add_member(int slot, int neighbor);
+
+/**
+ * @brief Take a reference to the slot forwarding to the members of a slot but one.
+ * @return The slot, -1 if the neighbor is not a member, the only member, or every slot is in use.
+ */
+int nexthop_remove_member(int slot, int neighbor);
+
+/**
+ * @brief Record that a neighbor sent a response.
+ */
+void nexthop_heard(int neighbor);
+
+/**
+ * @brief Whether a neighbor is heard and its port is up.
+ */
+int nexthop_alive(int neighbor);
+
+/**
+ * @brief Take a neighbor down, and drop it from every group.
+ * @note The groups are rewritten in place, which moves all their routes at once.
+ *  A group keeps its last member, its routes are withdrawn with the others, see flush_neighbor().
+ */
+void nexthop_down(int neighbor);
+
+/**
+ * @brief Ignore a neighbor for HOLD_DOWN_TIME_LIMIT, after it was torn down.
+ * @note A neighbor held down is not evicted, so the hold-down is not lost.
+ */
+void nexthop_hold_down(int neighbor);
+
+/**
+ * @brief Whether a neighbor is held down, its responses must be ignored.
+ * @note The hold-down ends here once HOLD_DOWN_TIME_LIMIT is over.
+ */
+int nexthop_held_down(int neighbor);
+
+/**
+ * @brief Take down a neighbor that timed out.
+ * @return The neighbor, -1 if none timed out.
+ */
+int nexthop_expire();
+
+/**
+ * @brief The number of routes through a neighbor, groups excluded.
+ */
+int nexthop_routes(int neighbor);
+
+#endif // _NEXTHOP_H_
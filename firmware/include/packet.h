@@ -6,23 +6,13 @@
 #include "udp.h"
 #include "ripng.h"
 #include "ether.h"
+#include "hal.h" // brev8, htonl, htons
 
 #define MTU 1500
 #define RIPNG_MAX_RTE_NUM 71
 #define RIPNG_MAX_RTE_LEN 1420
 #define PACKET_HDR_LEN 68
 
-#define __REVS(x)                              \
-    asm volatile("mv a0, %0" ::"r"(x) : "a0"); \
-    asm volatile(".word 0x68855513" ::: "a0") // grevi a0, a0, 01000
-#define __REVL(x)                              \
-    asm volatile("mv a0, %0" ::"r"(x) : "a0"); \
-    asm volatile(".word 0x69855513" ::: "a0") // grevi a0, a0, 11000
-#define __BREV8(x)                             \
-    asm volatile("mv a0, %0" ::"r"(x) : "a0"); \
-    asm volatile(".word 0x68755513" ::: "a0") // brev8 a0, a0
-
-
 // Packet header
 struct packet_hdr
 {
@@ -32,31 +22,6 @@ struct packet_hdr
     struct ripng_hdr ripng;
 };
 
-inline uint32_t brev8(uint32_t x)
-{
-    __BREV8(x);
-    uint32_t ret;
-    asm volatile("mv %0, a0" : "=r"(ret) : :);
-    return ret;
-}
-
-inline uint32_t htonl(uint32_t hostlong)
-{
-    __REVL(hostlong);
-    uint32_t ret;
-    asm volatile("mv %0, a0" : "=r"(ret) : :);
-    return ret;
-}
-
-inline uint16_t htons(uint16_t hostshort)
-{
-    uint32_t extended = (uint32_t)hostshort;
-    uint32_t ret;
-    __REVS(extended);
-    asm volatile("mv %0, a0" : "=r"(ret) : :);
-    return (uint16_t)ret;
-}
-
 inline uint32_t ntohl(uint32_t netlong)
 {
     return htonl(netlong);
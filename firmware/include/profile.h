@@ -0,0 +1,121 @@
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include "stdint.h"
+
+/*
+ * Sampling profiler, built with PROFILE (make EN_PROFILE=y). The machine timer
+ * interrupt records the interrupted PC, its return address and the stack depth
+ * every PROFILE_PERIOD mtime ticks, and the regions below count the mcycle and
+ * minstret spent in them. Needs a CPU with Zicsr and the timer interrupt, as
+ * QEMU (make sim). Once the sample ring is full, profile_poll() sends it on
+ * the UART from the idle loop, as far as the UART keeps up and between the
+ * frames of the trace and the console output, and recording resumes when all
+ * of it is out. profile.py symbolises the output against kernel.elf.
+ * The rate of mtime depends on the target: 10 MHz on QEMU virt (PROFILE_QEMU,
+ * make EN_QEMU=y), one tick per second on the board, whose timer only counts
+ * seconds. The board thus takes at most a sample per second, which fills the
+ * ring in about 17 minutes; the regions are counted in cycles on both.
+ */
+#ifndef PROFILE_PERIOD
+#ifdef PROFILE_QEMU
+#define PROFILE_PERIOD 10000 // mtime ticks, 1 ms on QEMU virt
+#else
+#define PROFILE_PERIOD 1 // mtime ticks, 1 s on the board
+#endif
+#endif
+#define PROFILE_SAMPLES 1024
+#define PROFILE_LINE_LEN 64 // a line of the dump, see profile_poll()
+#define PROFILE_STACK_TOP 0x80800000 // END_OF_STACK of reset_vector.S
+
+// The regions are inclusive: a trie call made by disassemble counts in both.
+enum ProfileRegion
+{
+    PROFILE_DISASSEMBLE,
+    PROFILE_ASSEMBLE,
+    PROFILE_SEND_RESPONSE,
+    PROFILE_TRIE_INSERT,
+    PROFILE_TRIE_LOOKUP,
+    PROFILE_TRIE_DELETE,
+    PROFILE_TRIE_MODIFY,
+    PROFILE_DMA_WAIT,
+    PROFILE_REGION_NUM
+};
+
+struct profile_sample
+{
+    uint32_t pc;
+    uint32_t ra;    // the caller, unless ra was already saved and reused
+    uint32_t depth; // bytes of stack in use
+};
+
+struct profile_region
+{
+    uint32_t calls;
+    uint32_t cycles_low; // 64 bits, as mtime
+    uint32_t cycles_high;
+    uint32_t instret_low;
+    uint32_t instret_high;
+};
+
+struct profile_mark
+{
+    uint32_t cycle;
+    uint32_t instret;
+};
+
+#ifdef PROFILE
+// csrr a0, mcycle / minstret, without requiring the assembler to know Zicsr
+#define __CSRR_MCYCLE() asm volatile(".word 0xB0002573" ::: "a0")
+#define __CSRR_MINSTRET() asm volatile(".word 0xB0202573" ::: "a0")
+
+inline uint32_t profile_cycle()
+{
+    uint32_t ret;
+    __CSRR_MCYCLE();
+    asm volatile("mv %0, a0" : "=r"(ret) : :);
+    return ret;
+}
+
+inline uint32_t profile_instret()
+{
+    uint32_t ret;
+    __CSRR_MINSTRET();
+    asm volatile("mv %0, a0" : "=r"(ret) : :);
+    return ret;
+}
+
+#define PROFILE_BEGIN(mark) struct profile_mark mark = {profile_cycle(), profile_instret()}
+#define PROFILE_END(mark, region) profile_end(&(mark), (region))
+
+/**
+ * @brief Add the cycles and instructions since PROFILE_BEGIN to a region.
+ */
+void profile_end(struct profile_mark *mark, enum ProfileRegion region);
+
+/**
+ * @brief Install the trap handler and start sampling.
+ * @note Call after the timers are initialized, it owns mtimecmp from then on.
+ */
+void profile_init();
+
+/**
+ * @brief Send the samples and the regions once the ring is full.
+ * @note Call from the idle loop when neither the trace nor the console is sending,
+ *       never waits for the UART.
+ */
+void profile_poll();
+
+/**
+ * @brief Whether a line of the dump is partly sent, the UART is then not free.
+ */
+int profile_sending();
+#else
+#define PROFILE_BEGIN(mark)
+#define PROFILE_END(mark, region)
+#define profile_init()
+#define profile_poll()
+#define profile_sending() 0
+#endif
+
+#endif // _PROFILE_H_
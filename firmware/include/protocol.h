@@ -7,6 +7,37 @@
 
 #define MULTICAST_ADDR {htonl(0xff020000), 0, 0, htonl(0x00000009)}
 #define PORT_NUM 4
+#define NUM_AGGREGATE 16
+#define NUM_CHANGED_ROUTE 4096 // changes tracked between periodic updates
+#define ROUTE_RESERVE 16384    // the last entries of memory_rte only go to the neighbors with few routes
+#define NEIGHBOR_RESERVE 1024  // routes a neighbor may always have, while memory_rte has room
+
+/*
+ * An aggregate prefix advertised on some ports instead of the routes it covers.
+ * The aggregate is advertised with the best metric of the routes it covers, as
+ * they would have been advertised on the port, and only if it covers some.
+ * Triggered updates carry the aggregate whenever its metric changes, and metric
+ * 16 once it covers no route any more.
+ */
+struct aggregate
+{
+    struct ip6_addr prefix;
+    struct ip6_addr mask;
+    uint8_t prefix_len;
+    uint8_t ports; // bit i: advertised on port i
+};
+
+/*
+ * The number of routes a neighbor may put into the routing table, for the
+ * neighbors on a port. New routes past the limit are refused, or the neighbor
+ * is torn down and its routes withdrawn.
+ */
+struct prefix_limit
+{
+    uint32_t max; // 0: no limit
+    uint8_t warning; // percent of max, the neighbors past it are flagged
+    uint8_t teardown;
+};
 
 /**
  * @brief Put a direct route into the routing table.
@@ -17,6 +48,24 @@
  */
 void config_direct_route(struct ip6_addr *ip6_addr, uint8_t prefix_len, uint8_t port);
 
+/**
+ * @brief Advertise an aggregate prefix instead of the routes it covers.
+ * @param prefix The aggregate prefix.
+ * @param prefix_len The prefix length of the aggregate.
+ * @param ports The ports it is advertised on, bit i for port i.
+ * @return 0 on success, -1 if there are NUM_AGGREGATE aggregates already.
+ */
+int config_aggregate(struct ip6_addr *prefix, uint8_t prefix_len, uint8_t ports);
+
+/**
+ * @brief Limit the number of routes of each neighbor on a port.
+ * @param port The port.
+ * @param max The number of routes, 0 for no limit.
+ * @param warning The percent of max past which a neighbor is flagged.
+ * @param teardown Take down a neighbor that goes past max, instead of refusing its new routes.
+ */
+void config_max_prefix(uint8_t port, uint32_t max, uint8_t warning, uint8_t teardown);
+
 /**
  * @brief Update one memory_rte's validation by checking its timers.
  * @param memory_rte_v The address of the rte.
@@ -25,6 +74,36 @@ void config_direct_route(struct ip6_addr *ip6_addr, uint8_t prefix_len, uint8_t
  */
 int update_memory_rte(void *memory_rte_v);
 
+/**
+ * @brief Check the timers of the next TIMER_SWEEP_BUDGET routes.
+ * @note Called when idle, so that a route expires within a second or so of its
+ *  timeout, whatever slice of the table the refresh is at. The routes that time
+ *  out go with the next unsolicited response.
+ */
+void sweep_timers();
+
+/**
+ * @brief Withdraw all routes through a neighbor.
+ * @param neighbor The neighbor id, see nexthop_get(), taken down already.
+ * @note Only its slots are marked here, the routes are withdrawn by flush_poll().
+ */
+void flush_neighbor(int neighbor);
+
+/**
+ * @brief Withdraw the routes marked by flush_neighbor(), a few chunks of memory_rte at a time.
+ * @note Called when idle. Only the chunks that hold routes of the slots are
+ *  walked, see fib_next_chunk(). The routes with a backup path fail over to
+ *  it, the others are poisoned. The changes are advertised as triggered updates.
+ * @return 1 if some routes are left to withdraw, 0 otherwise.
+ */
+int flush_poll();
+
+/**
+ * @brief Take down the neighbors on a port, and withdraw their routes.
+ * @param port The port that went down.
+ */
+void flush_port(uint8_t port);
+
 /**
  * @brief Disassemble the packet and check the correctness of the packet.
  * @param base_addr The base address of the packet.
@@ -61,6 +140,8 @@ int assemble(void *src_addr_v, void *dst_addr_v, void *entries_v, int num_entrie
  * @brief Send triggered update.
  * @note  This function will block until the whole routing table is sent.
  *  No multicast logic should be in and after this function.
+ *  The routes covered by an aggregate of the port are left out of the whole
+ *  table and of multicast entries, the aggregate is sent instead with the table.
  * @param src_addr_v The source address of the packet.
  * @param dst_addr_v The destination address of the packet.
  * @param entries_v The routing table entries.
@@ -73,7 +154,11 @@ void send_response(void *src_addr_v, void *dst_addr_v, void *entries_v, int num_
 
 /**
  * @brief Send unsolicited response.
- * @note  This function will block until the whole routing table is sent.
+ * @note  This function will block until the response is sent.
+ *  Only the routes that changed since the last call are sent, with a slice of
+ *  the table, so that every route is sent once every REFRESH_TIME_LIMIT.
+ *  The timers are checked apart, see sweep_timers().
+ *  The aggregates are sent with the last slice.
  * @author Jason Fu
  */
 void send_unsolicited_response();
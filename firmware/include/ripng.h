@@ -82,6 +82,9 @@ typedef enum
     // 解析 RIPng 时Trie报错
     // Trie error when processing RIPng
     ERR_TRIE,
+    // 邻居的路由数超过上限，邻居已被断开，或仍在抑制期内
+    // The neighbor went past its prefix limit and was torn down, or is still held down
+    ERR_PREFIX_LIMIT,
 } RipngErrorCode;
 
 #endif // _RIPNG_H_
@@ -0,0 +1,77 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include "stdint.h"
+
+/*
+ * Counters of the control plane, bumped with a single increment where the
+ * events happen. The console prints them, clears them, and sends them as a
+ * frame of 'S', 'T', the number of words (2 bytes), the words (little-endian)
+ * and the sum of their bytes, which stats.py decodes, see include/console.h.
+ */
+#define STATS_PORTS 4   // PORT_NUM
+#define STATS_ERRORS 13 // RipngErrorCode, SUCCESS counts the packets accepted
+
+// X(name, count), in the order of the dump
+#define STATS_COUNTERS(X)         \
+    X(rx_packets, STATS_PORTS)    \
+    X(rx_bytes, STATS_PORTS)      \
+    X(tx_packets, STATS_PORTS)    \
+    X(tx_bytes, STATS_PORTS)      \
+    X(errors, STATS_ERRORS)       \
+    X(routes_learned, 1)          \
+    X(routes_withdrawn, 1)        \
+    X(routes_expired, 1)          \
+    X(routes_deleted, 1)          \
+    X(trie_spills, 1)             \
+    X(bt_out_of_memory, 1)        \
+    X(nexthop_evictions, 1)       \
+    X(nexthop_full, 1)            \
+    X(filter_overflows, 1)        \
+    X(dma_waits, 1)               \
+    X(dma_wait_polls, 1)
+
+struct router_stats
+{
+#define STATS_FIELD(name, count) uint32_t name[count];
+    STATS_COUNTERS(STATS_FIELD)
+#undef STATS_FIELD
+};
+
+extern struct router_stats router_stats;
+
+#ifndef TRIE_SIM
+#define STATS_INC(name) (router_stats.name[0]++)
+#define STATS_INC_AT(name, i) (router_stats.name[i]++)
+#define STATS_ADD_AT(name, i, n) (router_stats.name[i] += (n))
+#else
+// The trie simulation builds the trie alone, without stats.c
+#define STATS_INC(name)
+#define STATS_INC_AT(name, i)
+#define STATS_ADD_AT(name, i, n)
+#endif
+
+#define STATS_WORDS (sizeof(struct router_stats) / sizeof(uint32_t))
+#define STATS_FRAME_LEN (4 * STATS_WORDS + 5)
+
+/**
+ * @brief Clear all counters.
+ */
+void stats_clear();
+
+/**
+ * @brief A counter of STATS_COUNTERS, for printing.
+ * @param i The counter, in the order of the table.
+ * @param name Set to its name.
+ * @param values Set to its values.
+ * @return The number of values, 0 past the last counter.
+ */
+int stats_counter(int i, const char **name, const uint32_t **values);
+
+/**
+ * @brief Write the counters as a binary frame.
+ * @param frame STATS_FRAME_LEN bytes.
+ */
+void stats_frame(uint8_t *frame);
+
+#endif // _STATS_H_
@@ -9,8 +9,8 @@ typedef unsigned char uint8_t;
 typedef unsigned short uint16_t;
 typedef unsigned int uint32_t;
 
-typedef int32_t intptr_t;
-typedef uint32_t uintptr_t;
+typedef __INTPTR_TYPE__ intptr_t;
+typedef __UINTPTR_TYPE__ uintptr_t;
 //typedef int32_t ptrdiff_t;
 //typedef uint32_t size_t;
 typedef int32_t ssize_t;
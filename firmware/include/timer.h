@@ -9,6 +9,18 @@
 
 #define GARBAGE_COLLECTION_TIME_LIMIT 60
 
+#define HOLD_DOWN_TIME_LIMIT 120 // a neighbor torn down by its prefix limit is ignored this long, below 256
+
+// Every route is advertised at least this often. The neighbors time a route
+// out after TIMEOUT_TIME_LIMIT, the refresh must reach them a tick before that.
+#ifndef REFRESH_TIME_LIMIT
+#define REFRESH_TIME_LIMIT 25
+#endif
+
+#if REFRESH_TIME_LIMIT < MULTICAST_TIME_LIMIT || REFRESH_TIME_LIMIT > TIMEOUT_TIME_LIMIT - MULTICAST_TIME_LIMIT
+#error "REFRESH_TIME_LIMIT must be within MULTICAST_TIME_LIMIT and TIMEOUT_TIME_LIMIT - MULTICAST_TIME_LIMIT"
+#endif
+
 
 #define MTIME_LADDR 0x0200BFF8    // lower 32 bits of mtime
 #define MTIMECMP_LADDR 0x02004000 // lower 32 bits of mtimecmp
@@ -0,0 +1,79 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include "stdint.h"
+
+/*
+ * Binary event trace, built with TRACE (make EN_TRACE=y, the default). An event
+ * is the mtime, its id and 3 arguments, stored into a ring of TRACE_ENTRIES,
+ * without formatting or waiting for the UART. trace_poll() sends the ring from
+ * the idle loop, one byte whenever the UART can take it. Each event goes out
+ * as a frame of 'T', 'R', the 20 bytes of the entry (little-endian) and their
+ * sum, so that trace.py finds the frames between the printf() output.
+ * When the ring is full, new events are dropped and counted by a TRACE_LOST.
+ */
+#define TRACE_ENTRIES 256 // a power of 2
+#define TRACE_FRAME_LEN 23
+
+// The order is the one of trace.py
+enum TraceEvent
+{
+    TRACE_LOST,         // count
+    TRACE_ROUTE_INSERT, // s6_addr32[0], s6_addr32[1], prefix_len | slot << 8 | failed << 31
+    TRACE_ROUTE_DELETE, // s6_addr32[0], s6_addr32[1], prefix_len | failed << 31
+    TRACE_TIMER_EXPIRE, // TraceTimer, the route or the neighbor
+    TRACE_DMA_START,    // address, size, write enable
+    TRACE_DMA_ACK,      // 1 if waited for
+    TRACE_RX,           // port, length
+    TRACE_TX,           // port, length, multicast
+    TRACE_ERROR,        // RipngErrorCode, port, length
+    TRACE_LOG,          // LogId and its 2 arguments, see include/log.h
+    TRACE_EVENT_NUM
+};
+
+enum TraceTimer
+{
+    TRACE_TIMER_ROUTE,     // the route timed out
+    TRACE_TIMER_GARBAGE,   // the route was deleted
+    TRACE_TIMER_NEIGHBOR,  // the neighbor went silent
+    TRACE_TIMER_MULTICAST, // the unsolicited response is due
+};
+
+struct trace_entry
+{
+    uint32_t time;  // lower 32 bits of mtime
+    uint32_t event; // TraceEvent
+    uint32_t args[3];
+};
+
+#ifdef TRACE
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Record an event, never waits.
+ */
+void trace_record(uint32_t event, uint32_t a0, uint32_t a1, uint32_t a2);
+
+/**
+ * @brief Send the recorded events over the UART, as long as it does not have to wait.
+ * @note Call from the idle loop.
+ */
+void trace_poll();
+
+/**
+ * @brief Whether a frame is partly sent, the UART must not be given other bytes meanwhile.
+ */
+int trace_sending();
+#ifdef __cplusplus
+}
+#endif
+#define TRACE_EVENT(event, a0, a1, a2) trace_record((event), (a0), (a1), (a2))
+#else
+#define TRACE_EVENT(event, a0, a1, a2)
+#define trace_poll()
+#define trace_sending() 0
+#endif
+
+#endif // _TRACE_H_
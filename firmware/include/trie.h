@@ -0,0 +1,159 @@
+#ifndef _TRIE_H_
+#define _TRIE_H_
+
+#include <stdint.h>
+#include <hal.h>
+#include <ip6.h>
+
+// Trie control registers, in the BT level 15 window (there is no BRAM behind it)
+#define TRIE_CTRL_BASE_ADDR 0x27800000
+#define TRIE_LOOKUP_IN_SEQ_ADDR  (TRIE_CTRL_BASE_ADDR + 0x0) // lookups entered the pipeline (RO)
+#define TRIE_LOOKUP_OUT_SEQ_ADDR (TRIE_CTRL_BASE_ADDR + 0x4) // lookups left the pipeline (RO)
+#define TRIE_BANK_ADDR           (TRIE_CTRL_BASE_ADDR + 0x8) // bank used by new lookups (RW)
+
+/*
+ * The tries hold two banks, each with its own roots: VC stage 0 nodes and BT
+ * level 0 entries 1 / 2 for bank 0, 3 / 4 for bank 1. All other nodes are
+ * shared, a node belongs to the bank it is reachable from. The firmware edits
+ * one bank while the pipeline reads the one selected by TRIE_BANK_ADDR.
+ */
+#define TRIE_BANK_ROOT(bank, lsb) (((bank) << 1) + 1 + (lsb))
+
+// Indices returned by TrieInsert: VC entries first, then the BTrie entries from here
+#define TRIE_BT_INDEX_BASE 306496
+
+/*
+ * Prefixes that did not fit into the VC trie and were spilled into the BTrie.
+ * They are kept (bit-reversed, as the tries see them) so that TrieRebalance
+ * can move them back into the VC trie once deletions free some bins.
+ */
+#define NUM_SPILL_ENTRY 4096
+
+struct spill_entry
+{
+    struct ip6_addr prefix;
+    int bt_index;
+    uint16_t next;  // next entry of the bucket of its BTrie index + 1, 0 at the end
+    uint8_t length;
+    uint8_t next_hop;
+    uint8_t valid;
+};
+
+/*
+ * Every store to the trie BRAM goes through TRIE_STORE, so that the stores
+ * reach the pipeline exactly in program order. The update protocol is:
+ *  - VC entry: publish by writing prefix, next hop, and the length last;
+ *    retire by writing the length first. The pipeline ignores an entry
+ *    whose length or next hop is 31.
+ *  - BT chain: build every new node first, then link the chain into the
+ *    trie with a single store.
+ *  - A change that spans several stages (e.g. moving a prefix between the
+ *    tries) calls TrieSync() between its steps.
+ * The simulator (trie/sim) defines TRIE_SIM to interleave lookups with stores.
+ */
+#ifdef TRIE_SIM
+#ifdef __cplusplus
+extern "C" {
+#endif
+void     TrieSimStore(uint32_t addr, uint32_t data);
+uint32_t TrieSimLoad(uint32_t addr);
+#ifdef __cplusplus
+}
+#endif
+#define TRIE_STORE(addr, data) (TRIE_COUNT(writes, addr), TrieSimStore((uint32_t)(uintptr_t)(addr), (data)))
+#define TRIE_LOAD(addr)        (TRIE_COUNT(reads, addr), TrieSimLoad((uint32_t)(uintptr_t)(addr)))
+#else
+#define TRIE_STORE(addr, data) (TRIE_COUNT(writes, addr), HAL_WRITE32(addr, data))
+#define TRIE_LOAD(addr)        (TRIE_COUNT(reads, addr), HAL_READ32(addr))
+#endif
+
+/*
+ * With TRIE_STATS (make EN_TRIE_STATS=y), every TRIE_LOAD / TRIE_STORE is
+ * counted, as the uncached bus accesses are what a trie update costs. The
+ * counters are split by the API call that made the access and by the BRAM
+ * it went to: BT levels 0 ~ 15, then VC stages 0 ~ 15, as in bits 27:23 of
+ * the address. The trie control registers count as BT level 15.
+ */
+#define TRIE_STATS_BRAMS 32
+#define TRIE_STATS_BRAM(addr) (((uint32_t)(uintptr_t)(addr) >> 23) & 0x1f)
+
+enum TrieOp
+{
+    TRIE_OP_OTHER,    // TrieInit, TrieSync and the callers of VCTrie / BTrie
+    TRIE_OP_INSERT,
+    TRIE_OP_LOOKUP,
+    TRIE_OP_DELETE,
+    TRIE_OP_MODIFY,
+    TRIE_OP_REBALANCE,
+    TRIE_OP_COMPACT,
+    TRIE_OP_NUM
+};
+
+struct trie_op_stats
+{
+    uint32_t calls;
+    uint32_t max_accesses;             // the most loads and stores made by one call
+    uint32_t reads[TRIE_STATS_BRAMS];  // indexed by TRIE_STATS_BRAM
+    uint32_t writes[TRIE_STATS_BRAMS];
+};
+
+#ifdef TRIE_STATS
+#ifdef __cplusplus
+extern "C" {
+#endif
+extern struct trie_op_stats trie_op_stats[TRIE_OP_NUM];
+extern struct trie_op_stats *trie_op;  // the counters of the call being made
+extern uint32_t trie_op_accesses;      // loads and stores of the call being made
+#ifdef __cplusplus
+}
+#endif
+#define TRIE_COUNT(kind, addr) (trie_op->kind[TRIE_STATS_BRAM(addr)]++, trie_op_accesses++)
+#else
+#define TRIE_COUNT(kind, addr) ((void)0)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/**
+ * @brief Called for every prefix found when walking a bank of the trie.
+ * @param prefix the prefix, in the bit order of the tries (brev8 applied)
+ * @param length the length of the prefix
+ * @param next_hop the index of the next hop table
+ * @param index the index of the entry, as returned by TrieInsert
+ */
+typedef void (*TrieVisitor)(void* prefix, uint32_t length, uint32_t next_hop, uint32_t index);
+
+extern struct spill_entry spill_entries[NUM_SPILL_ENTRY];
+extern int spill_top;    // all valid entries are below spill_top
+extern int spill_cursor; // next entry to be retried by TrieRebalance
+
+/**
+ * @brief Wait until every lookup that was in the pipeline when called has left it.
+ * @note After TrieSync returns, no lookup can observe the trie as it was
+ *  before the stores preceding the call.
+ */
+void TrieSync();
+
+/**
+ * @brief The occupancy of a BRAM, numbered as by TRIE_STATS_BRAM.
+ * @param capacity Set to the nodes the BRAM can hold.
+ * @return The nodes in use in a VC stage, the nodes up to the highest one
+ *  allocated in a BT level.
+ */
+uint32_t TrieBramNodes(int bram, uint32_t* capacity);
+
+/**
+ * @brief Clear the counters of TRIE_STATS.
+ */
+void TrieStatsClear();
+
+/**
+ * @brief Print the counters of TRIE_STATS, one line per API call and BRAM used.
+ */
+void TrieStatsReport();
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _TRIE_H_
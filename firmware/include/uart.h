@@ -5,14 +5,16 @@
 
 #define UART_BASE 0x10000000
 
-#define UART_THR (*(volatile uint8_t *)(UART_BASE + 0))
-#define UART_DLL (*(volatile uint8_t *)(UART_BASE + 0))
-#define UART_IER (*(volatile uint8_t *)(UART_BASE + 1))
-#define UART_DLM (*(volatile uint8_t *)(UART_BASE + 1))
-#define UART_FCR (*(volatile uint8_t *)(UART_BASE + 2))
-#define UART_LCR (*(volatile uint8_t *)(UART_BASE + 3))
-#define UART_MCR (*(volatile uint8_t *)(UART_BASE + 4))
-#define UART_LSR (*(volatile uint8_t *)(UART_BASE + 5))
+// Register addresses, accessed with HAL_READ8 / HAL_WRITE8
+#define UART_THR (UART_BASE + 0)
+#define UART_RBR (UART_BASE + 0)
+#define UART_DLL (UART_BASE + 0)
+#define UART_IER (UART_BASE + 1)
+#define UART_DLM (UART_BASE + 1)
+#define UART_FCR (UART_BASE + 2)
+#define UART_LCR (UART_BASE + 3)
+#define UART_MCR (UART_BASE + 4)
+#define UART_LSR (UART_BASE + 5)
 
 // LSR 寄存器的定义
 #define COM_LSR_FIFOE 0x80          /* Fifo error */
@@ -39,4 +41,16 @@
 
 void init_uart(void);
 
+/**
+ * @brief Send a character if the UART can take it now.
+ * @return 1 if sent, 0 if the UART is busy.
+ */
+int _trychar(char ch);
+
+/**
+ * @brief Read a character if one was received.
+ * @return The character, or -1 if there is none.
+ */
+int _trygetchar();
+
 #endif
@@ -0,0 +1,17 @@
+#ifndef _VALIDATE_H_
+#define _VALIDATE_H_
+
+#include "stdint.h"
+#include "ripng.h"
+
+/**
+ * @brief Check the entries of a RIPng packet, before any of them is used.
+ * @note A whole packet is checked word by word without branches per entry, the
+ *  entries are checked one by one only to find the error of a bad packet.
+ * @param entries The entries.
+ * @param num_entries The number of entries.
+ * @return SUCCESS, or the error of the first bad entry.
+ */
+RipngErrorCode validate_entries(struct ripng_rte *entries, int num_entries);
+
+#endif // _VALIDATE_H_
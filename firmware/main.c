@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <uart.h>
 #include <dma.h>
+#include <hal.h>
 #include <ip6.h>
 #include <ripng.h>
 #include <udp.h>
@@ -10,6 +11,13 @@
 #include <timer.h>
 #include <memory.h>
 #include <protocol.h>
+#include <nexthop.h>
+#include <fib.h>
+#include <filter.h>
+#include <profile.h>
+#include <trace.h>
+#include <stats.h>
+#include <console.h>
 
 // Configurate the MAC and IP addresses
 struct ip6_addr ip_addrs[PORT_NUM] = {
@@ -30,6 +38,7 @@ extern uint32_t _bss_end[];
 extern uint32_t multicast_timer_ldata;
 extern struct memory_rte memory_rte[NUM_MEMORY_RTE];
 extern void TrieInit();
+extern int TrieRebalance();
 
 void start(void)
 {
@@ -46,19 +55,23 @@ void start(void)
     _putchar('\0');
 
     // Initialize timers
-    *((volatile uint32_t *)MTIMECMP_HADDR) = 0xFFFFFFFF;
-    *((volatile uint32_t *)MTIMECMP_LADDR) = 0xFFFFFFFF;
+    HAL_WRITE32(MTIMECMP_HADDR, 0xFFFFFFFF);
+    HAL_WRITE32(MTIMECMP_LADDR, 0xFFFFFFFF);
 
-    *((volatile uint32_t *)MTIME_HADDR) = 0;
-    *((volatile uint32_t *)MTIME_LADDR) = 0;
+    HAL_WRITE32(MTIME_HADDR, 0);
+    HAL_WRITE32(MTIME_LADDR, 0);
 
     // Initialize multicast timer
-    multicast_timer_ldata = *((volatile uint32_t *)MTIME_LADDR);
+    multicast_timer_ldata = HAL_READ32(MTIME_LADDR);
+
+    // Start sampling, with EN_PROFILE=y
+    profile_init();
 
     // Initialize tries
     TrieInit();
+    nexthop_init();
 
-    *(volatile uint32_t *)DMA_OUT_LENGTH = 0;
+    HAL_WRITE32(DMA_OUT_LENGTH, 0);
 
     for(int i = 0; i < PORT_NUM; i++){
         write_ip_addr(ip_addrs + i, IP_CONFIG_ADDR(i));
@@ -73,23 +86,34 @@ void start(void)
         direct_route.s6_addr32[1] = htonl(0x04950000 + i);
         config_direct_route(&direct_route, 64, i);
     }
+    // Advertise the address plan as a single prefix, e.g. on port 0:
+    // direct_route.s6_addr32[1] = htonl(0x04950000);
+    // config_aggregate(&direct_route, 48, 1 << 0);
+    // Refuse more than 8192 routes from each neighbor on port 0, flag the ones past 75%:
+    // config_max_prefix(0, 8192, 75, 0);
+    // Accept only global unicast routes up to /64:
+    // direct_route.s6_addr32[0] = htonl(0x20000000);
+    // filter_add(&direct_route, 3, 0, 64, 1);
+    // filter_compile();
 
     write_nexthop_table_ip6_addr(&direct_route, NEXTHOP_TABLE_ADDR(5)); 
 
     // Send multicast request.
     for(int p = 0; p < PORT_NUM; p++){
         // Appoint out port id
-        *(volatile uint32_t *)DMA_OUT_PORT_ID = p;
+        HAL_WRITE32(DMA_OUT_PORT_ID, p);
         send_multicast_request(p);
         // Grant DMA access (Read) to the memory
-        _grant_dma_access(DMA_BLOCK_RADDR, *(volatile uint32_t *)DMA_OUT_LENGTH, 0);
+        _grant_dma_access(DMA_BLOCK_RADDR, HAL_READ32(DMA_OUT_LENGTH), 0);
         // Wait for the DMA to finish
         _wait_for_dma();
-        *(volatile uint32_t *)DMA_CPU_STB = 0;
+        HAL_WRITE32(DMA_CPU_STB, 0);
         // Reset the out length
-        *(volatile uint32_t *)DMA_OUT_LENGTH = 0;
+        HAL_WRITE32(DMA_OUT_LENGTH, 0);
     }
 
+    uint32_t link_status = HAL_READ32(LINK_STATUS_ADDR);
+
     printf("I");
     _putchar('\0');
 
@@ -103,15 +127,47 @@ void start(void)
         if (dma_res == 0)
         { // not busy
             if (check_timeout(MULTICAST_TIME_LIMIT, multicast_timer_ldata)) { // check multicast timer (30s)
+                TRACE_EVENT(TRACE_TIMER_EXPIRE, TRACE_TIMER_MULTICAST, 0, 0);
                 // Send multicast request.
                 send_unsolicited_response();
                 if(_check_dma_busy()) { _wait_for_dma(); }
                 // Reset the multicast timer
-                multicast_timer_ldata = *((volatile uint32_t *)MTIME_LADDR);
+                multicast_timer_ldata = HAL_READ32(MTIME_LADDR);
             }
-            else if (*(volatile uint32_t *)DMA_IN_VALID) {
+            else if (HAL_READ32(DMA_IN_VALID)) {
                 _grant_dma_access(DMA_BLOCK_WADDR, MTU, 1);
             }
+            else {
+                // Idle: withdraw the routes of silent neighbors and of ports that went down
+                int neighbor = nexthop_expire();
+                if (neighbor >= 0) {
+                    flush_neighbor(neighbor);
+                }
+                uint32_t link_up = HAL_READ32(LINK_STATUS_ADDR);
+                for (int p = 0; p < PORT_NUM; p++) {
+                    if ((link_status & ~link_up) & (1 << p)) {
+                        flush_port(p);
+                    }
+                }
+                link_status = link_up;
+                flush_poll();
+                // Expire the routes whose neighbors went silent
+                sweep_timers();
+                // Move spilled prefixes back into the VC trie
+                TrieRebalance();
+                // Put back the hidden routes that did not fit into the tries
+                fib_retry();
+                // Send the profile once it is complete, between the trace frames and the console output
+                if (!trace_sending() && !console_sending()) {
+                    profile_poll();
+                }
+                // Send the trace, as far as the UART keeps up, unless the console or the profile is sending
+                if (!console_sending() && !profile_sending()) {
+                    trace_poll();
+                }
+                // Run the console commands, a line at a time
+                console_poll();
+            }
             continue;
         }
         else if (dma_res == 1)
@@ -123,15 +179,20 @@ void start(void)
         {    // in
             if (_check_dma_ack())
             { // ack
-                uint32_t data_width = *(volatile uint32_t *)DMA_DATA_WIDTH;
-                uint8_t port_id = *(volatile uint8_t *)DMA_IN_PORT_ID;
+                uint32_t data_width = HAL_READ32(DMA_DATA_WIDTH);
+                uint8_t port_id = HAL_READ8(DMA_IN_PORT_ID);
+                TRACE_EVENT(TRACE_RX, port_id, data_width, 0);
+                STATS_INC_AT(rx_packets, port_id & (PORT_NUM - 1));
+                STATS_ADD_AT(rx_bytes, port_id & (PORT_NUM - 1), data_width);
 
                 // Process the packet
+                PROFILE_BEGIN(mark);
                 RipngErrorCode error = disassemble(DMA_BLOCK_WADDR, data_width, port_id);
+                PROFILE_END(mark, PROFILE_DISASSEMBLE);
+                STATS_INC_AT(errors, error);
                 if (error != SUCCESS)
                 {
-                    printf("D%d", error);
-                    _putchar('\0');
+                    TRACE_EVENT(TRACE_ERROR, error, port_id, data_width);
                 }
                 // If SUCCESS, we should continue
             }
@@ -2,6 +2,15 @@
 
 struct memory_rte memory_rte[NUM_MEMORY_RTE] __attribute__((section(".data")));
 int rte_map[NUM_TRIE_NODE] __attribute__((section(".data")));
-int spare_nexthop_index = 6;
 int spare_memory_index = 1;
-// uint32_t last_triggered_time = 0;
\ No newline at end of file
+// uint32_t last_triggered_time = 0;
+// The external definitions of the functions of memory.h, for the calls that are not inlined
+extern inline void write_ip_addr(struct ip6_addr *ip_addr, uint32_t base_addr);
+extern inline struct ip6_addr read_ip_addr(uint32_t base_addr);
+extern inline void write_mac_addr(struct ether_addr *mac_addr, uint32_t base_addr);
+extern inline struct ether_addr read_mac_addr(uint32_t base_addr);
+extern inline void write_nexthop_table_ip6_addr(struct ip6_addr *ip_addr, uint32_t base_addr);
+extern inline struct ip6_addr read_nexthop_table_ip6_addr(uint32_t base_addr);
+extern inline void write_nexthop_table_port_id(uint32_t port_id, uint32_t base_addr);
+extern inline uint32_t read_nexthop_table_port_id(uint32_t base_addr);
+extern inline void write_nexthop_table_group(uint32_t group, uint32_t base_addr);
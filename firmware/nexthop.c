@@ -0,0 +1,418 @@
+// Next hop indirection, see include/nexthop.h
+#include "stdint.h"
+#include "memory.h"
+#include "timer.h"
+#include "hal.h"
+#include "nexthop.h"
+#include "trace.h"
+#include "stats.h"
+
+#define NEXTHOP_SLOT_GROUP -2 // nexthop_slot_neighbors[] of a group slot
+
+struct nexthop nexthops[NUM_NEXTHOP];
+int nexthop_slot_neighbors[NEXTHOP_TABLE_INDEX_NUM];  // neighbor bound to each slot, -1 if free
+uint32_t nexthop_slot_refs[NEXTHOP_TABLE_INDEX_NUM];  // routes in the tries using each slot
+int nexthop_victim = 0;                              // where to look for a neighbor to evict
+
+// Members of the group slots
+uint8_t nexthop_group_sizes[NEXTHOP_TABLE_INDEX_NUM];
+uint8_t nexthop_group_members[NEXTHOP_TABLE_INDEX_NUM][NEXTHOP_GROUP_SIZE];
+
+static int nexthop_equal(struct nexthop *nexthop, struct ip6_addr *ip6_addr, uint8_t port)
+{
+    return nexthop->valid && nexthop->port == port &&
+           nexthop->ip6_addr.s6_addr32[0] == ip6_addr->s6_addr32[0] &&
+           nexthop->ip6_addr.s6_addr32[1] == ip6_addr->s6_addr32[1] &&
+           nexthop->ip6_addr.s6_addr32[2] == ip6_addr->s6_addr32[2] &&
+           nexthop->ip6_addr.s6_addr32[3] == ip6_addr->s6_addr32[3];
+}
+
+static void nexthop_write_slot(int slot, int neighbor)
+{
+    write_nexthop_table_ip6_addr(&nexthops[neighbor].ip6_addr, NEXTHOP_TABLE_ADDR(slot));
+    write_nexthop_table_port_id(nexthops[neighbor].port, NEXTHOP_TABLE_PORT_ID_ADDR(slot));
+    write_nexthop_table_group(0, NEXTHOP_TABLE_GROUP_ADDR(slot));
+}
+
+// A single store, the pipeline sees either the old or the new members
+static void nexthop_write_group(int slot)
+{
+    uint32_t group = (uint32_t)nexthop_group_sizes[slot] << 20;
+    for (int i = 0; i < nexthop_group_sizes[slot]; i++)
+    {
+        group |= (uint32_t)nexthops[nexthop_group_members[slot][i]].slot << (5 * i);
+    }
+    write_nexthop_table_group(group, NEXTHOP_TABLE_GROUP_ADDR(slot));
+}
+
+static int nexthop_free_slot()
+{
+    for (int slot = NEXTHOP_SLOT_BASE; slot < NEXTHOP_SLOT_END; slot++)
+    {
+        if (nexthop_slot_neighbors[slot] == -1)
+        {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+void nexthop_init()
+{
+    for (int i = 0; i < NUM_NEXTHOP; i++)
+    {
+        nexthops[i].valid = 0;
+        nexthops[i].slot = 0;
+        nexthops[i].holds = 0;
+    }
+    for (int i = 0; i < NEXTHOP_TABLE_INDEX_NUM; i++)
+    {
+        nexthop_slot_neighbors[i] = -1;
+        nexthop_slot_refs[i] = 0;
+        nexthop_group_sizes[i] = 0;
+        write_nexthop_table_group(0, NEXTHOP_TABLE_GROUP_ADDR(i));
+    }
+    nexthop_victim = 0;
+}
+
+int nexthop_get(struct ip6_addr *ip6_addr, uint8_t port)
+{
+    int free_index = -1;
+    for (int i = 0; i < NUM_NEXTHOP; i++)
+    {
+        if (nexthop_equal(nexthops + i, ip6_addr, port))
+        {
+            return i;
+        }
+        if (free_index < 0 && !nexthops[i].valid)
+        {
+            free_index = i;
+        }
+    }
+    if (free_index < 0)
+    {
+        // Evict a neighbor that no route uses
+        for (int n = 0; n < NUM_NEXTHOP; n++)
+        {
+            int i = nexthop_victim;
+            nexthop_victim = (nexthop_victim + 1) % NUM_NEXTHOP;
+            if (nexthops[i].slot == 0 && nexthops[i].holds == 0 && !nexthop_held_down(i))
+            {
+                free_index = i;
+                STATS_INC(nexthop_evictions);
+                break;
+            }
+        }
+        if (free_index < 0)
+        {
+            return -1;
+        }
+    }
+    nexthops[free_index].ip6_addr = *ip6_addr;
+    nexthops[free_index].port = port;
+    nexthops[free_index].valid = 1;
+    nexthops[free_index].slot = 0;
+    nexthops[free_index].holds = 0;
+    nexthops[free_index].alive = 0;
+    nexthops[free_index].responses = 0;
+    nexthops[free_index].flushes = 0;
+    nexthops[free_index].warned = 0;
+    nexthops[free_index].held_down = 0;
+    nexthops[free_index].rejected = 0;
+    nexthops[free_index].heard = HAL_READ32(MTIME_LADDR);
+    return free_index;
+}
+
+void nexthop_hold(int neighbor)
+{
+    nexthops[neighbor].holds++;
+}
+
+void nexthop_unhold(int neighbor)
+{
+    nexthops[neighbor].holds--;
+}
+
+int nexthop_acquire(int neighbor)
+{
+    if (neighbor < 0 || neighbor >= NUM_NEXTHOP || !nexthops[neighbor].valid)
+    {
+        return -1;
+    }
+    int slot = nexthops[neighbor].slot;
+    if (slot == 0)
+    {
+        slot = nexthop_free_slot();
+        if (slot < 0)
+        {
+            return -1;
+        }
+        nexthop_write_slot(slot, neighbor);
+        nexthop_slot_neighbors[slot] = neighbor;
+        nexthops[neighbor].slot = slot;
+    }
+    nexthop_slot_refs[slot]++;
+    return slot;
+}
+
+static int nexthop_is_member(int slot, int neighbor)
+{
+    for (int i = 0; i < nexthop_group_sizes[slot]; i++)
+    {
+        if (nexthop_group_members[slot][i] == neighbor)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int nexthop_acquire_group(int *neighbors, int num)
+{
+    if (num == 1)
+    {
+        return nexthop_acquire(neighbors[0]);
+    }
+    if (num < 1 || num > NEXTHOP_GROUP_SIZE)
+    {
+        return -1;
+    }
+    // Share the group of another route with the same members
+    for (int slot = NEXTHOP_SLOT_BASE; slot < NEXTHOP_SLOT_END; slot++)
+    {
+        if (nexthop_slot_neighbors[slot] != NEXTHOP_SLOT_GROUP || nexthop_group_sizes[slot] != num)
+        {
+            continue;
+        }
+        int i = 0;
+        while (i < num && nexthop_is_member(slot, neighbors[i]))
+        {
+            i++;
+        }
+        if (i == num)
+        {
+            nexthop_slot_refs[slot]++;
+            return slot;
+        }
+    }
+    int slot = nexthop_free_slot();
+    if (slot < 0)
+    {
+        return -1;
+    }
+    // Reserve the slot while the members get theirs
+    nexthop_slot_neighbors[slot] = NEXTHOP_SLOT_GROUP;
+    nexthop_group_sizes[slot] = 0;
+    for (int i = 0; i < num; i++)
+    {
+        if (nexthop_acquire(neighbors[i]) < 0)
+        {
+            for (int j = 0; j < i; j++)
+            {
+                nexthop_release(nexthops[neighbors[j]].slot);
+            }
+            nexthop_slot_neighbors[slot] = -1;
+            return -1;
+        }
+        nexthop_group_members[slot][i] = neighbors[i];
+    }
+    nexthop_group_sizes[slot] = num;
+    nexthop_write_group(slot);
+    nexthop_slot_refs[slot] = 1;
+    return slot;
+}
+
+void nexthop_release(int slot)
+{
+    if (slot < NEXTHOP_SLOT_BASE || slot >= NEXTHOP_SLOT_END || nexthop_slot_refs[slot] == 0)
+    {
+        return;
+    }
+    nexthop_slot_refs[slot]--;
+    if (nexthop_slot_refs[slot] == 0)
+    {
+        // The table entry is left as it is, no prefix points to it any more
+        if (nexthop_slot_neighbors[slot] == NEXTHOP_SLOT_GROUP)
+        {
+            for (int i = 0; i < nexthop_group_sizes[slot]; i++)
+            {
+                nexthop_release(nexthops[nexthop_group_members[slot][i]].slot);
+            }
+            nexthop_group_sizes[slot] = 0;
+        }
+        else
+        {
+            nexthops[nexthop_slot_neighbors[slot]].slot = 0;
+        }
+        nexthop_slot_neighbors[slot] = -1;
+    }
+}
+
+int nexthop_move(int slot, int neighbor)
+{
+    if (slot < NEXTHOP_SLOT_BASE || slot >= NEXTHOP_SLOT_END || nexthop_slot_neighbors[slot] < 0)
+    {
+        return -1;
+    }
+    if (neighbor < 0 || neighbor >= NUM_NEXTHOP || !nexthops[neighbor].valid || nexthops[neighbor].slot != 0)
+    {
+        return -1;
+    }
+    nexthop_write_slot(slot, neighbor);
+    nexthops[nexthop_slot_neighbors[slot]].slot = 0;
+    nexthop_slot_neighbors[slot] = neighbor;
+    nexthops[neighbor].slot = slot;
+    return 0;
+}
+
+int nexthop_slot_neighbor(int slot)
+{
+    if (slot < 0 || slot >= NEXTHOP_TABLE_INDEX_NUM || nexthop_slot_neighbors[slot] < 0)
+    {
+        return -1;
+    }
+    return nexthop_slot_neighbors[slot];
+}
+
+int nexthop_members(int slot, int *neighbors)
+{
+    if (slot < 0 || slot >= NEXTHOP_TABLE_INDEX_NUM || nexthop_slot_neighbors[slot] == -1)
+    {
+        return 0;
+    }
+    if (nexthop_slot_neighbors[slot] != NEXTHOP_SLOT_GROUP)
+    {
+        neighbors[0] = nexthop_slot_neighbors[slot];
+        return 1;
+    }
+    for (int i = 0; i < nexthop_group_sizes[slot]; i++)
+    {
+        neighbors[i] = nexthop_group_members[slot][i];
+    }
+    return nexthop_group_sizes[slot];
+}
+
+int nexthop_add_member(int slot, int neighbor)
+{
+    int neighbors[NEXTHOP_GROUP_SIZE + 1];
+    int num = nexthop_members(slot, neighbors);
+    if (num == 0 || num == NEXTHOP_GROUP_SIZE)
+    {
+        return -1;
+    }
+    for (int i = 0; i < num; i++)
+    {
+        if (neighbors[i] == neighbor)
+        {
+            return -1;
+        }
+    }
+    neighbors[num++] = neighbor;
+    return nexthop_acquire_group(neighbors, num);
+}
+
+int nexthop_remove_member(int slot, int neighbor)
+{
+    int neighbors[NEXTHOP_GROUP_SIZE];
+    int num = nexthop_members(slot, neighbors);
+    int i = 0;
+    while (i < num && neighbors[i] != neighbor)
+    {
+        i++;
+    }
+    if (num < 2 || i == num)
+    {
+        return -1;
+    }
+    neighbors[i] = neighbors[--num];
+    return nexthop_acquire_group(neighbors, num);
+}
+
+void nexthop_heard(int neighbor)
+{
+    if (neighbor >= 0 && neighbor < NUM_NEXTHOP)
+    {
+        nexthops[neighbor].heard = HAL_READ32(MTIME_LADDR);
+        nexthops[neighbor].alive = 1;
+        nexthops[neighbor].responses++;
+    }
+}
+
+int nexthop_alive(int neighbor)
+{
+    return nexthops[neighbor].alive;
+}
+
+void nexthop_down(int neighbor)
+{
+    nexthops[neighbor].alive = 0;
+    nexthops[neighbor].flushes++;
+    for (int slot = NEXTHOP_SLOT_BASE; slot < NEXTHOP_SLOT_END; slot++)
+    {
+        if (nexthop_slot_neighbors[slot] != NEXTHOP_SLOT_GROUP || nexthop_group_sizes[slot] < 2 || !nexthop_is_member(slot, neighbor))
+        {
+            continue;
+        }
+        int i = 0;
+        while (nexthop_group_members[slot][i] != neighbor)
+        {
+            i++;
+        }
+        // Rewrite the group before releasing the member, its slot may be rebound
+        nexthop_group_members[slot][i] = nexthop_group_members[slot][--nexthop_group_sizes[slot]];
+        nexthop_write_group(slot);
+        nexthop_release(nexthops[neighbor].slot);
+    }
+}
+
+void nexthop_hold_down(int neighbor)
+{
+    nexthops[neighbor].held_down = 1;
+    nexthops[neighbor].held = HAL_READ32(MTIME_LADDR);
+}
+
+int nexthop_held_down(int neighbor)
+{
+    if (neighbor < 0 || neighbor >= NUM_NEXTHOP || !nexthops[neighbor].held_down)
+    {
+        return 0;
+    }
+    if (check_timeout(HOLD_DOWN_TIME_LIMIT, nexthops[neighbor].held))
+    {
+        nexthops[neighbor].held_down = 0;
+    }
+    return nexthops[neighbor].held_down;
+}
+
+int nexthop_expire()
+{
+    for (int i = 0; i < NUM_NEXTHOP; i++)
+    {
+        if (nexthops[i].valid && nexthops[i].alive && check_timeout(TIMEOUT_TIME_LIMIT, nexthops[i].heard))
+        {
+            TRACE_EVENT(TRACE_TIMER_EXPIRE, TRACE_TIMER_NEIGHBOR, i, 0);
+            nexthop_down(i);
+            return i;
+        }
+    }
+    return -1;
+}
+
+int nexthop_routes(int neighbor)
+{
+    int slot = nexthops[neighbor].slot;
+    if (slot == 0)
+    {
+        return 0;
+    }
+    // The references to the slot are its routes and the groups it is a member of
+    int routes = nexthop_slot_refs[slot];
+    for (int group = NEXTHOP_SLOT_BASE; group < NEXTHOP_SLOT_END; group++)
+    {
+        if (nexthop_slot_neighbors[group] == NEXTHOP_SLOT_GROUP && nexthop_is_member(group, neighbor))
+        {
+            routes--;
+        }
+    }
+    return routes;
+}
@@ -0,0 +1,159 @@
+// Sampling profiler, see include/profile.h
+#ifdef PROFILE
+#include "stdint.h"
+#include "stdio.h"
+#include "hal.h"
+#include "uart.h"
+#include "timer.h"
+#include "profile.h"
+
+extern inline uint32_t profile_cycle();
+extern inline uint32_t profile_instret();
+
+#define MCAUSE_MACHINE_TIMER 0x80000007
+#define MIE_MTIE 0x80
+#define MSTATUS_MIE 0x8
+
+// csrw mtvec, a0 / csrs mie, a0 / csrs mstatus, a0
+#define __CSRW_MTVEC(x)                        \
+    asm volatile("mv a0, %0" ::"r"(x) : "a0"); \
+    asm volatile(".word 0x30551073" ::: "a0")
+#define __CSRS_MIE(x)                          \
+    asm volatile("mv a0, %0" ::"r"(x) : "a0"); \
+    asm volatile(".word 0x30452073" ::: "a0")
+#define __CSRS_MSTATUS(x)                      \
+    asm volatile("mv a0, %0" ::"r"(x) : "a0"); \
+    asm volatile(".word 0x30052073" ::: "a0")
+
+extern void profile_trap(); // profile_trap.S
+
+struct profile_sample profile_samples[PROFILE_SAMPLES];
+struct profile_region profile_regions[PROFILE_REGION_NUM];
+uint32_t profile_sample_count = 0;
+uint32_t profile_dumped = 0; // lines of the dump formatted, the ring records while 0
+char profile_line[PROFILE_LINE_LEN]; // the line being sent
+int profile_line_len = 0;
+int profile_line_sent = 0; // bytes of profile_line sent
+
+static void add64(uint32_t *low, uint32_t *high, uint32_t delta)
+{
+    *low += delta;
+    *high += (*low < delta);
+}
+
+void profile_end(struct profile_mark *mark, enum ProfileRegion region)
+{
+    uint32_t cycle = profile_cycle();
+    uint32_t instret = profile_instret();
+    struct profile_region *stats = profile_regions + region;
+    stats->calls++;
+    add64(&stats->cycles_low, &stats->cycles_high, cycle - mark->cycle);
+    add64(&stats->instret_low, &stats->instret_high, instret - mark->instret);
+}
+
+// The next interrupt, PROFILE_PERIOD ticks from now
+static void profile_arm()
+{
+    uint32_t low = HAL_READ32(MTIME_LADDR) + PROFILE_PERIOD;
+    uint32_t high = HAL_READ32(MTIME_HADDR) + (low < PROFILE_PERIOD);
+    // No interrupt may fire while only half of mtimecmp is written
+    HAL_WRITE32(MTIMECMP_HADDR, 0xFFFFFFFF);
+    HAL_WRITE32(MTIMECMP_LADDR, low);
+    HAL_WRITE32(MTIMECMP_HADDR, high);
+}
+
+/**
+ * @brief Called by profile_trap with the state of the interrupted code.
+ */
+void profile_sample(uint32_t pc, uint32_t ra, uint32_t sp, uint32_t cause)
+{
+    if (cause != MCAUSE_MACHINE_TIMER)
+    {
+        // An exception, there is nothing to return to
+        printf("[PROF]X%x,%x", cause, pc);
+        _putchar('\0');
+        while (1)
+            ;
+    }
+    if (profile_dumped == 0 && profile_sample_count < PROFILE_SAMPLES)
+    {
+        struct profile_sample *sample = profile_samples + profile_sample_count;
+        sample->pc = pc;
+        sample->ra = ra;
+        sample->depth = PROFILE_STACK_TOP - sp;
+        profile_sample_count++;
+    }
+    profile_arm();
+}
+
+void profile_init()
+{
+    __CSRW_MTVEC((uint32_t)profile_trap);
+    profile_arm();
+    __CSRS_MIE(MIE_MTIE);
+    __CSRS_MSTATUS(MSTATUS_MIE);
+}
+
+/*
+ * The dump is
+ *  [PROF]S<pc>,<ra>,<depth>             one line per sample
+ *  [PROF]R<region>,<calls>,<cycles>,<instret>   one line per region
+ *  [PROF]E<samples>                     at the end
+ * in hex, the 64 bits counters as 16 digits.
+ */
+static int profile_format(uint32_t i)
+{
+    if (i < PROFILE_SAMPLES)
+    {
+        struct profile_sample *sample = profile_samples + i;
+        return snprintf(profile_line, sizeof(profile_line), "[PROF]S%x,%x,%x\n", sample->pc, sample->ra,
+                        sample->depth);
+    }
+    if (i < PROFILE_SAMPLES + PROFILE_REGION_NUM)
+    {
+        struct profile_region *region = profile_regions + (i - PROFILE_SAMPLES);
+        return snprintf(profile_line, sizeof(profile_line), "[PROF]R%x,%x,%08x%08x,%08x%08x\n",
+                        i - PROFILE_SAMPLES, region->calls, region->cycles_high, region->cycles_low,
+                        region->instret_high, region->instret_low);
+    }
+    // The terminating zero goes out too, as after the other outputs
+    return snprintf(profile_line, sizeof(profile_line), "[PROF]E%x\n", profile_sample_count) + 1;
+}
+
+void profile_poll()
+{
+    if (profile_sample_count < PROFILE_SAMPLES)
+    {
+        return;
+    }
+    while (1)
+    {
+        if (profile_line_sent == profile_line_len)
+        {
+            if (profile_dumped > PROFILE_SAMPLES + PROFILE_REGION_NUM)
+            {
+                // The end is out, record again
+                profile_line_len = 0;
+                profile_line_sent = 0;
+                profile_dumped = 0;
+                profile_sample_count = 0;
+                return;
+            }
+            // Recording stays stopped from the first line on
+            profile_line_len = profile_format(profile_dumped);
+            profile_line_sent = 0;
+            profile_dumped++;
+        }
+        if (!_trychar(profile_line[profile_line_sent]))
+        {
+            return;
+        }
+        profile_line_sent++;
+    }
+}
+
+int profile_sending()
+{
+    return profile_line_sent != profile_line_len;
+}
+#endif
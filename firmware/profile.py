@@ -0,0 +1,82 @@
+import os
+import subprocess
+import sys
+
+# Symbolise the profile printed by a firmware built with EN_PROFILE=y (see include/profile.h)
+# into the folded stacks of flamegraph.pl / speedscope, and list the cycles of the regions.
+#   python profile.py kernel.elf uart.log > kernel.folded
+#   flamegraph.pl kernel.folded > kernel.svg
+
+REGIONS = ['disassemble', 'assemble', 'send_response', 'TrieInsert', 'TrieLookup',
+           'TrieDelete', 'TrieModify', 'dma_wait']
+
+if len(sys.argv) != 3:
+    print('usage: python {} kernel.elf uart.log'.format(sys.argv[0]), file=sys.stderr)
+    sys.exit(1)
+
+# Functions of the firmware, sorted by address
+nm = os.environ.get('NM', 'riscv64-unknown-elf-nm')
+symbols = []
+for line in subprocess.run([nm, '-n', '-S', '--defined-only', sys.argv[1]],
+                           stdout=subprocess.PIPE, check=True, universal_newlines=True).stdout.splitlines():
+    # 80000010 00000124 T start
+    fields = line.split()
+    if len(fields) == 4 and fields[2] in 'tTwW':
+        symbols.append((int(fields[0], 16), int(fields[1], 16), fields[3]))
+
+
+def symbolise(addr):
+    lo, hi = 0, len(symbols)
+    while lo < hi:
+        mid = (lo + hi) // 2
+        if symbols[mid][0] <= addr:
+            lo = mid + 1
+        else:
+            hi = mid
+    if lo == 0 or addr >= symbols[lo - 1][0] + max(symbols[lo - 1][1], 1):
+        return '0x{:08x}'.format(addr)
+    return symbols[lo - 1][2]
+
+
+# Only the last complete dump is used
+samples, regions, dump = [], [], None
+with open(sys.argv[2], errors='replace') as log:
+    for line in log:
+        line = line.replace('\0', '')
+        start = line.find('[PROF]')
+        if start < 0:
+            continue
+        kind, fields = line[start + 6], line[start + 7:].strip().split(',')
+        if kind == 'S':
+            if dump is None:
+                dump = ([], [])
+            dump[0].append([int(f, 16) for f in fields])
+        elif kind == 'R' and dump is not None:
+            dump[1].append([int(f, 16) for f in fields])
+        elif kind == 'E' and dump is not None:
+            samples, regions, dump = dump[0], dump[1], None
+        elif kind == 'X':
+            print('exception: mcause {} at {}'.format(fields[0], symbolise(int(fields[1], 16))), file=sys.stderr)
+
+if not samples:
+    print('no complete profile in {}'.format(sys.argv[2]), file=sys.stderr)
+    sys.exit(1)
+
+# The return address gives the caller, unless the function has already saved
+# and reused ra, then both symbolise to the same function (or to none)
+stacks = {}
+for pc, ra, depth in samples:
+    function = symbolise(pc)
+    caller = symbolise(ra)
+    stack = function if caller == function or caller.startswith('0x') else caller + ';' + function
+    stacks[stack] = stacks.get(stack, 0) + 1
+for stack, count in sorted(stacks.items(), key=lambda item: -item[1]):
+    print('{} {}'.format(stack, count))
+
+print('{} samples, deepest stack {} bytes'.format(len(samples), max(s[2] for s in samples)), file=sys.stderr)
+print('{:16s} {:>10s} {:>14s} {:>14s} {:>10s}'.format('region', 'calls', 'cycles', 'instret', 'cycles/call'),
+      file=sys.stderr)
+for region, calls, cycles, instret in regions:
+    print('{:16s} {:10d} {:14d} {:14d} {:10d}'.format(REGIONS[region] if region < len(REGIONS) else str(region),
+                                                     calls, cycles, instret, cycles // calls if calls else 0),
+          file=sys.stderr)
@@ -3,28 +3,77 @@
 #include "stdint.h"
 #include "packet.h"
 #include "dma.h"
+#include "hal.h"
 #include "timer.h"
 #include "protocol.h"
 #include "memory.h"
+#include "nexthop.h"
+#include "backup.h"
+#include "damping.h"
+#include "filter.h"
+#include "validate.h"
+#include "fib.h"
 
 extern struct ip6_addr ip_addrs[PORT_NUM];
 extern struct ether_addr mac_addrs[PORT_NUM];
 
-extern int rte_map[NUM_TRIE_NODE];
+extern struct nexthop nexthops[NUM_NEXTHOP];
 extern struct memory_rte memory_rte[NUM_MEMORY_RTE];
-extern int spare_nexthop_index;
 extern int spare_memory_index;
+struct aggregate aggregates[NUM_AGGREGATE];
+int aggregate_num = 0;
+int changed_routes[NUM_CHANGED_ROUTE]; // see mark_changed()
+int changed_num = 0;
+int changed_overflow = 0; // more changes than changed_routes holds, the whole table is sent
+int refresh_cursor = 1;   // the next route of the rolling refresh
+int timer_cursor = 1;     // the next route of sweep_timers()
+uint32_t flush_slots = 0; // bit s: the routes of slot s are withdrawn by flush_poll()
+int flush_chunk = 0;      // the next chunk of memory_rte flush_poll() looks at
+uint8_t refresh_metrics[PORT_NUM][NUM_AGGREGATE]; // best metrics of the aggregates in the refresh so far, 0 if none
+uint8_t aggregate_metrics[PORT_NUM][NUM_AGGREGATE]; // metrics the aggregates were last advertised with, 0 if not advertised
+uint16_t aggregate_stale[PORT_NUM]; // bit a: a route behind aggregate a got worse, it is counted again
+struct prefix_limit prefix_limits[PORT_NUM];
+int route_num = 0; // valid routes in memory_rte
 // extern uint32_t last_triggered_time;
 
-extern int TrieInsert(void *prefix, unsigned int length, uint32_t next_hop);
-extern int TrieDelete(void *prefix, unsigned int length);
-extern int TrieLookup(void *prefix, unsigned int length);
-extern void TrieModify(void *prefix, unsigned int length, uint32_t next_hop);
-
 #define ISVALID(rte) (((rte)->nexthop_port & 0x80) != 0)
 #define ISINVALID(rte) (((rte)->nexthop_port & 0x80) == 0)
 #define ISDIRECT(rte) (((rte)->nexthop_port & 0x40) != 0)
 #define PORT_ID(rte) ((rte)->nexthop_port & 0x03)
+#define ISCHANGED(rte) (((rte)->nexthop_port & 0x20) != 0)
+
+#define REFRESH_TICKS (REFRESH_TIME_LIMIT / MULTICAST_TIME_LIMIT)
+#define TIMER_SWEEP_BUDGET 64 // routes checked by each call of sweep_timers()
+#define FLUSH_BUDGET 4        // chunks of FIB_CHUNK routes walked by each call of flush_poll()
+
+/**
+ * @brief The index of a route in memory_rte.
+ */
+static int rte_index(struct memory_rte *rte)
+{
+    return rte - memory_rte;
+}
+
+/**
+ * @brief Queue a route for the next periodic update.
+ * @note For the changes that are not sent as triggered updates, e.g. timeouts.
+ */
+static void mark_changed(struct memory_rte *rte)
+{
+    if (ISCHANGED(rte))
+    {
+        return;
+    }
+    rte->nexthop_port |= 0x20;
+    if (changed_num < NUM_CHANGED_ROUTE)
+    {
+        changed_routes[changed_num++] = rte_index(rte);
+    }
+    else
+    {
+        changed_overflow = 1;
+    }
+}
 
 /**
  * @brief Put a direct route into the routing table.
@@ -35,41 +84,27 @@ extern void TrieModify(void *prefix, unsigned int length, uint32_t next_hop);
  */
 void config_direct_route(struct ip6_addr *ip6_addr, uint8_t prefix_len, uint8_t port)
 {
-    int j;
-    for (j = 6; j < NEXTHOP_TABLE_INDEX_NUM; j++)
+    if (fib_lookup(ip6_addr, prefix_len, NULL))
     {
-        struct ip6_addr nexthop_ip6_addr = read_nexthop_table_ip6_addr(NEXTHOP_TABLE_ADDR(j));
-        if (read_nexthop_table_port_id(NEXTHOP_TABLE_PORT_ID_ADDR(j)) == port && nexthop_ip6_addr.s6_addr32[0] == ip6_addr->s6_addr32[0] && nexthop_ip6_addr.s6_addr32[1] == ip6_addr->s6_addr32[1] && nexthop_ip6_addr.s6_addr32[2] == ip6_addr->s6_addr32[2] && nexthop_ip6_addr.s6_addr32[3] == ip6_addr->s6_addr32[3])
-        {
-            break;
-        }
-    }
-    if (j == NEXTHOP_TABLE_INDEX_NUM)
-    {
-        j = spare_nexthop_index;
-        write_nexthop_table_ip6_addr(ip6_addr, NEXTHOP_TABLE_ADDR(j));
-        write_nexthop_table_port_id(port, NEXTHOP_TABLE_PORT_ID_ADDR(j));
-        spare_nexthop_index++;
-        if (spare_nexthop_index == NEXTHOP_TABLE_INDEX_NUM)
-            spare_nexthop_index = 6;
+        return;
     }
-    int trie_index = TrieLookup(ip6_addr, prefix_len);
-    if (trie_index >= 0)
+    int slot = nexthop_acquire(nexthop_get(ip6_addr, port));
+    if (slot < 0)
     {
         return;
     }
-    trie_index = TrieInsert(ip6_addr, prefix_len, j);
-    if (trie_index < 0)
+    memory_rte[spare_memory_index].ip6_addr = *ip6_addr;
+    memory_rte[spare_memory_index].prefix_len = prefix_len;
+    if (fib_insert(spare_memory_index, slot) < 0)
     {
-        // printf("[TI]%d", trie_index);
+        nexthop_release(slot);
         return;
     }
-    rte_map[trie_index] = spare_memory_index;
-    memory_rte[spare_memory_index].ip6_addr = *ip6_addr;
     memory_rte[spare_memory_index].metric = 1;
-    memory_rte[spare_memory_index].lower_timer = (*((volatile uint32_t *)MTIME_LADDR)) & 0xFF;
-    memory_rte[spare_memory_index].prefix_len = prefix_len;
+    memory_rte[spare_memory_index].lower_timer = HAL_READ32(MTIME_LADDR) & 0xFF;
     memory_rte[spare_memory_index].nexthop_port = port | 0xc0;
+    mark_changed(memory_rte + spare_memory_index);
+    route_num++;
     while (ISVALID(memory_rte + spare_memory_index))
     {
         spare_memory_index++;
@@ -78,6 +113,159 @@ void config_direct_route(struct ip6_addr *ip6_addr, uint8_t prefix_len, uint8_t
     }
 }
 
+int config_aggregate(struct ip6_addr *prefix, uint8_t prefix_len, uint8_t ports)
+{
+    if (aggregate_num == NUM_AGGREGATE)
+    {
+        return -1;
+    }
+    struct aggregate *aggregate = aggregates + aggregate_num++;
+    for (int i = 0; i < 4; i++)
+    {
+        int bits = prefix_len - (i << 5);
+        uint32_t mask = bits >= 32 ? 0xffffffff : bits <= 0 ? 0 : 0xffffffff << (32 - bits);
+        aggregate->mask.s6_addr32[i] = htonl(mask);
+        aggregate->prefix.s6_addr32[i] = prefix->s6_addr32[i] & aggregate->mask.s6_addr32[i];
+    }
+    aggregate->prefix_len = prefix_len;
+    aggregate->ports = ports;
+    // Counted with the next unsolicited response
+    for (int p = 0; p < PORT_NUM; p++)
+    {
+        if (ports & (1 << p))
+        {
+            aggregate_stale[p] |= 1 << (aggregate_num - 1);
+        }
+    }
+    return 0;
+}
+
+void config_max_prefix(uint8_t port, uint32_t max, uint8_t warning, uint8_t teardown)
+{
+    prefix_limits[port].max = max;
+    prefix_limits[port].warning = warning;
+    prefix_limits[port].teardown = teardown;
+}
+
+/**
+ * @brief Check whether a neighbor may add a route, before it goes into the tries.
+ * @param neighbor The neighbor id, see nexthop_get().
+ * @param port The port of the neighbor.
+ * @return 0 if it may, -1 if the route is refused, -2 if the neighbor must be torn down.
+ */
+static int admit_route(int neighbor, uint8_t port)
+{
+    if (neighbor < 0)
+    {
+        return 0;
+    }
+    uint32_t routes = nexthop_routes(neighbor);
+    struct prefix_limit *limit = prefix_limits + port;
+    if (limit->max != 0)
+    {
+        if (routes >= limit->max)
+        {
+            nexthops[neighbor].rejected++;
+            return limit->teardown ? -2 : -1;
+        }
+        nexthops[neighbor].warned = (routes * 100 >= limit->max * limit->warning);
+    }
+    // Under overload, the last entries are kept for the neighbors with few routes
+    if (route_num >= NUM_MEMORY_RTE - 2 || (route_num >= NUM_MEMORY_RTE - ROUTE_RESERVE && routes >= NEIGHBOR_RESERVE))
+    {
+        nexthops[neighbor].rejected++;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Point a route to another slot of the next hop table.
+ * @param rte The route.
+ * @param slot The slot, the reference taken for it goes to the route.
+ * @note A withdrawn route is put back into the tries, see poison_route().
+ * @return 0 on success, -1 if the slot is invalid or the tries are full.
+ */
+static int change_slot(struct memory_rte *rte, int slot)
+{
+    if (slot < 0)
+    {
+        return -1;
+    }
+    uint32_t old_slot = fib_slot(rte_index(rte));
+    if (old_slot == NEXTHOP_SLOT_END)
+    {
+        if (fib_insert(rte_index(rte), slot) < 0)
+        {
+            nexthop_release(slot);
+            return -1;
+        }
+    }
+    else
+    {
+        // The old slot is released last, it may be freed and rebound only once no prefix points to it
+        fib_modify(rte_index(rte), slot);
+        nexthop_release(old_slot);
+    }
+    // The port of the route is the one of its first next hop
+    int neighbors[NEXTHOP_GROUP_SIZE];
+    nexthop_members(slot, neighbors);
+    rte->nexthop_port = (rte->nexthop_port & 0xe0) | nexthops[neighbors[0]].port;
+    return 0;
+}
+
+/**
+ * @brief Point a route to another neighbor.
+ * @param rte The route.
+ * @param neighbor The neighbor id, see nexthop_get().
+ * @return 0 on success, -1 if the neighbor cannot get a slot.
+ */
+static int change_nexthop(struct memory_rte *rte, int neighbor)
+{
+    return change_slot(rte, nexthop_acquire(neighbor));
+}
+
+/**
+ * @brief Replace the active path of a route by its best backup path.
+ * @param rte The route.
+ * @return 1 if a backup took over, 0 if the route has none.
+ */
+static int promote_backup(struct memory_rte *rte)
+{
+    int mem_id = rte_index(rte);
+    int neighbor;
+    uint8_t metric, lower_timer;
+    while (backup_pop(mem_id, &neighbor, &metric, &lower_timer))
+    {
+        if (change_nexthop(rte, neighbor) == 0)
+        {
+            rte->metric = metric;
+            rte->lower_timer = lower_timer;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Advertise a route as unreachable until it is collected, and stop forwarding through it.
+ * @param rte The route.
+ * @note Its slot is released at once, the prefix is still found, see fib_withdraw().
+ *  While the pool of withdrawn routes is full, it stays in the tries until it is collected.
+ */
+static void poison_route(struct memory_rte *rte)
+{
+    int mem_id = rte_index(rte);
+    rte->metric = 16;
+    rte->lower_timer = HAL_READ32(MTIME_LADDR) & 0xFF;
+    damping_flap(mem_id, DAMPING_PENALTY);
+    uint32_t slot = fib_slot(mem_id);
+    if (slot != NEXTHOP_SLOT_END && fib_withdraw(mem_id) == 0)
+    {
+        nexthop_release(slot);
+    }
+}
+
 /**
  * @brief Update one memory_rte's validation by checking its timers.
  * @param memory_rte_v The address of the rte.
@@ -99,9 +287,17 @@ int update_memory_rte(void *memory_rte_v)
     {
         if (check_timeout(TIMEOUT_TIME_LIMIT, memory_rte->lower_timer))
         {
+            TRACE_EVENT(TRACE_TIMER_EXPIRE, TRACE_TIMER_ROUTE, rte_index(memory_rte), 0);
+            STATS_INC(routes_expired);
+            // Fail over to the best backup path
+            if (promote_backup(memory_rte))
+            {
+                mark_changed(memory_rte);
+                return 1;
+            }
             // Start GC Timer
-            memory_rte->metric = 16;
-            memory_rte->lower_timer = *((volatile uint32_t *)MTIME_LADDR);
+            poison_route(memory_rte);
+            mark_changed(memory_rte);
         }
         return 1;
     }
@@ -109,27 +305,162 @@ int update_memory_rte(void *memory_rte_v)
     {
         if (check_timeout(GARBAGE_COLLECTION_TIME_LIMIT, memory_rte->lower_timer))
         {
+            if (damping_suppressed(rte_index(memory_rte)))
+            {
+                // Keep it poisoned until it may be reused, so its penalty is not lost
+                memory_rte->lower_timer = HAL_READ32(MTIME_LADDR);
+                return 1;
+            }
+            TRACE_EVENT(TRACE_TIMER_EXPIRE, TRACE_TIMER_GARBAGE, rte_index(memory_rte), 0);
+            STATS_INC(routes_deleted);
             // Delete the route
             // delete memory_rte
             // trie.delete(addr, prefix_length), return index
             // invalidate (trie->memory[index])
-            int trie_index = TrieDelete(&(memory_rte->ip6_addr), memory_rte->prefix_len);
-            if (trie_index < 0)
+            uint32_t slot = fib_slot(rte_index(memory_rte));
+            if (slot != NEXTHOP_SLOT_END)
             {
-                // printf("[TD]%d", trie_index);
-                memory_rte->lower_timer = 0;
-                memory_rte->nexthop_port = 0;
-                return 0;
+                nexthop_release(slot);
             }
-            rte_map[trie_index] = 0;
+            fib_delete(rte_index(memory_rte));
+            backup_clear(rte_index(memory_rte));
+            damping_clear(rte_index(memory_rte));
             memory_rte->lower_timer = 0;
             memory_rte->nexthop_port = 0;
+            route_num--;
             return 0;
         }
         return 1;
     }
 }
 
+/**
+ * @brief Check the timers of the next TIMER_SWEEP_BUDGET routes, from timer_cursor.
+ */
+void sweep_timers()
+{
+    for (int n = 0; n < TIMER_SWEEP_BUDGET; n++)
+    {
+        if (timer_cursor >= spare_memory_index)
+        {
+            timer_cursor = 1;
+            return;
+        }
+        update_memory_rte(memory_rte + timer_cursor);
+        timer_cursor++;
+    }
+}
+
+/**
+ * @brief Withdraw all routes through a neighbor.
+ * @param neighbor The neighbor id, see nexthop_get(), taken down already.
+ * @note Only its slots are marked here, flush_poll() walks their routes.
+ */
+void flush_neighbor(int neighbor)
+{
+    for (int slot = NEXTHOP_SLOT_BASE; slot < NEXTHOP_SLOT_END; slot++)
+    {
+        int members[NEXTHOP_GROUP_SIZE];
+        if (nexthop_members(slot, members) == 1 && members[0] == neighbor)
+        {
+            flush_slots |= 1u << slot;
+        }
+    }
+    // The walk starts over, the routes withdrawn already are passed over
+    flush_chunk = 0;
+}
+
+/**
+ * @brief Withdraw the routes of the slots marked by flush_neighbor(), FLUSH_BUDGET chunks of memory_rte at a time.
+ * @note The routes with a backup path fail over to it, the others are poisoned
+ *  and stop being forwarded at once, see poison_route().
+ *  The changes of each call are advertised as triggered updates.
+ * @return 1 if some routes are left to withdraw, 0 otherwise.
+ */
+int flush_poll()
+{
+    int send_entry_num = 0;
+    struct ripng_rte send_entries[PORT_NUM][RIPNG_MAX_RTE_NUM];
+    struct ip6_addr dst_addr = {.s6_addr32 = MULTICAST_ADDR};
+    for (int n = 0; n < FLUSH_BUDGET && flush_slots; n++)
+    {
+        int chunk = fib_next_chunk(flush_slots, flush_chunk);
+        if (chunk < 0)
+        {
+            flush_slots = 0;
+            break;
+        }
+        int end = (chunk + 1) * FIB_CHUNK;
+        for (int mem_id = chunk * FIB_CHUNK; mem_id < end && mem_id < NUM_MEMORY_RTE; mem_id++)
+        {
+            struct memory_rte *rte = memory_rte + mem_id;
+            if (mem_id == 0 || ISINVALID(rte) || ISDIRECT(rte) || rte->metric == 16)
+            {
+                continue;
+            }
+            uint32_t slot = fib_slot(mem_id);
+            if (slot == NEXTHOP_SLOT_END || !(flush_slots & (1u << slot)))
+            {
+                continue;
+            }
+            // Checked route by route, a slot freed by an earlier route may be rebound to a backup path,
+            // and a neighbor heard again keeps its routes
+            int members[NEXTHOP_GROUP_SIZE];
+            if (nexthop_members(slot, members) != 1 || nexthop_alive(members[0]))
+            {
+                continue;
+            }
+            if (!promote_backup(rte))
+            {
+                poison_route(rte);
+            }
+            for (int p = 0; p < PORT_NUM; p++)
+            {
+                send_entries[p][send_entry_num].ip6_addr = rte->ip6_addr;
+                send_entries[p][send_entry_num].prefix_len = rte->prefix_len;
+                send_entries[p][send_entry_num].route_tag = 0;
+                send_entries[p][send_entry_num].metric = (p == PORT_ID(rte)) ? 16 : rte->metric;
+            }
+            send_entry_num++;
+            if (send_entry_num == RIPNG_MAX_RTE_NUM)
+            {
+                for (int p = 0; p < PORT_NUM; p++)
+                {
+                    send_response(ip_addrs + p, &dst_addr, send_entries[p], RIPNG_MAX_RTE_NUM, p, 1);
+                }
+                send_entry_num = 0;
+            }
+        }
+        fib_chunk_sync(chunk);
+        flush_chunk = chunk + 1;
+    }
+    if (send_entry_num > 0)
+    {
+        for (int p = 0; p < PORT_NUM; p++)
+        {
+            send_response(ip_addrs + p, &dst_addr, send_entries[p], send_entry_num, p, 1);
+        }
+    }
+    return flush_slots != 0;
+}
+
+/**
+ * @brief Take down the neighbors on a port, and withdraw their routes.
+ * @param port The port that went down.
+ * @note The routes of all of them are withdrawn by the same walk, see flush_poll().
+ */
+void flush_port(uint8_t port)
+{
+    for (int neighbor = 0; neighbor < NUM_NEXTHOP; neighbor++)
+    {
+        if (nexthops[neighbor].valid && nexthops[neighbor].alive && nexthops[neighbor].port == port)
+        {
+            nexthop_down(neighbor);
+            flush_neighbor(neighbor);
+        }
+    }
+}
+
 /**
  * @brief Disassemble the packet and check the correctness of the packet.
  * @param base_addr The base address of the packet.
@@ -142,7 +473,7 @@ RipngErrorCode disassemble(uint32_t base_addr, uint32_t length, uint8_t port)
 {
     base_addr = base_addr + PADDING + ETHER_HDR_LEN;
     // 读取IPv6头部
-    struct ip6_hdr *ip6 = (struct ip6_hdr *)base_addr;
+    struct ip6_hdr *ip6 = (struct ip6_hdr *)HAL_PTR(base_addr);
     // 2. IPv6 Header 中的 Payload Length 加上 Header 长度是否等于 len。
     int payload_len = ntohs(ip6->payload_len);
     if (PADDING + ETHER_HDR_LEN + IP6_HDR_LEN + payload_len != length)
@@ -160,7 +491,7 @@ RipngErrorCode disassemble(uint32_t base_addr, uint32_t length, uint8_t port)
         return ERR_LENGTH;
     }
     // get upd header
-    struct udp_hdr *udp = (struct udp_hdr *)(base_addr + IP6_HDR_LEN);
+    struct udp_hdr *udp = (struct udp_hdr *)HAL_PTR(base_addr + IP6_HDR_LEN);
     // 5. 检查 UDP 源端口和目的端口是否都为 521。
     if (ntohs(udp->src_port) != UDP_PORT_RIPNG || ntohs(udp->dst_port) != UDP_PORT_RIPNG)
     {
@@ -171,8 +502,13 @@ RipngErrorCode disassemble(uint32_t base_addr, uint32_t length, uint8_t port)
      * 长度加上 RIPng entry 长度的整数倍。
      */
     int udp_len = ntohs(udp->len);
+    // The entries are read up to udp_len, which must not go past the packet
+    if (udp_len != payload_len || udp_len < UDP_HDR_LEN + RIPNG_HDR_LEN || (udp_len - UDP_HDR_LEN - RIPNG_HDR_LEN) % RTE_LEN != 0)
+    {
+        return ERR_LENGTH;
+    }
     // get RIPng header
-    struct ripng_hdr *ripng_hdr = (struct ripng_hdr *)(base_addr + IP6_HDR_LEN + UDP_HDR_LEN);
+    struct ripng_hdr *ripng_hdr = (struct ripng_hdr *)HAL_PTR(base_addr + IP6_HDR_LEN + UDP_HDR_LEN);
     /*
      * 7. 检查 RIPng header 中的 Command 是否为 1 或 2，
      * Version 是否为 1，Zero（Reserved） 是否为 0。
@@ -190,68 +526,27 @@ RipngErrorCode disassemble(uint32_t base_addr, uint32_t length, uint8_t port)
         return ERR_RIPNG_BAD_ZERO;
     }
     // get the entries
-    struct ripng_rte *entries = (struct ripng_rte *)(base_addr + IP6_HDR_LEN + UDP_HDR_LEN + RIPNG_HDR_LEN);
+    struct ripng_rte *entries = (struct ripng_rte *)HAL_PTR(base_addr + IP6_HDR_LEN + UDP_HDR_LEN + RIPNG_HDR_LEN);
     int entry_length = udp_len - UDP_HDR_LEN - RIPNG_HDR_LEN;
     int len = 0, i = 0;
     int send_entry_num = 0;
+    int neighbor = -1; // the sender in the neighbor table
+    int torn_down = 0; // the sender went over the prefix limit of its port
     struct ripng_rte send_entries[PORT_NUM][RIPNG_MAX_RTE_NUM];
+    // 8, 9. 在处理之前检查所有 RIPng entry。
+    RipngErrorCode error = validate_entries(entries, entry_length / RTE_LEN);
+    if (error != SUCCESS)
+    {
+        return error;
+    }
     while (len < entry_length)
     {
-        /*
-         * 8. 对每个 RIPng entry，当 Metric=0xFF 时，检查 Prefix Len
-         * 和 Route Tag 是否为 0。
-         */
-        if (entries[i].metric == 0xff)
-        {
-            if (entries[i].prefix_len != 0)
-            {
-                return ERR_RIPNG_BAD_PREFIX_LEN;
-            }
-            if (entries[i].route_tag != 0)
-            {
-                return ERR_RIPNG_BAD_ROUTE_TAG;
-            }
-        }
-        else
+        // 10. 丢弃前缀列表不允许的路由。
+        if (ripng_hdr->cmd == RIPNG_CMD_RESPONSE && entries[i].metric != 0xff && !filter_permit(&(entries[i].ip6_addr), entries[i].prefix_len))
         {
-            /*
-             * 9. 对每个 RIPng entry，当 Metric!=0xFF 时，检查 Metric 是否属于
-             * [1,16]，并检查 Prefix Len 是否属于 [0,128]，Prefix Len 是否与 IPv6 prefix
-             * 字段组成合法的 IPv6 前缀。
-             */
-            if (entries[i].metric < 1 || entries[i].metric > 16)
-            {
-                return ERR_RIPNG_BAD_METRIC;
-            }
-            if (entries[i].prefix_len < 0 || entries[i].prefix_len > 128)
-            {
-                return ERR_RIPNG_BAD_PREFIX_LEN;
-            }
-            // check whether the prefix is valid
-            int prefix_len = entries[i].prefix_len;
-            for (int j = 0; j < 16; j++)
-            {
-                if (prefix_len >= 8)
-                {
-                    prefix_len -= 8;
-                }
-                else if (prefix_len > 0)
-                {
-                    uint8_t mask = 0xff >> prefix_len;
-                    if ((entries[i].ip6_addr.s6_addr8[j] & mask) != 0)
-                    {
-                        return ERR_RIPNG_INCONSISTENT_PREFIX_LENGTH;
-                    }
-                    prefix_len = 0;
-                }
-                else
-                {
-                    if (entries[i].ip6_addr.s6_addr8[j] != 0)
-                    {
-                        return ERR_RIPNG_INCONSISTENT_PREFIX_LENGTH;
-                    }
-                }
-            }
+            len += 20;
+            i++;
+            continue;
         }
 
         if (ripng_hdr->cmd == RIPNG_CMD_REQUEST) // Received REQUEST
@@ -263,24 +558,6 @@ RipngErrorCode disassemble(uint32_t base_addr, uint32_t length, uint8_t port)
             // lookup trie (addr, prefix_length), return index1
             // (trie->memory[index1]->index2
             // memory_rte[index2]->metric
-            int j;
-            for (j = 5; j < NEXTHOP_TABLE_INDEX_NUM; j++)
-            {
-                struct ip6_addr nexthop_ip6_addr = read_nexthop_table_ip6_addr(NEXTHOP_TABLE_ADDR(j));
-                if (read_nexthop_table_port_id(NEXTHOP_TABLE_PORT_ID_ADDR(j)) == port && nexthop_ip6_addr.s6_addr32[0] == ip6->src_addr.s6_addr32[0] && nexthop_ip6_addr.s6_addr32[1] == ip6->src_addr.s6_addr32[1] && nexthop_ip6_addr.s6_addr32[2] == ip6->src_addr.s6_addr32[2] && nexthop_ip6_addr.s6_addr32[3] == ip6->src_addr.s6_addr32[3])
-                {
-                    break;
-                }
-            }
-            if (j == NEXTHOP_TABLE_INDEX_NUM)
-            {
-                j = spare_nexthop_index;
-                write_nexthop_table_ip6_addr(&(ip6->src_addr), NEXTHOP_TABLE_ADDR(j));
-                write_nexthop_table_port_id(port, NEXTHOP_TABLE_PORT_ID_ADDR(j));
-                spare_nexthop_index++;
-                if (spare_nexthop_index == NEXTHOP_TABLE_INDEX_NUM)
-                    spare_nexthop_index = 6;
-            }
             if (entry_length == 20 && entries[i].metric == 16 && entries[i].prefix_len == 0 && entries[i].ip6_addr.s6_addr32[0] == 0 && entries[i].ip6_addr.s6_addr32[1] == 0 && entries[i].ip6_addr.s6_addr32[2] == 0 && entries[i].ip6_addr.s6_addr32[3] == 0)
             {
                 // Send all routes
@@ -290,10 +567,9 @@ RipngErrorCode disassemble(uint32_t base_addr, uint32_t length, uint8_t port)
             else
             {
                 // Send needed routes
-                int trie_index = TrieLookup(&(entries[i].ip6_addr), entries[i].prefix_len);
-                if (trie_index >= 0)
+                int mem_id = fib_lookup(&(entries[i].ip6_addr), entries[i].prefix_len, NULL);
+                if (mem_id)
                 {
-                    int mem_id = rte_map[trie_index];
                     // Route found
                     send_entries[port][send_entry_num] = entries[i];
                     if (update_memory_rte(memory_rte + mem_id) && (PORT_ID(memory_rte + mem_id)) != port && (!ISDIRECT(memory_rte + mem_id)))
@@ -328,62 +604,70 @@ RipngErrorCode disassemble(uint32_t base_addr, uint32_t length, uint8_t port)
         else // Received RESPONSE
         {
             // Update memory rte
-            // Check nexthop_table (src_addr, port), return index (insert:FIFO)
+            // Find the sender in the neighbor table, it gets a slot of nexthop_table with its first route
             // Lookup if the rte exists
-            // If not, insert trie (addr, prefix_length, index), return (trie->memory) index1
+            // If not, insert trie (addr, prefix_length, slot), return (trie->memory) index1
             // memory: find a space, return index2
             // (trie->memory)[index1]: insert index2
-            int j;
-            for (j = 5; j < NEXTHOP_TABLE_INDEX_NUM; j++)
+            if (neighbor < 0)
             {
-                struct ip6_addr nexthop_ip6_addr = read_nexthop_table_ip6_addr(NEXTHOP_TABLE_ADDR(j));
-                if (read_nexthop_table_port_id(NEXTHOP_TABLE_PORT_ID_ADDR(j)) == port && nexthop_ip6_addr.s6_addr32[0] == ip6->src_addr.s6_addr32[0] && nexthop_ip6_addr.s6_addr32[1] == ip6->src_addr.s6_addr32[1] && nexthop_ip6_addr.s6_addr32[2] == ip6->src_addr.s6_addr32[2] && nexthop_ip6_addr.s6_addr32[3] == ip6->src_addr.s6_addr32[3])
+                neighbor = nexthop_get(&(ip6->src_addr), port);
+                // A neighbor torn down by its prefix limit is ignored until its hold-down is over
+                if (nexthop_held_down(neighbor))
                 {
-                    break;
+                    return ERR_PREFIX_LIMIT;
                 }
+                nexthop_heard(neighbor);
             }
-            if (j == NEXTHOP_TABLE_INDEX_NUM)
+            uint32_t slot;
+            int mem_id = fib_lookup(&(entries[i].ip6_addr), entries[i].prefix_len, &slot);
+            if (mem_id)
             {
-                j = spare_nexthop_index;
-                if (len == 0){
-                    j = 5;
-                }
-                write_nexthop_table_ip6_addr(&(ip6->src_addr), NEXTHOP_TABLE_ADDR(j));
-                write_nexthop_table_port_id(port, NEXTHOP_TABLE_PORT_ID_ADDR(j));
-                spare_nexthop_index++;
-                if (spare_nexthop_index == NEXTHOP_TABLE_INDEX_NUM)
-                    spare_nexthop_index = 6;
-            }
-            int trie_index = TrieLookup(&(entries[i].ip6_addr), entries[i].prefix_len);
-            if (trie_index > 0)
-            {
-                int mem_id = rte_map[trie_index];
                 // If it is a direct route, do nothing
                 if (ISDIRECT(memory_rte + mem_id)){
                     len += 20;
                     i++;
                     continue;
                 }
+                // The equal-cost next hops of the route
+                int members[NEXTHOP_GROUP_SIZE];
+                int num_members = nexthop_members(slot, members);
+                int is_member = 0;
+                for (int m = 0; m < num_members; m++)
+                {
+                    is_member |= (members[m] == neighbor);
+                }
                 // Route found
                 int new_metric = entries[i].metric + 1;
                 if (new_metric > 16)
                     new_metric = 16;
-                if (new_metric == 16)
+                if (num_members > 1 && is_member && new_metric > memory_rte[mem_id].metric)
+                {
+                    // One of the equal-cost next hops is worse now, the others keep the route
+                    change_slot(memory_rte + mem_id, nexthop_remove_member(slot, neighbor));
+                    backup_update(mem_id, neighbor, new_metric);
+                }
+                else if (new_metric == 16)
                 {
-                    if (port == (PORT_ID(memory_rte + mem_id)))
+                    if (port == (PORT_ID(memory_rte + mem_id)) && num_members <= 1 && memory_rte[mem_id].metric == 16)
+                    { // Withdrawn already
+                        len += 20;
+                        i++;
+                        continue;
+                    }
+                    if (port == (PORT_ID(memory_rte + mem_id)) && num_members <= 1)
                     { // next_hop same
-                        // Delete the route
-                        int trie_index = TrieLookup(&(memory_rte[mem_id].ip6_addr), memory_rte[mem_id].prefix_len);
-                        if (trie_index < 0)
+                        STATS_INC(routes_withdrawn);
+                        // A route without a slot is left parked by poison_route(), change_slot() inserts it again
+                        if (promote_backup(memory_rte + mem_id))
+                        {
+                            // Fail over at once, advertise the metric of the backup path
+                            new_metric = memory_rte[mem_id].metric;
+                        }
+                        else
                         {
-                            // printf("[TF]%d", trie_index);
-                            memory_rte[mem_id].metric = 16;
-                            memory_rte[mem_id].lower_timer = 0;
-                            memory_rte[mem_id].nexthop_port = 0;
-                            return ERR_TRIE;
+                            poison_route(memory_rte + mem_id);
                         }
-                        memory_rte[mem_id].metric = 16;
-                        memory_rte[mem_id].lower_timer = (*((volatile uint32_t *)MTIME_LADDR)) & 0xFF;
                         // if(check_timeout(TRIGGERED_RESPONSE_TIME_INTERVAL, last_triggered_time)){
                         //     last_triggered_time = *((volatile uint32_t *)MTIME_LADDR);
                         // }
@@ -393,7 +677,7 @@ RipngErrorCode disassemble(uint32_t base_addr, uint32_t length, uint8_t port)
                         for (int p = 0; p < PORT_NUM; p++)
                         {
                             send_entries[p][send_entry_num] = entries[i];
-                            send_entries[p][send_entry_num].metric = 16;
+                            send_entries[p][send_entry_num].metric = (p == PORT_ID(memory_rte + mem_id)) ? 16 : new_metric;
                         }
                         send_entry_num++;
                         if (send_entry_num == RIPNG_MAX_RTE_NUM)
@@ -407,15 +691,26 @@ RipngErrorCode disassemble(uint32_t base_addr, uint32_t length, uint8_t port)
                         }
                     }
                     else
-                        ; // Do nothing
+                    { // A backup path is gone
+                        backup_update(mem_id, neighbor, 16);
+                    }
                 }
                 else if (new_metric > memory_rte[mem_id].metric)
                 {
-                    if (port == (PORT_ID(memory_rte + mem_id)))
+                    if (port == (PORT_ID(memory_rte + mem_id)) && num_members <= 1)
                     { // next_hop same
-                        // Update the route
-                        memory_rte[mem_id].metric = new_metric;
-                        memory_rte[mem_id].lower_timer = (*((volatile uint32_t *)MTIME_LADDR)) & 0xFF;
+                        if (backup_best(mem_id) < new_metric && promote_backup(memory_rte + mem_id))
+                        {
+                            // A backup path is better now, the active one becomes a backup
+                            backup_update(mem_id, neighbor, new_metric);
+                            new_metric = memory_rte[mem_id].metric;
+                        }
+                        else
+                        {
+                            // Update the route
+                            memory_rte[mem_id].metric = new_metric;
+                            memory_rte[mem_id].lower_timer = HAL_READ32(MTIME_LADDR) & 0xFF;
+                        }
                         // if(check_timeout(TRIGGERED_RESPONSE_TIME_INTERVAL, last_triggered_time)){
                         //     last_triggered_time = *((volatile uint32_t *)MTIME_LADDR);
                         // }
@@ -425,7 +720,7 @@ RipngErrorCode disassemble(uint32_t base_addr, uint32_t length, uint8_t port)
                         for (int p = 0; p < PORT_NUM; p++)
                         {
                             send_entries[p][send_entry_num] = entries[i];
-                            send_entries[p][send_entry_num].metric = (p == port) ? 16 : new_metric;
+                            send_entries[p][send_entry_num].metric = (p == PORT_ID(memory_rte + mem_id)) ? 16 : new_metric;
                         }
                         send_entry_num++;
                         if (send_entry_num == RIPNG_MAX_RTE_NUM)
@@ -439,34 +734,29 @@ RipngErrorCode disassemble(uint32_t base_addr, uint32_t length, uint8_t port)
                         }
                     }
                     else
-                        ; // Do nothing
+                    { // A backup path
+                        backup_update(mem_id, neighbor, new_metric);
+                    }
+                }
+                else if (new_metric == memory_rte[mem_id].metric && !is_member && change_slot(memory_rte + mem_id, nexthop_add_member(slot, neighbor)) == 0)
+                {
+                    // Another equal-cost next hop
+                    memory_rte[mem_id].lower_timer = HAL_READ32(MTIME_LADDR) & 0xFF;
+                    backup_update(mem_id, neighbor, 16);
                 }
                 else if (new_metric == memory_rte[mem_id].metric)
                 {
-                    if (port != (PORT_ID(memory_rte + mem_id)) && check_timeout(TIMEOUT_TIME_LIMIT >> 1, memory_rte[mem_id].lower_timer))
+                    if (!is_member && port != (PORT_ID(memory_rte + mem_id)) && check_timeout(TIMEOUT_TIME_LIMIT >> 1, memory_rte[mem_id].lower_timer) && !damping_suppressed(mem_id))
                     { // next_hop NOT same and memory_rte timeout soon
                         // Update the route
-                        int nexthop_index = 0;
-                        for (nexthop_index = 5; nexthop_index < NEXTHOP_TABLE_INDEX_NUM; nexthop_index++)
+                        if (change_nexthop(memory_rte + mem_id, neighbor) < 0)
                         {
-                            struct ip6_addr nexthop_ip6_addr = read_nexthop_table_ip6_addr(NEXTHOP_TABLE_ADDR(nexthop_index));
-                            if (read_nexthop_table_port_id(NEXTHOP_TABLE_PORT_ID_ADDR(nexthop_index)) == port && nexthop_ip6_addr.s6_addr32[0] == ip6->src_addr.s6_addr32[0] && nexthop_ip6_addr.s6_addr32[1] == ip6->src_addr.s6_addr32[1] && nexthop_ip6_addr.s6_addr32[2] == ip6->src_addr.s6_addr32[2] && nexthop_ip6_addr.s6_addr32[3] == ip6->src_addr.s6_addr32[3])
-                            {
-                                break;
-                            }
-                        }
-                        if (nexthop_index == NEXTHOP_TABLE_INDEX_NUM)
-                        {
-                            nexthop_index = spare_nexthop_index;
-                            write_nexthop_table_ip6_addr(&(ip6->src_addr), NEXTHOP_TABLE_ADDR(nexthop_index));
-                            write_nexthop_table_port_id(port, NEXTHOP_TABLE_PORT_ID_ADDR(nexthop_index));
-                            spare_nexthop_index++;
-                            if (spare_nexthop_index == NEXTHOP_TABLE_INDEX_NUM)
-                                spare_nexthop_index = 6;
+                            len += 20;
+                            i++;
+                            continue;
                         }
-                        TrieModify(&(memory_rte[mem_id].ip6_addr), memory_rte[mem_id].prefix_len, nexthop_index);
-                        memory_rte[mem_id].nexthop_port = port | 0x80;
-                        memory_rte[mem_id].lower_timer = (*((volatile uint32_t *)MTIME_LADDR)) & 0xFF;
+                        memory_rte[mem_id].nexthop_port = (memory_rte[mem_id].nexthop_port & 0x20) | port | 0x80;
+                        memory_rte[mem_id].lower_timer = HAL_READ32(MTIME_LADDR) & 0xFF;
                         // if(check_timeout(TRIGGERED_RESPONSE_TIME_INTERVAL, last_triggered_time)){
                         //     last_triggered_time = *((volatile uint32_t *)MTIME_LADDR);
                         // }
@@ -492,36 +782,51 @@ RipngErrorCode disassemble(uint32_t base_addr, uint32_t length, uint8_t port)
                     else
                     { // Nexthop and metric both same
                         // Update timer
-                        memory_rte[mem_id].lower_timer = (*((volatile uint32_t *)MTIME_LADDR)) & 0xFF;
+                        memory_rte[mem_id].lower_timer = HAL_READ32(MTIME_LADDR) & 0xFF;
+                        if (!is_member)
+                        {
+                            backup_update(mem_id, neighbor, new_metric);
+                        }
                     }
                 }
                 else
                 {
-                    // Update the route
-                    if (port != (PORT_ID(memory_rte + mem_id)))
+                    // A flapping route is neither put back nor moved to a better path until it is stable
+                    if (damping_suppressed(mem_id))
                     {
-                        int nexthop_index = 0;
-                        for (nexthop_index = 5; nexthop_index < NEXTHOP_TABLE_INDEX_NUM; nexthop_index++)
+                        if (memory_rte[mem_id].metric != 16)
                         {
-                            struct ip6_addr nexthop_ip6_addr = read_nexthop_table_ip6_addr(NEXTHOP_TABLE_ADDR(nexthop_index));
-                            if (read_nexthop_table_port_id(NEXTHOP_TABLE_PORT_ID_ADDR(nexthop_index)) == port && nexthop_ip6_addr.s6_addr32[0] == ip6->src_addr.s6_addr32[0] && nexthop_ip6_addr.s6_addr32[1] == ip6->src_addr.s6_addr32[1] && nexthop_ip6_addr.s6_addr32[2] == ip6->src_addr.s6_addr32[2] && nexthop_ip6_addr.s6_addr32[3] == ip6->src_addr.s6_addr32[3])
+                            if (is_member)
                             {
-                                break;
+                                memory_rte[mem_id].lower_timer = HAL_READ32(MTIME_LADDR) & 0xFF;
+                            }
+                            else
+                            {
+                                backup_update(mem_id, neighbor, new_metric);
                             }
                         }
-                        if (nexthop_index == NEXTHOP_TABLE_INDEX_NUM)
+                        len += 20;
+                        i++;
+                        continue;
+                    }
+                    // Update the route, a withdrawn one gets a slot again
+                    if (port != (PORT_ID(memory_rte + mem_id)) || num_members != 1)
+                    {
+                        if (change_nexthop(memory_rte + mem_id, neighbor) < 0)
                         {
-                            nexthop_index = spare_nexthop_index;
-                            write_nexthop_table_ip6_addr(&(ip6->src_addr), NEXTHOP_TABLE_ADDR(nexthop_index));
-                            write_nexthop_table_port_id(port, NEXTHOP_TABLE_PORT_ID_ADDR(nexthop_index));
-                            spare_nexthop_index++;
-                            if (spare_nexthop_index == NEXTHOP_TABLE_INDEX_NUM)
-                                spare_nexthop_index = 6;
+                            len += 20;
+                            i++;
+                            continue;
                         }
-                        TrieModify(&(memory_rte[mem_id].ip6_addr), memory_rte[mem_id].prefix_len, nexthop_index);
+                        // The path it replaces becomes a backup
+                        if (num_members == 1 && members[0] != neighbor)
+                        {
+                            backup_update(mem_id, members[0], memory_rte[mem_id].metric);
+                        }
+                        backup_update(mem_id, neighbor, 16);
                     }
-                    memory_rte[mem_id].nexthop_port = port | 0x80;
-                    memory_rte[mem_id].lower_timer = (*((volatile uint32_t *)MTIME_LADDR)) & 0xFF;
+                    memory_rte[mem_id].nexthop_port = (memory_rte[mem_id].nexthop_port & 0x20) | port | 0x80;
+                    memory_rte[mem_id].lower_timer = HAL_READ32(MTIME_LADDR) & 0xFF;
                     memory_rte[mem_id].metric = new_metric;
                     // if(check_timeout(TRIGGERED_RESPONSE_TIME_INTERVAL, last_triggered_time)){
                     //     last_triggered_time = *((volatile uint32_t *)MTIME_LADDR);
@@ -555,18 +860,42 @@ RipngErrorCode disassemble(uint32_t base_addr, uint32_t length, uint8_t port)
                     continue;
                 }
                 // Add new route
-                int trie_index = TrieInsert(&(entries[i].ip6_addr), entries[i].prefix_len, j);
-                if (trie_index < 0)
+                int admitted = admit_route(neighbor, port);
+                if (admitted == -2)
                 {
-                    // printf("[TI]%d", trie_index);
-                    return ERR_TRIE;
+                    // The entries taken so far are sent first, see below
+                    torn_down = 1;
+                    break;
+                }
+                if (admitted < 0)
+                {
+                    len += 20;
+                    i++;
+                    continue;
+                }
+                // Without a slot or room in the tries the route is refused, the other entries are still taken
+                int slot = nexthop_acquire(neighbor);
+                if (slot < 0)
+                {
+                    STATS_INC(nexthop_full);
+                    len += 20;
+                    i++;
+                    continue;
                 }
-                rte_map[trie_index] = spare_memory_index;
                 memory_rte[spare_memory_index].ip6_addr = entries[i].ip6_addr;
-                memory_rte[spare_memory_index].metric = entries[i].metric + 1;
-                memory_rte[spare_memory_index].lower_timer = (*((volatile uint32_t *)MTIME_LADDR)) & 0xFF;
                 memory_rte[spare_memory_index].prefix_len = entries[i].prefix_len;
+                if (fib_insert(spare_memory_index, slot) < 0)
+                {
+                    nexthop_release(slot);
+                    len += 20;
+                    i++;
+                    continue;
+                }
+                memory_rte[spare_memory_index].metric = entries[i].metric + 1;
+                memory_rte[spare_memory_index].lower_timer = HAL_READ32(MTIME_LADDR) & 0xFF;
                 memory_rte[spare_memory_index].nexthop_port = port | 0x80;
+                route_num++;
+                STATS_INC(routes_learned);
                 while (ISVALID(memory_rte + spare_memory_index))
                 {
                     spare_memory_index++;
@@ -623,6 +952,14 @@ RipngErrorCode disassemble(uint32_t base_addr, uint32_t length, uint8_t port)
             }
         }
     }
+    if (torn_down)
+    {
+        // Its routes are withdrawn, and it is not heard again until the hold-down is over
+        nexthop_down(neighbor);
+        nexthop_hold_down(neighbor);
+        flush_neighbor(neighbor);
+        return ERR_PREFIX_LIMIT;
+    }
 
     return SUCCESS;
 }
@@ -636,7 +973,7 @@ RipngErrorCode disassemble(uint32_t base_addr, uint32_t length, uint8_t port)
 void send_multicast_request(int port)
 {
     // Write to DMA_BLOCK_RADDR
-    volatile struct packet_hdr *packet = (volatile struct packet_hdr *)DMA_BLOCK_RADDR;
+    volatile struct packet_hdr *packet = (volatile struct packet_hdr *)HAL_PTR(DMA_BLOCK_RADDR);
     // set the ether header
     packet->ether.padding = 0;
     packet->ether.dst_addr.ether_addr16[0] = htons(0x3333);
@@ -666,7 +1003,7 @@ void send_multicast_request(int port)
     packet->ripng.vers = 1;
     packet->ripng.reserved = 0;
     // append an RTE
-    struct ripng_rte *rte = (struct ripng_rte *)(DMA_BLOCK_RADDR + PADDING + ETHER_HDR_LEN + IP6_HDR_LEN + UDP_HDR_LEN + RIPNG_HDR_LEN);
+    struct ripng_rte *rte = (struct ripng_rte *)HAL_PTR(DMA_BLOCK_RADDR + PADDING + ETHER_HDR_LEN + IP6_HDR_LEN + UDP_HDR_LEN + RIPNG_HDR_LEN);
     rte->ip6_addr.s6_addr32[0] = 0;
     rte->ip6_addr.s6_addr32[1] = 0;
     rte->ip6_addr.s6_addr32[2] = 0;
@@ -675,7 +1012,7 @@ void send_multicast_request(int port)
     rte->prefix_len = 0;
     rte->metric = 16;
     // Set the length to DMA_OUT_LENGTH
-    *(volatile uint32_t *)DMA_OUT_LENGTH = PADDING + ETHER_HDR_LEN + IP6_HDR_LEN + UDP_HDR_LEN + RIPNG_HDR_LEN + RTE_LEN;
+    HAL_WRITE32(DMA_OUT_LENGTH, PADDING + ETHER_HDR_LEN + IP6_HDR_LEN + UDP_HDR_LEN + RIPNG_HDR_LEN + RTE_LEN);
 }
 
 /**
@@ -694,7 +1031,7 @@ int assemble(void *src_addr_v, void *dst_addr_v, void *entries_v, int num_entrie
     struct ripng_rte *entries = (struct ripng_rte *)entries_v;
     struct ip6_addr *src_addr = (struct ip6_addr *)src_addr_v;
     struct ip6_addr *dst_addr = (struct ip6_addr *)dst_addr_v;
-    volatile struct packet_hdr *packet_hdr = (struct packet_hdr *)DMA_BLOCK_RADDR;
+    volatile struct packet_hdr *packet_hdr = (struct packet_hdr *)HAL_PTR(DMA_BLOCK_RADDR);
     // set the ether header
     packet_hdr->ether.padding = 0;
     packet_hdr->ether.ethertype = 0xdd86;
@@ -751,10 +1088,197 @@ int assemble(void *src_addr_v, void *dst_addr_v, void *entries_v, int num_entrie
     return PACKET_HDR_LEN + entries_size;
 }
 
+/**
+ * @brief Assemble a packet and hand it to the DMA.
+ * @note Waits for the DMA to finish the previous packet first.
+ */
+static void send_packet(struct ip6_addr *src_addr, struct ip6_addr *dst_addr, struct ripng_rte *entries, int num_entries, uint8_t port, uint8_t is_multicast)
+{
+    PROFILE_BEGIN(mark);
+    int size = assemble(src_addr, dst_addr, entries, num_entries, port, is_multicast);
+    PROFILE_END(mark, PROFILE_ASSEMBLE);
+    if (_check_dma_busy())
+        _wait_for_dma();
+    HAL_WRITE32(DMA_CPU_STB, 0);
+    HAL_WRITE8(DMA_OUT_PORT_ID, port);
+    TRACE_EVENT(TRACE_TX, port, size, is_multicast);
+    STATS_INC_AT(tx_packets, port);
+    STATS_ADD_AT(tx_bytes, port, size);
+    _grant_dma_access(DMA_BLOCK_RADDR, size, 0);
+    HAL_WRITE32(DMA_OUT_LENGTH, 0);
+}
+
+/**
+ * @brief The longest aggregate of a port that covers a prefix.
+ * @return The aggregate, NULL if none covers it.
+ */
+static struct aggregate *find_aggregate(struct ip6_addr *prefix, uint8_t prefix_len, uint8_t port)
+{
+    struct aggregate *found = NULL;
+    for (int a = 0; a < aggregate_num; a++)
+    {
+        struct aggregate *aggregate = aggregates + a;
+        if ((aggregate->ports & (1 << port)) && prefix_len >= aggregate->prefix_len &&
+            (found == NULL || aggregate->prefix_len > found->prefix_len) &&
+            (prefix->s6_addr32[0] & aggregate->mask.s6_addr32[0]) == aggregate->prefix.s6_addr32[0] &&
+            (prefix->s6_addr32[1] & aggregate->mask.s6_addr32[1]) == aggregate->prefix.s6_addr32[1] &&
+            (prefix->s6_addr32[2] & aggregate->mask.s6_addr32[2]) == aggregate->prefix.s6_addr32[2] &&
+            (prefix->s6_addr32[3] & aggregate->mask.s6_addr32[3]) == aggregate->prefix.s6_addr32[3])
+        {
+            found = aggregate;
+        }
+    }
+    return found;
+}
+
+/**
+ * @brief Add an entry to a response, the entries are sent once they fill a packet.
+ */
+static void response_add(struct ripng_rte *entries, int *num_entries, struct ip6_addr *prefix, uint8_t prefix_len, uint8_t metric,
+                         struct ip6_addr *dst_addr, uint8_t port, uint8_t is_multicast)
+{
+    entries[*num_entries].ip6_addr = *prefix;
+    entries[*num_entries].prefix_len = prefix_len;
+    entries[*num_entries].metric = metric;
+    entries[*num_entries].route_tag = 0;
+    (*num_entries)++;
+    if (*num_entries == RIPNG_MAX_RTE_NUM)
+    {
+        send_packet(ip_addrs + port, dst_addr, entries, RIPNG_MAX_RTE_NUM, port, is_multicast);
+        *num_entries = 0;
+    }
+}
+
+/**
+ * @brief The metric of a route as advertised on a port, with split horizon with poisoned reverse.
+ */
+static uint8_t route_metric(struct memory_rte *rte, uint8_t port)
+{
+    return ((PORT_ID(rte) == port) && (!ISDIRECT(rte))) ? 16 : rte->metric;
+}
+
+/**
+ * @brief Take the new metric of a route behind an aggregate into account, for a triggered update.
+ * @return 1 if the aggregate got better and is to be sent, 0 otherwise.
+ * @note An aggregate that may have got worse is counted again by the next unsolicited response.
+ */
+static int aggregate_changed(int a, uint8_t port, uint8_t metric)
+{
+    uint8_t advertised = aggregate_metrics[port][a] ? aggregate_metrics[port][a] : 16;
+    if (metric < advertised)
+    {
+        aggregate_metrics[port][a] = metric;
+        return 1;
+    }
+    if (metric > advertised)
+    {
+        aggregate_stale[port] |= 1 << a;
+    }
+    return 0;
+}
+
+/**
+ * @brief The best metrics of the aggregates on every port, over the whole table.
+ * @param metrics Set to the best metric of the routes behind each aggregate, 0 if none.
+ */
+static void count_aggregates(uint8_t metrics[PORT_NUM][NUM_AGGREGATE])
+{
+    for (int p = 0; p < PORT_NUM; p++)
+    {
+        for (int a = 0; a < aggregate_num; a++)
+        {
+            metrics[p][a] = 0;
+        }
+    }
+    for (int i = 1; i < spare_memory_index; i++)
+    {
+        struct memory_rte *rte = memory_rte + i;
+        if (ISINVALID(rte))
+        {
+            continue;
+        }
+        for (int p = 0; p < PORT_NUM; p++)
+        {
+            struct aggregate *aggregate = find_aggregate(&(rte->ip6_addr), rte->prefix_len, p);
+            uint8_t metric = route_metric(rte, p);
+            if (aggregate != NULL && (metrics[p][aggregate - aggregates] == 0 || metric < metrics[p][aggregate - aggregates]))
+            {
+                metrics[p][aggregate - aggregates] = metric;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Add a route to a response, with split horizon with poisoned reverse.
+ * @param metrics The best metrics of the aggregates so far, 0 if none. A route
+ *  covered by an aggregate of the port only counts for the metric of the
+ *  aggregate. If metrics is NULL, the aggregate is sent instead if it got
+ *  better, see aggregate_changed().
+ */
+static void response_add_route(struct ripng_rte *entries, int *num_entries, struct memory_rte *rte, uint8_t *metrics,
+                               struct ip6_addr *dst_addr, uint8_t port, uint8_t is_multicast)
+{
+    uint8_t metric = route_metric(rte, port);
+    struct aggregate *aggregate = find_aggregate(&(rte->ip6_addr), rte->prefix_len, port);
+    if (aggregate != NULL)
+    {
+        // Suppressed, it only counts for the metric of its aggregate
+        int a = aggregate - aggregates;
+        if (metrics == NULL)
+        {
+            if (aggregate_changed(a, port, metric))
+            {
+                response_add(entries, num_entries, &(aggregate->prefix), aggregate->prefix_len, metric, dst_addr, port, is_multicast);
+            }
+        }
+        else if (metrics[a] == 0 || metric < metrics[a])
+        {
+            metrics[a] = metric;
+        }
+        return;
+    }
+    response_add(entries, num_entries, &(rte->ip6_addr), rte->prefix_len, metric, dst_addr, port, is_multicast);
+}
+
+/**
+ * @brief Add the aggregates that covered some route to a response.
+ * @param metrics The best metrics of the aggregates, see response_add_route().
+ * @note On multicast, an aggregate that covers no route any more is sent with
+ *  metric 16, in this response and the next one.
+ */
+static void response_add_aggregates(struct ripng_rte *entries, int *num_entries, uint8_t *metrics,
+                                    struct ip6_addr *dst_addr, uint8_t port, uint8_t is_multicast)
+{
+    for (int a = 0; a < aggregate_num; a++)
+    {
+        uint8_t metric = metrics[a];
+        if (is_multicast)
+        {
+            if (metric == 0 && aggregate_metrics[port][a] != 0)
+            {
+                // Withdrawn
+                metric = 16;
+                aggregate_metrics[port][a] = (aggregate_metrics[port][a] == 16) ? 0 : 16;
+            }
+            else
+            {
+                aggregate_metrics[port][a] = metric;
+            }
+        }
+        if (metric != 0)
+        {
+            response_add(entries, num_entries, &(aggregates[a].prefix), aggregates[a].prefix_len, metric, dst_addr, port, is_multicast);
+        }
+    }
+}
+
 /**
  * @brief Send response.
  * @note  This function will block until the whole routing table is sent.
  *  No multicast logic should be in and after this function.
+ *  The routes covered by an aggregate of the port are left out of the whole
+ *  table and of multicast entries, the aggregate is sent instead with the table.
  * @param src_addr_v The source address of the packet.
  * @param dst_addr_v The destination address of the packet.
  * @param entries_v The routing table entries.
@@ -768,80 +1292,180 @@ void send_response(void *src_addr_v, void *dst_addr_v, void *entries_v, int num_
     struct ripng_rte *entries = (struct ripng_rte *)entries_v;
     struct ip6_addr *src_addr = (struct ip6_addr *)src_addr_v;
     struct ip6_addr *dst_addr = (struct ip6_addr *)dst_addr_v;
+    PROFILE_BEGIN(mark);
     if (entries == NULL)
     {
         int send_entry_num = 0;
         struct ripng_rte send_entries[RIPNG_MAX_RTE_NUM];
+        uint8_t metrics[NUM_AGGREGATE];
+        for (int a = 0; a < aggregate_num; a++)
+        {
+            metrics[a] = 0;
+        }
         for (int i = 1; i < spare_memory_index; i++)
         {
             if (update_memory_rte(memory_rte + i))
             {
-                send_entries[send_entry_num].ip6_addr = memory_rte[i].ip6_addr;
-                send_entries[send_entry_num].prefix_len = memory_rte[i].prefix_len;
-                send_entries[send_entry_num].metric = (
-                    (PORT_ID(memory_rte + i) == port)
-                    && (!ISDIRECT(memory_rte + i))
-                ) ? 16 : memory_rte[i].metric;
-                send_entries[send_entry_num].route_tag = 0;
-                send_entry_num++;
-                if (send_entry_num == RIPNG_MAX_RTE_NUM)
-                {
-                    int size = assemble(ip_addrs + port, dst_addr, send_entries, RIPNG_MAX_RTE_NUM, port, is_multicast);
-                    if (_check_dma_busy())
-                        _wait_for_dma();
-                    *((volatile uint32_t *)DMA_CPU_STB) = 0;
-                    *(volatile uint8_t *)DMA_OUT_PORT_ID = port;
-                    _grant_dma_access(DMA_BLOCK_RADDR, size, 0);
-                    *(volatile uint32_t *)DMA_OUT_LENGTH = 0;
-                    send_entry_num = 0;
-                }
+                response_add_route(send_entries, &send_entry_num, memory_rte + i, metrics, dst_addr, port, is_multicast);
             }
         }
+        response_add_aggregates(send_entries, &send_entry_num, metrics, dst_addr, port, is_multicast);
+        if (is_multicast)
+        {
+            aggregate_stale[port] = 0;
+        }
         if (send_entry_num > 0)
         {
-            int size = assemble(ip_addrs + port, dst_addr, send_entries, send_entry_num, port, is_multicast);
-            if (_check_dma_busy())
-                _wait_for_dma();
-            *((volatile uint32_t *)DMA_CPU_STB) = 0;
-            *(volatile uint8_t *)DMA_OUT_PORT_ID = port;
-            _grant_dma_access(DMA_BLOCK_RADDR, size, 0);
-            *(volatile uint32_t *)DMA_OUT_LENGTH = 0;
+            send_packet(ip_addrs + port, dst_addr, send_entries, send_entry_num, port, is_multicast);
         }
     }
     else
     {
+        if (is_multicast && aggregate_num > 0)
+        {
+            // Triggered updates leave out the routes behind an aggregate, the aggregate is sent instead if it got better
+            int kept = 0;
+            for (int i = 0; i < num_entries; i++)
+            {
+                struct aggregate *aggregate = find_aggregate(&(entries[i].ip6_addr), entries[i].prefix_len, port);
+                if (aggregate == NULL)
+                {
+                    entries[kept++] = entries[i];
+                }
+                else if (aggregate_changed(aggregate - aggregates, port, entries[i].metric))
+                {
+                    entries[kept] = entries[i];
+                    entries[kept].ip6_addr = aggregate->prefix;
+                    entries[kept].prefix_len = aggregate->prefix_len;
+                    kept++;
+                }
+            }
+            num_entries = kept;
+            if (num_entries == 0)
+            {
+                PROFILE_END(mark, PROFILE_SEND_RESPONSE);
+                return;
+            }
+        }
         int start_entrie = 0;
         while ((num_entries - start_entrie) > RIPNG_MAX_RTE_NUM)
         {
-            int size = assemble(src_addr, dst_addr, &entries[start_entrie], RIPNG_MAX_RTE_NUM, port, is_multicast);
-            if (_check_dma_busy())
-                _wait_for_dma();
-            *((volatile uint32_t *)DMA_CPU_STB) = 0;
-            *(volatile uint8_t *)DMA_OUT_PORT_ID = port;
-            _grant_dma_access(DMA_BLOCK_RADDR, size, 0);
-            *(volatile uint32_t *)DMA_OUT_LENGTH = 0;
+            send_packet(src_addr, dst_addr, &entries[start_entrie], RIPNG_MAX_RTE_NUM, port, is_multicast);
             start_entrie += RIPNG_MAX_RTE_NUM;
         }
-        int size = assemble(src_addr, dst_addr, &entries[start_entrie], num_entries - start_entrie, port, is_multicast);
-        if (_check_dma_busy())
-            _wait_for_dma();
-        *((volatile uint32_t *)DMA_CPU_STB) = 0;
-        *(volatile uint8_t *)DMA_OUT_PORT_ID = port;
-        _grant_dma_access(DMA_BLOCK_RADDR, size, 0);
-        *(volatile uint32_t *)DMA_OUT_LENGTH = 0;
+        send_packet(src_addr, dst_addr, &entries[start_entrie], num_entries - start_entrie, port, is_multicast);
     }
+    PROFILE_END(mark, PROFILE_SEND_RESPONSE);
 }
 
 /**
  * @brief Send unsolicited response.
- * @note This function will block until the whole routing table is sent.
+ * @note This function will block until the response is sent.
+ *  The routes queued by mark_changed() go with the next slice of the table,
+ *  the slices cover the table once every REFRESH_TIME_LIMIT. The timers are
+ *  checked by sweep_timers(), not by the slice. The aggregates go
+ *  with the last slice, and as soon as they change, see aggregate_changed(). The whole table is sent if too many routes changed.
  * @author Jason Fu
  */
 void send_unsolicited_response()
 {
     struct ip6_addr dst_addr = {.s6_addr32 = MULTICAST_ADDR};
+    if (changed_overflow)
+    {
+        for (int p = 0; p < PORT_NUM; p++)
+        {
+            send_response(ip_addrs + p, &dst_addr, NULL, 0, p, 1);
+        }
+        for (int i = 1; i < spare_memory_index; i++)
+        {
+            memory_rte[i].nexthop_port &= ~0x20;
+        }
+        changed_num = 0;
+        changed_overflow = 0;
+        return;
+    }
+    if (refresh_cursor >= spare_memory_index)
+    {
+        refresh_cursor = 1;
+    }
+    int slice = (spare_memory_index - 1 + REFRESH_TICKS - 1) / REFRESH_TICKS;
+    int end = refresh_cursor + slice;
+    // A slice past the end of the table goes on from its start, so that every route is sent
+    // within REFRESH_TICKS even when the cursor is not where a round started
+    int wrap_end = 1;
+    if (end > spare_memory_index)
+    {
+        wrap_end = 1 + end - spare_memory_index;
+        end = spare_memory_index;
+    }
+    // The aggregates that may have got worse are counted again, the ones that changed go with this update
+    uint8_t counted[PORT_NUM][NUM_AGGREGATE];
+    int recount = 0;
+    for (int p = 0; p < PORT_NUM; p++)
+    {
+        recount |= aggregate_stale[p];
+    }
+    if (recount)
+    {
+        count_aggregates(counted);
+    }
     for (int p = 0; p < PORT_NUM; p++)
     {
-        send_response(ip_addrs + p, &dst_addr, NULL, 0, p, 1);
+        int send_entry_num = 0;
+        struct ripng_rte send_entries[RIPNG_MAX_RTE_NUM];
+        for (int i = refresh_cursor; i < end; i++)
+        {
+            if (ISVALID(memory_rte + i))
+            {
+                response_add_route(send_entries, &send_entry_num, memory_rte + i, refresh_metrics[p], &dst_addr, p, 1);
+            }
+        }
+        for (int c = 0; c < changed_num; c++)
+        {
+            int mem_id = changed_routes[c];
+            if ((mem_id < refresh_cursor || mem_id >= end) && mem_id >= wrap_end && ISVALID(memory_rte + mem_id))
+            {
+                response_add_route(send_entries, &send_entry_num, memory_rte + mem_id, NULL, &dst_addr, p, 1);
+            }
+        }
+        if (recount)
+        {
+            for (int a = 0; a < aggregate_num; a++)
+            {
+                // An aggregate that covers no route any more is withdrawn
+                uint8_t metric = counted[p][a] ? counted[p][a] : aggregate_metrics[p][a] ? 16 : 0;
+                if (((aggregate_stale[p] >> a) & 1) && metric != aggregate_metrics[p][a])
+                {
+                    aggregate_metrics[p][a] = metric;
+                    response_add(send_entries, &send_entry_num, &(aggregates[a].prefix), aggregates[a].prefix_len, metric, &dst_addr, p, 1);
+                }
+            }
+            aggregate_stale[p] = 0;
+        }
+        if (end == spare_memory_index)
+        {
+            response_add_aggregates(send_entries, &send_entry_num, refresh_metrics[p], &dst_addr, p, 1);
+            for (int a = 0; a < aggregate_num; a++)
+            {
+                refresh_metrics[p][a] = 0;
+            }
+        }
+        for (int i = 1; i < wrap_end; i++)
+        {
+            if (ISVALID(memory_rte + i))
+            {
+                response_add_route(send_entries, &send_entry_num, memory_rte + i, refresh_metrics[p], &dst_addr, p, 1);
+            }
+        }
+        if (send_entry_num > 0)
+        {
+            send_packet(ip_addrs + p, &dst_addr, send_entries, send_entry_num, p, 1);
+        }
+    }
+    for (int c = 0; c < changed_num; c++)
+    {
+        memory_rte[changed_routes[c]].nexthop_port &= ~0x20;
     }
+    changed_num = 0;
+    refresh_cursor = (end == spare_memory_index) ? wrap_end : end;
 }
\ No newline at end of file
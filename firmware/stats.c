@@ -0,0 +1,62 @@
+// Counters of the control plane, see include/stats.h
+#include "stdint.h"
+#include "ripng.h"
+#include "protocol.h"
+#include "stats.h"
+
+// The counters must follow the tables they are indexed by
+typedef char stats_ports_check[(STATS_PORTS == PORT_NUM) ? 1 : -1];
+typedef char stats_errors_check[(STATS_ERRORS == ERR_PREFIX_LIMIT + 1) ? 1 : -1];
+
+struct router_stats router_stats;
+
+struct stats_counter
+{
+    const char *name;
+    const uint32_t *values;
+    int count;
+};
+
+static const struct stats_counter stats_counters[] = {
+#define STATS_ENTRY(name, count) {#name, router_stats.name, (count)},
+    STATS_COUNTERS(STATS_ENTRY)
+#undef STATS_ENTRY
+};
+
+#define STATS_NUM_COUNTERS ((int)(sizeof(stats_counters) / sizeof(stats_counters[0])))
+
+void stats_clear()
+{
+    uint32_t *words = (uint32_t *)&router_stats;
+    for (uint32_t i = 0; i < STATS_WORDS; i++)
+    {
+        words[i] = 0;
+    }
+}
+
+int stats_counter(int i, const char **name, const uint32_t **values)
+{
+    if (i < 0 || i >= STATS_NUM_COUNTERS)
+    {
+        return 0;
+    }
+    *name = stats_counters[i].name;
+    *values = stats_counters[i].values;
+    return stats_counters[i].count;
+}
+
+void stats_frame(uint8_t *frame)
+{
+    uint8_t *bytes = (uint8_t *)&router_stats;
+    uint8_t sum = 0;
+    frame[0] = 'S';
+    frame[1] = 'T';
+    frame[2] = STATS_WORDS & 0xff;
+    frame[3] = STATS_WORDS >> 8;
+    for (uint32_t i = 0; i < sizeof(struct router_stats); i++)
+    {
+        frame[4 + i] = bytes[i];
+        sum += bytes[i];
+    }
+    frame[STATS_FRAME_LEN - 1] = sum;
+}
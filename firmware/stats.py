@@ -0,0 +1,51 @@
+import os
+import re
+import struct
+import sys
+
+# Decode the statistics frames of the dump command of the console in a capture
+# of the UART (see include/stats.h).
+#   python stats.py uart.bin
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+with open(os.path.join(HERE, 'include', 'stats.h')) as header:
+    text = header.read()
+# The STATS_* sizes, then X(name, count) of STATS_COUNTERS, in order
+SIZES = {name: int(value) for name, value in re.findall(r'#define (STATS_\w+) (\d+)', text)}
+COUNTERS = [(name, SIZES[count] if count in SIZES else int(count))
+            for name, count in re.findall(r'X\((\w+), (\w+)\)',
+                                          re.search(r'define STATS_COUNTERS.*?\n\n', text, re.S).group(0))]
+WORDS = sum(count for _, count in COUNTERS)
+
+
+def show(words):
+    i = 0
+    for name, count in COUNTERS:
+        print('{:20s} {}'.format(name, ' '.join(str(word) for word in words[i:i + count])))
+        i += count
+
+
+if len(sys.argv) != 2:
+    print('usage: python {} uart.bin'.format(sys.argv[0]), file=sys.stderr)
+    sys.exit(1)
+
+with open(sys.argv[1], 'rb') as capture:
+    data = capture.read()
+
+# A frame is 'ST', the number of words, the words and the sum of their bytes
+frames = bad = 0
+i = data.find(b'ST')
+while 0 <= i and i + 4 <= len(data):
+    words, = struct.unpack('<H', data[i + 2:i + 4])
+    end = i + 4 + 4 * words
+    if words != WORDS or end >= len(data) or sum(data[i + 4:end]) & 0xff != data[end]:
+        bad += 1
+        i = data.find(b'ST', i + 1)
+        continue
+    if frames:
+        print()
+    show(struct.unpack('<{}I'.format(words), data[i + 4:end]))
+    frames += 1
+    i = data.find(b'ST', end + 1)
+print('{} dumps, {} damaged frames skipped'.format(frames, bad), file=sys.stderr)
@@ -1,11 +1,12 @@
 #include <timer.h>
 #include <stdint.h>
+#include <hal.h>
 
 uint32_t multicast_timer_ldata = 0;
 
 int check_timeout(uint32_t time_llimit, uint32_t timer_ldata)
 {
-    uint32_t cur_timer_ldata = *((volatile uint32_t *)MTIME_LADDR);
+    uint32_t cur_timer_ldata = HAL_READ32(MTIME_LADDR);
 
     // Add the time limit to the timer
     uint32_t timer_interval = (cur_timer_ldata - timer_ldata) & 0xFF;
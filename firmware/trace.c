@@ -0,0 +1,88 @@
+// Binary event trace, see include/trace.h
+#ifdef TRACE
+#include "stdint.h"
+#include "hal.h"
+#include "timer.h"
+#include "uart.h"
+#include "trace.h"
+
+struct trace_entry trace_entries[TRACE_ENTRIES];
+uint32_t trace_head = 0;  // next entry to record
+uint32_t trace_tail = 0;  // next entry to send
+uint32_t trace_byte = 0;  // next byte of the frame of trace_tail
+uint32_t trace_lost = 0;  // events dropped since the last TRACE_LOST
+
+static int trace_put(uint32_t event, uint32_t a0, uint32_t a1, uint32_t a2)
+{
+    uint32_t next = (trace_head + 1) & (TRACE_ENTRIES - 1);
+    if (next == trace_tail)
+    {
+        return 0;
+    }
+    struct trace_entry *entry = trace_entries + trace_head;
+    entry->time = HAL_READ32(MTIME_LADDR);
+    entry->event = event;
+    entry->args[0] = a0;
+    entry->args[1] = a1;
+    entry->args[2] = a2;
+    trace_head = next;
+    return 1;
+}
+
+void trace_record(uint32_t event, uint32_t a0, uint32_t a1, uint32_t a2)
+{
+    if (trace_lost && trace_put(TRACE_LOST, trace_lost, 0, 0))
+    {
+        trace_lost = 0;
+    }
+    if (trace_lost || !trace_put(event, a0, a1, a2))
+    {
+        trace_lost++;
+    }
+}
+
+// Byte i of the frame of an entry
+static uint8_t trace_frame_byte(struct trace_entry *entry, uint32_t i)
+{
+    uint8_t *data = (uint8_t *)entry;
+    if (i == 0)
+    {
+        return 'T';
+    }
+    if (i == 1)
+    {
+        return 'R';
+    }
+    if (i < TRACE_FRAME_LEN - 1)
+    {
+        return data[i - 2];
+    }
+    uint8_t sum = 0;
+    for (uint32_t j = 0; j < sizeof(struct trace_entry); j++)
+    {
+        sum += data[j];
+    }
+    return sum;
+}
+
+void trace_poll()
+{
+    while (trace_tail != trace_head)
+    {
+        if (!_trychar(trace_frame_byte(trace_entries + trace_tail, trace_byte)))
+        {
+            return;
+        }
+        if (++trace_byte == TRACE_FRAME_LEN)
+        {
+            trace_byte = 0;
+            trace_tail = (trace_tail + 1) & (TRACE_ENTRIES - 1);
+        }
+    }
+}
+
+int trace_sending()
+{
+    return trace_byte != 0;
+}
+#endif
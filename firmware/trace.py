@@ -0,0 +1,92 @@
+import os
+import re
+import struct
+import sys
+
+# Decode the event trace in a capture of the UART (see include/trace.h), with the
+# log messages of include/log.h.
+#   python trace.py uart.bin
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+
+def enum(name):
+    # The members of an enum of trace.h, in order
+    with open(os.path.join(HERE, 'include', 'trace.h')) as header:
+        body = re.search(r'enum ' + name + r'\s*\{(.*?)\}', header.read(), re.S).group(1)
+    return re.findall(r'^\s*(TRACE_\w+)', body, re.M)
+
+
+EVENTS = enum('TraceEvent')
+TIMERS = enum('TraceTimer')
+
+# X(id, level, format) of LOG_MESSAGES, in order
+with open(os.path.join(HERE, 'include', 'log.h')) as header:
+    MESSAGES = re.findall(r'X\((LOG_\w+), (LOG_\w+), "((?:[^"\\]|\\.)*)"\)', header.read())
+
+
+def prefix(word0, word1, length):
+    # The words are in network order, as stored by the little-endian CPU
+    raw = struct.pack('<II', word0, word1)
+    groups = ['{:x}'.format((raw[i] << 8) | raw[i + 1]) for i in range(0, 8, 2)]
+    return '{}::/{}'.format(':'.join(groups), length & 0xff)
+
+
+def describe(event, a0, a1, a2):
+    name = EVENTS[event] if event < len(EVENTS) else 'event {}'.format(event)
+    if name == 'TRACE_LOST':
+        return 'lost {} events'.format(a0)
+    if name in ('TRACE_ROUTE_INSERT', 'TRACE_ROUTE_DELETE'):
+        text = '{} {}'.format('insert' if name == 'TRACE_ROUTE_INSERT' else 'delete', prefix(a0, a1, a2))
+        if name == 'TRACE_ROUTE_INSERT':
+            text += ' slot {}'.format((a2 >> 8) & 0xff)
+        return text + (' FAILED' if a2 >> 31 else '')
+    if name == 'TRACE_TIMER_EXPIRE':
+        timer = TIMERS[a0] if a0 < len(TIMERS) else str(a0)
+        return 'timer {} {}'.format(timer[len('TRACE_TIMER_'):].lower(), a1)
+    if name == 'TRACE_DMA_START':
+        return 'dma {} 0x{:08x} {} bytes'.format('in' if a2 else 'out', a0, a1)
+    if name == 'TRACE_DMA_ACK':
+        return 'dma ack' + (' (waited)' if a0 else '')
+    if name == 'TRACE_RX':
+        return 'rx port {} {} bytes'.format(a0, a1)
+    if name == 'TRACE_TX':
+        return 'tx port {} {} bytes{}'.format(a0, a1, ' multicast' if a2 else '')
+    if name == 'TRACE_ERROR':
+        return 'error {} port {} {} bytes'.format(a0, a1, a2)
+    if name == 'TRACE_LOG':
+        if a0 >= len(MESSAGES):
+            return 'log {} {:x} {:x}'.format(a0, a1, a2)
+        _, level, text = MESSAGES[a0]
+        args = iter((a1, a2))
+
+        def arg(match):
+            value = next(args)
+            if match.group(1) == 'd' and value >= 1 << 31:
+                value -= 1 << 32
+            return format(value, 'x' if match.group(1) == 'x' else 'd')
+        return '{} {}'.format(level[len('LOG_'):], re.sub(r'%([udx])', arg, text))
+    return '{} {:x} {:x} {:x}'.format(name, a0, a1, a2)
+
+
+if len(sys.argv) != 2:
+    print('usage: python {} uart.bin'.format(sys.argv[0]), file=sys.stderr)
+    sys.exit(1)
+
+with open(sys.argv[1], 'rb') as capture:
+    data = capture.read()
+
+# A frame is 'TR', 20 bytes and their sum, anything else on the UART is skipped
+frames = bad = 0
+i = data.find(b'TR')
+while 0 <= i and i + 23 <= len(data):
+    entry = data[i + 2:i + 22]
+    if sum(entry) & 0xff != data[i + 22]:
+        bad += 1
+        i = data.find(b'TR', i + 1)
+        continue
+    time, event, a0, a1, a2 = struct.unpack('<5I', entry)
+    print('{:10d} {}'.format(time, describe(event, a0, a1, a2)))
+    frames += 1
+    i = data.find(b'TR', i + 23)
+print('{} events, {} damaged frames skipped'.format(frames, bad), file=sys.stderr)
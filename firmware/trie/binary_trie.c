@@ -7,6 +7,7 @@
  */
 
 #include <packet.h>
+#include <trie.h>
 
 // ! Should not surpass 1024 !
 #define N 256
@@ -47,12 +48,17 @@ unsigned int BTrieAddressToIndex(void* address) {
 
 int bram_tops[16];
 int bram_empty_bottoms[16]; // lowest index of empty entry
+int bram_freed = 0;         // nodes have been freed since the last TrieSync
+int bt_bank = 0;            // bank being edited, see TRIE_BANK_ROOT
+
+// the entry points of both banks are never allocated or freed
+#define IS_ENTRY_POINT(level, index) ((level) == 0 && (index) >= 1 && (index) <= 4)
 
 // update the lowest empty index of the BRAM
 void BTrieUpdateBramEmptyBottom(int level) {
     for (int i = bram_empty_bottoms[level]; i < bram_tops[level]; i++) {
         // empty entry
-        if (*(volatile unsigned int*)CONSTRUCT_BRAM_ADDRESS(level, i) == 0) {
+        if (TRIE_LOAD(CONSTRUCT_BRAM_ADDRESS(level, i)) == 0) {
             bram_empty_bottoms[level] = i;
             return;
         }
@@ -82,7 +88,7 @@ int _BTrieLookup(void* prefix_ptr, int prefix_length, int *current_prefix_length
             // extract the entry
             int entry_level = LEVEL(address);
             int entry_index = INDEX(address);
-            unsigned int entry = *(volatile unsigned int*)CONSTRUCT_BRAM_ADDRESS(entry_level, entry_index);
+            unsigned int entry = TRIE_LOAD(CONSTRUCT_BRAM_ADDRESS(entry_level, entry_index));
 
             unsigned int lc = LC(entry);
             unsigned int rc = RC(entry);
@@ -90,7 +96,7 @@ int _BTrieLookup(void* prefix_ptr, int prefix_length, int *current_prefix_length
             if (lsb == 0) {
                 // turn left
                 if (i == 0) {
-                    address = CONSTRUCT_BRAM_ADDRESS(0, 1);
+                    address = CONSTRUCT_BRAM_ADDRESS(0, TRIE_BANK_ROOT(bt_bank, 0));
                 } else {
                     if (lc == 0) {
                         break;
@@ -101,7 +107,7 @@ int _BTrieLookup(void* prefix_ptr, int prefix_length, int *current_prefix_length
             } else {
                 // turn right
                 if (i == 0) {
-                    address = CONSTRUCT_BRAM_ADDRESS(0, 2);
+                    address = CONSTRUCT_BRAM_ADDRESS(0, TRIE_BANK_ROOT(bt_bank, 1));
                 } else {
                     if (rc == 0) {
                         break;
@@ -119,75 +125,92 @@ int _BTrieLookup(void* prefix_ptr, int prefix_length, int *current_prefix_length
 /**
  *
  * @brief Insert a prefix into the binary trie
- * @return 0 - success, 1 - invalid prefix length, 2 - out of memory
+ * @note The missing part of the path is built bottom-up while it is unreachable,
+ * and then linked into the trie with a single store, so lookups see either none
+ * or all of it.
+ * @return the index of the entry, -1 - invalid prefix length, -2 - out of memory
  *
  */
 int BTrieInsert(void* prefix_ptr, int prefix_length, unsigned int next_hop_addr) {
     struct ip6_addr prefix = *(struct ip6_addr*)prefix_ptr;
+    if (prefix_length <= 0 || prefix_length > 128) {
+        return -1;
+    }
 	int current_prefix_length = 0;
     int address = _BTrieLookup(prefix_ptr, prefix_length, &current_prefix_length);
-    int address_to_write = address;
-    if (current_prefix_length < prefix_length) {
-        // the prefix does not exist
-        for (int i = current_prefix_length; i < prefix_length; i++) {
-            int lsb = LSB(prefix.s6_addr32, i);
-            int level = (i >> 3) & 0xF;
-
-            // extract the entry
-            int entry_level = LEVEL(address_to_write);
-            int entry_index = INDEX(address_to_write);
-            unsigned int entry = *(volatile unsigned int*)CONSTRUCT_BRAM_ADDRESS(entry_level, entry_index);
-            unsigned int valid = VALID(entry);
-            unsigned int entry_next_hop_addr = NEXT_HOP_ADDR(entry);
-            unsigned int lc = LC(entry);
-            unsigned int rc = RC(entry);
-
-            // construct a new entry
-            int new_index = bram_empty_bottoms[level];
-            bram_empty_bottoms[level] += 1;
 
-            // update top pointer
-            if (new_index == bram_tops[level]) {
-                bram_tops[level] += 1;
-            }
+    // extract the entry
+    int entry_level = LEVEL(address);
+    int entry_index = INDEX(address);
+    unsigned int entry = TRIE_LOAD(CONSTRUCT_BRAM_ADDRESS(entry_level, entry_index));
+    unsigned int valid = VALID(entry);
+    unsigned int entry_next_hop_addr = NEXT_HOP_ADDR(entry);
+    unsigned int lc = LC(entry);
+    unsigned int rc = RC(entry);
 
-            // update the lowest empty index
-            BTrieUpdateBramEmptyBottom(level);
+    if (current_prefix_length == prefix_length) {
+        // the prefix already exists, update the entry
+        TRIE_STORE(CONSTRUCT_BRAM_ADDRESS(entry_level, entry_index), CONSTRUCT_BRAM_ENTRY(1, next_hop_addr, rc, lc));
+        return BTrieAddressToIndex((void*)address);
+    }
 
-            // check if the BRAM is full
-            if (bram_tops[level] >= 8 * N) {
-                return -2;
-            }
+    // the prefix does not exist, allocate the missing nodes
+    int new_indices[128];
+    for (int i = current_prefix_length; i < prefix_length; i++) {
+        int level = (i >> 3) & 0xF;
+        int new_index = bram_empty_bottoms[level];
+        bram_empty_bottoms[level] += 1;
+        new_indices[i] = new_index;
+
+        // update top pointer
+        if (new_index == bram_tops[level]) {
+            bram_tops[level] += 1;
+        }
 
-            // Construct a new entry (should not be 0)
-	        *(volatile unsigned int*)CONSTRUCT_BRAM_ADDRESS(level, new_index) = CONSTRUCT_BRAM_ENTRY(0, 1, 0, 0);
-            address_to_write = CONSTRUCT_BRAM_ADDRESS(level, new_index);
+        // update the lowest empty index
+        BTrieUpdateBramEmptyBottom(level);
 
-            if (lsb == 0) {
-                // turn left
-	            *(volatile unsigned int*)CONSTRUCT_BRAM_ADDRESS(entry_level, entry_index) = CONSTRUCT_BRAM_ENTRY(valid, entry_next_hop_addr, rc, new_index);
-            } else {
-                // turn right
-	            *(volatile unsigned int*)CONSTRUCT_BRAM_ADDRESS(entry_level, entry_index) = CONSTRUCT_BRAM_ENTRY(valid, entry_next_hop_addr, new_index, lc);
+        // check if the BRAM is full
+        if (new_index >= 8 * N - 1) {
+            // nothing has been linked yet, give the nodes back
+            for (int j = current_prefix_length; j <= i; j++) {
+                int j_level = (j >> 3) & 0xF;
+                if (new_indices[j] < bram_empty_bottoms[j_level]) {
+                    bram_empty_bottoms[j_level] = new_indices[j];
+                }
             }
+            return -2;
         }
     }
 
-    // write the entry
-
-    // the prefix already exists
-    int entry_level = LEVEL(address_to_write);
-    int entry_index = INDEX(address_to_write);
+    // a reused node may still be visited by lookups that read its old parent
+    if (bram_freed) {
+        TrieSync();
+        bram_freed = 0;
+    }
 
-    // extract the entry
-    unsigned int entry = *(volatile unsigned int*)CONSTRUCT_BRAM_ADDRESS(entry_level, entry_index);
-    unsigned int lc = LC(entry);
-    unsigned int rc = RC(entry);
+    // construct the new nodes from the bottom (should not be 0)
+    int leaf_level = ((prefix_length - 1) >> 3) & 0xF;
+    TRIE_STORE(CONSTRUCT_BRAM_ADDRESS(leaf_level, new_indices[prefix_length - 1]), CONSTRUCT_BRAM_ENTRY(1, next_hop_addr, 0, 0));
+    for (int i = prefix_length - 2; i >= current_prefix_length; i--) {
+        int level = (i >> 3) & 0xF;
+        if (LSB(prefix.s6_addr32, i + 1) == 0) {
+            TRIE_STORE(CONSTRUCT_BRAM_ADDRESS(level, new_indices[i]), CONSTRUCT_BRAM_ENTRY(0, 1, 0, new_indices[i + 1]));
+        } else {
+            TRIE_STORE(CONSTRUCT_BRAM_ADDRESS(level, new_indices[i]), CONSTRUCT_BRAM_ENTRY(0, 1, new_indices[i + 1], 0));
+        }
+    }
 
-    // update the entry
-    *(volatile unsigned int*)CONSTRUCT_BRAM_ADDRESS(entry_level, entry_index) = CONSTRUCT_BRAM_ENTRY(1, next_hop_addr, rc, lc);
+    // link the new path into the trie
+    if (LSB(prefix.s6_addr32, current_prefix_length) == 0) {
+        // turn left
+        TRIE_STORE(CONSTRUCT_BRAM_ADDRESS(entry_level, entry_index), CONSTRUCT_BRAM_ENTRY(valid, entry_next_hop_addr, rc, new_indices[current_prefix_length]));
+    } else {
+        // turn right
+        TRIE_STORE(CONSTRUCT_BRAM_ADDRESS(entry_level, entry_index), CONSTRUCT_BRAM_ENTRY(valid, entry_next_hop_addr, new_indices[current_prefix_length], lc));
+    }
 
-    return BTrieAddressToIndex((void*)CONSTRUCT_BRAM_ADDRESS(entry_level, entry_index));
+    return BTrieAddressToIndex((void*)CONSTRUCT_BRAM_ADDRESS(leaf_level, new_indices[prefix_length - 1]));
 }
 
 /**
@@ -206,7 +229,7 @@ int BTrieDelete(void* prefix_ptr, int prefix_length) {
     int entry_index = INDEX(address);
 
     // extract the entry
-    unsigned int entry = *(volatile unsigned int*)CONSTRUCT_BRAM_ADDRESS(entry_level, entry_index);
+    unsigned int entry = TRIE_LOAD(CONSTRUCT_BRAM_ADDRESS(entry_level, entry_index));
     unsigned int lc = LC(entry);
     unsigned int rc = RC(entry);
 
@@ -215,14 +238,15 @@ int BTrieDelete(void* prefix_ptr, int prefix_length) {
     }
 
     // update the entry
-	*(volatile unsigned int*)CONSTRUCT_BRAM_ADDRESS(entry_level, entry_index) = CONSTRUCT_BRAM_ENTRY(0, 0, rc, lc);
+	TRIE_STORE(CONSTRUCT_BRAM_ADDRESS(entry_level, entry_index), CONSTRUCT_BRAM_ENTRY(0, 0, rc, lc));
 
     // leaf node
     if (lc == 0 && rc == 0) {
+        bram_freed = 1;
         // update the bram bottom pointer
         if (entry_index < bram_empty_bottoms[entry_level]) {
             // entry point should not be pointed to
-            if (!(entry_level == 0 && (entry_index == 1 || entry_index == 2))) {
+            if (!IS_ENTRY_POINT(entry_level, entry_index)) {
                 bram_empty_bottoms[entry_level] = entry_index;
             }
         }
@@ -248,7 +272,7 @@ int BTrieDelete(void* prefix_ptr, int prefix_length) {
             }
 
             // extract the parent entry
-            unsigned int parent_entry = *(volatile unsigned int*)CONSTRUCT_BRAM_ADDRESS(parent_level, parent_index);
+            unsigned int parent_entry = TRIE_LOAD(CONSTRUCT_BRAM_ADDRESS(parent_level, parent_index));
             unsigned int parent_valid = VALID(parent_entry);
             unsigned int parent_next_hop_addr = parent_valid ? NEXT_HOP_ADDR(parent_entry) : 0;
             unsigned int parent_lc = LC(parent_entry);
@@ -259,29 +283,30 @@ int BTrieDelete(void* prefix_ptr, int prefix_length) {
             if (lsb == 0) {
                 // lc
                 if (parent_lc == prev_index) {
-	                *(volatile unsigned int*)CONSTRUCT_BRAM_ADDRESS(parent_level, parent_index) = CONSTRUCT_BRAM_ENTRY(parent_valid, parent_next_hop_addr, parent_rc, 0);
+	                TRIE_STORE(CONSTRUCT_BRAM_ADDRESS(parent_level, parent_index), CONSTRUCT_BRAM_ENTRY(parent_valid, parent_next_hop_addr, parent_rc, 0));
                 } else {
                     return -3;
                 }
             } else {
                 // rc
                 if (parent_rc == prev_index) {
-	                *(volatile unsigned int*)CONSTRUCT_BRAM_ADDRESS(parent_level, parent_index) = CONSTRUCT_BRAM_ENTRY(parent_valid, parent_next_hop_addr, 0, parent_lc);
+	                TRIE_STORE(CONSTRUCT_BRAM_ADDRESS(parent_level, parent_index), CONSTRUCT_BRAM_ENTRY(parent_valid, parent_next_hop_addr, 0, parent_lc));
                 } else {
                     return -3;
                 }
             }
 
             // check whether the node is entry point
-            if (parent_level == 0 && (parent_index == 1 || parent_index == 2)) {
+            if (IS_ENTRY_POINT(parent_level, parent_index)) {
                 should_stop = 1;
             } else {
                 // check whether the parent node is now a leaf node
-                parent_entry = *(volatile unsigned int*)CONSTRUCT_BRAM_ADDRESS(parent_level, parent_index);
+                parent_entry = TRIE_LOAD(CONSTRUCT_BRAM_ADDRESS(parent_level, parent_index));
                 parent_lc = LC(parent_entry);
                 parent_rc = RC(parent_entry);
                 if (parent_valid == 0 && parent_lc == 0 && parent_rc == 0) {
                     prev_index = parent_index;
+                    bram_freed = 1;
                     // update the bram bottom pointer
                     if (parent_index < bram_empty_bottoms[parent_level]) {
                         bram_empty_bottoms[parent_level] = parent_index;
@@ -295,26 +320,114 @@ int BTrieDelete(void* prefix_ptr, int prefix_length) {
     return BTrieAddressToIndex((void*)address);
 }
 
-void BTrieInitBram() {
+/**
+ * @brief Empty a bank without freeing its nodes, only valid before BTrieInitBram
+ */
+void BTrieClearBank(int bank) {
+    TRIE_STORE(CONSTRUCT_BRAM_ADDRESS(0, TRIE_BANK_ROOT(bank, 0)), CONSTRUCT_BRAM_ENTRY(0, 0, 0, 0));
+    TRIE_STORE(CONSTRUCT_BRAM_ADDRESS(0, TRIE_BANK_ROOT(bank, 1)), CONSTRUCT_BRAM_ENTRY(0, 0, 0, 0));
+}
+
+/**
+ * @brief Reset the binary trie in constant time, and direct the following updates to a bank
+ * @note Only the entry points are cleared. A node above bram_tops is written as a whole
+ * when it is allocated, so its stale contents never become reachable.
+ */
+void BTrieInitBram(int bank) {
     for (int i = 0; i < 16; i++) {
-	    *(volatile unsigned int*)CONSTRUCT_BRAM_ADDRESS(i, 0) = 0;
+	    TRIE_STORE(CONSTRUCT_BRAM_ADDRESS(i, 0), 0);
         bram_tops[i] = 1;
         bram_empty_bottoms[i] = 1;
     }
-    // initialize the enter points
-	*(volatile unsigned int*)CONSTRUCT_BRAM_ADDRESS(0, 1) = CONSTRUCT_BRAM_ENTRY(0, 0, 0, 0);
-	*(volatile unsigned int*)CONSTRUCT_BRAM_ADDRESS(0, 2) = CONSTRUCT_BRAM_ENTRY(0, 0, 0, 0);
-    bram_tops[0] = 3;
-    bram_empty_bottoms[0] = 3;
+    bram_freed = 0;
+    // initialize the enter points of both banks
+    for (int i = 1; i <= 4; i++) {
+	    TRIE_STORE(CONSTRUCT_BRAM_ADDRESS(0, i), CONSTRUCT_BRAM_ENTRY(0, 0, 0, 0));
+    }
+    bram_tops[0] = 5;
+    bram_empty_bottoms[0] = 5;
+    bt_bank = bank;
+}
+
+/**
+ * @brief The nodes up to the highest one allocated in a level, and the nodes it can hold
+ * @note Freed nodes below the highest one are counted, the level cannot be scanned cheaply.
+ */
+int BTrieGetLevelTop(int level, int *capacity) {
+    *capacity = 8 * N - 2;
+    return bram_tops[level] - 1;
+}
+
+/**
+ * @brief Direct the following inserts, deletes and lookups to a bank
+ */
+void BTrieSelectBank(int bank) {
+    bt_bank = bank;
+}
+
+void _BTrieWalk(int level, int index, int depth, struct ip6_addr* path, TrieVisitor visit) {
+    int address = CONSTRUCT_BRAM_ADDRESS(level, index);
+    unsigned int entry = TRIE_LOAD(address);
+    if (VALID(entry)) {
+        visit(path, depth, NEXT_HOP_ADDR(entry), BTrieAddressToIndex((void*)address));
+    }
+    int child_level = (depth >> 3) & 0xF;
+    if (LC(entry) != 0) {
+        _BTrieWalk(child_level, LC(entry), depth + 1, path, visit);
+    }
+    if (RC(entry) != 0) {
+        path->s6_addr32[depth >> 5] |= (1u << (depth & 0x1F));
+        _BTrieWalk(child_level, RC(entry), depth + 1, path, visit);
+        path->s6_addr32[depth >> 5] &= ~(1u << (depth & 0x1F));
+    }
+}
+
+/**
+ * @brief Call visit on every prefix in a bank
+ * @note The prefix passed to visit is in the same bit order as the prefixes inserted
+ */
+void BTrieWalk(int bank, TrieVisitor visit) {
+    struct ip6_addr path;
+    for (int i = 0; i < 4; i++) {
+        path.s6_addr32[i] = 0;
+    }
+    _BTrieWalk(0, TRIE_BANK_ROOT(bank, 0), 1, &path, visit);
+    path.s6_addr32[0] = 1;
+    _BTrieWalk(0, TRIE_BANK_ROOT(bank, 1), 1, &path, visit);
+}
+
+void _BTrieRelease(int level, int index, int depth) {
+    unsigned int entry = TRIE_LOAD(CONSTRUCT_BRAM_ADDRESS(level, index));
+    int child_level = (depth >> 3) & 0xF;
+    if (LC(entry) != 0) {
+        _BTrieRelease(child_level, LC(entry), depth + 1);
+    }
+    if (RC(entry) != 0) {
+        _BTrieRelease(child_level, RC(entry), depth + 1);
+    }
+    TRIE_STORE(CONSTRUCT_BRAM_ADDRESS(level, index), 0);
+    if (!IS_ENTRY_POINT(level, index) && index < bram_empty_bottoms[level]) {
+        bram_empty_bottoms[level] = index;
+    }
+}
+
+/**
+ * @brief Empty a bank and free all of its nodes
+ * @note The bank must not be used by the pipeline, and the lookups reading it must have been drained.
+ */
+void BTrieReleaseBank(int bank) {
+    _BTrieRelease(0, TRIE_BANK_ROOT(bank, 0), 1);
+    _BTrieRelease(0, TRIE_BANK_ROOT(bank, 1), 1);
 }
 
 // Binary Trie functions
 void BTrieUpdateBramEmptyBottom(int level);
-void BTrieInitBram();
+void BTrieInitBram(int);
 unsigned int BTrieLookup(void* prefix, int prefix_length) {
 	int temp;
     int result = _BTrieLookup(prefix, prefix_length, &temp);
-    if (temp < prefix_length) {
+    // The nodes on the path of longer prefixes are not prefixes themselves
+    if (temp < prefix_length || !VALID(TRIE_LOAD(CONSTRUCT_BRAM_ADDRESS(LEVEL(result), INDEX(result))))) {
         return -1;
     } else {
         return BTrieAddressToIndex((void*)result);
@@ -322,3 +435,37 @@ unsigned int BTrieLookup(void* prefix, int prefix_length) {
 }
 int BTrieInsert(void* prefix, int prefix_length, unsigned int next_hop_addr);
 int BTrieDelete(void* prefix, int prefix_length);
+
+/**
+ *
+ * @brief Find the longest prefix in the binary trie that is shorter than a prefix and covers it
+ * @param match_length (will be modified) the length of the prefix found
+ * @note The path of the prefix is walked once, keeping the deepest valid entry
+ * @return its index, -1 if there is none
+ *
+ */
+int BTrieLongestMatch(void* prefix_ptr, int prefix_length, int *match_length) {
+    struct ip6_addr prefix = *(struct ip6_addr*)prefix_ptr;
+    int found = -1;
+    unsigned int entry = 0;
+    for (int i = 0; i + 1 < prefix_length && i < 128; i++) {
+        int lsb = LSB(prefix.s6_addr32, i);
+        unsigned int child = (i == 0) ? TRIE_BANK_ROOT(bt_bank, lsb) : (lsb ? RC(entry) : LC(entry));
+        if (child == 0) {
+            break;
+        }
+        int address = CONSTRUCT_BRAM_ADDRESS((i >> 3) & 0xF, child);
+        entry = TRIE_LOAD(address);
+        if (VALID(entry)) {
+            found = address;
+            *match_length = i + 1;
+        }
+    }
+    return found < 0 ? -1 : (int)BTrieAddressToIndex((void*)found);
+}
+
+unsigned int BTrieGetNextHop(unsigned int index) {
+    index -= INDEX_BASE;
+    unsigned int entry = TRIE_LOAD(CONSTRUCT_BRAM_ADDRESS(index >> 11, index & 0x7FF));
+    return NEXT_HOP_ADDR(entry);
+}
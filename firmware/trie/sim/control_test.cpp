@@ -0,0 +1,352 @@
+//
+// Test of the control plane built for the host (libcontrol.a, see include/hal.h).
+//
+// A neighbor on port 1 sends a response through the DMA of hal_host.c, as the
+// main loop takes it. Its routes must be learned and advertised on port 0 with
+// the metric of the hop added, next to the direct route. A withdrawn route must
+// leave the tries and come back, an aggregate must follow the routes it covers,
+// a bad response must be refused, and a neighbor past its prefix limit torn down.
+// Two neighbors with the same metric must share a route as an ECMP group, which
+// shrinks back to one next hop when the other withdraws the route or dies. A
+// route withdrawn by its next hop must fail over at once to its backup path, and
+// a flapping route must stay out of the tries until its penalty decays. A
+// periodic update must send a slice of the table and the routes that changed,
+// and every route within REFRESH_TIME_LIMIT.
+//
+// Build & run: make -C trie/sim test
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "sim_host.h"
+
+extern "C" {
+void TrieInit();
+void nexthop_init();
+void config_direct_route(void* ip6_addr, uint8_t prefix_len, uint8_t port);
+int  disassemble(uint32_t base_addr, uint32_t length, uint8_t port);
+void send_unsolicited_response();
+int  fib_lookup(void* prefix, uint8_t prefix_len, uint32_t* slot);
+int  TrieLookup(void* prefix, unsigned int length);
+int  config_aggregate(void* prefix, uint8_t prefix_len, uint8_t ports);
+void config_max_prefix(uint8_t port, uint32_t max, uint8_t warning, uint8_t teardown);
+int  flush_poll();
+void flush_neighbor(int neighbor);
+void sweep_timers();
+extern int spare_memory_index;
+}
+
+struct Packet {
+	uint32_t port;
+	std::vector<uint8_t> data;
+};
+static std::vector<Packet> sent;
+
+static void on_tx(uint32_t port, const uint8_t* data, uint32_t length) {
+	sent.push_back({port, std::vector<uint8_t>(data, data + length)});
+}
+
+static void fail(const char* what) {
+	printf("FAIL: %s\n", what);
+	exit(1);
+}
+
+// A response from fe80::<source>, the entries of RTE_LEN bytes each
+static std::vector<uint8_t> response(const std::vector<uint8_t>& entries, uint8_t source = 1) {
+	std::vector<uint8_t> packet(PACKET_HDR_LEN + entries.size(), 0);
+	uint32_t udp_len = 8 + 4 + entries.size();
+	packet[14] = 0x86; packet[15] = 0xdd;               // ethertype
+	uint8_t* ip6 = packet.data() + 16;
+	ip6[0] = 0x60;
+	ip6[4] = udp_len >> 8; ip6[5] = udp_len & 0xff;     // payload length
+	ip6[6] = 17;                                        // UDP
+	ip6[7] = 255;
+	ip6[8] = 0xfe; ip6[9] = 0x80; ip6[23] = source;     // fe80::<source>
+	ip6[24] = 0xff; ip6[25] = 0x02; ip6[39] = 0x09;     // ff02::9
+	uint8_t* udp = ip6 + 40;
+	udp[0] = 521 >> 8; udp[1] = 521 & 0xff;
+	udp[2] = 521 >> 8; udp[3] = 521 & 0xff;
+	udp[4] = udp_len >> 8; udp[5] = udp_len & 0xff;
+	udp[8] = 2;                                         // RESPONSE
+	udp[9] = 1;
+	memcpy(packet.data() + PACKET_HDR_LEN, entries.data(), entries.size());
+	return packet;
+}
+
+static void add_entry(std::vector<uint8_t>& entries, const uint8_t* prefix, uint8_t prefix_len, uint8_t metric) {
+	entries.insert(entries.end(), prefix, prefix + 16);
+	entries.push_back(0);
+	entries.push_back(0);
+	entries.push_back(prefix_len);
+	entries.push_back(metric);
+}
+
+// Receive a packet the way the main loop does
+static int receive(uint32_t port, const std::vector<uint8_t>& packet) {
+	if (hal_host_rx(port, packet.data(), packet.size()) != 0 || !hal_read32(DMA_IN_VALID)) {
+		fail("the DMA did not take the packet");
+	}
+	hal_write32(DMA_CPU_ADDR, DMA_BLOCK_WADDR);
+	hal_write32(DMA_CPU_DATA_WIDTH, MTU);
+	hal_write32(DMA_CPU_WE, 1);
+	hal_write32(DMA_CPU_STB, 1);
+	if (!hal_read32(DMA_ACK)) {
+		fail("the DMA did not acknowledge");
+	}
+	hal_write32(DMA_CPU_STB, 0);
+	return disassemble(DMA_BLOCK_WADDR, hal_read32(DMA_DATA_WIDTH), hal_read32(DMA_IN_PORT_ID) & 0xff);
+}
+
+// The metric of a route in the packets sent on a port, 0 if it is not there
+static int advertised(uint32_t port, const uint8_t* prefix, uint8_t prefix_len) {
+	for (const Packet& packet : sent) {
+		if (packet.port != port) {
+			continue;
+		}
+		for (size_t off = PACKET_HDR_LEN; off + RTE_LEN <= packet.data.size(); off += RTE_LEN) {
+			const uint8_t* rte = packet.data.data() + off;
+			if (memcmp(rte, prefix, 16) == 0 && rte[18] == prefix_len) {
+				return rte[19];
+			}
+		}
+	}
+	return 0;
+}
+
+int main() {
+	if (hal_host_init() != 0) {
+		fail("cannot map the trie BRAM window");
+	}
+	hal_host_tx = on_tx;
+	TrieInit();
+	nexthop_init();
+
+	uint8_t direct[16] = {0x2a, 0x0e, 0xaa, 0x06, 0x04, 0x95};
+	config_direct_route(direct, 64, 0);
+
+	uint8_t learned[2][16] = {{0x20, 0x01, 0x0d, 0xb8}, {0x24, 0x0e, 0x00, 0x01}};
+	std::vector<uint8_t> entries;
+	add_entry(entries, learned[0], 32, 1);
+	add_entry(entries, learned[1], 48, 3);
+	int error = receive(1, response(entries));
+	if (error != 0) {
+		printf("FAIL: the response was refused with error %d\n", error);
+		return 1;
+	}
+	if (!fib_lookup(learned[0], 32, NULL) || !fib_lookup(learned[1], 48, NULL)) {
+		fail("a route was not learned");
+	}
+
+	send_unsolicited_response();
+	if (advertised(0, direct, 64) != 1) {
+		fail("the direct route is not advertised on port 0");
+	}
+	if (advertised(0, learned[0], 32) != 2 || advertised(0, learned[1], 48) != 4) {
+		fail("a learned route is not advertised on port 0 with its metric");
+	}
+
+	// A withdrawn route leaves the tries at once, its prefix is still found to be advertised
+	std::vector<uint8_t> withdrawn;
+	add_entry(withdrawn, learned[0], 32, 16);
+	uint32_t slot = 0;
+	if (receive(1, response(withdrawn)) != 0 || TrieLookup(learned[0], 32) >= 0 ||
+	    !fib_lookup(learned[0], 32, &slot) || slot != 31) {
+		fail("a withdrawn route is still forwarded");
+	}
+	if (receive(1, response(entries)) != 0 || TrieLookup(learned[0], 32) < 0) {
+		fail("a withdrawn route was not learned again");
+	}
+
+	// An aggregate is advertised as soon as it is configured, and withdrawn with the routes it covers
+	uint8_t aggregate[16] = {0x20, 0x01};
+	config_aggregate(aggregate, 16, 1 << 0);
+	sent.clear();
+	send_unsolicited_response();
+	if (advertised(0, aggregate, 16) != 2 || advertised(0, learned[0], 32) != 0) {
+		fail("the aggregate is not advertised instead of the route it covers");
+	}
+	sent.clear();
+	receive(1, response(withdrawn));
+	send_unsolicited_response();
+	if (advertised(0, aggregate, 16) != 16) {
+		fail("the aggregate is not withdrawn with the route it covers");
+	}
+
+	std::vector<uint8_t> bad;
+	uint8_t other[16] = {0x20, 0x01, 0x0d, 0xb9};
+	add_entry(bad, other, 32, 17);
+	if (receive(1, response(bad)) != 7 || fib_lookup(other, 32, NULL)) {
+		fail("a response with a bad metric was accepted");
+	}
+
+	// A neighbor past its prefix limit is torn down after the entries taken so far are sent,
+	// and ignored until its hold-down is over
+	config_max_prefix(1, 2, 75, 1);
+	std::vector<uint8_t> flood = entries;
+	uint8_t extra[2][16] = {{0x24, 0x0e, 0x00, 0x02}, {0x24, 0x0e, 0x00, 0x03}};
+	add_entry(flood, extra[0], 48, 1);
+	add_entry(flood, extra[1], 48, 1);
+	sent.clear();
+	if (receive(1, response(flood)) != ERR_PREFIX_LIMIT) {
+		fail("a neighbor past its prefix limit was not torn down");
+	}
+	while (flush_poll()) {
+	}
+	if (advertised(2, extra[0], 48) != 2 || TrieLookup(learned[1], 48) >= 0) {
+		fail("the routes of a torn down neighbor were not sent, then withdrawn");
+	}
+	if (receive(1, response(entries)) != ERR_PREFIX_LIMIT || TrieLookup(learned[0], 32) >= 0) {
+		fail("a neighbor is heard again while it is held down");
+	}
+	hal_write32(MTIME_LADDR, HOLD_DOWN_TIME_LIMIT);
+	if (receive(1, response(entries)) != 0 || TrieLookup(learned[0], 32) < 0) {
+		fail("a neighbor is still held down after its hold-down");
+	}
+
+	// Two neighbors with the same metric share the route, the group shrinks back to the slot
+	// of the other one when one withdraws the route
+	uint8_t ecmp[16] = {0x24, 0x0e, 0x00, 0x10};
+	uint8_t peers[2][16] = {{0xfe, 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x02},
+	                        {0xfe, 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x03}};
+	std::vector<uint8_t> ecmp_entries, ecmp_withdrawn;
+	add_entry(ecmp_entries, ecmp, 48, 1);
+	add_entry(ecmp_withdrawn, ecmp, 48, 16);
+	int members[NEXTHOP_GROUP_SIZE];
+	if (receive(2, response(ecmp_entries, 2)) != 0 || receive(3, response(ecmp_entries, 3)) != 0 ||
+	    !fib_lookup(ecmp, 48, &slot) || nexthop_members(slot, members) != 2 || TrieLookup(ecmp, 48) < 0) {
+		fail("two equal-cost next hops do not share the route");
+	}
+	int survivor = nexthop_get((struct ip6_addr*)peers[1], 3);
+	if (receive(2, response(ecmp_withdrawn, 2)) != 0 || !fib_lookup(ecmp, 48, &slot) ||
+	    nexthop_slot_neighbor(slot) != survivor || TrieLookup(ecmp, 48) < 0) {
+		fail("the group does not shrink to the other next hop when one withdraws the route");
+	}
+	if (receive(2, response(ecmp_entries, 2)) != 0 || !fib_lookup(ecmp, 48, &slot) || nexthop_members(slot, members) != 2) {
+		fail("a next hop does not join the group again");
+	}
+
+	// fe80::2 goes silent while fe80::3 is heard, the group keeps fe80::3 alone once fe80::2 times out
+	uint32_t now = hal_read32(MTIME_LADDR);
+	hal_write32(MTIME_LADDR, now + TIMEOUT_TIME_LIMIT / 2);
+	receive(3, response(ecmp_entries, 3));
+	hal_write32(MTIME_LADDR, now + TIMEOUT_TIME_LIMIT);
+	for (int neighbor = nexthop_expire(); neighbor >= 0; neighbor = nexthop_expire()) {
+		flush_neighbor(neighbor);
+	}
+	while (flush_poll()) {
+	}
+	if (!fib_lookup(ecmp, 48, &slot) || nexthop_members(slot, members) != 1 || members[0] != survivor ||
+	    TrieLookup(ecmp, 48) < 0) {
+		fail("the group keeps a next hop that timed out");
+	}
+
+	// A route withdrawn by its next hop fails over at once to the backup path, and is advertised
+	// with the metric of the backup in the triggered update
+	uint8_t backed[16] = {0x24, 0x0e, 0x00, 0x20};
+	std::vector<uint8_t> primary, secondary, backed_withdrawn;
+	add_entry(primary, backed, 48, 1);
+	add_entry(secondary, backed, 48, 3);
+	add_entry(backed_withdrawn, backed, 48, 16);
+	if (receive(2, response(primary, 2)) != 0 || receive(3, response(secondary, 3)) != 0 ||
+	    !fib_lookup(backed, 48, &slot) || nexthop_slot_neighbor(slot) != nexthop_get((struct ip6_addr*)peers[0], 2)) {
+		fail("the better of two paths is not the one forwarded");
+	}
+	sent.clear();
+	if (receive(2, response(backed_withdrawn, 2)) != 0 || !fib_lookup(backed, 48, &slot) ||
+	    nexthop_slot_neighbor(slot) != survivor || TrieLookup(backed, 48) < 0 || advertised(0, backed, 48) != 4) {
+		fail("a withdrawn route does not fail over to its backup path at once");
+	}
+
+	// A route withdrawn until it is suppressed is neither put back nor moved to a better path
+	// before its penalty decays below DAMPING_REUSE
+	uint8_t flapping[16] = {0x24, 0x0e, 0x00, 0x30};
+	std::vector<uint8_t> flap, flap_withdrawn, flap_better;
+	add_entry(flap, flapping, 48, 2);
+	add_entry(flap_withdrawn, flapping, 48, 16);
+	add_entry(flap_better, flapping, 48, 1);
+	for (int n = 0; n < DAMPING_SUPPRESS / DAMPING_PENALTY; n++) {
+		if (receive(2, response(flap, 2)) != 0 || TrieLookup(flapping, 48) < 0 ||
+		    receive(2, response(flap_withdrawn, 2)) != 0 || TrieLookup(flapping, 48) >= 0) {
+			fail("a route that is not suppressed yet does not follow its next hop");
+		}
+	}
+	sent.clear();
+	if (receive(2, response(flap, 2)) != 0 || receive(3, response(flap_better, 3)) != 0 ||
+	    TrieLookup(flapping, 48) >= 0 || advertised(0, flapping, 48) != 0) {
+		fail("a suppressed route is put back");
+	}
+	now = hal_read32(MTIME_LADDR);
+	hal_write32(MTIME_LADDR, now + DAMPING_HALF_LIFE);
+	if (receive(3, response(flap_better, 3)) != 0 || TrieLookup(flapping, 48) >= 0) {
+		fail("a suppressed route is put back before its penalty decays");
+	}
+	hal_write32(MTIME_LADDR, now + 2 * DAMPING_HALF_LIFE);
+	if (receive(3, response(flap_better, 3)) != 0 || !fib_lookup(flapping, 48, &slot) ||
+	    nexthop_slot_neighbor(slot) != survivor || TrieLookup(flapping, 48) < 0) {
+		fail("a route is still suppressed after its penalty decays");
+	}
+
+	// A steady periodic update sends one slice of the table, and every route goes out within
+	// REFRESH_TIME_LIMIT
+	const int BULK = 60;
+	const int ticks = REFRESH_TIME_LIMIT / MULTICAST_TIME_LIMIT;
+	uint8_t bulk[BULK][16] = {};
+	std::vector<uint8_t> bulk_entries;
+	for (int i = 0; i < BULK; i++) {
+		bulk[i][0] = 0x26;
+		bulk[i][5] = i;
+		add_entry(bulk_entries, bulk[i], 48, 1);
+	}
+	if (receive(2, response(bulk_entries, 4)) != 0) {
+		fail("the routes of the refresh were refused");
+	}
+	send_unsolicited_response();
+	int slice = (spare_memory_index - 1 + ticks - 1) / ticks;
+	std::vector<int> refreshed(BULK, 0);
+	for (int tick = 0; tick < ticks; tick++) {
+		sent.clear();
+		send_unsolicited_response();
+		int count = 0;
+		for (int i = 0; i < BULK; i++) {
+			if (advertised(0, bulk[i], 48) != 0) {
+				count++;
+				refreshed[i]++;
+			}
+		}
+		if (count > slice) {
+			fail("a periodic update sends more than a slice of the table");
+		}
+	}
+	for (int i = 0; i < BULK; i++) {
+		if (refreshed[i] == 0) {
+			fail("a route is not sent within REFRESH_TIME_LIMIT");
+		}
+	}
+
+	// A route that times out goes with the next periodic update, next to the slice
+	now = hal_read32(MTIME_LADDR);
+	hal_write32(MTIME_LADDR, now + TIMEOUT_TIME_LIMIT / 2);
+	std::vector<uint8_t> refreshed_entries(bulk_entries.begin() + RTE_LEN, bulk_entries.end());
+	receive(2, response(refreshed_entries, 4));
+	hal_write32(MTIME_LADDR, now + TIMEOUT_TIME_LIMIT);
+	for (int n = 0; n <= spare_memory_index / 64; n++) {
+		sweep_timers();
+	}
+	slice = (spare_memory_index - 1 + ticks - 1) / ticks;
+	sent.clear();
+	send_unsolicited_response();
+	int count = 0;
+	for (int i = 0; i < BULK; i++) {
+		count += advertised(0, bulk[i], 48) != 0;
+	}
+	if (advertised(0, bulk[0], 48) != 16 || count > slice + 1) {
+		fail("a periodic update does not send the slice and the route that timed out");
+	}
+
+	printf("%zu packets sent\n", sent.size());
+	printf("PASS\n");
+	return 0;
+}
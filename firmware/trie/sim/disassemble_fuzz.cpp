@@ -0,0 +1,395 @@
+//
+// Fuzzing of disassemble() on the host build (libcontrol.a, see include/hal.h).
+//
+// An input is the port (its first byte) and a frame from the padding of the
+// Ethernet header, received through the DMA of hal_host.c as the main loop
+// does, against a routing table preloaded with PRELOAD_ROUTES routes from a
+// neighbor. The table is not reset between inputs, as on the router.
+//
+// The rest of the receive block is filled with valid entries of POISON, so a
+// packet that makes disassemble() read past its end gets POISON learned or
+// sent back, which fails the run. Every input is also costed: the trie BRAM
+// loads and stores counted by TRIE_STATS (the uncached bus accesses that bound
+// the time of a packet on the router), the trie calls, the packets sent and
+// the host time. The worst packets are reported, and saved with -w.
+//
+// Without inputs, the harness mutates its seeds (a response, a request for
+// the whole table, a request for some routes) n times. With inputs, it runs
+// each of them once, as afl-fuzz runs it with @@. Built with -DLIBFUZZER and
+// -fsanitize=fuzzer, it is a libFuzzer target instead (make fuzz).
+//
+// Build & run: make -C trie/sim test
+//   ./disassemble_fuzz [-n inputs] [-s seed] [-w worst.bin] [input...]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include "sim_host.h"
+
+extern "C" {
+void TrieInit();
+void nexthop_init();
+void config_direct_route(void* ip6_addr, uint8_t prefix_len, uint8_t port);
+int  disassemble(uint32_t base_addr, uint32_t length, uint8_t port);
+int  fib_lookup(void* prefix, uint8_t prefix_len, uint32_t* slot);
+}
+
+static const int PRELOAD_ROUTES = 4096;
+static const uint8_t POISON[16] = {0x3f, 0xff, 0xff, 0xff};
+static const uint8_t POISON_LEN = 32;
+
+struct Cost {
+	uint64_t accesses = 0;  // trie BRAM loads and stores
+	uint64_t calls = 0;     // trie API calls
+	uint64_t sent = 0;      // packets sent
+	double ns = 0;
+};
+
+static Cost cost;
+static bool poison_sent = false;
+
+static void fail(const char* what) {
+	printf("FAIL: %s\n", what);
+	exit(1);
+}
+
+static void on_tx(uint32_t port, const uint8_t* data, uint32_t length) {
+	cost.sent++;
+	for (uint32_t off = PACKET_HDR_LEN; off + RTE_LEN <= length; off += RTE_LEN) {
+		if (memcmp(data + off, POISON, 4) == 0) {
+			poison_sent = true;
+		}
+	}
+}
+
+static void count_trie(uint64_t& accesses, uint64_t& calls) {
+	accesses = calls = 0;
+	for (int op = 0; op < TRIE_OP_NUM; ++op) {
+		calls += trie_op_stats[op].calls;
+		for (int bram = 0; bram < TRIE_STATS_BRAMS; ++bram) {
+			accesses += trie_op_stats[op].reads[bram] + trie_op_stats[op].writes[bram];
+		}
+	}
+}
+
+// Fill the receive block past a packet with valid entries of POISON
+static void poison(uint32_t length) {
+	uint8_t* block = (uint8_t*)hal_ptr(DMA_BLOCK_WADDR);
+	uint8_t entry[RTE_LEN] = {};
+	memcpy(entry, POISON, sizeof(POISON));
+	entry[18] = POISON_LEN;
+	entry[19] = 1;
+	for (uint32_t off = length; off < DMA_BLOCK_SIZE; ++off) {
+		block[off] = entry[(off - length) % RTE_LEN];
+	}
+}
+
+// Receive a packet the way the main loop does, and cost it
+static int receive(uint32_t port, const uint8_t* data, uint32_t length) {
+	if (hal_host_rx(port, data, length) != 0) {
+		fail("the DMA did not take the packet");
+	}
+	hal_write32(DMA_CPU_ADDR, DMA_BLOCK_WADDR);
+	hal_write32(DMA_CPU_DATA_WIDTH, MTU);
+	hal_write32(DMA_CPU_WE, 1);
+	hal_write32(DMA_CPU_STB, 1);
+	if (!hal_read32(DMA_ACK)) {
+		fail("the DMA did not acknowledge");
+	}
+	hal_write32(DMA_CPU_STB, 0);
+	poison(length);
+
+	uint64_t accesses, calls;
+	count_trie(accesses, calls);
+	cost = Cost();
+	poison_sent = false;
+	auto start = std::chrono::steady_clock::now();
+	int error = disassemble(DMA_BLOCK_WADDR, hal_read32(DMA_DATA_WIDTH), hal_read32(DMA_IN_PORT_ID) & 0xff);
+	cost.ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	count_trie(cost.accesses, cost.calls);
+	cost.accesses -= accesses;
+	cost.calls -= calls;
+
+	uint8_t prefix[16] = {};
+	memcpy(prefix, POISON, sizeof(POISON));
+	if (poison_sent || fib_lookup(prefix, POISON_LEN, NULL)) {
+		return -1;
+	}
+	return error;
+}
+
+// A packet from fe80::<host> on its port, the entries of RTE_LEN bytes each
+static std::vector<uint8_t> packet(uint8_t port, uint8_t host, uint8_t cmd, const std::vector<uint8_t>& entries) {
+	std::vector<uint8_t> input(1 + PACKET_HDR_LEN + entries.size(), 0);
+	input[0] = port;
+	uint8_t* frame = input.data() + 1;
+	uint32_t udp_len = 8 + 4 + entries.size();
+	frame[14] = 0x86; frame[15] = 0xdd;                 // ethertype
+	uint8_t* ip6 = frame + 16;
+	ip6[0] = 0x60;
+	ip6[4] = udp_len >> 8; ip6[5] = udp_len & 0xff;     // payload length
+	ip6[6] = 17;                                        // UDP
+	ip6[7] = 255;
+	ip6[8] = 0xfe; ip6[9] = 0x80; ip6[23] = host;       // fe80::<host>
+	ip6[24] = 0xff; ip6[25] = 0x02; ip6[39] = 0x09;     // ff02::9
+	uint8_t* udp = ip6 + 40;
+	udp[0] = 521 >> 8; udp[1] = 521 & 0xff;
+	udp[2] = 521 >> 8; udp[3] = 521 & 0xff;
+	udp[4] = udp_len >> 8; udp[5] = udp_len & 0xff;
+	udp[8] = cmd;
+	udp[9] = 1;
+	memcpy(frame + PACKET_HDR_LEN, entries.data(), entries.size());
+	return input;
+}
+
+// The n-th route of the preloaded table, 2001:db8:<n>::/48
+static void add_route(std::vector<uint8_t>& entries, uint32_t n, uint8_t metric) {
+	uint8_t entry[RTE_LEN] = {0x20, 0x01, 0x0d, 0xb8, (uint8_t)(n >> 8), (uint8_t)n};
+	entry[18] = 48;
+	entry[19] = metric;
+	entries.insert(entries.end(), entry, entry + RTE_LEN);
+}
+
+static int run(const uint8_t* data, size_t size) {
+	if (size < 1 || size - 1 > HAL_RX_SIZE) {
+		return 0;
+	}
+	return receive(data[0] % PORT_NUM, data + 1, size - 1);
+}
+
+static void setup() {
+	if (hal_host_init() != 0) {
+		fail("cannot map the trie BRAM window");
+	}
+	hal_host_tx = on_tx;
+	TrieInit();
+	nexthop_init();
+	uint8_t direct[16] = {0x2a, 0x0e, 0xaa, 0x06, 0x04, 0x95};
+	config_direct_route(direct, 64, 0);
+	for (int n = 0; n < PRELOAD_ROUTES; n += RIPNG_MAX_RTE_NUM) {
+		std::vector<uint8_t> entries;
+		for (int i = n; i < n + (int)RIPNG_MAX_RTE_NUM && i < PRELOAD_ROUTES; ++i) {
+			add_route(entries, i, 1 + i % 14);
+		}
+		std::vector<uint8_t> input = packet(1, 1, 2, entries);
+		if (run(input.data(), input.size()) != 0) {
+			fail("the preloaded routes were refused");
+		}
+	}
+}
+
+#ifdef LIBFUZZER
+extern "C" int LLVMFuzzerInitialize(int*, char***) {
+	setup();
+	return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+	if (run(data, size) < 0) {
+		fprintf(stderr, "disassemble read past the packet\n");
+		abort();
+	}
+	return 0;
+}
+#else
+struct Worst {
+	const char* what;
+	double value = -1;
+	std::vector<uint8_t> input;
+	Cost cost;
+};
+
+static const int MUTATIONS = 7;
+
+// Change an input in one of MUTATIONS ways
+static void mutate(std::vector<uint8_t>& input, std::mt19937& rng) {
+	static const uint8_t bytes[] = {0, 1, 2, 15, 16, 17, 127, 128, 129, 255};
+	static const uint32_t lengths[] = {0, 1, 7, 8, 11, 12, 13, 31, 32, 52, 0x7fff, 0xffff};
+	size_t size = input.size();
+	switch (rng() % MUTATIONS) {
+	case 0:  // flip a bit
+		input[rng() % size] ^= 1 << (rng() % 8);
+		break;
+	case 1:  // set a byte
+		input[rng() % size] = bytes[rng() % sizeof(bytes)];
+		break;
+	case 2: {  // set the IPv6 payload length or the UDP length, to a value or off by a few entries
+		size_t off = 1 + 16 + (rng() % 2 ? 4 : 44);
+		if (off + 2 > size) {
+			break;
+		}
+		uint32_t value = (input[off] << 8) | input[off + 1];
+		value = rng() % 2 ? lengths[rng() % (sizeof(lengths) / sizeof(lengths[0]))] : value + RTE_LEN * ((int)(rng() % 9) - 4);
+		input[off] = value >> 8;
+		input[off + 1] = value;
+		break;
+	}
+	case 3:  // cut the packet
+		input.resize(1 + rng() % size);
+		break;
+	case 4: {  // append bytes
+		size_t more = 1 + rng() % 64;
+		for (size_t i = 0; i < more && input.size() <= HAL_RX_SIZE; ++i) {
+			input.push_back(rng());
+		}
+		break;
+	}
+	case 5: {  // repeat the last entry, up to a full packet, with the lengths that go with it
+		if (size < 1 + PACKET_HDR_LEN + RTE_LEN) {
+			break;
+		}
+		size_t times = 1 + rng() % RIPNG_MAX_RTE_NUM;
+		for (size_t i = 0; i < times && input.size() + RTE_LEN <= 1 + PACKET_HDR_LEN + RIPNG_MAX_RTE_NUM * RTE_LEN; ++i) {
+			std::vector<uint8_t> entry(input.end() - RTE_LEN, input.end());
+			entry[5] = rng();  // another /48 under 2001:db8
+			input.insert(input.end(), entry.begin(), entry.end());
+		}
+		uint32_t udp_len = input.size() - 1 - 16 - 40;
+		input[1 + 16 + 4] = input[1 + 16 + 44] = udp_len >> 8;
+		input[1 + 16 + 5] = input[1 + 16 + 45] = udp_len;
+		break;
+	}
+	default:  // another port, or another neighbor
+		if (rng() % 2) {
+			input[0] = rng() % PORT_NUM;
+		} else if (size > 1 + 16 + 23) {
+			input[1 + 16 + 23] = 1 + rng() % 8;
+		}
+		break;
+	}
+}
+
+static void record(Worst& worst, double value, const uint8_t* data, size_t size) {
+	if (value > worst.value) {
+		worst.value = value;
+		worst.input.assign(data, data + size);
+		worst.cost = cost;
+	}
+}
+
+static void report(const Worst& worst) {
+	if (worst.value < 0) {
+		return;
+	}
+	printf("  worst %-13s %6llu BRAM accesses %5llu trie calls %3llu packets sent %10.0f ns, %zu bytes on port %u\n",
+	       worst.what, (unsigned long long)worst.cost.accesses, (unsigned long long)worst.cost.calls,
+	       (unsigned long long)worst.cost.sent, worst.cost.ns, worst.input.size() - 1, worst.input[0] % PORT_NUM);
+}
+
+static bool load(const char* path, std::vector<uint8_t>& input) {
+	FILE* f = fopen(path, "rb");
+	if (!f) {
+		return false;
+	}
+	input.clear();
+	int ch;
+	while ((ch = fgetc(f)) != EOF) {
+		input.push_back(ch);
+	}
+	fclose(f);
+	return true;
+}
+
+static void save(const char* path, const std::vector<uint8_t>& input) {
+	FILE* f = fopen(path, "wb");
+	if (!f || fwrite(input.data(), 1, input.size(), f) != input.size()) {
+		fail("cannot write the input");
+	}
+	fclose(f);
+}
+
+int main(int argc, char** argv) {
+	long inputs = 20000;
+	uint32_t seed = 1;
+	const char* worst_path = NULL;
+	std::vector<const char*> paths;
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+			inputs = atol(argv[++i]);
+		} else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+			seed = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+			worst_path = argv[++i];
+		} else if (argv[i][0] == '-') {
+			printf("usage: %s [-n inputs] [-s seed] [-w worst.bin] [input...]\n", argv[0]);
+			return 1;
+		} else {
+			paths.push_back(argv[i]);
+		}
+	}
+	setup();
+
+	std::vector<std::vector<uint8_t>> corpus;
+	if (paths.empty()) {
+		std::vector<uint8_t> entries;
+		for (int i = 0; i < 4; ++i) {
+			add_route(entries, PRELOAD_ROUTES + i, 2);
+		}
+		corpus.push_back(packet(2, 2, 2, entries));                  // a response of new routes
+		std::vector<uint8_t> all(RTE_LEN, 0);
+		all[19] = 16;
+		corpus.push_back(packet(0, 3, 1, all));                      // a request for the whole table
+		entries.clear();
+		for (int i = 0; i < 4; ++i) {
+			add_route(entries, i * 97, 16);
+		}
+		corpus.push_back(packet(3, 4, 1, entries));                  // a request for some routes
+	}
+
+	std::mt19937 rng(seed);
+	Worst worst[4] = {{"BRAM accesses"}, {"trie calls"}, {"packets sent"}, {"host time"}};
+	long errors[ERROR_NUM + 1] = {};
+	long runs = paths.empty() ? inputs : (long)paths.size();
+	for (long n = 0; n < runs; ++n) {
+		std::vector<uint8_t> input;
+		if (!paths.empty()) {
+			if (!load(paths[n], input)) {
+				printf("cannot read %s\n", paths[n]);
+				return 1;
+			}
+		} else {
+			input = corpus[rng() % corpus.size()];
+			for (int m = 1 + rng() % 4; m > 0 && input.size() > 1; --m) {
+				mutate(input, rng);
+			}
+		}
+		int error = run(input.data(), input.size());
+		if (error < 0) {
+			save("disassemble_crash.bin", input);
+			fail("disassemble read past the packet, the input is in disassemble_crash.bin");
+		}
+		errors[error >= 0 && error < ERROR_NUM ? error : ERROR_NUM]++;
+		if (input.size() < 1 || input.size() - 1 > HAL_RX_SIZE) {
+			continue;
+		}
+		record(worst[0], cost.accesses, input.data(), input.size());
+		record(worst[1], cost.calls, input.data(), input.size());
+		record(worst[2], cost.sent, input.data(), input.size());
+		record(worst[3], cost.ns, input.data(), input.size());
+		// Accepted packets are mutated further, up to the size of a seed set
+		if (paths.empty() && error == 0 && corpus.size() < 64) {
+			corpus.push_back(input);
+		}
+	}
+
+	printf("%ld inputs, by RipngErrorCode:", runs);
+	for (int e = 0; e <= ERROR_NUM; ++e) {
+		printf(" %ld", errors[e]);
+	}
+	printf("\n");
+	for (const Worst& w : worst) {
+		report(w);
+	}
+	if (worst_path && worst[0].value >= 0) {
+		save(worst_path, worst[0].input);
+	}
+	printf("PASS\n");
+	return 0;
+}
+#endif
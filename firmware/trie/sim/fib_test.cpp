@@ -0,0 +1,202 @@
+//
+// Random test of the forwarding table compression (fib.c) on top of the tries.
+//
+// Routes are added, moved to another slot and removed through fib.c, clustered
+// and nested with only a few slots, so that many of them are hidden. After
+// every update, every address must be forwarded by the prefixes in the tries
+// to the slot of its longest match in the route table, and every route must
+// still be found with its slot.
+//
+// Build & run: make -C trie/sim test
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "sim_host.h"
+#include "sim_test.h"
+
+extern "C" {
+void     TrieInit();
+int      TrieLookup(void* prefix, unsigned int length);
+uint32_t TrieGetNextHop(int index);
+
+int      fib_lookup(void* prefix, uint8_t prefix_len, uint32_t* slot);
+int      fib_insert(int mem_id, uint32_t slot);
+void     fib_modify(int mem_id, uint32_t slot);
+void     fib_delete(int mem_id);
+int      fib_retry();
+extern uint32_t fib_hidden_num;
+extern uint32_t fib_stranded_num;
+extern struct memory_rte memory_rte[NUM_MEMORY_RTE];
+}
+
+static const uint32_t NUM_SLOTS = 3;
+
+// No lookups run in this test, the stores only go to the BRAMs
+extern "C" void TrieSimStore(uint32_t addr, uint32_t data) {
+	sim_check_store(addr);
+	*(volatile uint32_t*)(uintptr_t)addr = data;
+}
+
+extern "C" uint32_t TrieSimLoad(uint32_t addr) {
+	if (addr == TRIE_LOOKUP_IN_SEQ_ADDR || addr == TRIE_LOOKUP_OUT_SEQ_ADDR) {
+		return 0;
+	}
+	return *(volatile uint32_t*)(uintptr_t)addr;
+}
+
+// ---------------------------------------------------------------------------
+// Reference route table
+// ---------------------------------------------------------------------------
+
+struct Route {
+	int mem_id;
+	uint32_t slot;
+};
+
+static RouteTable<Addr, Route> table;
+
+static int reference_lookup(const Addr& addr) {
+	const Route* route = table.lookup(addr);
+	return route ? (int)route->slot : -1;
+}
+
+// The slot an address is forwarded to, by the prefixes in the tries
+static int trie_lookup(const Addr& addr) {
+	for (int length = 128; length >= 0; --length) {
+		Addr prefix = mask(addr, length);
+		int index = TrieLookup(prefix.data(), length);
+		if (index >= 0) {
+			return (int)TrieGetNextHop(index);
+		}
+	}
+	return -1;
+}
+
+static bool check(const Addr& addr) {
+	int expected = reference_lookup(addr);
+	int forwarded = trie_lookup(addr);
+	if (expected != forwarded) {
+		printf("FAIL: an address goes to slot %d instead of %d\n", forwarded, expected);
+		return false;
+	}
+	return true;
+}
+
+// Routes are nested below a few prefixes, with a few slots
+static std::pair<uint32_t, Addr> random_route(const std::vector<Addr>& clusters) {
+	if (rng() % 256 == 0) {
+		return {0, Addr()};
+	}
+	const Addr& base = clusters[rng() % clusters.size()];
+	uint32_t length = 16 + rng() % 49;
+	return {length, mask(random_below(base, 16 + rng() % 8), length)};
+}
+
+int main(int argc, char** argv) {
+	uint32_t seed = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : 1;
+	uint32_t rounds = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) : 20000;
+	rng.seed(seed);
+
+	sim_map_bram();
+	TrieInit();
+
+	std::vector<Addr> clusters;
+	for (int i = 0; i < 4; ++i) {
+		clusters.push_back(random_address());
+	}
+	std::vector<std::pair<uint32_t, Addr>> routes;
+	std::vector<int> free_ids;
+	int next_id = 1;
+	uint32_t inserted = 0, failed = 0, stranded = 0, deleted = 0, modified = 0, checked = 0, most_hidden = 0;
+
+	for (uint32_t round = 0; round < rounds; ++round) {
+		uint32_t op = rng() % 8;
+		std::pair<uint32_t, Addr> key;
+		if (op < 4 || routes.size() < 256) {
+			key = random_route(clusters);
+			if (table.find(key)) {
+				continue;
+			}
+			int mem_id = next_id;
+			if (!free_ids.empty()) {
+				mem_id = free_ids.back();
+				free_ids.pop_back();
+			} else {
+				++next_id;
+			}
+			uint32_t slot = 6 + rng() % NUM_SLOTS;
+			memcpy(&memory_rte[mem_id].ip6_addr, key.second.data(), 16);
+			memory_rte[mem_id].prefix_len = key.first;
+			if (fib_insert(mem_id, slot) < 0) {
+				// the tries are full, nothing must have changed
+				free_ids.push_back(mem_id);
+				++failed;
+			} else {
+				table.set(key, {mem_id, slot});
+				routes.push_back(key);
+				++inserted;
+			}
+		} else if (op < 6) {
+			uint32_t index = rng() % routes.size();
+			key = routes[index];
+			int mem_id = table.find(key)->mem_id;
+			fib_delete(mem_id);
+			free_ids.push_back(mem_id);
+			table.erase(key);
+			routes[index] = routes.back();
+			routes.pop_back();
+			++deleted;
+		} else {
+			key = routes[rng() % routes.size()];
+			uint32_t slot = 6 + rng() % NUM_SLOTS;
+			Route* route = table.find(key);
+			fib_modify(route->mem_id, slot);
+			route->slot = slot;
+			++modified;
+		}
+
+		if (fib_hidden_num > most_hidden) {
+			most_hidden = fib_hidden_num;
+		}
+		// Routes that did not fit into the tries may be forwarded wrong until they are placed again
+		fib_retry();
+		if (fib_stranded_num > 0) {
+			++stranded;
+		} else {
+			// Addresses around the route that changed, and anywhere in the clusters
+			for (int i = 0; i < 16; ++i) {
+				Addr addr = (i < 12) ? random_below(key.second, key.first)
+				                     : random_below(clusters[rng() % clusters.size()], 16);
+				if (!check(addr)) {
+					return 1;
+				}
+				++checked;
+			}
+		}
+		if (round % 1024 == 0) {
+			for (auto& entry : table.routes) {
+				Addr prefix = entry.first.second;
+				uint32_t slot = 31;
+				int mem_id = fib_lookup(prefix.data(), entry.first.first, &slot);
+				if (mem_id != entry.second.mem_id || slot != entry.second.slot) {
+					printf("FAIL: /%u found as %d with slot %u\n", entry.first.first, mem_id, slot);
+					return 1;
+				}
+			}
+		}
+	}
+
+	printf("seed %u: %u inserted, %u not placed, %u deleted, %u modified, %zu routes left, %u hidden, %u at most\n",
+	       seed, inserted, failed, deleted, modified, table.routes.size(), fib_hidden_num, most_hidden);
+	printf("%u addresses checked, %u rounds with stranded routes\n", checked, stranded);
+	if (most_hidden == 0) {
+		printf("FAIL: no route was hidden\n");
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
@@ -0,0 +1,166 @@
+//
+// Random test of the compiled prefix-list (filter.c).
+//
+// Rules are drawn around an address plan, with random lengths and the usual
+// ranges, and compiled. Every route checked must get the decision of the first
+// rule that matches it in the list, or be denied if none does. A list that
+// does not fit must leave the one compiled before, or deny every route.
+//
+// Build & run: make -C trie/sim test
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+#include "sim_host.h"
+#include "sim_test.h"
+
+extern "C" {
+int filter_add(void* prefix, uint8_t prefix_len, uint8_t ge, uint8_t le, uint8_t permit);
+int filter_compile();
+int filter_permit(void* prefix, uint8_t prefix_len);
+extern int filter_rule_num;
+extern int filter_node_num;
+extern int filter_decision_num;
+}
+
+struct Rule {
+	Addr prefix;
+	uint32_t length, low, high;
+	bool permit;
+};
+
+static std::vector<Rule> rules;
+
+static int reference_permit(const Addr& prefix, uint32_t length) {
+	for (const Rule& rule : rules) {
+		if (length >= rule.low && length <= rule.high && mask(prefix, rule.length) == rule.prefix) {
+			return rule.permit;
+		}
+	}
+	return 0;
+}
+
+static bool check(const Addr& prefix, uint32_t length) {
+	Addr copy = prefix;
+	int expected = rules.empty() ? 1 : reference_permit(prefix, length);
+	int permitted = filter_permit(copy.data(), length);
+	if (expected != permitted) {
+		printf("FAIL: a /%u route is %s instead of %s\n", length, permitted ? "permitted" : "denied",
+		       expected ? "permitted" : "denied");
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	uint32_t seed = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : 1;
+	uint32_t num_rules = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) : 1000;
+	rng.seed(seed);
+
+	// The address plan: prefixes of /16 to /32 in a few clusters
+	std::vector<std::pair<Addr, uint32_t>> plans;
+	for (int c = 0; c < 8; ++c) {
+		Addr cluster = random_address();
+		for (int i = 0; i < 16; ++i) {
+			uint32_t length = 16 + rng() % 17;
+			plans.push_back({mask(random_below(cluster, 8 + rng() % 8), length), length});
+		}
+	}
+	// An empty list permits everything
+	filter_compile();
+	if (!check(mask(random_address(), 64), 64)) {
+		return 1;
+	}
+	// A list too large is dropped: every route is denied without a list compiled before,
+	// else the list compiled before stays
+	for (int pass = 0; pass < 2; ++pass) {
+		for (int i = 0; i < 200; ++i) {
+			Addr host = random_address();
+			filter_add(host.data(), 128, 0, 0, 1);
+		}
+		if (filter_compile() >= 0 || filter_rule_num != (int)rules.size()) {
+			printf("FAIL: a list too large was compiled\n");
+			return 1;
+		}
+		Addr route = mask(random_address(), 64);
+		if (pass == 0 ? filter_permit(route.data(), 64) != 0 : !check(route, 64)) {
+			printf("FAIL: a list too large left the previous one out\n");
+			return 1;
+		}
+		if (pass == 0) {
+			Rule rule;
+			rule.length = rule.low = rule.high = 16;
+			rule.prefix = mask(random_address(), 16);
+			rule.permit = true;
+			Addr prefix = rule.prefix;
+			filter_add(prefix.data(), 16, 0, 0, 1);
+			rules.push_back(rule);
+			if (filter_compile() < 0 || !check(rule.prefix, 16)) {
+				printf("FAIL: a list is not compiled after a list too large\n");
+				return 1;
+			}
+		}
+	}
+
+	uint32_t checked = 0;
+	while (rules.size() < num_rules) {
+		Rule rule;
+		// Bogons anywhere, and rules in the plan, with the usual ranges
+		static const uint32_t bounds[] = {0, 24, 32, 48, 56, 64, 128};
+		if (rng() % 16 == 0) {
+			rule.length = rng() % 17;
+			rule.prefix = mask(random_address(), rule.length);
+		} else {
+			const auto& plan = plans[rng() % plans.size()];
+			rule.length = plan.second + rng() % 33;
+			rule.prefix = mask(random_below(plan.first, plan.second), rule.length);
+		}
+		uint32_t ge = bounds[rng() % 7];
+		uint32_t le = bounds[rng() % 7];
+		ge = (ge > rule.length) ? ge : 0;
+		le = (le > (ge ? ge : rule.length)) ? le : 0;
+		rule.low = ge ? ge : rule.length;
+		rule.high = le ? le : (ge ? 128 : rule.length);
+		rule.permit = rng() % 2;
+		Addr prefix = rule.prefix;
+		if (filter_add(prefix.data(), rule.length, ge, le, rule.permit) < 0) {
+			printf("FAIL: rule %zu refused\n", rules.size());
+			return 1;
+		}
+		rules.push_back(rule);
+
+		// Compile from time to time, with a few rules and with many
+		if (rules.size() != num_rules && (rules.size() & (rules.size() - 1)) != 0) {
+			continue;
+		}
+		if (filter_compile() < 0) {
+			printf("FAIL: %zu rules do not fit, %d nodes, %d decisions\n", rules.size(), filter_node_num, filter_decision_num);
+			return 1;
+		}
+		for (int i = 0; i < 20000; ++i) {
+			// Routes around the rules, and anywhere
+			uint32_t length = rng() % 129;
+			Addr prefix;
+			if (i % 4 == 0) {
+				prefix = random_address();
+			} else {
+				const Rule& near = rules[rng() % rules.size()];
+				prefix = random_below(near.prefix, near.length);
+				if (i % 4 == 1) {
+					length = near.low + rng() % (near.high - near.low + 1);
+				}
+			}
+			if (!check(mask(prefix, length), length)) {
+				return 1;
+			}
+			++checked;
+		}
+	}
+
+	printf("seed %u: %d rules, %d nodes, %d decisions, %u routes checked\n",
+	       seed, filter_rule_num, filter_node_num, filter_decision_num, checked);
+	printf("PASS\n");
+	return 0;
+}
@@ -0,0 +1,400 @@
+//
+// Replay of a capture through the main loop of the firmware, on the host build
+// (libcontrol.a, see include/hal.h).
+//
+// start() runs as on the router, against the DMA of hal_host.c. Whenever the
+// main loop checks for a packet (hal_host_poll), the next packet of the capture
+// is handed to the DMA, once mtime has reached its arrival time. mtime is a
+// virtual clock: it follows the timestamps of the capture, or -r packets per
+// second, and jumps over idle time. A packet keeps the firmware busy for the
+// host time it took, times -x, and the packets that arrive meanwhile queue up
+// to -q of them, the others are dropped. The packets the firmware sends are
+// written to -o as pcap, at the virtual time they were sent. What the firmware
+// prints to the UART goes to stderr, the report to stdout.
+//
+// The port of a packet is the interface of a pcapng capture with several
+// interfaces, else the port whose MAC address it is sent to, else -p. The
+// cost of a packet is everything the firmware does between the turn that
+// takes it and the next turn that looks for a packet: the host time, the trie
+// BRAM loads and stores counted by TRIE_STATS (the uncached bus accesses that
+// bound the time of a packet on the router) and the packets sent. The turns
+// without a packet (timers, idle work) are reported apart, and -d seconds of
+// them are run after the last packet.
+//
+// Build & run: make -C trie/sim test
+//   ./pcap_replay [-r pps] [-x slowdown] [-q depth] [-p port] [-d seconds] [-o out.pcap] capture.pcap[ng]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <csetjmp>
+#include <chrono>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include "sim_host.h"
+
+extern "C" {
+void start();
+}
+
+static const uint8_t MAC_PREFIX[5] = {0x8c, 0x1f, 0x64, 0x69, 0x10};  // port p is ...:10:54 + p, see main.c
+static const uint8_t MAC_PORT_BASE = 0x54;
+
+struct Packet {
+	uint64_t time;  // ns since the first packet
+	uint32_t port;
+	std::vector<uint8_t> data;  // from the Ethernet header
+};
+
+struct Sent {
+	uint64_t time;
+	std::vector<uint8_t> data;
+};
+
+struct Cost {
+	double ns = 0;
+	uint64_t accesses = 0;
+	uint64_t sent = 0;
+};
+
+static std::vector<Packet> packets;
+static std::vector<Sent> sent;
+static std::vector<Cost> costs;   // per packet replayed
+static Cost background;           // the turns without a packet
+static uint64_t background_turns = 0;
+
+static double slowdown = 1;
+static size_t depth = 4;
+static uint64_t linger = 0;       // ns run after the last packet
+
+static std::deque<size_t> queue;  // packets waiting for the DMA
+static size_t next_packet = 0;    // next packet to arrive
+static long current = -1;         // the packet taken in this turn, -1 if none
+static bool started = false;      // the main loop has been entered
+static uint64_t now = 0;          // virtual time, ns
+static uint64_t drops = 0;
+static std::jmp_buf done;
+
+static std::chrono::steady_clock::time_point turn_start;
+static uint64_t turn_accesses = 0;
+static uint64_t turn_sent = 0;
+
+static void fail(const char* what) {
+	printf("FAIL: %s\n", what);
+	exit(1);
+}
+
+static uint64_t count_accesses() {
+	uint64_t accesses = 0;
+	for (int op = 0; op < TRIE_OP_NUM; ++op) {
+		for (int bram = 0; bram < TRIE_STATS_BRAMS; ++bram) {
+			accesses += trie_op_stats[op].reads[bram] + trie_op_stats[op].writes[bram];
+		}
+	}
+	return accesses;
+}
+
+// mtime counts seconds, see include/timer.h
+static void set_mtime(uint64_t ns) {
+	uint64_t seconds = ns / 1000000000;
+	hal_write32(MTIME_HADDR, seconds >> 32);
+	hal_write32(MTIME_LADDR, seconds);
+}
+
+static void on_tx(uint32_t port, const uint8_t* data, uint32_t length) {
+	if (length < PADDING) {
+		return;
+	}
+	sent.push_back({now, std::vector<uint8_t>(data + PADDING, data + length)});
+}
+
+// The packets that arrived up to now join the queue, or are dropped if it is full
+static void arrive() {
+	while (next_packet < packets.size() && packets[next_packet].time <= now) {
+		if (queue.size() < depth) {
+			queue.push_back(next_packet);
+		} else {
+			drops++;
+		}
+		next_packet++;
+	}
+}
+
+static void on_poll() {
+	// Close the turn that ends here
+	Cost cost;
+	cost.ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - turn_start).count();
+	cost.accesses = count_accesses() - turn_accesses;
+	cost.sent = sent.size() - turn_sent;
+	if (!started) {
+		started = true;  // the start up is not a turn
+	} else if (current >= 0) {
+		costs.push_back(cost);
+		now += (uint64_t)(cost.ns * slowdown);
+		set_mtime(now);
+	} else {
+		background.ns += cost.ns;
+		background.accesses += cost.accesses;
+		background.sent += cost.sent;
+		background_turns++;
+	}
+	current = -1;
+
+	arrive();
+	if (queue.empty()) {
+		uint64_t end = packets.empty() ? linger : packets.back().time + linger;
+		if (next_packet < packets.size()) {
+			// Nothing to do until the next packet, the timers get a turn at its time first
+			now = packets[next_packet].time;
+		} else if (now < end) {
+			// Run the timers for a while, a second at a time
+			now = std::min(end, now + 1000000000);
+		} else {
+			std::longjmp(done, 1);
+		}
+		set_mtime(now);
+	} else {
+		Packet& packet = packets[queue.front()];
+		std::vector<uint8_t> frame(PADDING, 0);
+		frame.insert(frame.end(), packet.data.begin(), packet.data.end());
+		if (hal_host_rx(packet.port, frame.data(), frame.size()) != 0) {
+			fail("the DMA did not take the packet");
+		}
+		current = queue.front();
+		queue.pop_front();
+	}
+	turn_start = std::chrono::steady_clock::now();
+	turn_accesses = count_accesses();
+	turn_sent = sent.size();
+}
+
+struct Reader {
+	const std::vector<uint8_t>& data;
+	bool swap;
+	uint32_t u32(size_t at) const {
+		uint32_t v = data[at] | data[at + 1] << 8 | data[at + 2] << 16 | (uint32_t)data[at + 3] << 24;
+		return swap ? __builtin_bswap32(v) : v;
+	}
+	uint16_t u16(size_t at) const {
+		uint16_t v = data[at] | data[at + 1] << 8;
+		return swap ? __builtin_bswap16(v) : v;
+	}
+};
+
+static uint32_t port_of(const uint8_t* frame, size_t length, uint32_t default_port) {
+	if (length >= 6 && memcmp(frame, MAC_PREFIX, sizeof(MAC_PREFIX)) == 0 &&
+	    frame[5] >= MAC_PORT_BASE && frame[5] < MAC_PORT_BASE + PORT_NUM) {
+		return frame[5] - MAC_PORT_BASE;
+	}
+	return default_port;
+}
+
+static void add_packet(uint64_t time, int interface, const uint8_t* frame, size_t length, uint32_t default_port) {
+	if (length + PADDING > HAL_RX_SIZE) {
+		printf("a packet of %zu bytes is too long, skipped\n", length);
+		return;
+	}
+	uint32_t port = interface >= 0 ? interface % PORT_NUM : port_of(frame, length, default_port);
+	packets.push_back({time, port, std::vector<uint8_t>(frame, frame + length)});
+}
+
+// pcap, in µs or ns, either byte order
+static bool read_pcap(const std::vector<uint8_t>& data, uint32_t default_port) {
+	Reader r{data, false};
+	uint32_t magic = r.u32(0);
+	r.swap = magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1;
+	magic = r.u32(0);
+	uint64_t unit = magic == 0xa1b23c4d ? 1 : 1000;
+	if (r.u32(20) != 1) {
+		printf("not an Ethernet capture\n");
+		return false;
+	}
+	for (size_t off = 24; off + 16 <= data.size();) {
+		uint64_t time = (uint64_t)r.u32(off) * 1000000000 + r.u32(off + 4) * unit;
+		uint32_t length = r.u32(off + 8);
+		if (off + 16 + length > data.size()) {
+			break;
+		}
+		add_packet(time, -1, data.data() + off + 16, length, default_port);
+		off += 16 + length;
+	}
+	return true;
+}
+
+// pcapng, the Enhanced and Simple Packet Blocks of Ethernet interfaces
+static bool read_pcapng(const std::vector<uint8_t>& data, uint32_t default_port) {
+	Reader r{data, false};
+	std::vector<uint64_t> resolutions;  // ns per tick of each interface, 0 if not Ethernet
+	for (size_t off = 0; off + 12 <= data.size();) {
+		uint32_t type = r.u32(off);
+		if (type == 0x0a0d0d0a) {
+			r.swap = r.u32(off + 8) != 0x1a2b3c4d;
+			resolutions.clear();
+		}
+		uint32_t length = r.u32(off + 4);
+		if (length < 12 || off + length > data.size()) {
+			break;
+		}
+		if (type == 1 && length >= 20) {
+			uint64_t resolution = 1000;
+			for (size_t opt = off + 16; opt + 4 <= off + length - 4;) {
+				uint16_t code = r.u16(opt), size = r.u16(opt + 2);
+				if (code == 0) {
+					break;
+				}
+				if (code == 9 && size >= 1) {  // if_tsresol
+					uint8_t value = data[opt + 4];
+					uint64_t per_second = 1;
+					for (int i = 0; i < (value & 0x7f); ++i) {
+						per_second *= (value & 0x80) ? 2 : 10;
+					}
+					resolution = per_second ? 1000000000 / per_second : 1;
+				}
+				opt += 4 + ((size + 3) & ~3);
+			}
+			resolutions.push_back(r.u16(off + 8) == 1 ? std::max<uint64_t>(resolution, 1) : 0);
+		} else if (type == 6 && length >= 32) {
+			uint32_t interface = r.u32(off + 8);
+			uint64_t ticks = (uint64_t)r.u32(off + 12) << 32 | r.u32(off + 16);
+			uint32_t captured = r.u32(off + 20);
+			if (interface < resolutions.size() && resolutions[interface] && 28 + captured <= length) {
+				add_packet(ticks * resolutions[interface], resolutions.size() > 1 ? (int)interface : -1,
+				           data.data() + off + 28, captured, default_port);
+			}
+		} else if (type == 3 && length >= 16 && !resolutions.empty() && resolutions[0]) {
+			uint32_t captured = std::min<uint32_t>(r.u32(off + 8), length - 16);
+			add_packet(packets.empty() ? 0 : packets.back().time, -1, data.data() + off + 12, captured, default_port);
+		}
+		off += length;
+	}
+	return true;
+}
+
+static void write_pcap(const char* path) {
+	FILE* f = fopen(path, "wb");
+	if (!f) {
+		fail("cannot write the output");
+	}
+	uint32_t header[6] = {0xa1b23c4d, 0x00040002, 0, 0, 65535, 1};
+	fwrite(header, sizeof(header), 1, f);
+	for (const Sent& s : sent) {
+		uint32_t record[4] = {(uint32_t)(s.time / 1000000000), (uint32_t)(s.time % 1000000000),
+		                      (uint32_t)s.data.size(), (uint32_t)s.data.size()};
+		fwrite(record, sizeof(record), 1, f);
+		fwrite(s.data.data(), 1, s.data.size(), f);
+	}
+	fclose(f);
+}
+
+static double percentile(std::vector<double>& sorted, double p) {
+	return sorted.empty() ? 0 : sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+int main(int argc, char** argv) {
+	double rate = 0;
+	uint32_t default_port = 0;
+	const char* output = NULL;
+	const char* input = NULL;
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+			rate = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "-x") && i + 1 < argc) {
+			slowdown = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "-q") && i + 1 < argc) {
+			depth = std::max(1, atoi(argv[++i]));
+		} else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+			default_port = atoi(argv[++i]) % PORT_NUM;
+		} else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+			linger = (uint64_t)(atof(argv[++i]) * 1e9);
+		} else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			output = argv[++i];
+		} else if (argv[i][0] != '-' && !input) {
+			input = argv[i];
+		} else {
+			input = NULL;
+			break;
+		}
+	}
+	if (!input) {
+		printf("usage: %s [-r pps] [-x slowdown] [-q depth] [-p port] [-d seconds] [-o out.pcap] capture.pcap[ng]\n", argv[0]);
+		return 1;
+	}
+
+	FILE* f = fopen(input, "rb");
+	if (!f) {
+		printf("FAIL: cannot read %s\n", input);
+		return 1;
+	}
+	std::vector<uint8_t> data;
+	int ch;
+	while ((ch = fgetc(f)) != EOF) {
+		data.push_back(ch);
+	}
+	fclose(f);
+	bool ok = data.size() >= 24 && ((data[0] == 0x0a && data[1] == 0x0d) ? read_pcapng(data, default_port)
+	                                                                      : read_pcap(data, default_port));
+	if (!ok) {
+		fail("not a pcap or pcapng capture");
+	}
+	uint64_t first = packets.empty() ? 0 : packets[0].time;
+	for (size_t i = 0; i < packets.size(); ++i) {
+		packets[i].time = rate > 0 ? (uint64_t)(i * 1e9 / rate) : packets[i].time - std::min(first, packets[i].time);
+	}
+	std::stable_sort(packets.begin(), packets.end(), [](const Packet& a, const Packet& b) { return a.time < b.time; });
+
+	if (hal_host_init() != 0) {
+		fail("cannot map the trie BRAM window");
+	}
+	hal_host_tx = on_tx;
+	hal_host_poll = on_poll;
+	turn_start = std::chrono::steady_clock::now();
+	if (setjmp(done) == 0) {
+		start();
+	}
+	hal_host_poll = NULL;
+	hal_host_tx = NULL;
+	printf("\n");
+
+	std::vector<double> ns;
+	uint64_t accesses = 0, max_accesses = 0, outputs = 0;
+	for (const Cost& c : costs) {
+		ns.push_back(c.ns);
+		accesses += c.accesses;
+		max_accesses = std::max(max_accesses, c.accesses);
+		outputs += c.sent;
+	}
+	std::sort(ns.begin(), ns.end());
+	printf("%zu packets read, %zu replayed, %llu dropped, %.3f s of virtual time\n", packets.size(), costs.size(),
+	       (unsigned long long)drops, now / 1e9);
+	printf("  per packet: %.0f ns p50 %.0f ns p99 %.0f ns max, %.1f BRAM accesses mean %llu max, %llu packets sent\n",
+	       percentile(ns, 0.5), percentile(ns, 0.99), ns.empty() ? 0 : ns.back(),
+	       costs.empty() ? 0 : (double)accesses / costs.size(), (unsigned long long)max_accesses,
+	       (unsigned long long)outputs);
+	printf("  without packet: %llu turns, %.0f ns, %llu BRAM accesses, %llu packets sent\n",
+	       (unsigned long long)background_turns, background.ns, (unsigned long long)background.accesses,
+	       (unsigned long long)background.sent);
+	printf("  received by port:");
+	for (int p = 0; p < PORT_NUM; ++p) {
+		printf(" %u", router_stats.rx_packets[p]);
+	}
+	printf(", by RipngErrorCode:");
+	for (int e = 0; e < ERROR_NUM; ++e) {
+		printf(" %u", router_stats.errors[e]);
+	}
+	printf("\n  sent by port:");
+	for (int p = 0; p < PORT_NUM; ++p) {
+		printf(" %u", router_stats.tx_packets[p]);
+	}
+	printf(", %zu in all\n", sent.size());
+	if (output) {
+		write_pcap(output);
+	}
+	if (costs.size() + drops != packets.size()) {
+		fail("some packets were neither replayed nor dropped");
+	}
+	printf("PASS\n");
+	return 0;
+}
@@ -0,0 +1,39 @@
+//
+// The registers, sizes, layouts and counters of the firmware, for the host
+// tests and tools. They come from the firmware headers themselves, which are on
+// the include path after the system headers (-idirafter, see the Makefile), so
+// that a tool cannot drift from the firmware. The checks below are what the
+// tools assume on top of the headers.
+//
+
+#ifndef _SIM_HOST_H_
+#define _SIM_HOST_H_
+
+#include <cstdint>
+
+// The types of the host are those of the firmware's stdint.h, which is left out
+#define _STDINT_H_
+
+extern "C" {
+#include "hal.h"
+#include "dma.h"
+#include "timer.h"
+#include "packet.h"
+#include "../../include/memory.h" // not the memory.h of the C library
+#include "stats.h"
+#include "trie.h"
+#include "nexthop.h"
+#include "damping.h"
+}
+
+static const int PORT_NUM = STATS_PORTS;
+static const int ERROR_NUM = STATS_ERRORS;  // RipngErrorCode
+static const uint32_t DMA_BLOCK_SIZE = DMA_BLOCK_RADDR - DMA_BLOCK_WADDR;
+
+static_assert(sizeof(struct packet_hdr) == PACKET_HDR_LEN, "the packets are built from PACKET_HDR_LEN bytes of headers");
+static_assert(sizeof(struct ripng_rte) == RTE_LEN, "the entries are built RTE_LEN bytes each");
+static_assert(ERROR_NUM == ERR_PREFIX_LIMIT + 1, "the error counters are indexed by RipngErrorCode");
+static_assert(PACKET_HDR_LEN + RIPNG_MAX_RTE_NUM * RTE_LEN <= HAL_RX_SIZE, "hal_host_rx() takes a full response");
+static_assert(HAL_RX_SIZE <= DMA_BLOCK_SIZE, "a packet fits the DMA block");
+
+#endif // _SIM_HOST_H_
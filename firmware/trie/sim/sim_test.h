@@ -0,0 +1,150 @@
+//
+// The helpers of the random tests: the generator, the addresses and their
+// prefixes, the route table the firmware is checked against, and the trie BRAM
+// window of the tests built with TRIE_SIM, which do without hal_host_init().
+// Each test is a single source file, which includes this after sim_host.h.
+//
+
+#ifndef _SIM_TEST_H_
+#define _SIM_TEST_H_
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <map>
+#include <random>
+#include <utility>
+#include <sys/mman.h>
+#include "sim_host.h"
+
+extern "C" {
+// The firmware prints nothing in the tests
+void _putchar(char c) {
+	(void)c;
+}
+}
+
+static std::mt19937 rng;
+
+// Addresses in network order, as in memory_rte and the packets
+typedef std::array<uint8_t, 16> Addr;
+
+// Addresses in the bit order of the tries: bit i is bit (i & 31) of word i >> 5
+typedef std::array<uint32_t, 4> BitAddr;
+
+static inline Addr mask(const Addr& a, uint32_t length) {
+	Addr ret;
+	for (int i = 0; i < 16; ++i) {
+		int bits = (int)length - 8 * i;
+		ret[i] = bits >= 8 ? a[i] : bits <= 0 ? 0 : a[i] & (0xff00 >> bits);
+	}
+	return ret;
+}
+
+static inline BitAddr mask(const BitAddr& a, uint32_t length) {
+	BitAddr ret = {0, 0, 0, 0};
+	for (uint32_t i = 0; i < 4; ++i) {
+		if (length >= 32 * (i + 1)) {
+			ret[i] = a[i];
+		} else if (length > 32 * i) {
+			ret[i] = a[i] & ((1u << (length - 32 * i)) - 1);
+		}
+	}
+	return ret;
+}
+
+template <typename A = Addr>
+static inline A random_address() {
+	A a;
+	for (auto& word : a) {
+		word = rng();
+	}
+	return a;
+}
+
+// A random address that shares its first `length` bits with base
+template <typename A>
+static inline A random_below(const A& base, uint32_t length) {
+	A host = random_address<A>();
+	A ones;
+	ones.fill(~(typename A::value_type)0);
+	A m = mask(ones, length);
+	A ret;
+	for (size_t i = 0; i < ret.size(); ++i) {
+		ret[i] = (base[i] & m[i]) | (host[i] & ~m[i]);
+	}
+	return ret;
+}
+
+// The route table of a test, a value for each prefix
+template <typename A, typename V>
+struct RouteTable {
+	typedef std::pair<uint32_t, A> Key; // length, prefix
+
+	std::map<Key, V> routes;
+	uint32_t length_count[129] = {};
+
+	V* find(const Key& key) {
+		auto it = routes.find(key);
+		return it == routes.end() ? NULL : &it->second;
+	}
+
+	void set(const Key& key, const V& value) {
+		auto it = routes.emplace(key, value);
+		if (it.second) {
+			++length_count[key.first];
+		} else {
+			it.first->second = value;
+		}
+	}
+
+	void erase(const Key& key) {
+		if (routes.erase(key)) {
+			--length_count[key.first];
+		}
+	}
+
+	void clear() {
+		routes.clear();
+		std::fill(length_count, length_count + 129, 0);
+	}
+
+	// The value of the longest prefix of an address, NULL if none matches
+	const V* lookup(const A& addr) const {
+		for (int length = 128; length >= 0; --length) {
+			if (length_count[length] == 0) {
+				continue;
+			}
+			auto it = routes.find({(uint32_t)length, mask(addr, length)});
+			if (it != routes.end()) {
+				return &it->second;
+			}
+		}
+		return NULL;
+	}
+};
+
+// The trie BRAM, mapped at its address as hal_host_init() does for libcontrol.a
+static const uint32_t BRAM_WINDOW = HAL_BRAM_BASE;
+static const uint32_t BRAM_WINDOW_SIZE = HAL_BRAM_SIZE;
+
+static inline void sim_map_bram() {
+	void* bram = mmap((void*)(uintptr_t)BRAM_WINDOW, BRAM_WINDOW_SIZE, PROT_READ | PROT_WRITE,
+	                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE | MAP_NORESERVE, -1, 0);
+	if (bram != (void*)(uintptr_t)BRAM_WINDOW) {
+		printf("FAIL: cannot map the trie BRAM window\n");
+		exit(1);
+	}
+}
+
+// The tries only store to their BRAM, see TrieSimStore
+static inline void sim_check_store(uint32_t addr) {
+	if (addr < BRAM_WINDOW || addr >= BRAM_WINDOW + BRAM_WINDOW_SIZE) {
+		printf("FAIL: store to %08x outside the trie BRAM\n", addr);
+		exit(1);
+	}
+}
+
+#endif // _SIM_TEST_H_
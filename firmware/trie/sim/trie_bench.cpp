@@ -0,0 +1,722 @@
+//
+// Benchmark of the tries on the host build (libcontrol.a, see include/hal.h).
+//
+// A route table is loaded, looked up, churned and deleted again, once in the
+// VC trie alone, once in the BTrie alone and once through TrieInsert & co, as
+// protocol.c uses them. Every stage reports ops/s, the latency percentiles of
+// single operations and the trie BRAM loads and stores per operation counted
+// by TRIE_STATS (see include/trie.h), the MMIO accesses the firmware would
+// make, in total and per BRAM. The anchor lookups find the longest route above
+// a loaded one, as fib.c does to hide routes. The LPM lookups walk the BRAMs as
+// the pipeline does and count its reads instead. The failed
+// operations are the routes that did not fit, or for LPM lookups the
+// addresses without a route. TrieInsert & co also report their accesses per
+// call, over all stages.
+//
+// The routes come from a dump in the format of route_for_cpp.txt (4 words of
+// the prefix in the bit order of the tries, length, 4 words of next hop
+// address, next hop), or are generated with the prefix lengths of the IPv6
+// default-free zone, clustered under a few allocations.
+//
+// Build & run: make -C trie/sim bench
+//   ./trie_bench [-n routes] [-f dump] [-s seed] [-m insert:withdraw:modify] [-o results.json]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <array>
+#include <set>
+#include "sim_host.h"
+
+extern "C" {
+void     TrieStatsClear();
+
+typedef void (*TrieVisitor)(void* prefix, uint32_t length, uint32_t next_hop, uint32_t index);
+void     TrieInit();
+int      TrieInsert(void* prefix, unsigned int length, uint32_t next_hop);
+int      TrieLookup(void* prefix, unsigned int length);
+int      TrieLongestMatch(void* prefix, unsigned int length, unsigned int* match_length);
+int      TrieDelete(void* prefix, unsigned int length);
+void     TrieModify(void* prefix, unsigned int length, uint32_t next_hop);
+uint32_t VCTrieInsert(void* prefix, uint32_t length, uint32_t next_hop);
+uint32_t VCTrieLookup(void* prefix, uint32_t length);
+uint32_t VCTrieLongestMatch(void* prefix, uint32_t length, uint32_t* match_length);
+void*    VCTrieIndexToAddress(uint32_t index);
+void     VCEntryInvalidate(void* entry_addr);
+void     VCEntryModify(void* entry_addr, uint32_t next_hop);
+void     VCTrieWalk(uint32_t bank, TrieVisitor visit);
+int      BTrieInsert(void* prefix, int prefix_length, unsigned int next_hop_addr);
+unsigned int BTrieLookup(void* prefix, int prefix_length);
+int      BTrieLongestMatch(void* prefix, int prefix_length, int* match_length);
+int      BTrieDelete(void* prefix, int prefix_length);
+void     BTrieWalk(int bank, TrieVisitor visit);
+extern int trie_bank;
+}
+
+static const uint32_t VC_BASE = 0x28000000;
+static const uint32_t BT_BASE = 0x20000000;
+static const uint32_t TRIE_BANK = 0x27800008;
+static const uint32_t BT_INDEX_BASE = 306496;
+
+static const uint32_t VC_BRAM_DEPTHS[16] = {
+	64, 256, 6144, 7168, 5120, 3072, 256, 256,
+	256, 256, 256, 256, 256, 256, 256, 256
+};
+static const uint32_t VC_BIN_SIZES[16] = {
+	1, 7, 15, 15, 14, 10, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1
+};
+static const uint32_t VC_INDEX_SUMS[17] = {
+	0, 64, 1856, 94016,
+	201536, 273216, 303936, 304192,
+	304448, 304704, 304960, 305216,
+	305472, 305728, 305984, 306240,
+	306496
+};
+
+// Addresses are kept in the bit order of the tries: bit i is bit (i & 31) of ip[i >> 5]
+typedef std::array<uint32_t, 4> Addr;
+
+struct Route {
+	Addr prefix;   // bit order of the tries
+	Addr network;  // network order, as in memory_rte
+	uint32_t length;
+	uint32_t next_hop;
+};
+
+static inline uint32_t bit(const Addr& a, uint32_t i) {
+	return (a[i >> 5] >> (i & 31)) & 1;
+}
+
+static Addr reorder(const Addr& a) {
+	return {brev8(a[0]), brev8(a[1]), brev8(a[2]), brev8(a[3])};
+}
+
+static Addr mask(const Addr& a, uint32_t length) {
+	Addr ret = {0, 0, 0, 0};
+	for (uint32_t i = 0; i < 4; ++i) {
+		if (length >= 32 * (i + 1)) {
+			ret[i] = a[i];
+		} else if (length > 32 * i) {
+			ret[i] = a[i] & ((1u << (length - 32 * i)) - 1);
+		}
+	}
+	return ret;
+}
+
+static std::mt19937 rng;
+
+// Random bits past the first length bits of base
+static Addr random_below(const Addr& base, uint32_t length) {
+	Addr a = {(uint32_t)rng(), (uint32_t)rng(), (uint32_t)rng(), (uint32_t)rng()};
+	Addr m = mask({~0u, ~0u, ~0u, ~0u}, length);
+	for (int i = 0; i < 4; ++i) {
+		a[i] = (base[i] & m[i]) | (a[i] & ~m[i]);
+	}
+	return a;
+}
+
+static Route make_route(const Addr& prefix, uint32_t length) {
+	Route r;
+	r.prefix = mask(prefix, length);
+	r.network = reorder(r.prefix);
+	r.length = length;
+	r.next_hop = 1 + rng() % 30;
+	return r;
+}
+
+// ---------------------------------------------------------------------------
+// Route tables
+// ---------------------------------------------------------------------------
+
+static bool load_dump(const char* path, std::vector<Route>& routes, size_t limit) {
+	FILE* f = fopen(path, "r");
+	if (f == NULL) {
+		return false;
+	}
+	Addr prefix, next_hop_addr;
+	uint32_t length, next_hop;
+	while (routes.size() < limit &&
+	       fscanf(f, "%u %u %u %u %u %u %u %u %u %u", &prefix[0], &prefix[1], &prefix[2], &prefix[3], &length,
+	              &next_hop_addr[0], &next_hop_addr[1], &next_hop_addr[2], &next_hop_addr[3], &next_hop) == 10) {
+		if (length == 0 || length > 128) {
+			continue;
+		}
+		Route r = make_route(prefix, length);
+		r.next_hop = 1 + next_hop % 30;
+		routes.push_back(r);
+	}
+	fclose(f);
+	return true;
+}
+
+// Prefix lengths of the IPv6 default-free zone, in percent
+static const uint32_t DFZ_LENGTHS[][2] = {
+	{48, 50}, {32, 12}, {44, 8}, {40, 7}, {36, 4}, {29, 4}, {46, 3},
+	{47, 2}, {42, 2}, {45, 2}, {64, 2}, {28, 1}, {34, 1}, {38, 1}, {56, 1},
+};
+
+static uint32_t dfz_length() {
+	uint32_t pick = rng() % 100;
+	for (auto& l : DFZ_LENGTHS) {
+		if (pick < l[1]) {
+			return l[0];
+		}
+		pick -= l[1];
+	}
+	return 24 + rng() % 41;
+}
+
+// Allocations of the RIRs, then prefixes inside them and inside each other
+static void generate(std::vector<Route>& routes, size_t count) {
+	static const uint32_t RIR_BLOCKS[] = {0x2001, 0x2400, 0x2600, 0x2800, 0x2a00, 0x2c00};
+	std::vector<Addr> allocations;
+	for (uint32_t block : RIR_BLOCKS) {
+		Addr a = {block << 16, 0, 0, 0};
+		allocations.push_back(reorder(a));
+	}
+	std::vector<std::pair<Addr, uint32_t>> bases;
+	for (auto& a : allocations) {
+		bases.push_back({a, (a[0] == brev8(0x20010000)) ? 16 : 12});
+	}
+	std::set<std::pair<uint32_t, Addr>> seen;
+	while (routes.size() < count) {
+		uint32_t length = dfz_length();
+		// Most long prefixes are carved out of the shorter ones
+		std::pair<Addr, uint32_t> base = bases[rng() % 6];
+		if (bases.size() > 6 && rng() % 4 != 0) {
+			auto& b = bases[6 + rng() % (bases.size() - 6)];
+			if (b.second < length) {
+				base = b;
+			}
+		}
+		Route r = make_route(random_below(base.first, base.second), length);
+		if (!seen.insert({length, r.prefix}).second) {
+			continue;
+		}
+		routes.push_back(r);
+		if (length <= 36) {
+			bases.push_back({r.prefix, length});
+		}
+	}
+}
+
+// ---------------------------------------------------------------------------
+// Pipeline model, for LPM lookups
+// ---------------------------------------------------------------------------
+
+static uint32_t pipeline_reads;
+
+static inline uint32_t peek(uint32_t addr) {
+	++pipeline_reads;
+	return *(volatile uint32_t*)(uintptr_t)addr;
+}
+
+// The length of the longest prefix of addr in the live bank, 0 for none
+static uint32_t lpm(const Addr& addr) {
+	uint32_t root = ((peek(TRIE_BANK) & 1) << 1) + 1 + bit(addr, 0);
+	uint32_t vc_node = root, bt_node = root, best = 0;
+	for (uint32_t k = 0; k < 128 && (vc_node || bt_node); ++k) {
+		uint32_t stage = k >> 3;
+		uint32_t next_bit = (k < 127) ? bit(addr, k + 1) : 0;
+		if (vc_node != 0) {
+			uint32_t base = VC_BASE | (stage << 23) | (vc_node << 10);
+			for (uint32_t i = 0; i < VC_BIN_SIZES[stage]; ++i) {
+				uint32_t length = peek(base + ((i + 1) << 4));
+				uint32_t prefix = peek(base + ((i + 1) << 4) + 4);
+				uint32_t next_hop = peek(base + ((i + 1) << 4) + 8);
+				if (length == 31 || next_hop == 31 || k + 1 + length > 128 || k + 1 + length <= best) {
+					continue;
+				}
+				uint32_t remaining = 0;
+				for (uint32_t j = 0; j < length; ++j) {
+					remaining |= bit(addr, k + 1 + j) << j;
+				}
+				uint32_t m = (length == 0) ? 0 : (0xffffffffu >> (32 - length));
+				if ((remaining & m) == (prefix & m)) {
+					best = k + 1 + length;
+				}
+			}
+			vc_node = (k < 127) ? peek(base + (next_bit ? 4 : 0)) : 0;
+		}
+		if (bt_node != 0) {
+			uint32_t entry = peek(BT_BASE | (stage << 23) | (bt_node << 10));
+			if ((entry >> 31) && k + 1 > best) {
+				best = k + 1;
+			}
+			bt_node = (k < 127) ? (next_bit ? ((entry >> 13) & 0x1fff) : (entry & 0x1fff)) : 0;
+		}
+	}
+	return best;
+}
+
+// ---------------------------------------------------------------------------
+// Targets
+// ---------------------------------------------------------------------------
+
+struct Target {
+	const char* name;
+	int (*insert)(Route& r);
+	int (*lookup)(Route& r);
+	int (*remove)(Route& r);
+	int (*modify)(Route& r);
+	int (*anchor)(Route& r, uint32_t* length);  // the longest prefix above a route
+};
+
+static int vc_insert(Route& r) {
+	return (int)VCTrieInsert(r.prefix.data(), r.length, r.next_hop);
+}
+static int vc_lookup(Route& r) {
+	return (int)VCTrieLookup(r.prefix.data(), r.length);
+}
+static int vc_anchor(Route& r, uint32_t* length) {
+	return (int)VCTrieLongestMatch(r.prefix.data(), r.length, length);
+}
+static int vc_remove(Route& r) {
+	int index = (int)VCTrieLookup(r.prefix.data(), r.length);
+	if (index >= 0) {
+		VCEntryInvalidate(VCTrieIndexToAddress(index));
+	}
+	return index;
+}
+static int vc_modify(Route& r) {
+	int index = (int)VCTrieLookup(r.prefix.data(), r.length);
+	if (index >= 0) {
+		VCEntryModify(VCTrieIndexToAddress(index), r.next_hop);
+	}
+	return index;
+}
+
+static int bt_insert(Route& r) {
+	return BTrieInsert(r.prefix.data(), r.length, r.next_hop);
+}
+static int bt_lookup(Route& r) {
+	return (int)BTrieLookup(r.prefix.data(), r.length);
+}
+static int bt_anchor(Route& r, uint32_t* length) {
+	return BTrieLongestMatch(r.prefix.data(), r.length, (int*)length);
+}
+static int bt_remove(Route& r) {
+	return BTrieDelete(r.prefix.data(), r.length);
+}
+
+static int tries_insert(Route& r) {
+	return TrieInsert(r.network.data(), r.length, r.next_hop);
+}
+static int tries_lookup(Route& r) {
+	return TrieLookup(r.network.data(), r.length);
+}
+static int tries_anchor(Route& r, uint32_t* length) {
+	return TrieLongestMatch(r.network.data(), r.length, length);
+}
+static int tries_remove(Route& r) {
+	return TrieDelete(r.network.data(), r.length);
+}
+static int tries_modify(Route& r) {
+	TrieModify(r.network.data(), r.length, r.next_hop);
+	return 0;
+}
+
+static const Target TARGETS[] = {
+	{"vc", vc_insert, vc_lookup, vc_remove, vc_modify, vc_anchor},
+	{"bt", bt_insert, bt_lookup, bt_remove, bt_insert, bt_anchor},
+	{"tries", tries_insert, tries_lookup, tries_remove, tries_modify, tries_anchor},
+};
+
+// ---------------------------------------------------------------------------
+// Measurements
+// ---------------------------------------------------------------------------
+
+struct Stage {
+	std::string name;
+	uint64_t ops = 0;
+	uint64_t failed = 0;
+	double seconds = 0;
+	std::vector<float> latency;  // ns per op
+	uint64_t reads = 0;
+	uint64_t writes = 0;
+	uint64_t bram_reads[TRIE_STATS_BRAMS] = {};  // BT levels, then VC stages
+	uint64_t bram_writes[TRIE_STATS_BRAMS] = {};
+
+	double percentile(double p) const {
+		if (latency.empty()) {
+			return 0;
+		}
+		return latency[std::min(latency.size() - 1, (size_t)(p * latency.size()))];
+	}
+};
+
+struct Result {
+	const char* target;
+	std::vector<Stage> stages;
+	uint32_t vc_prefixes[16];
+	uint32_t bt_prefixes[16];
+	struct trie_op_stats api[TRIE_OP_NUM];  // of TrieInsert & co, over the whole run
+};
+
+// The loads and stores counted so far, per BRAM
+static void count_accesses(uint64_t reads[TRIE_STATS_BRAMS], uint64_t writes[TRIE_STATS_BRAMS]) {
+	for (int bram = 0; bram < TRIE_STATS_BRAMS; ++bram) {
+		reads[bram] = writes[bram] = 0;
+		for (int op = 0; op < TRIE_OP_NUM; ++op) {
+			reads[bram] += trie_op_stats[op].reads[bram];
+			writes[bram] += trie_op_stats[op].writes[bram];
+		}
+	}
+}
+
+typedef std::chrono::steady_clock Clock;
+
+// Time op on every item, one at a time
+template <typename Op>
+static Stage measure(const char* name, size_t count, Op op) {
+	Stage s;
+	s.name = name;
+	s.latency.reserve(count);
+	uint64_t reads[TRIE_STATS_BRAMS], writes[TRIE_STATS_BRAMS];
+	count_accesses(reads, writes);
+	auto begin = Clock::now();
+	for (size_t i = 0; i < count; ++i) {
+		auto start = Clock::now();
+		bool ok = op(i);
+		auto end = Clock::now();
+		s.latency.push_back(std::chrono::duration<float, std::nano>(end - start).count());
+		s.failed += !ok;
+	}
+	s.seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+	s.ops = count;
+	count_accesses(s.bram_reads, s.bram_writes);
+	for (int bram = 0; bram < TRIE_STATS_BRAMS; ++bram) {
+		s.bram_reads[bram] -= reads[bram];
+		s.bram_writes[bram] -= writes[bram];
+		s.reads += s.bram_reads[bram];
+		s.writes += s.bram_writes[bram];
+	}
+	std::sort(s.latency.begin(), s.latency.end());
+	return s;
+}
+
+static Result* occupancy_result;
+
+static void count_prefix(void* prefix, uint32_t length, uint32_t next_hop, uint32_t index) {
+	(void)prefix, (void)length, (void)next_hop;
+	if (index >= BT_INDEX_BASE) {
+		occupancy_result->bt_prefixes[((index - BT_INDEX_BASE) >> 11) & 0xf]++;
+		return;
+	}
+	uint32_t stage = 0;
+	while (index >= VC_INDEX_SUMS[stage + 1]) {
+		++stage;
+	}
+	occupancy_result->vc_prefixes[stage]++;
+}
+
+static void fail(const char* target, const char* what, size_t count) {
+	printf("FAIL: %s: %zu %s\n", target, count, what);
+	exit(1);
+}
+
+static Result run(const Target& t, std::vector<Route>& routes, size_t loaded, const uint32_t mix[3]) {
+	Result result;
+	result.target = t.name;
+	TrieInit();
+	TrieStatsClear();
+
+	// Bulk load, then the routes that did not fit are left out of the other stages
+	std::vector<char> present(routes.size(), 0);
+	result.stages.push_back(measure("load", loaded, [&](size_t i) {
+		present[i] = t.insert(routes[i]) >= 0;
+		return present[i] != 0;
+	}));
+	std::vector<size_t> live;
+	for (size_t i = 0; i < loaded; ++i) {
+		if (present[i]) {
+			live.push_back(i);
+		}
+	}
+	memset(result.vc_prefixes, 0, sizeof(result.vc_prefixes));
+	memset(result.bt_prefixes, 0, sizeof(result.bt_prefixes));
+	occupancy_result = &result;
+	VCTrieWalk(trie_bank, count_prefix);
+	BTrieWalk(trie_bank, count_prefix);
+	if (live.empty()) {
+		return result;
+	}
+
+	size_t lookups = std::max(live.size(), (size_t)100000);
+	std::vector<size_t> picks(lookups);
+	for (auto& p : picks) {
+		p = live[rng() % live.size()];
+	}
+	Stage exact = measure("exact_lookup", lookups, [&](size_t i) {
+		return t.lookup(routes[picks[i]]) >= 0;
+	});
+	if (exact.failed) {
+		fail(t.name, "loaded routes not found", exact.failed);
+	}
+	result.stages.push_back(exact);
+
+	// The longest loaded route above each route, in a single walk of the tries
+	std::set<std::pair<uint32_t, Addr>> loaded_prefixes;
+	for (size_t i : live) {
+		loaded_prefixes.insert({routes[i].length, routes[i].prefix});
+	}
+	uint64_t misplaced = 0;
+	Stage anchor = measure("anchor_lookup", lookups, [&](size_t i) {
+		Route& r = routes[picks[i]];
+		uint32_t length = 0;
+		int found = t.anchor(r, &length) >= 0;
+		uint32_t expected = r.length;
+		while (expected > 1 && !loaded_prefixes.count({expected - 1, mask(r.prefix, expected - 1)})) {
+			--expected;
+		}
+		misplaced += found ? (length != expected - 1) : (expected > 1);
+		return found != 0;
+	});
+	if (misplaced) {
+		fail(t.name, "routes got a wrong route above them", misplaced);
+	}
+	result.stages.push_back(anchor);
+
+	// Addresses inside the loaded routes, and a few anywhere
+	std::vector<Addr> addrs(lookups);
+	std::vector<uint32_t> at_least(lookups);
+	for (size_t i = 0; i < lookups; ++i) {
+		if (rng() % 10 == 0) {
+			addrs[i] = random_below({0, 0, 0, 0}, 0);
+			at_least[i] = 0;
+		} else {
+			addrs[i] = random_below(routes[picks[i]].prefix, routes[picks[i]].length);
+			at_least[i] = routes[picks[i]].length;
+		}
+	}
+	uint64_t wrong = 0;
+	pipeline_reads = 0;
+	Stage longest = measure("lpm_lookup", lookups, [&](size_t i) {
+		uint32_t length = lpm(addrs[i]);
+		wrong += length < at_least[i];
+		return length > 0;
+	});
+	longest.reads = pipeline_reads;
+	if (wrong) {
+		fail(t.name, "addresses missed the loaded routes covering them", wrong);
+	}
+	result.stages.push_back(longest);
+
+	// Churn: insert the routes not loaded, withdraw and modify the loaded ones
+	std::vector<size_t> spare;
+	for (size_t i = 0; i < routes.size(); ++i) {
+		if (!present[i]) {
+			spare.push_back(i);
+		}
+	}
+	uint32_t total = mix[0] + mix[1] + mix[2];
+	result.stages.push_back(measure("churn", live.size(), [&](size_t) {
+		uint32_t pick = rng() % total;
+		if ((pick < mix[0] && !spare.empty()) || live.empty()) {
+			size_t k = rng() % spare.size();
+			size_t i = spare[k];
+			if (t.insert(routes[i]) < 0) {
+				return false;
+			}
+			spare[k] = spare.back();
+			spare.pop_back();
+			live.push_back(i);
+			return true;
+		}
+		size_t k = rng() % live.size();
+		size_t i = live[k];
+		if (pick < mix[0] + mix[1]) {
+			if (t.remove(routes[i]) < 0) {
+				return false;
+			}
+			live[k] = live.back();
+			live.pop_back();
+			spare.push_back(i);
+			return true;
+		}
+		routes[i].next_hop = 1 + (routes[i].next_hop % 30);
+		return t.modify(routes[i]) >= 0;
+	}));
+
+	Stage removal = measure("delete", live.size(), [&](size_t i) {
+		return t.remove(routes[live[i]]) >= 0;
+	});
+	if (removal.failed) {
+		fail(t.name, "live routes could not be deleted", removal.failed);
+	}
+	result.stages.push_back(removal);
+	size_t left = 0;
+	for (size_t i : live) {
+		left += t.lookup(routes[i]) >= 0;
+	}
+	if (left) {
+		fail(t.name, "deleted routes still found", left);
+	}
+	return result;
+}
+
+// ---------------------------------------------------------------------------
+// Reports
+// ---------------------------------------------------------------------------
+
+static void report(const Result& r) {
+	printf("%s\n", r.target);
+	printf("  %-13s %8s %8s %10s %8s %8s %8s %9s %8s %8s\n", "stage", "ops", "failed", "ops/s",
+	       "p50 ns", "p90 ns", "p99 ns", "max ns", "reads", "writes");
+	for (auto& s : r.stages) {
+		printf("  %-13s %8llu %8llu %10.0f %8.0f %8.0f %8.0f %9.0f %8.2f %8.2f\n", s.name.c_str(),
+		       (unsigned long long)s.ops, (unsigned long long)s.failed, s.ops / s.seconds,
+		       s.percentile(0.5), s.percentile(0.9), s.percentile(0.99), s.percentile(1.0),
+		       (double)s.reads / s.ops, (double)s.writes / s.ops);
+	}
+	static const char* API[TRIE_OP_NUM] = {NULL, "TrieInsert", "TrieLookup", "TrieDelete", "TrieModify"};
+	for (int op = TRIE_OP_INSERT; op <= TRIE_OP_MODIFY; ++op) {
+		const struct trie_op_stats& api = r.api[op];
+		if (api.calls == 0) {
+			continue;
+		}
+		uint64_t reads = 0, writes = 0;
+		for (int bram = 0; bram < TRIE_STATS_BRAMS; ++bram) {
+			reads += api.reads[bram];
+			writes += api.writes[bram];
+		}
+		printf("  %-13s %8u calls, %.2f reads %.2f writes per call, at most %u accesses\n", API[op], api.calls,
+		       (double)reads / api.calls, (double)writes / api.calls, api.max_accesses);
+	}
+	printf("  VC prefixes per stage:");
+	for (int i = 0; i < 16; ++i) {
+		printf(" %u/%u", r.vc_prefixes[i], VC_BRAM_DEPTHS[i] * VC_BIN_SIZES[i]);
+	}
+	printf("\n  BT prefixes per level:");
+	for (int i = 0; i < 16; ++i) {
+		printf(" %u", r.bt_prefixes[i]);
+	}
+	printf("\n");
+}
+
+// Per BRAM, BT levels 0 ~ 15 then VC stages 0 ~ 15
+static void write_array(FILE* f, const char* name, const uint64_t counts[TRIE_STATS_BRAMS]) {
+	fprintf(f, "\"%s\": [", name);
+	for (int bram = 0; bram < TRIE_STATS_BRAMS; ++bram) {
+		fprintf(f, "%llu%s", (unsigned long long)counts[bram], bram + 1 < TRIE_STATS_BRAMS ? ", " : "]");
+	}
+}
+
+static void write_json(FILE* f, const std::vector<Result>& results, const char* source, size_t routes, uint32_t seed) {
+	fprintf(f, "{\n  \"source\": \"%s\",\n  \"routes\": %zu,\n  \"seed\": %u,\n  \"targets\": [\n", source, routes, seed);
+	for (size_t t = 0; t < results.size(); ++t) {
+		const Result& r = results[t];
+		fprintf(f, "    {\n      \"name\": \"%s\",\n      \"stages\": [\n", r.target);
+		for (size_t i = 0; i < r.stages.size(); ++i) {
+			const Stage& s = r.stages[i];
+			fprintf(f, "        {\"name\": \"%s\", \"ops\": %llu, \"failed\": %llu, \"ops_per_s\": %.0f, "
+			        "\"p50_ns\": %.0f, \"p90_ns\": %.0f, \"p99_ns\": %.0f, \"max_ns\": %.0f, "
+			        "\"reads_per_op\": %.3f, \"writes_per_op\": %.3f, ",
+			        s.name.c_str(), (unsigned long long)s.ops, (unsigned long long)s.failed, s.ops / s.seconds,
+			        s.percentile(0.5), s.percentile(0.9), s.percentile(0.99), s.percentile(1.0),
+			        (double)s.reads / s.ops, (double)s.writes / s.ops);
+			write_array(f, "bram_reads", s.bram_reads);
+			fprintf(f, ", ");
+			write_array(f, "bram_writes", s.bram_writes);
+			fprintf(f, "}%s\n", i + 1 < r.stages.size() ? "," : "");
+		}
+		fprintf(f, "      ],\n      \"vc_prefixes\": [");
+		for (int i = 0; i < 16; ++i) {
+			fprintf(f, "%u%s", r.vc_prefixes[i], i < 15 ? ", " : "");
+		}
+		fprintf(f, "],\n      \"bt_prefixes\": [");
+		for (int i = 0; i < 16; ++i) {
+			fprintf(f, "%u%s", r.bt_prefixes[i], i < 15 ? ", " : "");
+		}
+		fprintf(f, "],\n      \"api\": {");
+		static const char* API[TRIE_OP_NUM] = {NULL, "insert", "lookup", "delete", "modify"};
+		for (int op = TRIE_OP_INSERT; op <= TRIE_OP_MODIFY; ++op) {
+			const struct trie_op_stats& api = r.api[op];
+			uint64_t reads[TRIE_STATS_BRAMS], writes[TRIE_STATS_BRAMS];
+			std::copy(api.reads, api.reads + TRIE_STATS_BRAMS, reads);
+			std::copy(api.writes, api.writes + TRIE_STATS_BRAMS, writes);
+			fprintf(f, "\n        \"%s\": {\"calls\": %u, \"max_accesses\": %u, ", API[op], api.calls, api.max_accesses);
+			write_array(f, "bram_reads", reads);
+			fprintf(f, ", ");
+			write_array(f, "bram_writes", writes);
+			fprintf(f, "}%s", op < TRIE_OP_MODIFY ? "," : "\n      ");
+		}
+		fprintf(f, "}\n    }%s\n", t + 1 < results.size() ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+}
+
+int main(int argc, char** argv) {
+	size_t count = 100000;
+	uint32_t seed = 1;
+	uint32_t mix[3] = {40, 40, 20};
+	const char* dump = NULL;
+	const char* output = NULL;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		if (!strcmp(argv[i], "-n")) {
+			count = strtoul(argv[i + 1], NULL, 0);
+		} else if (!strcmp(argv[i], "-f")) {
+			dump = argv[i + 1];
+		} else if (!strcmp(argv[i], "-s")) {
+			seed = strtoul(argv[i + 1], NULL, 0);
+		} else if (!strcmp(argv[i], "-m")) {
+			if (sscanf(argv[i + 1], "%u:%u:%u", &mix[0], &mix[1], &mix[2]) != 3 || mix[0] + mix[1] + mix[2] == 0) {
+				printf("bad mix %s\n", argv[i + 1]);
+				return 1;
+			}
+		} else if (!strcmp(argv[i], "-o")) {
+			output = argv[i + 1];
+		} else {
+			printf("usage: %s [-n routes] [-f dump] [-s seed] [-m insert:withdraw:modify] [-o results.json]\n", argv[0]);
+			return 1;
+		}
+	}
+	rng.seed(seed);
+	if (hal_host_init() != 0) {
+		printf("FAIL: cannot map the trie BRAM window\n");
+		return 1;
+	}
+
+	// A quarter more routes than loaded, to insert during the churn
+	std::vector<Route> routes;
+	size_t total = count + count / 4;
+	if (dump != NULL) {
+		if (!load_dump(dump, routes, total)) {
+			printf("FAIL: cannot read %s\n", dump);
+			return 1;
+		}
+		std::shuffle(routes.begin(), routes.end(), rng);
+		count = std::min(count, routes.size() * 4 / 5);
+	} else {
+		generate(routes, total);
+	}
+	printf("%zu routes (%s), %zu loaded, churn %u:%u:%u, seed %u\n", routes.size(), dump ? dump : "generated",
+	       count, mix[0], mix[1], mix[2], seed);
+
+	std::vector<Result> results;
+	for (const Target& t : TARGETS) {
+		std::vector<Route> copy = routes;
+		results.push_back(run(t, copy, count, mix));
+		memcpy(results.back().api, trie_op_stats, sizeof(trie_op_stats));
+		report(results.back());
+	}
+	if (output != NULL) {
+		FILE* f = fopen(output, "w");
+		if (f == NULL) {
+			printf("FAIL: cannot write %s\n", output);
+			return 1;
+		}
+		write_json(f, results, dump ? dump : "generated", count, seed);
+		fclose(f);
+	}
+	printf("PASS\n");
+	return 0;
+}
@@ -0,0 +1,457 @@
+//
+// Stress test of trie updates against live lookups.
+//
+// The firmware trie code (tries.c, vc_trie.cpp, binary_trie.c) is built with
+// TRIE_SIM, so that every BRAM store goes through TrieSimStore. The BRAM window
+// is mapped at its real address, and a model of the trie128 pipeline advances
+// by one level on every store, so lookups interleave with updates at store
+// granularity. Every lookup must return the longest match of some version of
+// the route table that existed while it was in the pipeline.
+//
+// Build & run: make -C trie/sim test
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+#include <map>
+#include <set>
+#include <array>
+#include <algorithm>
+#include "sim_host.h"
+#include "sim_test.h"
+
+extern "C" {
+void TrieInit();
+int  TrieInsert(void* prefix, unsigned int length, uint32_t next_hop);
+int  TrieDelete(void* prefix, unsigned int length);
+void TrieModify(void* prefix, unsigned int length, uint32_t next_hop);
+int  TrieRebalance();
+int  TrieCompact();
+
+int rte_map[NUM_TRIE_NODE];
+}
+
+static const uint32_t VC_BASE = 0x28000000;
+static const uint32_t BT_BASE = 0x20000000;
+
+static const uint32_t VC_BRAM_DEPTHS[16] = {
+	64, 256, 6144, 7168, 5120, 3072, 256, 256,
+	256, 256, 256, 256, 256, 256, 256, 256
+};
+static const uint32_t VC_BIN_SIZES[16] = {
+	1, 7, 15, 15, 14, 10, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1
+};
+
+// Addresses are kept in the bit order of the tries
+static inline uint32_t bit(const BitAddr& a, uint32_t i) {
+	return (a[i >> 5] >> (i & 31)) & 1;
+}
+
+static inline uint32_t peek(uint32_t addr) {
+	return *(volatile uint32_t*)(uintptr_t)addr;
+}
+
+// ---------------------------------------------------------------------------
+// Reference route table
+// ---------------------------------------------------------------------------
+
+struct Route {
+	BitAddr prefix;
+	uint32_t length;
+	bool spilled;  // placed into the BTrie
+};
+
+static RouteTable<BitAddr, uint32_t> table;
+
+static int reference_lookup(const BitAddr& addr) {
+	const uint32_t* next_hop = table.lookup(addr);
+	return next_hop ? (int)*next_hop : -1;
+}
+
+// ---------------------------------------------------------------------------
+// Pipeline model
+// ---------------------------------------------------------------------------
+
+struct Lookup {
+	BitAddr addr;
+	uint32_t level;     // 0~127, the level to be read next
+	uint32_t vc_node;   // node index in the VC stage of this level, 0 for none
+	uint32_t bt_node;   // node index in the BT level of this level, 0 for none
+	int vc_length, vc_next_hop;
+	int bt_length, bt_next_hop;
+	std::set<int> accepted;
+};
+
+static std::vector<Lookup> in_flight;
+static std::vector<Lookup> finished;
+static std::vector<Route> hot_routes;
+static uint32_t lookup_in_seq = 0;
+static uint32_t lookup_out_seq = 0;
+static uint64_t ticks = 0;
+static uint64_t checked = 0;
+static bool injecting = true;
+
+static void inject() {
+	Lookup l;
+	if (!hot_routes.empty() && rng() % 4 != 0) {
+		// an address inside a prefix that is being updated
+		const Route& r = hot_routes[rng() % hot_routes.size()];
+		l.addr = random_below(r.prefix, r.length);
+	} else {
+		l.addr = random_address<BitAddr>();
+	}
+	// the root of the bank is latched when the lookup enters the pipeline
+	uint32_t root = TRIE_BANK_ROOT(peek(TRIE_BANK_ADDR) & 1, bit(l.addr, 0));
+	l.level = 0;
+	l.vc_node = root;
+	l.bt_node = root;
+	l.vc_length = l.bt_length = 0;
+	l.vc_next_hop = l.bt_next_hop = -1;
+	l.accepted.insert(reference_lookup(l.addr));
+	in_flight.push_back(l);
+	++lookup_in_seq;
+}
+
+// Read the nodes of one level, as a trie8 stage does.
+// The node at level k represents the first k + 1 bits of the address.
+static void step(Lookup& l) {
+	uint32_t k = l.level;
+	uint32_t stage = k >> 3;
+	uint32_t next_stage = (k + 1) >> 3;
+	uint32_t next_bit = (k < 127) ? bit(l.addr, k + 1) : 0;
+	if (l.vc_node != 0) {
+		uint32_t base = VC_BASE | (stage << 23) | (l.vc_node << 10);
+		for (uint32_t i = 0; i < VC_BIN_SIZES[stage]; ++i) {
+			uint32_t length = peek(base + ((i + 1) << 4));
+			uint32_t prefix = peek(base + ((i + 1) << 4) + 4);
+			uint32_t next_hop = peek(base + ((i + 1) << 4) + 8);
+			if (length == 31 || next_hop == 31 || k + 1 + length > 128) {
+				continue;
+			}
+			uint32_t m = (length == 0) ? 0 : (0xffffffffu >> (32 - length));
+			uint32_t remaining = 0;
+			for (uint32_t j = 0; j < length; ++j) {
+				remaining |= bit(l.addr, k + 1 + j) << j;
+			}
+			if ((remaining & m) == (prefix & m) && (int)(k + 1 + length) > l.vc_length) {
+				l.vc_length = k + 1 + length;
+				l.vc_next_hop = next_hop;
+			}
+		}
+		l.vc_node = (k < 127) ? peek(base + (next_bit ? 4 : 0)) : 0;
+		if (l.vc_node != 0 && l.vc_node >= VC_BRAM_DEPTHS[next_stage]) {
+			printf("FAIL: VC node %u out of range at stage %u\n", l.vc_node, next_stage);
+			exit(1);
+		}
+	}
+	if (l.bt_node != 0) {
+		uint32_t entry = peek(BT_BASE | (stage << 23) | (l.bt_node << 10));
+		if (entry >> 31) {
+			l.bt_length = k + 1;
+			l.bt_next_hop = (entry >> 26) & 0x1f;
+		}
+		l.bt_node = (k < 127) ? (next_bit ? ((entry >> 13) & 0x1fff) : (entry & 0x1fff)) : 0;
+	}
+	++l.level;
+}
+
+static void tick() {
+	++ticks;
+	for (size_t i = 0; i < in_flight.size();) {
+		step(in_flight[i]);
+		if (in_flight[i].level == 128) {
+			finished.push_back(in_flight[i]);
+			in_flight[i] = in_flight.back();
+			in_flight.pop_back();
+			++lookup_out_seq;
+		} else {
+			++i;
+		}
+	}
+	// about one lookup per stage, as in trie128
+	if (injecting && rng() % 8 == 0) {
+		inject();
+	}
+}
+
+// Called after every update: lookups that overlapped with it may see its result
+static void commit() {
+	for (auto& l : in_flight) {
+		l.accepted.insert(reference_lookup(l.addr));
+	}
+	for (auto& l : finished) {
+		l.accepted.insert(reference_lookup(l.addr));
+		// VC wins ties, as in trie128
+		int result = (l.vc_length >= l.bt_length) ? l.vc_next_hop : l.bt_next_hop;
+		if (l.vc_length == 0 && l.bt_length == 0) {
+			result = -1;
+		}
+		if (l.accepted.count(result) == 0) {
+			printf("FAIL: lookup %08x:%08x:%08x:%08x returned %d (vc /%d, bt /%d), expected one of",
+			       brev8(l.addr[0]), brev8(l.addr[1]), brev8(l.addr[2]), brev8(l.addr[3]),
+			       result, l.vc_length, l.bt_length);
+			for (int r : l.accepted) {
+				printf(" %d", r);
+			}
+			printf("\n");
+			exit(1);
+		}
+		++checked;
+	}
+	finished.clear();
+}
+
+// Let lookups to the prefixes of the next update fill the pipeline
+static void warm_up() {
+	for (int i = 0; i < 128; ++i) {
+		tick();
+	}
+}
+
+extern "C" void TrieSimStore(uint32_t addr, uint32_t data) {
+	sim_check_store(addr);
+	*(volatile uint32_t*)(uintptr_t)addr = data;
+	tick();
+}
+
+extern "C" uint32_t TrieSimLoad(uint32_t addr) {
+	tick();
+	if (addr == TRIE_LOOKUP_IN_SEQ_ADDR) {
+		return lookup_in_seq;
+	}
+	if (addr == TRIE_LOOKUP_OUT_SEQ_ADDR) {
+		return lookup_out_seq;
+	}
+	return peek(addr);
+}
+
+// ---------------------------------------------------------------------------
+// Driver
+// ---------------------------------------------------------------------------
+
+static void power_on() {
+	sim_map_bram();
+	// As after a warm reset: the BRAMs hold the tables of a previous run,
+	// which TrieInit must not have to sweep
+	for (uint32_t stage = 0; stage < 16; ++stage) {
+		for (uint32_t node = 0; node < VC_BRAM_DEPTHS[stage]; ++node) {
+			uint32_t base = VC_BASE | (stage << 23) | (node << 10);
+			*(uint32_t*)(uintptr_t)base = rng() % VC_BRAM_DEPTHS[(stage + 1) % 16];
+			*(uint32_t*)(uintptr_t)(base + 4) = rng() % VC_BRAM_DEPTHS[(stage + 1) % 16];
+			for (uint32_t i = 0; i < VC_BIN_SIZES[stage]; ++i) {
+				*(uint32_t*)(uintptr_t)(base + ((i + 1) << 4)) = rng() % 32;
+				*(uint32_t*)(uintptr_t)(base + ((i + 1) << 4) + 4) = rng();
+				*(uint32_t*)(uintptr_t)(base + ((i + 1) << 4) + 8) = rng() % 32;
+			}
+		}
+	}
+	for (uint32_t level = 0; level < 15; ++level) {
+		for (uint32_t index = 0; index < 2048; ++index) {
+			*(uint32_t*)(uintptr_t)(BT_BASE | (level << 23) | (index << 10)) = (rng() & 0x87ff8000) | ((rng() % 2048) << 13) | (rng() % 2048);
+		}
+	}
+	*(uint32_t*)(uintptr_t)TRIE_BANK_ADDR = rng() & 1;
+}
+
+static void to_network(const BitAddr& a, uint32_t* out) {
+	for (int i = 0; i < 4; ++i) {
+		out[i] = brev8(a[i]);
+	}
+}
+
+// Routes are clustered below a few prefixes, as in a real table
+static Route random_route(const std::vector<BitAddr>& clusters) {
+	Route r;
+	r.spilled = false;
+	const BitAddr& base = clusters[rng() % clusters.size()];
+	if (rng() % 8 < 5) {
+		// short prefixes, mostly land in the dense stages of the VC trie
+		r.prefix = random_below(base, 16);
+		r.length = 17 + rng() % 32;
+	} else {
+		// long prefixes, they overflow the narrow stages into the BTrie
+		r.prefix = random_below(base, 40);
+		r.length = 49 + rng() % 80;
+	}
+	r.prefix = mask(r.prefix, r.length);
+	return r;
+}
+
+// The first prefixes in the order of the tries are the first to be freed with the old bank
+static bool trie_order(const Route& a, const Route& b) {
+	for (uint32_t i = 0; i < 128; ++i) {
+		if (bit(a.prefix, i) != bit(b.prefix, i)) {
+			return bit(a.prefix, i) < bit(b.prefix, i);
+		}
+	}
+	return a.length > b.length;
+}
+
+// Copy the table into the other bank, lookups go to the prefixes freed first after the swap
+static bool compact(const std::vector<Route>& routes) {
+	hot_routes = routes;
+	std::sort(hot_routes.begin(), hot_routes.end(), trie_order);
+	hot_routes.resize(std::min<size_t>(hot_routes.size(), 8));
+	warm_up();
+	return TrieCompact() == 0;
+}
+
+int main(int argc, char** argv) {
+	uint32_t seed = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : 1;
+	uint32_t rounds = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) : 50000;
+	rng.seed(seed);
+
+	power_on();
+	// lookups are only checked once the tables are valid
+	injecting = false;
+	TrieInit();
+	injecting = true;
+
+	std::vector<BitAddr> clusters;
+	for (int i = 0; i < 16; ++i) {
+		clusters.push_back(random_address<BitAddr>());
+	}
+	std::vector<Route> routes;
+	uint32_t inserted = 0, deleted = 0, modified = 0, failed = 0, moved = 0;
+	uint32_t compacted = 0, aborted = 0, cleared = 0;
+
+	for (uint32_t round = 0; round < rounds; ++round) {
+		uint32_t op = rng() % 16;
+		uint32_t prefix[4];
+		if (round % 8192 == 4096) {
+			// clear all routes while forwarding, and reload some of them at once
+			hot_routes.assign(routes.begin(), routes.begin() + 8);
+			warm_up();
+			TrieInit();
+			table.clear();
+			routes.clear();
+			commit();
+			for (Route r : hot_routes) {
+				uint32_t next_hop = rng() % 31;
+				to_network(r.prefix, prefix);
+				int index = TrieInsert(prefix, r.length, next_hop);
+				if (index >= 0) {
+					r.spilled = (index >= TRIE_BT_INDEX_BASE);
+					table.set({r.length, r.prefix}, next_hop);
+					routes.push_back(r);
+					++inserted;
+				}
+				commit();
+			}
+			++cleared;
+		} else if (op < 7 || routes.size() < 2048) {
+			Route r = random_route(clusters);
+			uint32_t next_hop = rng() % 31;
+			if (table.find({r.length, r.prefix})) {
+				continue;
+			}
+			hot_routes.assign(1, r);
+			to_network(r.prefix, prefix);
+			warm_up();
+			int index = TrieInsert(prefix, r.length, next_hop);
+			if (index < 0) {
+				++failed;
+			} else {
+				r.spilled = (index >= TRIE_BT_INDEX_BASE);
+				table.set({r.length, r.prefix}, next_hop);
+				routes.push_back(r);
+				++inserted;
+			}
+		} else if (op < 13) {
+			uint32_t index = rng() % routes.size();
+			Route r = routes[index];
+			hot_routes.assign(1, r);
+			to_network(r.prefix, prefix);
+			warm_up();
+			if (TrieDelete(prefix, r.length) < 0) {
+				printf("FAIL: cannot delete /%u\n", r.length);
+				return 1;
+			}
+			table.erase({r.length, r.prefix});
+			routes[index] = routes.back();
+			routes.pop_back();
+			++deleted;
+		} else if (op < 15) {
+			Route r = routes[rng() % routes.size()];
+			uint32_t next_hop = rng() % 31;
+			hot_routes.assign(1, r);
+			to_network(r.prefix, prefix);
+			warm_up();
+			TrieModify(prefix, r.length, next_hop);
+			table.set({r.length, r.prefix}, next_hop);
+			++modified;
+		} else if (round % 64 == 0) {
+			// usually the table does not fit twice, the shadow bank must be thrown away cleanly
+			if (compact(routes)) {
+				++compacted;
+			} else {
+				++aborted;
+			}
+		} else {
+			// lookups go to the prefixes that are going to be moved back into the VC trie
+			hot_routes.clear();
+			for (int i = spill_cursor; i < spill_top && i < spill_cursor + 8; ++i) {
+				if (spill_entries[i].valid) {
+					Route r;
+					r.prefix = {spill_entries[i].prefix.s6_addr32[0], spill_entries[i].prefix.s6_addr32[1],
+					            spill_entries[i].prefix.s6_addr32[2], spill_entries[i].prefix.s6_addr32[3]};
+					r.length = spill_entries[i].length;
+					hot_routes.push_back(r);
+				}
+			}
+			warm_up();
+			moved += TrieRebalance();
+		}
+		commit();
+	}
+
+	// Shrink the table, copying it into the other bank once it is small enough
+	while (!routes.empty()) {
+		uint32_t index = rng() % routes.size();
+		Route r = routes[index];
+		uint32_t prefix[4];
+		hot_routes.assign(1, r);
+		to_network(r.prefix, prefix);
+		warm_up();
+		if (TrieDelete(prefix, r.length) < 0) {
+			printf("FAIL: cannot delete /%u\n", r.length);
+			return 1;
+		}
+		table.erase({r.length, r.prefix});
+		routes[index] = routes.back();
+		routes.pop_back();
+		++deleted;
+		commit();
+		if (routes.size() % 32 == 0 && !routes.empty()) {
+			if (compact(routes)) {
+				++compacted;
+			} else {
+				++aborted;
+			}
+			commit();
+		}
+	}
+
+	// Drain the pipeline
+	injecting = false;
+	while (!in_flight.empty()) {
+		tick();
+	}
+	commit();
+
+	printf("seed %u: %u inserted, %u deleted, %u modified, %u not placed, %u moved back to VC, %u/%u compactions, %u clears\n",
+	       seed, inserted, deleted, modified, failed, moved, compacted, compacted + aborted, cleared);
+	printf("%llu ticks, %llu lookups checked, %zu routes left\n",
+	       (unsigned long long)ticks, (unsigned long long)checked, table.routes.size());
+	if (moved == 0 || compacted == 0 || aborted == 0 || cleared == 0 || checked == 0) {
+		printf("FAIL: the test did not exercise rebalancing, compaction and clearing\n");
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
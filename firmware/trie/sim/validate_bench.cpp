@@ -0,0 +1,172 @@
+//
+// Microbenchmark of the checks of the RIPng entries (validate.c).
+//
+// Full packets of 71 entries are checked by validate_entries() and by the
+// byte-wise loop disassemble() used before, which must agree on every packet,
+// good or with a random fault. Then both are timed on good packets, the common
+// case.
+//
+// Build & run: make -C trie/sim test
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <vector>
+
+extern "C" {
+struct ripng_rte {
+	uint8_t ip6_addr[16];
+	uint16_t route_tag;
+	uint8_t prefix_len;
+	uint8_t metric;
+};
+int validate_entries(ripng_rte* entries, int num_entries);
+}
+
+// As in include/ripng.h
+enum {
+	SUCCESS = 0,
+	ERR_RIPNG_BAD_METRIC = 7,
+	ERR_RIPNG_BAD_PREFIX_LEN = 8,
+	ERR_RIPNG_BAD_ROUTE_TAG = 9,
+	ERR_RIPNG_INCONSISTENT_PREFIX_LENGTH = 10,
+};
+
+static const int NUM_ENTRIES = 71;
+
+// The checks of disassemble() before validate.c
+static int reference_validate(ripng_rte* entries, int num_entries) {
+	for (int i = 0; i < num_entries; i++) {
+		if (entries[i].metric == 0xff) {
+			if (entries[i].prefix_len != 0) {
+				return ERR_RIPNG_BAD_PREFIX_LEN;
+			}
+			if (entries[i].route_tag != 0) {
+				return ERR_RIPNG_BAD_ROUTE_TAG;
+			}
+		} else {
+			if (entries[i].metric < 1 || entries[i].metric > 16) {
+				return ERR_RIPNG_BAD_METRIC;
+			}
+			if (entries[i].prefix_len > 128) {
+				return ERR_RIPNG_BAD_PREFIX_LEN;
+			}
+			int prefix_len = entries[i].prefix_len;
+			for (int j = 0; j < 16; j++) {
+				if (prefix_len >= 8) {
+					prefix_len -= 8;
+				} else if (prefix_len > 0) {
+					uint8_t mask = 0xff >> prefix_len;
+					if ((entries[i].ip6_addr[j] & mask) != 0) {
+						return ERR_RIPNG_INCONSISTENT_PREFIX_LENGTH;
+					}
+					prefix_len = 0;
+				} else {
+					if (entries[i].ip6_addr[j] != 0) {
+						return ERR_RIPNG_INCONSISTENT_PREFIX_LENGTH;
+					}
+				}
+			}
+		}
+	}
+	return SUCCESS;
+}
+
+static std::mt19937 rng;
+
+static void random_entry(ripng_rte* entry) {
+	memset(entry, 0, sizeof(*entry));
+	if (rng() % 32 == 0) {
+		entry->metric = 0xff;
+		for (int i = 0; i < 16; ++i) {
+			entry->ip6_addr[i] = rng();
+		}
+		return;
+	}
+	entry->metric = 1 + rng() % 16;
+	entry->prefix_len = (rng() % 4 == 0) ? rng() % 129 : 32 + rng() % 33;
+	for (int i = 0; i < 16; ++i) {
+		int bits = (int)entry->prefix_len - 8 * i;
+		uint8_t byte = rng();
+		entry->ip6_addr[i] = bits >= 8 ? byte : bits <= 0 ? 0 : byte & (0xff00 >> bits);
+	}
+	entry->route_tag = rng();
+}
+
+// One fault in a random entry, or none
+static void random_fault(ripng_rte* entries) {
+	ripng_rte* entry = entries + rng() % NUM_ENTRIES;
+	switch (rng() % 6) {
+	case 0:
+		entry->metric = (rng() % 2) ? 0 : 17 + rng() % 238;
+		break;
+	case 1:
+		entry->prefix_len = 129 + rng() % 127;
+		break;
+	case 2:
+		if (entry->prefix_len < 128) {
+			int bit = entry->prefix_len + rng() % (128 - entry->prefix_len);
+			entry->ip6_addr[bit >> 3] |= 0x80 >> (bit & 7);
+		}
+		break;
+	case 3:
+		entry->metric = 0xff;
+		entry->prefix_len = rng() % 2;
+		entry->route_tag = rng() % 2;
+		break;
+	default:
+		break;
+	}
+}
+
+int main(int argc, char** argv) {
+	uint32_t seed = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : 1;
+	uint32_t rounds = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) : 200000;
+	rng.seed(seed);
+
+	std::vector<ripng_rte> packet(NUM_ENTRIES);
+	uint32_t bad = 0;
+	for (uint32_t round = 0; round < 100000; ++round) {
+		for (int i = 0; i < NUM_ENTRIES; ++i) {
+			random_entry(&packet[i]);
+		}
+		random_fault(packet.data());
+		int expected = reference_validate(packet.data(), NUM_ENTRIES);
+		int got = validate_entries(packet.data(), NUM_ENTRIES);
+		if (expected != got) {
+			printf("FAIL: error %d instead of %d\n", got, expected);
+			return 1;
+		}
+		bad += (expected != SUCCESS);
+	}
+
+	// Good packets only
+	std::vector<ripng_rte> packets(NUM_ENTRIES * 64);
+	for (auto& entry : packets) {
+		random_entry(&entry);
+	}
+	volatile int sink = 0;
+	auto time = [&](int (*validate)(ripng_rte*, int)) {
+		auto start = std::chrono::steady_clock::now();
+		for (uint32_t round = 0; round < rounds; ++round) {
+			sink = sink + validate(packets.data() + NUM_ENTRIES * (round % 64), NUM_ENTRIES);
+		}
+		return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / rounds;
+	};
+	double before = time(reference_validate);
+	double after = time(validate_entries);
+	if (sink != 0) {
+		printf("FAIL: a good packet was refused\n");
+		return 1;
+	}
+
+	printf("seed %u: 100000 packets checked, %u bad\n", seed, bad);
+	printf("%d entries: %.1f ns per packet byte-wise, %.1f ns word-wise (%.1fx)\n",
+	       NUM_ENTRIES, before, after, before / after);
+	printf("PASS\n");
+	return 0;
+}
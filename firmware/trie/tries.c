@@ -6,48 +6,213 @@
 #include <stdio.h>
 #include <packet.h>
 #include <memory.h>
+#include <trie.h>
+#include <profile.h>
+#include <log.h>
+#include <stats.h>
 
-extern void         BTrieInitBram();
+extern void         BTrieInitBram(int);
+extern void         BTrieClearBank(int);
 extern int          BTrieLookup(void*, int);
+extern int          BTrieLongestMatch(void*, int, int*);
 extern int          BTrieInsert(void*, int, unsigned int);
 extern int          BTrieDelete(void*, int);
+extern unsigned int BTrieGetNextHop(unsigned int);
 extern void*        BTrieIndexToAddress(unsigned int);
-extern void         VCTrieInit();
+extern void         BTrieSelectBank(int);
+extern void         BTrieWalk(int, TrieVisitor);
+extern void         BTrieReleaseBank(int);
+extern int          BTrieGetLevelTop(int, int*);
+extern void         VCTrieInit(unsigned int);
+extern void         VCTrieClearBank(unsigned int);
 extern unsigned int VCTrieInsert(void*, unsigned int, unsigned int);
 extern int          VCTrieLookup(void*, unsigned int);
+extern int          VCTrieLongestMatch(void*, unsigned int, unsigned int*);
 extern unsigned int VCTrieGetNodeCount();
 extern unsigned int VCTrieGetExcessiveCount();
+extern unsigned int VCTrieGetStageNodes(unsigned int, unsigned int*);
 extern void         VCEntryInvalidate(void*);
 extern void         VCEntryModify(void*, unsigned int);
+extern unsigned int VCEntryGetNextHop(void*);
 extern void*        VCTrieIndexToAddress(unsigned int);
+extern void         VCTrieSelectBank(unsigned int);
+extern void         VCTrieWalk(unsigned int, TrieVisitor);
+extern void         VCTrieReleaseBank(unsigned int);
 
+extern int rte_map[NUM_TRIE_NODE];
+
+// The spilled prefixes, see include/trie.h.
+// The entries are chained by buckets of their BTrie index, TrieDelete finds them without a scan.
+#define NUM_SPILL_BUCKET 1024 // power of 2
+#define TRIE_REBALANCE_BUDGET 8
+
+#define SPILL_BUCKET(bt_index) ((bt_index) & (NUM_SPILL_BUCKET - 1))
+
+struct spill_entry spill_entries[NUM_SPILL_ENTRY];
+uint16_t spill_buckets[NUM_SPILL_BUCKET]; // first entry of each bucket + 1, 0 if none
+int spill_top = 0;           // all valid entries are below spill_top
+int spill_count = 0;         // number of valid entries
+int spill_untracked = 0;     // spilled prefixes that did not fit into spill_entries
+int spill_cursor = 0;        // next entry to be retried by TrieRebalance
+unsigned int vc_freed_bins = 0;      // VC bins freed since the last rebalance sweep
+unsigned int vc_sweep_freed_bins = 0;
 
 int default_prefix_inserted = 0;
+uint32_t default_next_hop = 0;
+
+int trie_bank = 0;           // bank used by the pipeline
+int trie_edit_bank = 0;      // bank changed by TrieInsert / TrieDelete / TrieModify
+int trie_compact_failed = 0; // prefixes that did not fit into the shadow bank
+
+static void SpillTrack(struct ip6_addr* prefix, unsigned int length, uint32_t next_hop, int bt_index) {
+	int i;
+	for (i = 0; i < spill_top; i++) {
+		if (!spill_entries[i].valid) {
+			break;
+		}
+	}
+	if (i == NUM_SPILL_ENTRY) {
+		spill_untracked++;
+		return;
+	}
+	spill_entries[i].prefix = *prefix;
+	spill_entries[i].length = length;
+	spill_entries[i].next_hop = next_hop;
+	spill_entries[i].bt_index = bt_index;
+	spill_entries[i].valid = 1;
+	spill_entries[i].next = spill_buckets[SPILL_BUCKET(bt_index)];
+	spill_buckets[SPILL_BUCKET(bt_index)] = i + 1;
+	if (i == spill_top) {
+		spill_top++;
+	}
+	spill_count++;
+}
+
+static struct spill_entry* SpillFind(int bt_index) {
+	for (int i = spill_buckets[SPILL_BUCKET(bt_index)]; i; i = spill_entries[i - 1].next) {
+		if (spill_entries[i - 1].bt_index == bt_index) {
+			return spill_entries + i - 1;
+		}
+	}
+	return NULL;
+}
+
+static void SpillRelease(struct spill_entry* entry) {
+	uint16_t* link = spill_buckets + SPILL_BUCKET(entry->bt_index);
+	while (spill_entries + *link - 1 != entry) {
+		link = &spill_entries[*link - 1].next;
+	}
+	*link = entry->next;
+	entry->valid = 0;
+	spill_count--;
+	while (spill_top > 0 && !spill_entries[spill_top - 1].valid) {
+		spill_top--;
+	}
+}
+
+#ifdef TRIE_STATS
+struct trie_op_stats trie_op_stats[TRIE_OP_NUM];
+struct trie_op_stats* trie_op = trie_op_stats;
+uint32_t trie_op_accesses = 0;
+
+// Count the loads and stores until TrieOpEnd against an API call
+static void TrieOpBegin(int op) {
+	trie_op = trie_op_stats + op;
+	trie_op->calls++;
+	trie_op_accesses = 0;
+}
 
+static void TrieOpEnd() {
+	if (trie_op_accesses > trie_op->max_accesses) {
+		trie_op->max_accesses = trie_op_accesses;
+	}
+	trie_op = trie_op_stats + TRIE_OP_OTHER;
+}
+#else
+#define TrieOpBegin(op)
+#define TrieOpEnd()
+#endif
+
+void TrieSync() {
+	uint32_t target = TRIE_LOAD(TRIE_LOOKUP_IN_SEQ_ADDR);
+	while ((int)(TRIE_LOAD(TRIE_LOOKUP_OUT_SEQ_ADDR) - target) < 0)
+		;
+}
+
+static void SpillReset() {
+	for (int i = 0; i < NUM_SPILL_BUCKET; i++) {
+		spill_buckets[i] = 0;
+	}
+	spill_top = 0;
+	spill_count = 0;
+	spill_untracked = 0;
+	spill_cursor = 0;
+	vc_freed_bins = 0;
+	vc_sweep_freed_bins = 0;
+}
+
+/**
+ * @brief Empty the tries, in constant time
+ * @note Safe to call while forwarding, e.g. to clear the routes or after a warm
+ *  reset: the pipeline is switched to an empty bank first, so lookups see either
+ *  the old table or none, and the old nodes are only reused once they have drained.
+ *  The BRAMs are never swept, stale nodes are cleared when they are allocated again.
+ */
 void TrieInit() {
-	BTrieInitBram();
-    VCTrieInit();
+	// The register survives a warm reset, the firmware state does not
+	int bank = (TRIE_LOAD(TRIE_BANK_ADDR) & 1) ^ 1;
+	VCTrieClearBank(bank);
+	BTrieClearBank(bank);
+	TRIE_STORE(TRIE_BANK_ADDR, bank);
+	TrieSync();
+	BTrieInitBram(bank);
+    VCTrieInit(bank);
+	SpillReset();
+	trie_bank = bank;
+	trie_edit_bank = bank;
+	default_prefix_inserted = 0;
 }
 
-int TrieInsert(void* prefix, unsigned int length, uint32_t next_hop) {
+// Insert a prefix that is already in the bit order of the tries
+static int TrieInsertBitReversed(struct ip6_addr* ip6_prefix, unsigned int length, uint32_t next_hop) {
+	int result = VCTrieInsert(ip6_prefix, length, next_hop);
+	if (result < 0) {
+		result = BTrieInsert(ip6_prefix, length, next_hop);
+		if (result >= 0) {
+			SpillTrack(ip6_prefix, length, next_hop, result);
+			STATS_INC(trie_spills);
+		} else {
+			STATS_INC(bt_out_of_memory);
+		}
+	}
+	return result;
+}
+
+static int TrieInsertUncounted(void* prefix, unsigned int length, uint32_t next_hop) {
     struct ip6_addr ip6_prefix;
     struct ip6_addr* ip6 = (struct ip6_addr*)prefix;
 	if (length == 0) {
 		default_prefix_inserted = 1;
+		default_next_hop = next_hop;
 		return NUM_TRIE_NODE - 1;
 	}
     for(int i = 0; i < 4; i++) {
 		ip6_prefix.s6_addr32[i] = brev8(ip6->s6_addr32[i]);
 	}
-	int result = VCTrieInsert(&ip6_prefix, length, next_hop);
-	if (result < 0) {
-		return BTrieInsert(&ip6_prefix, length, next_hop);
-	}
-	return result;
+	return TrieInsertBitReversed(&ip6_prefix, length, next_hop);
     // return BTrieInsert(&ip6_prefix, length, next_hop);
 }
 
-int TrieLookup(void* prefix, unsigned int length) {
+int TrieInsert(void* prefix, unsigned int length, uint32_t next_hop) {
+	PROFILE_BEGIN(mark);
+	TrieOpBegin(TRIE_OP_INSERT);
+	int result = TrieInsertUncounted(prefix, length, next_hop);
+	TrieOpEnd();
+	PROFILE_END(mark, PROFILE_TRIE_INSERT);
+	return result;
+}
+
+static int TrieLookupUncounted(void* prefix, unsigned int length) {
     struct ip6_addr ip6_prefix;
     struct ip6_addr* ip6 = (struct ip6_addr*)prefix;
 	if (length == 0) {
@@ -67,7 +232,56 @@ int TrieLookup(void* prefix, unsigned int length) {
     // return BTrieLookup(&ip6_prefix, length);
 }
 
-int TrieDelete(void* prefix, unsigned int length) {
+int TrieLookup(void* prefix, unsigned int length) {
+	PROFILE_BEGIN(mark);
+	TrieOpBegin(TRIE_OP_LOOKUP);
+	int result = TrieLookupUncounted(prefix, length);
+	TrieOpEnd();
+	PROFILE_END(mark, PROFILE_TRIE_LOOKUP);
+	return result;
+}
+
+static int TrieLongestMatchUncounted(void* prefix, unsigned int length, unsigned int* match_length) {
+    struct ip6_addr ip6_prefix;
+    struct ip6_addr* ip6 = (struct ip6_addr*)prefix;
+	if (length == 0) {
+		return -1;
+	}
+    for(int i = 0; i < 4; i++) {
+		ip6_prefix.s6_addr32[i] = brev8(ip6->s6_addr32[i]);
+	}
+	// A prefix is in one of the tries, the longer match of both wins
+	unsigned int vc_length = 0;
+	int bt_length = 0;
+	int result = VCTrieLongestMatch(&ip6_prefix, length, &vc_length);
+	int bt_result = BTrieLongestMatch(&ip6_prefix, length, &bt_length);
+	if (bt_result >= 0 && (result < 0 || (unsigned int)bt_length > vc_length)) {
+		result = bt_result;
+		vc_length = bt_length;
+	}
+	if (result < 0 && default_prefix_inserted) {
+		result = NUM_TRIE_NODE - 1;
+		vc_length = 0;
+	}
+	*match_length = vc_length;
+	return result;
+}
+
+/**
+ * @brief Find the longest prefix in the tries that is shorter than a prefix and covers it
+ * @param match_length set to the length of the prefix found
+ * @return the index of its entry, as returned by TrieInsert, -1 if there is none
+ */
+int TrieLongestMatch(void* prefix, unsigned int length, unsigned int* match_length) {
+	PROFILE_BEGIN(mark);
+	TrieOpBegin(TRIE_OP_LOOKUP);
+	int result = TrieLongestMatchUncounted(prefix, length, match_length);
+	TrieOpEnd();
+	PROFILE_END(mark, PROFILE_TRIE_LOOKUP);
+	return result;
+}
+
+static int TrieDeleteUncounted(void* prefix, unsigned int length) {
     struct ip6_addr ip6_prefix;
     struct ip6_addr* ip6 = (struct ip6_addr*)prefix;
 	if (length == 0) {
@@ -79,17 +293,51 @@ int TrieDelete(void* prefix, unsigned int length) {
 	}
 	int result = VCTrieLookup(&ip6_prefix, length);
 	if (result < 0) {
-		return BTrieDelete(&ip6_prefix, length);
+		result = BTrieDelete(&ip6_prefix, length);
+		if (result >= 0) {
+			struct spill_entry* entry = SpillFind(result);
+			if (entry != NULL) {
+				SpillRelease(entry);
+			} else if (spill_untracked > 0) {
+				spill_untracked--;
+			}
+		}
+		return result;
 	}
 	VCEntryInvalidate(VCTrieIndexToAddress(result));
+	vc_freed_bins++;
 	return result;
     // return BTrieDelete(&ip6_prefix, length);
 }
 
-void TrieModify(void* prefix, unsigned int length, uint32_t next_hop) {
+int TrieDelete(void* prefix, unsigned int length) {
+	PROFILE_BEGIN(mark);
+	TrieOpBegin(TRIE_OP_DELETE);
+	int result = TrieDeleteUncounted(prefix, length);
+	TrieOpEnd();
+	PROFILE_END(mark, PROFILE_TRIE_DELETE);
+	return result;
+}
+
+/**
+ * @brief The next hop of an entry
+ * @param index the index returned by TrieInsert / TrieLookup
+ */
+uint32_t TrieGetNextHop(int index) {
+	if (index == NUM_TRIE_NODE - 1) {
+		return default_next_hop;
+	}
+	if (index >= TRIE_BT_INDEX_BASE) {
+		return BTrieGetNextHop(index);
+	}
+	return VCEntryGetNextHop(VCTrieIndexToAddress(index));
+}
+
+static void TrieModifyUncounted(void* prefix, unsigned int length, uint32_t next_hop) {
     struct ip6_addr ip6_prefix;
     struct ip6_addr* ip6 = (struct ip6_addr*)prefix;
 	if (length == 0) {
+		default_next_hop = next_hop;
 		return;
 	}
     for(int i = 0; i < 4; i++) {
@@ -98,18 +346,231 @@ void TrieModify(void* prefix, unsigned int length, uint32_t next_hop) {
 	int result = VCTrieLookup(&ip6_prefix, length);
 	if (result < 0) {
 	    result = BTrieInsert(&ip6_prefix, length, next_hop);
-		// if (result > 0) {
-		// 	printf("[TF]%d", result);
-		// }
+		if (result >= 0) {
+			struct spill_entry* entry = SpillFind(result);
+			if (entry != NULL) {
+				entry->next_hop = next_hop;
+			}
+		}
+		LOG(LOG_TRIE_MODIFY, result, next_hop);
         return;
 	}
     VCEntryModify(VCTrieIndexToAddress(result), next_hop);
-	// if (result > 0) {
-	// 	printf("[TF]%d", result);
-	// }
+	LOG(LOG_TRIE_MODIFY, result, next_hop);
+}
+
+void TrieModify(void* prefix, unsigned int length, uint32_t next_hop) {
+	PROFILE_BEGIN(mark);
+	TrieOpBegin(TRIE_OP_MODIFY);
+	TrieModifyUncounted(prefix, length, next_hop);
+	TrieOpEnd();
+	PROFILE_END(mark, PROFILE_TRIE_MODIFY);
+}
+
+static int TrieRebalanceUncounted() {
+	if (spill_count == 0) {
+		vc_freed_bins = 0;
+		return 0;
+	}
+	if (spill_cursor == 0) {
+		// Start a new sweep only if something has been freed since the last one
+		if (vc_freed_bins == vc_sweep_freed_bins) {
+			return 0;
+		}
+		vc_sweep_freed_bins = vc_freed_bins;
+	}
+	int moved = 0;
+	for (int budget = TRIE_REBALANCE_BUDGET; budget > 0 && spill_cursor < spill_top; budget--, spill_cursor++) {
+		struct spill_entry* entry = spill_entries + spill_cursor;
+		if (!entry->valid) {
+			continue;
+		}
+		int vc_index = VCTrieInsert(&entry->prefix, entry->length, entry->next_hop);
+		if (vc_index < 0) {
+			continue;
+		}
+		// From now on TrieLookup resolves the prefix to its VC entry
+		rte_map[vc_index] = rte_map[entry->bt_index];
+		TrieSync();
+		if (BTrieDelete(&entry->prefix, entry->length) < 0) {
+			// The BTrie copy stays, and so does its entry: the VC copy is taken out again
+			VCEntryInvalidate(VCTrieIndexToAddress(vc_index));
+			rte_map[vc_index] = 0;
+			continue;
+		}
+		rte_map[entry->bt_index] = 0;
+		SpillRelease(entry);
+		moved++;
+	}
+	if (spill_cursor >= spill_top) {
+		spill_cursor = 0;
+	}
+	return moved;
+}
+
+/**
+ * @brief Move spilled prefixes from the BTrie back into the VC trie.
+ * @note Does nothing unless VC bins have been freed since the last sweep, and
+ *  retries at most TRIE_REBALANCE_BUDGET prefixes per call, so it is cheap
+ *  enough to be called whenever the main loop is idle.
+ *  A prefix is inserted into the VC trie before it is removed from the BTrie,
+ *  and both copies carry the same next hop. The BTrie copy may sit in a later
+ *  stage than the VC copy, so the lookups in flight are drained in between,
+ *  otherwise one could miss both copies. If the BTrie copy cannot be deleted,
+ *  the VC copy is taken out again and the prefix stays spilled.
+ * @return The number of prefixes moved back into the VC trie.
+ */
+int TrieRebalance() {
+	TrieOpBegin(TRIE_OP_REBALANCE);
+	int result = TrieRebalanceUncounted();
+	TrieOpEnd();
+	return result;
+}
+
+static void TrieSelectEditBank(int bank) {
+	VCTrieSelectBank(bank);
+	BTrieSelectBank(bank);
+	trie_edit_bank = bank;
+}
+
+static void TrieForgetEntry(void* prefix, uint32_t length, uint32_t next_hop, uint32_t index) {
+	rte_map[index] = 0;
+}
+
+static void TrieTrackSpill(void* prefix, uint32_t length, uint32_t next_hop, uint32_t index) {
+	SpillTrack((struct ip6_addr*)prefix, length, next_hop, index);
+}
+
+static void TrieCopyEntry(void* prefix, uint32_t length, uint32_t next_hop, uint32_t index) {
+	if (trie_compact_failed) {
+		return;
+	}
+	int result = TrieInsertBitReversed((struct ip6_addr*)prefix, length, next_hop);
+	if (result < 0) {
+		trie_compact_failed = 1;
+		return;
+	}
+	rte_map[result] = rte_map[index];
+}
+
+// Free every node of a bank that the pipeline no longer reads
+static void TrieReleaseBank(int bank) {
+	VCTrieWalk(bank, TrieForgetEntry);
+	BTrieWalk(bank, TrieForgetEntry);
+	VCTrieReleaseBank(bank);
+	BTrieReleaseBank(bank);
+}
+
+/**
+ * @brief Start building a new table in the shadow bank.
+ * @note Until TrieShadowCommit or TrieShadowAbort, TrieInsert / TrieDelete /
+ *  TrieModify / TrieLookup work on the shadow bank, while the pipeline keeps
+ *  forwarding with the live one. Both banks share the BRAMs, so the shadow
+ *  table only fits if the live one uses less than half of them.
+ */
+void TrieShadowBegin() {
+	TrieSelectEditBank(trie_bank ^ 1);
+	// The spill table now follows the shadow bank
+	SpillReset();
+}
+
+/**
+ * @brief Make the shadow bank live and free the old one.
+ * @note New lookups switch to the shadow bank with a single register write,
+ *  the old bank is freed once the lookups still reading it have left the pipeline.
+ */
+void TrieShadowCommit() {
+	int old_bank = trie_bank;
+	trie_bank = trie_edit_bank;
+	TRIE_STORE(TRIE_BANK_ADDR, trie_bank);
+	TrieSync();
+	TrieReleaseBank(old_bank);
+}
+
+/**
+ * @brief Throw the shadow bank away and go back to editing the live one.
+ */
+void TrieShadowAbort() {
+	TrieReleaseBank(trie_edit_bank);
+	TrieSelectEditBank(trie_bank);
+	SpillReset();
+	BTrieWalk(trie_bank, TrieTrackSpill);
+}
+
+static int TrieCompactUncounted() {
+	TrieShadowBegin();
+	trie_compact_failed = 0;
+	VCTrieWalk(trie_bank, TrieCopyEntry);
+	BTrieWalk(trie_bank, TrieCopyEntry);
+	if (trie_compact_failed) {
+		TrieShadowAbort();
+		return -1;
+	}
+	TrieShadowCommit();
+	return 0;
+}
+
+/**
+ * @brief Rebuild the live table into the shadow bank and swap the banks.
+ * @note Every prefix is inserted again into an empty VC trie, which undoes the
+ *  fragmentation left by deletions and moves spilled prefixes back into the VC
+ *  trie where possible. rte_map follows the new indices. Forwarding is not
+ *  interrupted.
+ * @return 0 on success, -1 if the table does not fit twice into the BRAMs
+ *  (the live bank is then kept as it is).
+ */
+int TrieCompact() {
+	TrieOpBegin(TRIE_OP_COMPACT);
+	int result = TrieCompactUncounted();
+	TrieOpEnd();
+	return result;
 }
 
 void TrieReport() {
 	printf("[INFO]VC:%u\n", VCTrieGetNodeCount());
 	printf("[INFO]Ex:%u\n", VCTrieGetExcessiveCount());
+	printf("[INFO]Sp:%d\n", spill_count + spill_untracked);
+}
+
+uint32_t TrieBramNodes(int bram, uint32_t* capacity) {
+	if (bram >= 16) {
+		return VCTrieGetStageNodes(bram - 16, capacity);
+	}
+	int bt_capacity;
+	int top = BTrieGetLevelTop(bram, &bt_capacity);
+	*capacity = bt_capacity;
+	return top;
+}
+
+void TrieStatsClear() {
+#ifdef TRIE_STATS
+	for (int op = 0; op < TRIE_OP_NUM; op++) {
+		trie_op_stats[op].calls = 0;
+		trie_op_stats[op].max_accesses = 0;
+		for (int bram = 0; bram < TRIE_STATS_BRAMS; bram++) {
+			trie_op_stats[op].reads[bram] = 0;
+			trie_op_stats[op].writes[bram] = 0;
+		}
+	}
+#endif
+}
+
+void TrieStatsReport() {
+#ifdef TRIE_STATS
+	// [COST]<op>:<calls>,<max accesses per call>, then <B|V><level or stage>:<reads>,<writes>
+	static const char ops[TRIE_OP_NUM] = {'O', 'I', 'L', 'D', 'M', 'R', 'C'};
+	for (int op = 0; op < TRIE_OP_NUM; op++) {
+		struct trie_op_stats* stats = trie_op_stats + op;
+		if (stats->calls == 0 && op != TRIE_OP_OTHER) {
+			continue;
+		}
+		printf("[COST]%c:%u,%u", ops[op], stats->calls, stats->max_accesses);
+		for (int bram = 0; bram < TRIE_STATS_BRAMS; bram++) {
+			if (stats->reads[bram] || stats->writes[bram]) {
+				printf(" %c%d:%u,%u", bram < 16 ? 'B' : 'V', bram & 0xf, stats->reads[bram], stats->writes[bram]);
+			}
+		}
+		printf("\n");
+	}
+#endif
 }
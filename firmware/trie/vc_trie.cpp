@@ -4,6 +4,8 @@
 
 #include <stdio.h>
 #include <packet.h>
+#include <trie.h>
+#include <log.h>
 
 /*
  * | 31     28 | 27    | 26 23 | 22      10 | 9          0 |
@@ -14,6 +16,14 @@ static const void* BRAM_BASE = (void*)0x28000000;
 
 static const uint32_t MAX_PREFIX_LEN = 28;
 
+// Every field of a node is loaded through here, with TRIE_LOAD unless it is in the root, which is out of the BRAM.
+static inline uint32_t vcLoad(const uint32_t& field) {
+	if ((uintptr_t)&field - (uintptr_t)BRAM_BASE < 0x08000000) {
+		return TRIE_LOAD(&field);
+	}
+	return field;
+}
+
 static const uint32_t BRAM_DEPTHS[16] = {
 	64, 256, 6144, 7168, 5120, 3072, 256, 256,
 	256, 256, 256, 256, 256, 256, 256, 256
@@ -41,13 +51,13 @@ extern "C" void* VCTrieIndexToAddress(uint32_t index) {
 	uint32_t offset = index - NODE_SIZE_PREFIX_SUMS[stage];
     uint32_t node = offset / BIN_SIZES[stage];
     offset = offset % BIN_SIZES[stage];
-	return (void*)((uint32_t)BRAM_BASE | (stage << 23) | (node << 10) | ((offset + 1) << 4));
+	return (void*)((uintptr_t)BRAM_BASE | (stage << 23) | (node << 10) | ((offset + 1) << 4));
 }
 
 extern "C" uint32_t VCTrieAddressToIndex(void* address) {
-	uint32_t stage = ((uint32_t)address >> 23) & 0xF;
-	uint32_t node = ((uint32_t)address >> 10) & 0x1FFF;
-    uint32_t entry_offset = (((uint32_t)address >> 4) & 0x3F) - 1;
+	uint32_t stage = ((uintptr_t)address >> 23) & 0xF;
+	uint32_t node = ((uintptr_t)address >> 10) & 0x1FFF;
+    uint32_t entry_offset = (((uintptr_t)address >> 4) & 0x3F) - 1;
     uint32_t node_offset = 0;
     switch(stage) {
         case 2:
@@ -93,6 +103,13 @@ struct IP6 {
 	uint32_t operator& (const uint32_t mask) const {
 		return ip[0] & mask;
 	}
+	void setBit(uint32_t index, uint32_t value) {
+		if (value) {
+			ip[index >> 5] |= (1u << (index & 0x1F));
+		} else {
+			ip[index >> 5] &= ~(1u << (index & 0x1F));
+		}
+	}
 	void toHex(char* buffer) const {
 		uint32_t converted[4];
 		converted[0] = brev8(htonl(ip[0]));
@@ -123,17 +140,36 @@ struct VCEntry {
 	uint32_t padding;
 	VCEntry() : length(31), prefix(0), next_hop(31) {}
 	bool isValid() const {
-		return (length < 31) && (next_hop < 31);
+		return (vcLoad(length) < 31) && (vcLoad(next_hop) < 31);
 	}
 	bool isInvalid() const {
-		return (length >= 31) || (next_hop >= 31);
+		return (vcLoad(length) >= 31) || (vcLoad(next_hop) >= 31);
 	}
 	bool match(uint32_t _prefix, uint32_t _length) const {
-		return (prefix == _prefix) && (length == _length);
+		return (vcLoad(prefix) == _prefix) && (vcLoad(length) == _length);
+	}
+	uint32_t getLength() const {
+		return vcLoad(length);
+	}
+	uint32_t getPrefix() const {
+		return vcLoad(prefix);
+	}
+	uint32_t getNextHop() const {
+		return vcLoad(next_hop);
+	}
+	// The pipeline only matches an entry whose length and next hop are both valid,
+	// so the length store is the one that makes the entry visible, or hides it.
+	void publish(uint32_t _length, uint32_t _prefix, uint32_t _next_hop) {
+		TRIE_STORE(&prefix, _prefix);
+		TRIE_STORE(&next_hop, _next_hop);
+		TRIE_STORE(&length, _length);
 	}
 	void invalidate() {
-		length = 31;
-		next_hop = 31;
+		TRIE_STORE(&length, 31);
+		TRIE_STORE(&next_hop, 31);
+	}
+	void setNextHop(uint32_t _next_hop) {
+		TRIE_STORE(&next_hop, _next_hop);
 	}
 };
 
@@ -157,13 +193,13 @@ public:
 		return bin_size; // full
 	}
 	uint32_t getLc() const {
-		return lc;
+		return vcLoad(lc);
 	}
 	uint32_t getRc() const {
-		return rc;
+		return vcLoad(rc);
 	}
 	uint32_t getChild(uint32_t lsb) const {
-		return lsb ? rc : lc;
+		return vcLoad(lsb ? rc : lc);
 	}
 	void setLc(uint32_t _lc) {
 		lc = _lc;
@@ -172,14 +208,11 @@ public:
 		rc = _rc;
 	}
 	void setChild(uint32_t lsb, uint32_t child) {
-		if (lsb) {
-			rc = child;
-		} else {
-			lc = child;
-		}
+		// Only called on BRAM nodes, the root never changes its children
+		TRIE_STORE(lsb ? &rc : &lc, child);
 	}
 	bool noChild(uint32_t lsb) const {
-		return ((lsb == 1) ? rc == 0: lc == 0);
+		return getChild(lsb) == 0;
 	}
 	VCEntry* getBin() {
 		return bin;
@@ -198,34 +231,131 @@ typedef VCNode<0>* VCNodePtr;
 
 class VCTrie {
 protected:
-	VCNode<1> root;
+	VCNode<1> root;  // its children are the roots of the bank being edited
 	uint32_t node_count;
 	uint32_t node_num[16];
+	uint32_t free_head[16];  // released nodes, linked through lc
+	uint32_t free_num[16];   // nodes on free_head
 	uint32_t excessive_count;
-	char error_buffer[64];
 public:
 	VCTrie() : node_count(0), excessive_count(0) {}
 	VCTrie(const VCTrie&) = delete;
+	VCNodePtr _nodeAddr(uint32_t stage, uint32_t index) const {
+		return (VCNodePtr)((uintptr_t)BRAM_BASE | (stage << 23) | (index << 10));
+	}
 	VCNodePtr _childAddrInStage(VCNodePtr outer, uint32_t stage, uint32_t lsb) const {
-		return (VCNodePtr)((uint32_t)BRAM_BASE | (stage << 23) | (outer->getChild(lsb) << 10));
+		return _nodeAddr(stage, outer->getChild(lsb));
 	}
 	uint32_t _create_subtree(VCNodePtr node, uint32_t stage, uint32_t lsb) {
 		if (node->noChild(lsb)) {
-			++node_count;
-			++node_num[stage];
-			if (node_num[stage] >= BRAM_DEPTHS[stage]) {
-				printf("[TC]E");
-                _putchar('\0');
-				--node_count;
-				--node_num[stage];
-				return -1;
+			uint32_t child = free_head[stage];
+			if (child != 0) {
+				// A released node has been cleared, except for the free list link
+				VCNodePtr reused = _nodeAddr(stage, child);
+				free_head[stage] = reused->getLc();
+				--free_num[stage];
+				reused->setChild(0, 0);
+			} else {
+				++node_num[stage];
+				if (node_num[stage] >= BRAM_DEPTHS[stage]) {
+					LOG(LOG_VC_STAGE_FULL, stage, 0);
+					--node_num[stage];
+					return -1;
+				}
+				// Since every BRAM leaves out address 0x0, the node_num is just the index of the last node.
+				child = node_num[stage];
+				// Every node above node_num is left over from before the last VCTrieInit
+				// (or holds the power-on contents), clear it before it becomes reachable.
+				_clear(_nodeAddr(stage, child), stage);
 			}
-			// Since every BRAM leaves out address 0x0, the node_num is just the index of the last node.
-			node->setChild(lsb, node_num[stage]);
+			++node_count;
+			node->setChild(lsb, child);
 			return 1;
 		}
 		return 0;
 	}
+	/*
+	 * Make the node empty, so that lookups never match it.
+	 * */
+	void _clear(VCNodePtr node, uint32_t stage) {
+		VCEntry* bin = node->getBin();
+		for (uint32_t index = 0; index < BIN_SIZES[stage]; ++index) {
+			if (bin[index].isValid()) {
+				bin[index].invalidate();
+			}
+		}
+		node->setChild(0, 0);
+		node->setChild(1, 0);
+	}
+	/*
+	 * Release the subtree below a node at the given depth, the node itself is kept.
+	 * The subtree must be unreachable by lookups.
+	 * */
+	void _release_children(VCNodePtr node, uint32_t depth) {
+		uint32_t stage = depth >> 3;  // stage of the children
+		for (uint32_t lsb = 0; lsb < 2; ++lsb) {
+			if (node->noChild(lsb)) {
+				continue;
+			}
+			uint32_t index = node->getChild(lsb);
+			VCNodePtr child = _nodeAddr(stage, index);
+			_release_children(child, depth + 1);
+			_clear(child, stage);
+			child->setChild(0, free_head[stage]);
+			free_head[stage] = index;
+			++free_num[stage];
+			--node_count;
+		}
+	}
+	/*
+	 * Empty a bank by clearing its roots, the subtree is dropped without being freed.
+	 * */
+	void clear_bank(uint32_t bank) {
+		for (uint32_t lsb = 0; lsb < 2; ++lsb) {
+			_clear(_nodeAddr(0, TRIE_BANK_ROOT(bank, lsb)), 0);
+		}
+	}
+	void release_bank(uint32_t bank) {
+		for (uint32_t lsb = 0; lsb < 2; ++lsb) {
+			VCNodePtr bank_root = _nodeAddr(0, TRIE_BANK_ROOT(bank, lsb));
+			_release_children(bank_root, 1);
+			_clear(bank_root, 0);
+		}
+	}
+	/*
+	 * Call visit on every valid entry below a node at the given depth.
+	 * path holds the first depth bits of the node.
+	 * */
+	void _walk(VCNodePtr node, uint32_t depth, IP6& path, TrieVisitor visit) {
+		uint32_t now_stage = (depth - 1) >> 3;
+		VCEntry* bin = node->getBin();
+		for (uint32_t index = 0; index < BIN_SIZES[now_stage]; ++index) {
+			if (bin[index].isInvalid()) {
+				continue;
+			}
+			IP6 prefix = path;
+			uint32_t length = bin[index].getLength();
+			uint32_t bits = bin[index].getPrefix();
+			for (uint32_t i = 0; i < length; ++i) {
+				prefix.setBit(depth + i, (bits >> i) & 0x1);
+			}
+			visit(&prefix, depth + length, bin[index].getNextHop(), VCTrieAddressToIndex(&bin[index]));
+		}
+		for (uint32_t lsb = 0; lsb < 2; ++lsb) {
+			if (!node->noChild(lsb)) {
+				path.setBit(depth, lsb);
+				_walk(_childAddrInStage(node, depth >> 3, lsb), depth + 1, path, visit);
+				path.setBit(depth, 0);
+			}
+		}
+	}
+	void walk(uint32_t bank, TrieVisitor visit) {
+		IP6 path;
+		for (uint32_t lsb = 0; lsb < 2; ++lsb) {
+			path.setBit(0, lsb);
+			_walk(_nodeAddr(0, TRIE_BANK_ROOT(bank, lsb)), 1, path, visit);
+		}
+	}
 	/*
 	 * Insert a prefix into the trie.
 	 * If the prefix is excessive, return 1.
@@ -259,15 +389,11 @@ public:
 		}
 		if (stage_level <= length) {  // found a place
 			VCEntry* bin = now->getBin();
-			bin[freeIndex].length = length - stage_level;
-			bin[freeIndex].prefix = prefix.ip[0];
-			bin[freeIndex].next_hop = next_hop;
+			bin[freeIndex].publish(length - stage_level, prefix.ip[0], next_hop);
 			return VCTrieAddressToIndex(&now->getBin()[freeIndex]);
 		}
 END: // excessive
-		prefix_raw->toHex(error_buffer);
-		// printf("E%s/%d", error_buffer, length);
-        // _putchar('\0');
+		LOG(LOG_VC_EXCESSIVE, length, 0);
 		++excessive_count;
 		return 0xffffffff;
 #undef stage
@@ -313,6 +439,45 @@ END: // excessive
 #undef stage
 #undef now_stage
 #undef level
+#undef lsb
+	}
+	/*
+	 * Find the longest prefix in the trie that is shorter than a prefix and covers it,
+	 * in a single walk down the path of the prefix.
+	 * Return the index of the entry if found, else return -1.
+	 * */
+	uint32_t longest_entry(IP6* prefix_raw, uint32_t length, uint32_t* match_length) {
+		IP6 prefix = *prefix_raw;
+		VCNodePtr now = (VCNodePtr)(&root);
+		uint32_t stage_level = 0;
+		uint32_t found = 0xffffffff;
+#define stage (stage_level >> 3)
+#define now_stage ((stage_level == 0) ? (0) : ((stage_level - 1) >> 3))
+#define lsb   (prefix & 0x1)
+		while (stage_level < length) {
+			VCEntry* bin = now->getBin();
+			for (uint32_t index = 0; index < BIN_SIZES[now_stage]; ++index) {
+				uint32_t entry_length = bin[index].getLength();
+				if (entry_length >= 31 || stage_level + entry_length >= length ||
+				    (found != 0xffffffff && stage_level + entry_length <= *match_length)) {
+					continue;
+				}
+				uint32_t mask = (entry_length == 0) ? 0 : (0xffffffff >> (32 - entry_length));
+				if (((prefix.ip[0] ^ bin[index].getPrefix()) & mask) == 0 && bin[index].getNextHop() < 31) {
+					found = VCTrieAddressToIndex(&bin[index]);
+					*match_length = stage_level + entry_length;
+				}
+			}
+			if (now->noChild(lsb)) {
+				break;
+			}
+			now = _childAddrInStage(now, stage, lsb);
+			prefix >>= 1;
+			++stage_level;
+		}
+		return found;
+#undef stage
+#undef now_stage
 #undef lsb
 	}
     VCNodePtr get_root() {
@@ -333,28 +498,71 @@ END: // excessive
     uint32_t* get_node_num() {
         return node_num;
     }
+    uint32_t* get_free_head() {
+        return free_head;
+    }
+    uint32_t* get_free_num() {
+        return free_num;
+    }
 };
 
 VCTrie trie __attribute__((section(".data")));
 
-extern "C" void VCTrieInit() {
+/*
+ * Reset the trie in constant time, and direct the following updates to a bank.
+ * Only the roots are cleared: resetting node_num makes every other node stale,
+ * and a stale node is cleared when _create_subtree allocates it again.
+ * No lookup may be reading the nodes below the roots any more.
+ * */
+extern "C" void VCTrieInit(uint32_t bank) {
     trie.get_node_count() = 0;
     trie.get_excessive_count() = 0;
-    trie.get_node_num()[0] = 2;
-    trie.get_root()->setLc(1);
-    trie.get_root()->setRc(2);
+    // Nodes 1 ~ 4 of stage 0 are the roots of the two banks
+    trie.get_node_num()[0] = 4;
+    trie.get_free_head()[0] = 0;
+    trie.get_free_num()[0] = 0;
 	for (uint32_t stage = 1; stage < 16; ++stage) {
 		trie.get_node_num()[stage] = 0;
-    //     for (uint32_t index = 0; index < BRAM_DEPTHS[stage]; ++index) {
-    //         VCNodePtr base = (VCNodePtr)((uint32_t)BRAM_BASE | (stage << 23) | (index << 10));
-    //         base->setLc(0);
-    //         base->setRc(0);
-    //         VCEntry* bin = base->getBin();
-    //         for (uint32_t i = 0; i < BIN_SIZES[stage]; ++i) {
-    //             bin[i].invalidate();
-    //         }
-    //     }
+		trie.get_free_head()[stage] = 0;
+		trie.get_free_num()[stage] = 0;
     }
+    trie.clear_bank(0);
+    trie.clear_bank(1);
+    trie.get_root()->setLc(TRIE_BANK_ROOT(bank, 0));
+    trie.get_root()->setRc(TRIE_BANK_ROOT(bank, 1));
+    // The root is not in the BRAM, so its bin can never hold a prefix. Keep it occupied.
+    trie.get_root()->getBin()[0].length = 0;
+    trie.get_root()->getBin()[0].next_hop = 0;
+}
+
+/*
+ * Empty a bank without freeing its nodes, only valid before VCTrieInit.
+ * */
+extern "C" void VCTrieClearBank(uint32_t bank) {
+    trie.clear_bank(bank);
+}
+
+/*
+ * Direct the following inserts and lookups to a bank.
+ * */
+extern "C" void VCTrieSelectBank(uint32_t bank) {
+    trie.get_root()->setLc(TRIE_BANK_ROOT(bank, 0));
+    trie.get_root()->setRc(TRIE_BANK_ROOT(bank, 1));
+}
+
+/*
+ * Call visit on every prefix in a bank.
+ * */
+extern "C" void VCTrieWalk(uint32_t bank, TrieVisitor visit) {
+    trie.walk(bank, visit);
+}
+
+/*
+ * Empty a bank and put its nodes on the free lists.
+ * The bank must not be used by the pipeline, and the lookups reading it must have been drained.
+ * */
+extern "C" void VCTrieReleaseBank(uint32_t bank) {
+    trie.release_bank(bank);
 }
 
 extern "C" uint32_t VCTrieInsert(void* prefix, uint32_t length, uint32_t next_hop) {
@@ -365,6 +573,10 @@ extern "C" uint32_t VCTrieLookup(void* prefix, uint32_t length) {
 	return trie.lookup_entry((IP6*)prefix, length);
 }
 
+extern "C" uint32_t VCTrieLongestMatch(void* prefix, uint32_t length, uint32_t* match_length) {
+	return trie.longest_entry((IP6*)prefix, length, match_length);
+}
+
 extern "C" uint32_t VCTrieGetNodeCount() {
 	return trie.get_node_count();
 }
@@ -373,6 +585,14 @@ extern "C" uint32_t VCTrieGetExcessiveCount() {
 	return trie.get_excessive_count();
 }
 
+/*
+ * The nodes in use in a stage, the roots of both banks included, and the nodes it can hold.
+ * */
+extern "C" uint32_t VCTrieGetStageNodes(uint32_t stage, uint32_t* capacity) {
+	*capacity = BRAM_DEPTHS[stage] - 1;
+	return trie.get_node_num()[stage] - trie.get_free_num()[stage];
+}
+
 extern "C" uint32_t VCEntryIsValid(void* entry_addr) {
 	return ((VCEntry*)entry_addr)->isValid();
 }
@@ -385,6 +605,10 @@ extern "C" void VCEntryInvalidate(void* entry_addr) {
 	((VCEntry*)entry_addr)->invalidate();
 }
 
+extern "C" uint32_t VCEntryGetNextHop(void* entry_addr) {
+	return ((VCEntry*)entry_addr)->getNextHop();
+}
+
 extern "C" void VCEntryModify(void* entry_addr, uint32_t next_hop) {
-	((VCEntry*)entry_addr)->next_hop = next_hop;
+	((VCEntry*)entry_addr)->setNextHop(next_hop);
 }
@@ -1,19 +1,39 @@
 #include <uart.h>
+#include <hal.h>
 
 void init_uart(void)
 {
 #ifdef ENABLE_UART16550
-    UART_FCR = COM_FCR_CONFIG;
-    UART_LCR = COM_LCR_DLAB;
-    UART_DLL = COM_DLL_VAL;
-    UART_DLM = 0;
-    UART_LCR = COM_LCR_CONFIG;
-    UART_MCR = 0;
+    HAL_WRITE8(UART_FCR, COM_FCR_CONFIG);
+    HAL_WRITE8(UART_LCR, COM_LCR_DLAB);
+    HAL_WRITE8(UART_DLL, COM_DLL_VAL);
+    HAL_WRITE8(UART_DLM, 0);
+    HAL_WRITE8(UART_LCR, COM_LCR_CONFIG);
+    HAL_WRITE8(UART_MCR, 0);
 #endif
 }
 
 void _putchar(char ch)
 {
-    while (!(UART_LSR & COM_LSR_THRE));
-    UART_THR = ch;
+    while (!(HAL_READ8(UART_LSR) & COM_LSR_THRE));
+    HAL_WRITE8(UART_THR, ch);
+}
+
+int _trychar(char ch)
+{
+    if (!(HAL_READ8(UART_LSR) & COM_LSR_THRE))
+    {
+        return 0;
+    }
+    HAL_WRITE8(UART_THR, ch);
+    return 1;
+}
+
+int _trygetchar()
+{
+    if (!(HAL_READ8(UART_LSR) & COM_LSR_DR))
+    {
+        return -1;
+    }
+    return HAL_READ8(UART_RBR);
 }
@@ -0,0 +1,87 @@
+// Checks of the RIPng entries, see include/validate.h
+#include "stdint.h"
+#include "ripng.h"
+#include "validate.h"
+
+/*
+ * The bits of each word of an address past a prefix length, as the words are
+ * loaded from the packet on a little-endian CPU.
+ */
+#define SWAP32(x) ((((x) & 0xff) << 24) | (((x) & 0xff00) << 8) | (((x) >> 8) & 0xff00) | ((x) >> 24))
+#define HOST_BITS(bits) ((bits) <= 0 ? 0xffffffffu : (bits) >= 32 ? 0u : SWAP32(0xffffffffu >> (bits)))
+#define ROW(len) {HOST_BITS(len), HOST_BITS((len) - 32), HOST_BITS((len) - 64), HOST_BITS((len) - 96)}
+#define ROW4(len) ROW(len), ROW((len) + 1), ROW((len) + 2), ROW((len) + 3)
+#define ROW16(len) ROW4(len), ROW4((len) + 4), ROW4((len) + 8), ROW4((len) + 12)
+#define ROW64(len) ROW16(len), ROW16((len) + 16), ROW16((len) + 32), ROW16((len) + 48)
+
+static const uint32_t host_bits[129][4] = {ROW64(0), ROW64(64), ROW(128)};
+
+// The checks of one entry, in order
+static RipngErrorCode validate_entry(struct ripng_rte *entry)
+{
+    /*
+     * 8. 对每个 RIPng entry，当 Metric=0xFF 时，检查 Prefix Len
+     * 和 Route Tag 是否为 0。
+     */
+    if (entry->metric == 0xff)
+    {
+        if (entry->prefix_len != 0)
+        {
+            return ERR_RIPNG_BAD_PREFIX_LEN;
+        }
+        if (entry->route_tag != 0)
+        {
+            return ERR_RIPNG_BAD_ROUTE_TAG;
+        }
+        return SUCCESS;
+    }
+    /*
+     * 9. 对每个 RIPng entry，当 Metric!=0xFF 时，检查 Metric 是否属于
+     * [1,16]，并检查 Prefix Len 是否属于 [0,128]，Prefix Len 是否与 IPv6 prefix
+     * 字段组成合法的 IPv6 前缀。
+     */
+    if (entry->metric < 1 || entry->metric > 16)
+    {
+        return ERR_RIPNG_BAD_METRIC;
+    }
+    if (entry->prefix_len > 128)
+    {
+        return ERR_RIPNG_BAD_PREFIX_LEN;
+    }
+    const uint32_t *host = host_bits[entry->prefix_len];
+    if ((entry->ip6_addr.s6_addr32[0] & host[0]) | (entry->ip6_addr.s6_addr32[1] & host[1]) |
+        (entry->ip6_addr.s6_addr32[2] & host[2]) | (entry->ip6_addr.s6_addr32[3] & host[3]))
+    {
+        return ERR_RIPNG_INCONSISTENT_PREFIX_LENGTH;
+    }
+    return SUCCESS;
+}
+
+RipngErrorCode validate_entries(struct ripng_rte *entries, int num_entries)
+{
+    // Gather the faults of all entries, the next hop entries and the routes are checked both ways
+    uint32_t faults = 0;
+    for (int i = 0; i < num_entries; i++)
+    {
+        uint32_t len = entries[i].prefix_len;
+        uint32_t next_hop = -(uint32_t)(entries[i].metric == 0xff);
+        const uint32_t *host = host_bits[len <= 128 ? len : 128];
+        uint32_t route_faults = ((uint32_t)(entries[i].metric - 1) > 15) | (len > 128) |
+                                (entries[i].ip6_addr.s6_addr32[0] & host[0]) | (entries[i].ip6_addr.s6_addr32[1] & host[1]) |
+                                (entries[i].ip6_addr.s6_addr32[2] & host[2]) | (entries[i].ip6_addr.s6_addr32[3] & host[3]);
+        faults |= (next_hop & (len | entries[i].route_tag)) | (~next_hop & route_faults);
+    }
+    if (faults == 0)
+    {
+        return SUCCESS;
+    }
+    for (int i = 0; i < num_entries; i++)
+    {
+        RipngErrorCode error = validate_entry(entries + i);
+        if (error != SUCCESS)
+        {
+            return error;
+        }
+    }
+    return SUCCESS;
+}
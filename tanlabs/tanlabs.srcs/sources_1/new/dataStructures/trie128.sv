@@ -95,7 +95,10 @@ module trie128(
         end
     end
 
-    assign vc_init_addr_in[0] = addr[0] ? 2 : 1;
+    // Bank 0 starts at nodes 1 / 2, bank 1 at nodes 3 / 4 (see trie_bank below)
+    logic trie_bank;
+
+    assign vc_init_addr_in[0] = {trie_bank, 1'b0} + (addr[0] ? 2 : 1);
 
     // max_match
     logic [LEVELS-1:0][7:0] vc_max_match_in;
@@ -148,7 +151,7 @@ module trie128(
         end
     end
 
-    assign bt_init_addr_in[0] = addr[0] ? 2 : 1;
+    assign bt_init_addr_in[0] = {trie_bank, 1'b0} + (addr[0] ? 2 : 1);
 
     // max_match
     logic [LEVELS-1:0][7:0] bt_max_match_in;
@@ -284,6 +287,53 @@ module trie128(
         end
     end
 
+    // Lookup sequence numbers, counting lookups that entered / left the pipeline.
+    // The CPU snapshots lookup_in_seq after an update and waits until lookup_out_seq
+    // catches up, after which no lookup can still see the state before the update.
+    logic [31:0] lookup_in_seq;
+    logic [31:0] lookup_out_seq;
+
+    always_ff @(posedge clk) begin
+        if (rst_p) begin
+            lookup_in_seq  <= 0;
+            lookup_out_seq <= 0;
+        end else begin
+            if (in_valid && in_ready) begin
+                lookup_in_seq <= lookup_in_seq + 1;
+            end
+            if (out_valid && out_ready) begin
+                lookup_out_seq <= lookup_out_seq + 1;
+            end
+        end
+    end
+
+    // BT levels 8~15 have no BRAM behind them. The window of level 15
+    // (0x2780_0000) is used for the trie control registers:
+    //   0x2780_0000  lookup_in_seq   (RO)
+    //   0x2780_0004  lookup_out_seq  (RO)
+    //   0x2780_0008  trie_bank       (RW) root pair used by new lookups
+    always_comb begin
+        for (int i = BT_LEVELS; i < LEVELS - 1; i = i + 1) begin
+            bt_wbs_dat_out[i] = 0;
+        end
+        case (cpu_adr[9:2])
+            8'd0:    bt_wbs_dat_out[LEVELS-1] = lookup_in_seq;
+            8'd1:    bt_wbs_dat_out[LEVELS-1] = lookup_out_seq;
+            8'd2:    bt_wbs_dat_out[LEVELS-1] = {31'b0, trie_bank};
+            default: bt_wbs_dat_out[LEVELS-1] = 0;
+        endcase
+    end
+
+    // A lookup picks its root when it enters the pipeline, so flipping the bank
+    // switches the whole table at once without tearing any lookup.
+    always_ff @(posedge clk) begin
+        if (rst_p) begin
+            trie_bank <= 0;
+        end else if (bt_bram_write_stb[LEVELS-1] && cpu_wea && (cpu_adr[9:2] == 8'd2)) begin
+            trie_bank <= cpu_dat_in[0];
+        end
+    end
+
     logic [LEVELS-1:0][MAX_VC_NODE_WIDTH-1:0] cpu_vc_node_buffer;
     logic [LEVELS-1:0] vc_bram_buffer_stb;
 
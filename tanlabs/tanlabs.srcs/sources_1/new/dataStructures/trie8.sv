@@ -156,7 +156,10 @@ module trie8 #(
     for (int i = 0; i < VC_BIN_SIZE; i = i + 1) begin
       Entry entry = vc_node_i[2*VC_ADDR_WIDTH+(i+1)*VC_ENTRY_SIZE-1-:VC_ENTRY_SIZE];
       logic [27:0] mask = 28'hfffffff >> (28 - entry.prefix_length);
-      vc_valids[i] = (entry.prefix_length != 5'b11111) && ((vc_remaining_prefix_o[27:0] & mask) == (entry.prefix & mask));
+      // An entry is live only if both length and next hop are valid, so that the CPU
+      // can publish it by writing the length last and retire it by writing it first.
+      vc_valids[i] = (entry.prefix_length != 5'b11111) && (entry.entry_offset != 5'b11111)
+                  && ((vc_remaining_prefix_o[27:0] & mask) == (entry.prefix & mask));
       vc_max_matches[i] = BEGIN_LEVEL + state_level + entry.prefix_length;
       vc_next_hop_offsets[i] = entry.entry_offset;
     end
@@ -62,6 +62,7 @@ module frame_datapath #(
     input  wire [127:0] nexthop_ip6_addr,
     input  wire [  1:0] nexthop_port_id,
     output reg  [  4:0] nexthop_addr,
+    output reg  [  7:0] nexthop_hash,
 
     // DEBUG signals
     output wire [15:0] led,
@@ -319,6 +320,7 @@ module frame_datapath #(
       .fwt_addr        (fwt_addr),
 
       .nexthop_addr     (nexthop_addr),
+      .nexthop_hash     (nexthop_hash),
       .nexthop_IPv6_addr(nexthop_ip6_addr),
       .nexthop_port_id  (nexthop_port_id),
 
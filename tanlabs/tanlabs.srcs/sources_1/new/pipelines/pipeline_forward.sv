@@ -30,6 +30,7 @@ module pipeline_forward (
 
     // nexthop lookup
     output reg  [  4:0] nexthop_addr,
+    output reg  [  7:0] nexthop_hash,
     input  wire [127:0] nexthop_IPv6_addr,
     input  wire [  1:0] nexthop_port_id,
 
@@ -121,12 +122,24 @@ module pipeline_forward (
   fw_frame_beat_t nexthop_beat;
   logic nexthop_ready;
 
+  // Flow hash, picks the member of an ECMP group. Packets of a flow
+  // (addresses, flow label, next header) always take the same member.
+  function automatic logic [7:0] flow_hash(input ip6_hdr ip6);
+    logic [7:0] h;
+    h = {ip6.flow_hi, ip6.flow_hi} ^ ip6.flow_lo[7:0] ^ ip6.flow_lo[15:8] ^ ip6.flow_lo[23:16] ^ ip6.next_hdr;
+    for (int i = 0; i < 16; i = i + 1) begin
+      h = {h[6:0], h[7]} ^ ip6.src[i*8+:8] ^ ip6.dst[i*8+:8];
+    end
+    return h;
+  endfunction
+
   always_ff @(posedge clk) begin : NEXTHOP_BEAT
     if (rst_p) begin
       nexthop_beat <= 0;
     end else if (nexthop_ready) begin
       nexthop_beat <= fwt_out;
       nexthop_addr <= fwt_nexthop_addr;
+      nexthop_hash <= flow_hash(fwt_out.data.data.ip6);
     end
   end
 
@@ -728,6 +728,7 @@ module tanlabs #(
 
   logic [127:0] nexthop_ip6_addr;
   logic [4:0] nexthop_addr;
+  logic [7:0] nexthop_hash;
   logic [1:0] nexthop_port_id;
 
   logic checksum_fifo_in_ready;
@@ -818,6 +819,7 @@ module tanlabs #(
       .nexthop_ip6_addr(nexthop_ip6_addr),
       .nexthop_port_id(nexthop_port_id),
       .nexthop_addr(nexthop_addr),
+      .nexthop_hash(nexthop_hash),
 
       // DEBUG signal
       .led(led),
@@ -1558,6 +1560,13 @@ module tanlabs #(
       .wbs1_cyc_o(nxthop_conf_cyc)
   );
 
+  // Link status of the ports, sfp_rx_los is asynchronous
+  logic [3:0] link_up_meta, link_up;
+  always_ff @(posedge eth_clk) begin
+    link_up_meta <= ~sfp_rx_los;
+    link_up <= link_up_meta;
+  end
+
   address_config_adapter address_config_adapter_i (
       .eth_clk  (eth_clk),
       .eth_reset(reset_eth),
@@ -1571,7 +1580,8 @@ module tanlabs #(
       .wbm_ack_o(addr_conf_ack),
 
       .ip_addrs (ip_addrs),
-      .mac_addrs(mac_addrs)
+      .mac_addrs(mac_addrs),
+      .link_up  (link_up)
   );
 
 
@@ -1580,6 +1590,7 @@ module tanlabs #(
       .eth_reset(reset_eth),
 
       .r_addr(nexthop_addr),
+      .r_hash(nexthop_hash),
       .r_nexthop(nexthop_ip6_addr),
       .r_port_id(nexthop_port_id),
 
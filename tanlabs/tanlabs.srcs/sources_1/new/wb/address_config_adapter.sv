@@ -1,6 +1,7 @@
 /*
 Address configuration adapter module
 This module is used to configure the MAC and IP addresses of the Ethernet cores
+It also reports the link status of the ports (read only)
 @Author: Jason Fu
 */
 `include "wb.vh"
@@ -22,6 +23,9 @@ module address_config_adapter #(
     output reg [3:0][ 47:0] mac_addrs,
     output reg [3:0][127:0] ip_addrs,
 
+    // link status, one bit per port (eth_clk)
+    input wire [3:0] link_up,
+
     // Wishbone master interface (eth_clk)
     input  wire [31:0] wbm_adr_i,
     input  wire [31:0] wbm_dat_i,
@@ -37,7 +41,10 @@ module address_config_adapter #(
 
   always_comb begin
     wbm_dat_o = 32'd0;
-    if (wbm_adr_i[12] == 1'b0) begin
+    if (wbm_adr_i[13]) begin
+      // Link status
+      wbm_dat_o = {28'd0, link_up};
+    end else if (wbm_adr_i[12] == 1'b0) begin
       // IP address
       case (wbm_adr_i[3:0])
         4'h0: wbm_dat_o = ip_addrs[index][31:0];
@@ -85,7 +92,9 @@ module address_config_adapter #(
       mac_addrs[3] <= dafault_mac_addr_3;
     end else if (wbm_stb_i && wbm_we_i) begin
       // Write
-      if (wbm_adr_i[12] == 1'b0) begin
+      if (wbm_adr_i[13]) begin
+        // Link status is read only
+      end else if (wbm_adr_i[12] == 1'b0) begin
         // IP address
         case (wbm_adr_i[3:0])
           4'h0: ip_addrs[index][31:0] <= wbm_dat_i;
@@ -4,6 +4,9 @@
 * nexthop_table that stores the nexthop and interface for each destination
 * address. The table is implemented as a 32-entry 5-bit wide table.
 *
+* An entry can also be an ECMP group of up to 4 other entries, the flow hash
+* of the packet picks one of them.
+*
 * @author Jason Fu
 *
 */
@@ -13,6 +16,7 @@ module nexthop_table_adapter (
 
     // reading interface (within the same clock cycle)
     input  wire [  4:0] r_addr,
+    input  wire [  7:0] r_hash,
     output reg  [127:0] r_nexthop,
     output reg  [  1:0] r_port_id,
 
@@ -33,9 +37,30 @@ module nexthop_table_adapter (
   } nexthop_table_entry_t;
   nexthop_table_entry_t [31:0] nexthop_table_entries;
 
+  // ECMP groups, an entry with a non-zero count forwards to one of its members
+  typedef struct packed {
+    logic [2:0] count;
+    logic [3:0][4:0] members;
+  } nexthop_group_t;
+  nexthop_group_t [31:0] nexthop_groups;
+
+  nexthop_group_t r_group;
+  logic [4:0] r_member;
+  assign r_group = nexthop_groups[r_addr];
+
+  always_comb begin
+    case (r_group.count)
+      3'd1: r_member = r_group.members[0];
+      3'd2: r_member = r_group.members[r_hash[0]];
+      3'd3: r_member = r_group.members[r_hash%3];
+      3'd4: r_member = r_group.members[r_hash[1:0]];
+      default: r_member = r_addr;
+    endcase
+  end
+
   // read operation
-  assign r_nexthop = nexthop_table_entries[r_addr].nexthop;
-  assign r_port_id = nexthop_table_entries[r_addr].port_id;
+  assign r_nexthop = nexthop_table_entries[r_member].nexthop;
+  assign r_port_id = nexthop_table_entries[r_member].port_id;
 
   // Wishbone slave (eth_clk)
   logic [4:0] index;
@@ -43,7 +68,10 @@ module nexthop_table_adapter (
 
   always_comb begin
     wbm_dat_o = 32'd0;
-    if (wbm_adr_i[12]) begin
+    if (wbm_adr_i[13]) begin
+      // group
+      wbm_dat_o = {9'd0, nexthop_groups[index]};
+    end else if (wbm_adr_i[12]) begin
       // port_id
       wbm_dat_o = {30'd0, nexthop_table_entries[index].port_id};
     end else begin
@@ -78,10 +106,14 @@ module nexthop_table_adapter (
     if (eth_reset) begin
       for (int i = 0; i < 32; i++) begin
         nexthop_table_entries[i] <= 0;
+        nexthop_groups[i] <= 0;
       end
     end else if (wbm_stb_i && wbm_we_i) begin
       // Write
-      if (wbm_adr_i[12]) begin
+      if (wbm_adr_i[13]) begin
+        // group
+        nexthop_groups[index] <= wbm_dat_i[22:0];
+      end else if (wbm_adr_i[12]) begin
         // port_id
         nexthop_table_entries[index].port_id <= wbm_dat_i[1:0];
       end else begin